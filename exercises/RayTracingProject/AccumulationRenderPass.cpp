@@ -0,0 +1,161 @@
+#include "AccumulationRenderPass.h"
+
+#include <ituGL/renderer/Renderer.h>
+#include <ituGL/shader/Material.h>
+#include <ituGL/texture/Texture2DObject.h>
+#include <ituGL/texture/FramebufferObject.h>
+#include <array>
+#include <cassert>
+
+static std::shared_ptr<Texture2DObject> CreateTexture(int width, int height, TextureObject::Format format, TextureObject::InternalFormat internalFormat)
+{
+    std::shared_ptr<Texture2DObject> texture = std::make_shared<Texture2DObject>();
+    texture->Bind();
+    texture->SetImage(0, width, height, format, internalFormat);
+    texture->SetParameter(TextureObject::ParameterEnum::MinFilter, GL_NEAREST);
+    texture->SetParameter(TextureObject::ParameterEnum::MagFilter, GL_NEAREST);
+    Texture2DObject::Unbind();
+    return texture;
+}
+
+AccumulationRenderPass::Buffers::Buffers(int width, int height)
+{
+    // Sums with full precision so they keep growing. Positions too, the depth test compares them
+    sumTexture = CreateTexture(width, height, TextureObject::FormatRGBA, TextureObject::InternalFormat::InternalFormatRGBA32F);
+    momentsTexture = CreateTexture(width, height, TextureObject::FormatR, TextureObject::InternalFormat::InternalFormatR32F);
+    positionTexture = CreateTexture(width, height, TextureObject::FormatRGBA, TextureObject::InternalFormat::InternalFormatRGBA32F);
+    normalTexture = CreateTexture(width, height, TextureObject::FormatRGBA, TextureObject::InternalFormat::InternalFormatRGBA16F);
+    albedoTexture = CreateTexture(width, height, TextureObject::FormatRGBA, TextureObject::InternalFormat::InternalFormatRGBA16F);
+
+    // The sums are displayed with a linear filter
+    sumTexture->Bind();
+    sumTexture->SetParameter(TextureObject::ParameterEnum::MinFilter, GL_LINEAR);
+    sumTexture->SetParameter(TextureObject::ParameterEnum::MagFilter, GL_LINEAR);
+    Texture2DObject::Unbind();
+
+    framebuffer = std::make_shared<FramebufferObject>();
+    framebuffer->Bind();
+    framebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color0, *sumTexture);
+    framebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color1, *momentsTexture);
+    framebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color2, *positionTexture);
+    framebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color3, *normalTexture);
+    framebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color4, *albedoTexture);
+    framebuffer->SetDrawBuffers(std::array<FramebufferObject::Attachment, 5>({ FramebufferObject::Attachment::Color0, FramebufferObject::Attachment::Color1,
+        FramebufferObject::Attachment::Color2, FramebufferObject::Attachment::Color3, FramebufferObject::Attachment::Color4 }));
+    FramebufferObject::Unbind();
+}
+
+AccumulationRenderPass::AccumulationRenderPass(std::shared_ptr<Material> material, int width, int height)
+    : m_material(material)
+    , m_width(width)
+    , m_height(height)
+    , m_buffers(width, height)
+    , m_reprojectPending(false)
+    , m_sampleCount(0)
+    , m_targetSampleCount(0)
+    , m_sampleOffset(0)
+{
+    m_targetFramebuffer = m_buffers.framebuffer;
+
+    // Add the samples to the sums of each pixel
+    m_material->SetBlendEquation(Material::BlendEquation::Add);
+    m_material->SetBlendParams(Material::BlendParam::One, Material::BlendParam::One);
+}
+
+void AccumulationRenderPass::SetReprojectionMaterials(std::shared_ptr<Material> historyMaterial, std::shared_ptr<Material> reprojectionMaterial)
+{
+    m_historyBuffers = std::make_unique<Buffers>(m_width, m_height);
+
+    m_reprojectionFramebuffer = std::make_shared<FramebufferObject>();
+    m_reprojectionFramebuffer->Bind();
+    m_reprojectionFramebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color0, *m_buffers.sumTexture);
+    m_reprojectionFramebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color1, *m_buffers.momentsTexture);
+    m_reprojectionFramebuffer->SetDrawBuffers(std::array<FramebufferObject::Attachment, 2>({ FramebufferObject::Attachment::Color0, FramebufferObject::Attachment::Color1 }));
+    FramebufferObject::Unbind();
+
+    m_historyMaterial = historyMaterial;
+    m_historyMaterial->SetUniformValue("SourceTexture", m_buffers.sumTexture);
+    m_historyMaterial->SetUniformValue("MomentsTexture", m_buffers.momentsTexture);
+    m_historyMaterial->SetUniformValue("PositionTexture", m_buffers.positionTexture);
+    m_historyMaterial->SetUniformValue("NormalTexture", m_buffers.normalTexture);
+    m_historyMaterial->SetUniformValue("AlbedoTexture", m_buffers.albedoTexture);
+
+    // Add the history to the new sample
+    m_reprojectionMaterial = reprojectionMaterial;
+    m_reprojectionMaterial->SetUniformValue("PositionTexture", m_buffers.positionTexture);
+    m_reprojectionMaterial->SetUniformValue("NormalTexture", m_buffers.normalTexture);
+    m_reprojectionMaterial->SetUniformValue("HistorySourceTexture", m_historyBuffers->sumTexture);
+    m_reprojectionMaterial->SetUniformValue("HistoryMomentsTexture", m_historyBuffers->momentsTexture);
+    m_reprojectionMaterial->SetUniformValue("HistoryPositionTexture", m_historyBuffers->positionTexture);
+    m_reprojectionMaterial->SetUniformValue("HistoryNormalTexture", m_historyBuffers->normalTexture);
+    m_reprojectionMaterial->SetUniformValue("MaxHistorySampleCount", MaxHistorySampleCount);
+    m_reprojectionMaterial->SetBlendEquation(Material::BlendEquation::Add);
+    m_reprojectionMaterial->SetBlendParams(Material::BlendParam::One, Material::BlendParam::One);
+}
+
+void AccumulationRenderPass::Reset()
+{
+    m_sampleOffset += m_sampleCount;
+    m_sampleCount = 0;
+    m_reprojectPending = false;
+}
+
+void AccumulationRenderPass::Reproject(const glm::mat4& previousViewProjMatrix)
+{
+    // Several moves before the next frame keep the history of the first camera
+    bool reprojectPending = m_reprojectPending;
+    bool hasSamples = m_sampleCount > 0;
+    Reset();
+    if (m_reprojectionMaterial && (reprojectPending || hasSamples))
+    {
+        if (!reprojectPending)
+        {
+            m_reprojectionMaterial->SetUniformValue("PreviousViewProjMatrix", previousViewProjMatrix);
+        }
+        m_reprojectPending = true;
+    }
+}
+
+void AccumulationRenderPass::Render()
+{
+    if (IsComplete())
+        return;
+
+    Renderer& renderer = GetRenderer();
+    const Mesh* mesh = &renderer.GetFullscreenMesh();
+
+    if (m_sampleCount == 0)
+    {
+        // Keep the sums of the previous camera, before clearing them
+        if (m_reprojectPending)
+        {
+            m_historyBuffers->framebuffer->Bind();
+            m_historyMaterial->Use();
+            mesh->DrawSubmesh(0);
+            m_buffers.framebuffer->Bind();
+        }
+
+        // The renderer already bound the framebuffer
+        renderer.GetDevice().Clear(Color(0.0f, 0.0f, 0.0f, 0.0f));
+    }
+
+    assert(m_material);
+    m_material->SetUniformValue("FrameCount", ++m_sampleCount);
+    m_material->SetUniformValue("SampleOffset", m_sampleOffset);
+    m_material->Use();
+    mesh->DrawSubmesh(0);
+
+    if (m_reprojectPending)
+    {
+        DrawReprojection();
+    }
+}
+
+void AccumulationRenderPass::DrawReprojection()
+{
+    // Reads the positions and normals of the first sample, so they can't be attached
+    m_reprojectionFramebuffer->Bind();
+    m_reprojectionMaterial->Use();
+    GetRenderer().GetFullscreenMesh().DrawSubmesh(0);
+    m_reprojectPending = false;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <ituGL/renderer/RenderPass.h>
+
+#include <glm/mat4x4.hpp>
+#include <memory>
+
+class Material;
+class Texture2DObject;
+class FramebufferObject;
+
+// Adds one sample per pixel each frame to full precision sums, so the mean keeps converging for any number of samples
+// The material draws the samples, and gets the index of the sample plus one in FrameCount, and the samples drawn before the
+// last reset in SampleOffset. It also writes the position, normal and albedo of the primary hit with the first sample
+// Draw the sum texture with resolve.frag to display the mean
+class AccumulationRenderPass : public RenderPass
+{
+public:
+    AccumulationRenderPass(std::shared_ptr<Material> material, int width, int height);
+
+    void Render() override;
+
+    // Start again from 0 samples, for example when the scene changed
+    void Reset();
+
+    // Start again from 0 samples, but keep the sums of the pixels that still see the same surface after a camera move
+    // Needs the materials of SetReprojectionMaterials, otherwise it is the same as Reset
+    void Reproject(const glm::mat4& previousViewProjMatrix);
+
+    // The history material copies the accumulation, with history.frag
+    // The reprojection material adds the history of each pixel to the new sample, with reprojection.frag
+    void SetReprojectionMaterials(std::shared_ptr<Material> historyMaterial, std::shared_ptr<Material> reprojectionMaterial);
+
+    // Samples added to the sums since the last reset
+    unsigned int GetSampleCount() const { return m_sampleCount; }
+
+    // Accumulation stops at this number of samples. 0 keeps adding samples
+    unsigned int GetTargetSampleCount() const { return m_targetSampleCount; }
+    void SetTargetSampleCount(unsigned int sampleCount) { m_targetSampleCount = sampleCount; }
+
+    // True once the target sample count has been reached
+    bool IsComplete() const { return m_targetSampleCount > 0 && m_sampleCount >= m_targetSampleCount; }
+
+    // Sum of the samples of each pixel, with the sample count in alpha
+    std::shared_ptr<Texture2DObject> GetSumTexture() const { return m_buffers.sumTexture; }
+
+    // Sum of the squared luminance of the samples of each pixel
+    std::shared_ptr<Texture2DObject> GetMomentsTexture() const { return m_buffers.momentsTexture; }
+
+    // Primary hits of the first sample: position, with the distance along the ray in w or 0 if it missed, normal and albedo
+    std::shared_ptr<Texture2DObject> GetPositionTexture() const { return m_buffers.positionTexture; }
+    std::shared_ptr<Texture2DObject> GetNormalTexture() const { return m_buffers.normalTexture; }
+    std::shared_ptr<Texture2DObject> GetAlbedoTexture() const { return m_buffers.albedoTexture; }
+
+    // Reprojected pixels keep at most this number of samples, so the view dependent lighting and the resampling blur fade out
+    static constexpr float MaxHistorySampleCount = 64.0f;
+
+private:
+    // Sum, moments, position, normal and albedo textures, attached to a framebuffer in this order
+    struct Buffers
+    {
+        Buffers(int width, int height);
+
+        std::shared_ptr<Texture2DObject> sumTexture;
+        std::shared_ptr<Texture2DObject> momentsTexture;
+        std::shared_ptr<Texture2DObject> positionTexture;
+        std::shared_ptr<Texture2DObject> normalTexture;
+        std::shared_ptr<Texture2DObject> albedoTexture;
+
+        std::shared_ptr<FramebufferObject> framebuffer;
+    };
+
+    void DrawReprojection();
+
+private:
+    std::shared_ptr<Material> m_material;
+
+    int m_width;
+    int m_height;
+
+    Buffers m_buffers;
+
+    // Accumulation of the camera before the last move, created with the reprojection materials
+    std::unique_ptr<Buffers> m_historyBuffers;
+
+    // Draws only to the sums and moments, so the reprojection can read the positions and normals of the new samples
+    std::shared_ptr<FramebufferObject> m_reprojectionFramebuffer;
+
+    std::shared_ptr<Material> m_historyMaterial;
+    std::shared_ptr<Material> m_reprojectionMaterial;
+
+    // Reproject the history in the next frame
+    bool m_reprojectPending;
+
+    unsigned int m_sampleCount;
+    unsigned int m_targetSampleCount;
+
+    // Samples drawn before the last reset
+    unsigned int m_sampleOffset;
+};
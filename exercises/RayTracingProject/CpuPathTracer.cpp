@@ -0,0 +1,1022 @@
+#include "CpuPathTracer.h"
+
+#include "RaytracingScene.h"
+#include "Denoiser.h"
+#include "GgxMicrofacet.h"
+#include "RadianceCache.h"
+#include <ituGL/camera/Camera.h>
+#include <ituGL/utils/ThreadPool.h>
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+CpuPathTracer::CpuPathTracer(const RaytracingScene& scene)
+    : m_scene(scene)
+    , m_invViewMatrix(1.0f)
+    , m_invProjMatrix(1.0f)
+    , m_integrator(Integrator::RayTree)
+    , m_nextEventEstimation(true)
+    , m_radianceCache(nullptr)
+    , m_lightReservoirs(false)
+    , m_reservoirWidth(0)
+    , m_reservoirHeight(0)
+    , m_maxRays(12)
+    , m_packetTraversal(true)
+    , m_renderTime(0.0)
+    , m_renderSampleCount(0)
+    , m_renderRayCount(0)
+{
+}
+
+void CpuPathTracer::SetCamera(const Camera& camera)
+{
+    m_invViewMatrix = glm::inverse(camera.GetViewMatrix());
+    m_invProjMatrix = glm::inverse(camera.GetProjectionMatrix());
+}
+
+void CpuPathTracer::SetMaxRays(unsigned int maxRays)
+{
+    m_maxRays = std::min(maxRays, RayCapacity);
+}
+
+void CpuPathTracer::Render(ThreadPool& threadPool, unsigned int width, unsigned int height, unsigned int sampleCount, std::vector<glm::vec3>& image,
+    DenoiserFeatures* features)
+{
+    image.assign(width * height, glm::vec3(0.0f));
+    if (features)
+    {
+        features->albedo.assign(width * height, glm::vec3(0.0f));
+        features->normal.assign(width * height, glm::vec3(0.0f));
+        features->position.assign(width * height, glm::vec4(0.0f));
+        features->luminanceMoments.assign(width * height, 0.0f);
+        features->sampleCount = sampleCount;
+    }
+
+    unsigned int tileCountX = (width + TileSize - 1) / TileSize;
+    unsigned int tileCountY = (height + TileSize - 1) / TileSize;
+
+    // One counter per thread, each in its own cache line so threads don't fight over them
+    struct alignas(64) ThreadCounter
+    {
+        std::uint64_t rayCount = 0;
+    };
+    std::vector<ThreadCounter> rayCounts(threadPool.GetThreadCount());
+
+    // The reservoirs of a frame are reused by the neighbor pixels and by the next frame, so the frames are drawn one at a time over the image
+    // Otherwise each block draws all of them
+    unsigned int passCount = m_lightReservoirs ? sampleCount : 1;
+    unsigned int passFrameCount = m_lightReservoirs ? 1 : sampleCount;
+    if (m_lightReservoirs)
+    {
+        m_reservoirs.assign(width * height, PixelReservoir{});
+        m_previousReservoirs.assign(width * height, PixelReservoir{});
+        m_reservoirWidth = width;
+        m_reservoirHeight = height;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    // The image gets the sums of the samples, divided at the end
+    for (unsigned int pass = 0; pass < passCount; ++pass)
+    {
+        unsigned int firstFrame = pass * passFrameCount + 1;
+        if (m_lightReservoirs)
+        {
+            RenderReservoirs(threadPool, width, height, firstFrame);
+        }
+
+        // Tiles don't overlap, so threads write to different pixels
+        threadPool.ParallelFor(tileCountX * tileCountY, [&](unsigned int tileIndex, unsigned int threadIndex)
+            {
+                unsigned int beginX = (tileIndex % tileCountX) * TileSize;
+                unsigned int beginY = (tileIndex / tileCountX) * TileSize;
+                unsigned int endX = std::min(beginX + TileSize, width);
+                unsigned int endY = std::min(beginY + TileSize, height);
+
+                SampleState state;
+                state.castRayCount = 0;
+                for (unsigned int blockY = beginY; blockY < endY; blockY += PacketSize)
+                {
+                    for (unsigned int blockX = beginX; blockX < endX; blockX += PacketSize)
+                    {
+                        unsigned int blockEndX = std::min(blockX + PacketSize, endX);
+                        unsigned int blockEndY = std::min(blockY + PacketSize, endY);
+
+                        glm::vec3 sums[PacketSize * PacketSize];
+                        float moments[PacketSize * PacketSize];
+                        std::fill(std::begin(sums), std::end(sums), glm::vec3(0.0f));
+                        std::fill(std::begin(moments), std::end(moments), 0.0f);
+                        for (unsigned int frame = firstFrame; frame < firstFrame + passFrameCount; ++frame)
+                        {
+                            RenderBlock(blockX, blockY, blockEndX, blockEndY, width, height, frame, state, sums, moments, features);
+                        }
+
+                        for (unsigned int y = blockY; y < blockEndY; ++y)
+                        {
+                            for (unsigned int x = blockX; x < blockEndX; ++x)
+                            {
+                                image[y * width + x] += sums[(y - blockY) * PacketSize + (x - blockX)];
+                                if (features)
+                                {
+                                    features->luminanceMoments[y * width + x] += moments[(y - blockY) * PacketSize + (x - blockX)];
+                                }
+                            }
+                        }
+                    }
+                }
+                rayCounts[threadIndex].rayCount += state.castRayCount;
+            });
+    }
+
+    for (unsigned int i = 0; i < width * height; ++i)
+    {
+        image[i] /= static_cast<float>(sampleCount);
+        if (features)
+        {
+            features->luminanceMoments[i] /= static_cast<float>(sampleCount);
+        }
+    }
+
+    m_renderTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m_renderSampleCount = static_cast<std::uint64_t>(width) * height * sampleCount;
+    m_renderRayCount = 0;
+    for (const ThreadCounter& counter : rayCounts)
+    {
+        m_renderRayCount += counter.rayCount;
+    }
+}
+
+void CpuPathTracer::RenderBlock(unsigned int beginX, unsigned int beginY, unsigned int endX, unsigned int endY, unsigned int width, unsigned int height,
+    unsigned int frame, SampleState& state, glm::vec3* colors, float* moments, DenoiserFeatures* features) const
+{
+    const AccelerationStructure& accelerationStructure = m_scene.GetAccelerationStructure();
+
+    Ray rays[PacketSize * PacketSize];
+    RayPacket packet;
+    packet.size = 0;
+    for (unsigned int y = beginY; y < endY; ++y)
+    {
+        for (unsigned int x = beginX; x < endX; ++x)
+        {
+            rays[packet.size] = GetPrimaryRay(x, y, width, height);
+            packet.origins[packet.size] = rays[packet.size].point;
+            packet.directions[packet.size] = rays[packet.size].direction;
+            ++packet.size;
+        }
+    }
+
+    // Find the hits of all the primary rays first
+    RayHit hits[RayPacket::MaxSize];
+    for (unsigned int i = 0; i < packet.size; ++i)
+    {
+        hits[i].distance = std::numeric_limits<float>::infinity();
+    }
+
+    std::uint64_t found = 0;
+    if (m_packetTraversal)
+    {
+        found = accelerationStructure.Intersect(packet, hits);
+    }
+    else
+    {
+        for (unsigned int i = 0; i < packet.size; ++i)
+        {
+            if (accelerationStructure.Intersect(packet.origins[i], packet.directions[i], hits[i]))
+            {
+                found |= std::uint64_t(1) << i;
+            }
+        }
+    }
+
+    unsigned int i = 0;
+    for (unsigned int y = beginY; y < endY; ++y)
+    {
+        for (unsigned int x = beginX; x < endX; ++x, ++i)
+        {
+            // InitRandomSeed, with the integer part of gl_FragCoord
+            m_sampler.StartSample(state.sampler, x, y, frame - 1);
+            state.pixel = glm::ivec2(x, y);
+
+            bool sceneHit = (found >> i) & 1;
+            glm::vec3 color = RayTrace(rays[i], sceneHit, hits[i], state);
+            colors[(y - beginY) * PacketSize + (x - beginX)] += color;
+            moments[(y - beginY) * PacketSize + (x - beginX)] += RaytracingScene::GetLuminance(color) * RaytracingScene::GetLuminance(color);
+
+            // Same as the attachments written by raytracing.frag with the first sample
+            if (features && frame == 1)
+            {
+                const HitFeatures& primaryHit = state.primaryHit;
+                bool hit = !std::isinf(primaryHit.distance);
+                features->albedo[y * width + x] = hit ? primaryHit.albedo : glm::vec3(0.0f);
+                features->normal[y * width + x] = hit ? primaryHit.normal : glm::vec3(0.0f);
+                features->position[y * width + x] = hit ? glm::vec4(rays[i].point + primaryHit.distance * rays[i].direction, primaryHit.distance) : glm::vec4(0.0f);
+            }
+        }
+    }
+}
+
+void CpuPathTracer::RenderReservoirs(ThreadPool& threadPool, unsigned int width, unsigned int height, unsigned int frame)
+{
+    std::swap(m_reservoirs, m_previousReservoirs);
+    const AccelerationStructure& accelerationStructure = m_scene.GetAccelerationStructure();
+
+    // Rows are independent, the previous reservoirs are only read
+    threadPool.ParallelFor(height, [&](unsigned int y, unsigned int)
+        {
+            SampleState state;
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                PixelReservoir& pixelReservoir = m_reservoirs[y * width + x];
+                pixelReservoir = PixelReservoir{};
+
+                // The candidates take their own range of dimensions
+                m_sampler.StartSample(state.sampler, x, y, frame - 1);
+                m_sampler.StartRay(state.sampler, ReservoirSampleRay);
+
+                // Same primary hit as RenderBlock. Only the opaque hits shaded by ProcessOutput have a reservoir
+                Ray ray = GetPrimaryRay(x, y, width, height);
+                RayHit hit;
+                hit.distance = std::numeric_limits<float>::infinity();
+                bool sceneHit = accelerationStructure.Intersect(ray.point, ray.direction, hit);
+                glm::vec3 normal;
+                RaytracingMaterial material(0);
+                if (!GetHitSurface(ray, sceneHit, hit, normal, material) || hit.distance < 0.001f || material.m_ior != 0.0f)
+                {
+                    continue;
+                }
+                normal = glm::normalize(normal);
+                glm::vec3 position = ray.point + hit.distance * ray.direction;
+
+                LightReservoir reservoir = SampleReservoir(position, normal, state);
+
+                // The camera doesn't move between the frames, so the previous camera saw the hit at the same pixel
+                LightReservoir previous;
+                if (frame > 1 && ReadReservoir(m_previousReservoirs, glm::ivec2(x, y), position, normal, hit.distance, previous))
+                {
+                    previous.count = std::min(previous.count, MaxHistoryCount);
+                    CombineReservoir(reservoir, previous, position, normal, state);
+                }
+
+                FinishReservoir(reservoir);
+                pixelReservoir = PixelReservoir{ reservoir, glm::vec4(position, hit.distance), normal };
+            }
+        });
+}
+
+CpuPathTracer::Ray CpuPathTracer::GetPrimaryRay(unsigned int x, unsigned int y, unsigned int width, unsigned int height) const
+{
+    // Start from transformed position, at the center of the pixel
+    glm::vec2 texCoord((x + 0.5f) / width, (y + 0.5f) / height);
+    glm::vec4 viewPos = m_invProjMatrix * glm::vec4(texCoord * 2.0f - 1.0f, 0.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(viewPos) / viewPos.w;
+
+    // Normalize to get view direction
+    glm::vec3 direction = glm::normalize(origin);
+
+    // Rays are traced in world space
+    origin = m_invViewMatrix * glm::vec4(origin, 1.0f);
+    direction = m_invViewMatrix * glm::vec4(direction, 0.0f);
+
+    // The cone spreads by the angle between the rays of two neighbor pixels
+    float coneSpread = std::atan(2.0f * m_invProjMatrix[1][1] / height);
+
+    return Ray{ origin, direction, glm::vec3(1.0f), 1.0f, 0.0f, 0.0f, coneSpread };
+}
+
+glm::vec3 CpuPathTracer::RayTrace(const Ray& ray, bool sceneHit, const RayHit& hit, SampleState& state) const
+{
+    if (m_integrator == Integrator::Path)
+    {
+        return TracePath(ray, sceneHit, hit, state);
+    }
+
+    state.rayCount = 0;
+    state.rayIndex = 0;
+
+    m_sampler.StartRay(state.sampler, 0);
+    state.isPrimaryHit = true;
+    glm::vec3 color = ShadeRay(ray, sceneHit, hit, state);
+    state.isPrimaryHit = false;
+    state.primaryHit = state.hit;
+
+    // GetPendingRay
+    while (state.rayIndex < state.rayCount)
+    {
+        Ray pendingRay = state.pendingRays[state.rayIndex++];
+        m_sampler.StartRay(state.sampler, state.rayIndex);
+        color += CastRay(pendingRay, state);
+    }
+
+    return color;
+}
+
+glm::vec3 CpuPathTracer::TracePath(Ray ray, bool sceneHit, const RayHit& hit, SampleState& state) const
+{
+    state.pathColor = glm::vec3(0.0f);
+    state.pathVertexCount = 0;
+    for (unsigned int rayCount = 1; rayCount <= m_maxRays; ++rayCount)
+    {
+        state.nextRayWeightSum = 0.0f;
+        m_sampler.StartRay(state.sampler, rayCount - 1);
+        state.isPrimaryHit = rayCount == 1;
+        state.pathColor += rayCount == 1 ? ShadeRay(ray, sceneHit, hit, state) : CastRay(ray, state);
+        state.isPrimaryHit = false;
+        if (rayCount == 1)
+        {
+            state.primaryHit = state.hit;
+        }
+        if (state.nextRayWeightSum == 0.0f)
+        {
+            break;
+        }
+
+        // Continue with the kept candidate, divided by the probability of keeping it
+        ray = state.nextRay;
+        ray.colorFilter *= state.nextRayWeightSum / state.nextRayWeight;
+
+        // Russian roulette: end paths that carry little light, and boost the ones that survive
+        if (rayCount >= RussianRouletteDepth)
+        {
+            float survival = std::min(1.0f, std::max(ray.colorFilter.r, std::max(ray.colorFilter.g, ray.colorFilter.b)));
+            if (Rand01(state) >= survival)
+            {
+                break;
+            }
+            ray.colorFilter /= survival;
+        }
+    }
+
+    // Each vertex kept by the cache gets the radiance brought by the rest of the path. Filters with a zero component can't be divided
+    for (unsigned int vertexIndex = 0; vertexIndex < state.pathVertexCount; ++vertexIndex)
+    {
+        const PathVertex& vertex = state.pathVertices[vertexIndex];
+        if (glm::all(glm::greaterThan(vertex.colorFilter, glm::vec3(0.0f))))
+        {
+            m_radianceCache->AddSample(vertex.position, vertex.normal, (state.pathColor - vertex.colorBefore) / vertex.colorFilter);
+        }
+    }
+
+    return state.pathColor;
+}
+
+bool CpuPathTracer::EndPathOnRadianceCache(const Ray& ray, const glm::vec3& position, const glm::vec3& normal, bool afterDiffuseBounce, glm::vec3& radiance,
+    SampleState& state) const
+{
+    radiance = glm::vec3(0.0f);
+    if (!m_radianceCache || m_integrator != Integrator::Path || !afterDiffuseBounce)
+    {
+        return false;
+    }
+
+    // A few paths continue to keep training the cells, with the same directions as the lookups
+    if (m_radianceCache->GetRadiance(position, normal, radiance) && Rand01(state) >= RadianceCache::TrainingProbability)
+    {
+        return true;
+    }
+
+    if (state.pathVertexCount < PathVertexCapacity)
+    {
+        state.pathVertices[state.pathVertexCount++] = PathVertex{ position, normal, ray.colorFilter, state.pathColor };
+    }
+    return false;
+}
+
+bool CpuPathTracer::PushRay(Ray ray, SampleState& state) const
+{
+    bool pushed = false;
+    if (m_integrator == Integrator::Path)
+    {
+        // Replace the kept candidate with probability weight / weightSum, using the luminance as weight
+        float weight = RaytracingScene::GetLuminance(ray.colorFilter);
+        if (weight > 0.0f)
+        {
+            state.nextRayWeightSum += weight;
+            if (Rand01(state) * state.nextRayWeightSum < weight)
+            {
+                ray.point += 0.0001f * ray.direction;
+                state.nextRay = ray;
+                state.nextRayWeight = weight;
+                pushed = true;
+            }
+        }
+    }
+    else if (state.rayCount < m_maxRays)
+    {
+        // Offset in the ray direction
+        ray.point += 0.0001f * ray.direction;
+        state.pendingRays[state.rayCount++] = ray;
+        pushed = true;
+    }
+    return pushed;
+}
+
+glm::vec3 CpuPathTracer::CastRay(const Ray& ray, SampleState& state) const
+{
+    RayHit hit;
+    hit.distance = std::numeric_limits<float>::infinity();
+    bool sceneHit = m_scene.GetAccelerationStructure().Intersect(ray.point, ray.direction, hit);
+    return ShadeRay(ray, sceneHit, hit, state);
+}
+
+glm::vec3 CpuPathTracer::ShadeRay(const Ray& ray, bool sceneHit, const RayHit& hit, SampleState& state) const
+{
+    ++state.castRayCount;
+
+    RaytracingMaterial material(0);
+    glm::vec3 normal(0.0f);
+    bool found = GetHitSurface(ray, sceneHit, hit, normal, material);
+
+    state.hit.normal = normal;
+    state.hit.albedo = found ? glm::vec3(material.m_albedo) : glm::vec3(0.0f);
+    state.hit.distance = found ? hit.distance : std::numeric_limits<float>::infinity();
+
+    return found ? ProcessOutput(ray, hit.distance, normal, material, hit.instanceIndex, state) : glm::vec3(0.0f);
+}
+
+bool CpuPathTracer::GetHitSurface(const Ray& ray, bool sceneHit, const RayHit& hit, glm::vec3& normal, RaytracingMaterial& material) const
+{
+    normal = glm::vec3(0.0f);
+    if (!sceneHit)
+    {
+        return false;
+    }
+
+    // Meshes and analytic primitives, the sphere light among them
+    const AccelerationStructure& accelerationStructure = m_scene.GetAccelerationStructure();
+    glm::vec2 uv;
+    unsigned int materialId;
+    float textureLodOffset;
+    accelerationStructure.GetHitAttributes(ray.point, ray.direction, hit, normal, uv, materialId, textureLodOffset);
+    if (ray.ior != 1.0f && glm::dot(normal, ray.direction) > 0.0f)
+    {
+        normal = -normal;
+    }
+
+    material = m_scene.GetMaterials()[materialId];
+    material.m_albedo *= SampleTexture(material.m_textureLayer, uv, GetTextureLod(ray, hit.distance, normal, textureLodOffset));
+    return true;
+}
+
+glm::vec3 CpuPathTracer::ProcessOutput(const Ray& ray, float distance, glm::vec3 normal, const RaytracingMaterial& material, unsigned int instanceIndex,
+    SampleState& state) const
+{
+    if (distance < 0.001f) { return glm::vec3(0.f); }
+
+    normal = glm::normalize(normal);
+
+    // Find the position where the ray hit the surface
+    glm::vec3 contactPosition = ray.point + distance * ray.direction;
+
+    // The radiance of opaque rough surfaces is cached, as if it didn't depend on the view. Lights keep their emission weighted for the ray
+    // Specular rays as rough as the diffuse lobe also count as a diffuse bounce
+    glm::vec3 cachedRadiance;
+    bool isCached = material.m_ior == 0.0f && material.m_roughness >= RadianceCache::MinRoughness && glm::vec3(material.m_emissive) == glm::vec3(0.0f);
+    if (isCached && EndPathOnRadianceCache(ray, contactPosition, glm::dot(normal, ray.direction) < 0.0f ? normal : -normal,
+        ray.coneSpread >= DiffuseConeSpread, cachedRadiance, state))
+    {
+        return ray.colorFilter * cachedRadiance;
+    }
+
+    // A light hit by a diffuse or specular ray could also have been sampled at its origin: weight both with multiple importance sampling
+    // The lighting of the diffuse rays of the hits that read the reservoirs already has all the lights
+    glm::vec3 emissive(material.m_emissive);
+    float emissiveWeight = ray.bsdfPdf < 0.0f ? 0.0f : 1.0f;
+    if (ray.bsdfPdf > 0.0f && glm::dot(emissive, emissive) > 0.0f)
+    {
+        const AccelerationInstance& instance = m_scene.GetAccelerationStructure().GetInstances()[instanceIndex];
+        float lightPdf = static_cast<PrimitiveType>(instance.primitiveType) != PrimitiveType::Mesh
+            ? GetPrimitiveLightPdf(instanceIndex, emissive, ray.point, distance, glm::dot(normal, ray.direction))
+            : GetTriangleLightPdf(emissive, distance, glm::dot(normal, ray.direction));
+        emissiveWeight = PowerHeuristic(ray.bsdfPdf, lightPdf);
+    }
+    glm::vec3 color = glm::max(glm::vec3(0.f), ray.colorFilter * emissive) * emissiveWeight;
+
+    // Compute the fresnel, with a fixed reflectance of 4% for dielectrics
+    glm::vec3 albedo(material.m_albedo);
+    glm::vec3 reflectance = glm::mix(glm::vec3(0.04f), albedo, material.m_metallic);
+    glm::vec3 fresnel = FresnelSchlick(reflectance, -ray.direction, normal);
+
+    // Compute transparency
+    bool isTransparent = material.m_ior != 0.0f;
+    bool isExit = ray.ior != 1.0f;
+    float ior = isTransparent && !isExit ? material.m_ior : 1.0f;
+    glm::vec3 refractedDirection = glm::refract(ray.direction, normal, ray.ior / ior);
+
+    // Add a ray to compute the diffuse lighting
+    glm::vec3 diffuseDirection = GetDiffuseReflectionDirection(normal, state);
+    // The cones of the new rays keep the width at the hit
+    float coneWidth = ray.coneWidth + ray.coneSpread * distance;
+    Ray diffuseRay{ contactPosition, isTransparent ? refractedDirection : diffuseDirection, ray.colorFilter, ray.ior, 0.0f, coneWidth, ray.coneSpread };
+    if (!isExit)
+    {
+        // Metals have a black albedo
+        diffuseRay.colorFilter *= glm::mix(albedo, glm::vec3(0.0f), material.m_metallic);
+    }
+    diffuseRay.colorFilter *= (1.0f - fresnel);
+    diffuseRay.ior = ior;
+    if (!isTransparent)
+    {
+        diffuseRay.coneSpread += DiffuseConeSpread;
+    }
+
+    // Add a ray to compute the specular lighting, reflected over a microfacet normal visible from the ray
+    // Sampling the visible normals leaves only the Fresnel and the shadowing in the weight of the ray
+    // The lobe is around the normal facing the ray, so rays inside transparent objects also reflect
+    glm::vec3 view = -ray.direction;
+    glm::vec3 specularNormal = glm::dot(normal, view) < 0.0f ? -normal : normal;
+    float NdotV = glm::dot(specularNormal, view);
+    float alpha = std::max(material.m_roughness * material.m_roughness, GgxMicrofacet::MinAlpha);
+    glm::vec3 specularDirection = GetGgxReflectionDirection(ray, specularNormal, alpha, state);
+    glm::vec3 specularHalf = glm::normalize(view + specularDirection);
+    float specularNdotL = glm::dot(specularNormal, specularDirection);
+    Ray specularRay{ contactPosition, specularDirection, ray.colorFilter, ray.ior, 0.0f, coneWidth, ray.coneSpread + alpha };
+    specularRay.colorFilter *= FresnelSchlick(reflectance, view, specularHalf)
+        * (GgxMicrofacet::SmithG2(NdotV, specularNdotL, alpha) / GgxMicrofacet::SmithG1(NdotV, alpha));
+
+    // The primary hits on opaque surfaces light the diffuse lobe with the light point picked by the reservoirs, with a single shadow ray
+    // The specular lobe only gets the lights hit by its ray
+    if (m_lightReservoirs && state.isPrimaryHit && !isTransparent)
+    {
+        glm::vec3 lightPoint, lightDirection;
+        unsigned int lightIndex;
+        float lightDistance, geometry;
+        float weight = GetReservoirLightPoint(contactPosition, normal, distance, lightPoint, lightIndex, state);
+        glm::vec3 lighting = GetReservoirLighting(contactPosition, normal, lightPoint, lightIndex, lightDirection, lightDistance, geometry);
+        if (weight > 0.0f && geometry > 0.0f && IsLightVisible(contactPosition, lightDirection, lightDistance))
+        {
+            color += diffuseRay.colorFilter * lighting * weight;
+        }
+        diffuseRay.bsdfPdf = -1.0f;
+    }
+    // Sample a light for the diffuse and specular lobes. The random numbers are taken even if it isn't used, so the sequences stay the same
+    else if (m_nextEventEstimation)
+    {
+        glm::vec3 lightDirection;
+        float lightDistance, lightPdf;
+        glm::vec3 radiance = SampleLight(contactPosition, lightDirection, lightDistance, lightPdf, state);
+        float cosine = glm::dot(normal, lightDirection);
+        float specularCosine = glm::dot(specularNormal, lightDirection);
+        if (lightPdf > 0.0f && (cosine > 0.0f || specularCosine > 0.0f) && IsLightVisible(contactPosition, lightDirection, lightDistance))
+        {
+            if (!isTransparent && cosine > 0.0f)
+            {
+                float bsdfPdf = cosine * glm::one_over_pi<float>();
+                color += diffuseRay.colorFilter * radiance * (bsdfPdf / lightPdf) * PowerHeuristic(lightPdf, bsdfPdf);
+            }
+            if (specularCosine > 0.0f)
+            {
+                // Microfacet BRDF times the cosine: F D G2 / (4 NdotV)
+                glm::vec3 lightHalf = glm::normalize(view + lightDirection);
+                float NdotH = glm::dot(specularNormal, lightHalf);
+                glm::vec3 specular = FresnelSchlick(reflectance, view, lightHalf) * GgxMicrofacet::Distribution(NdotH, alpha)
+                    * GgxMicrofacet::SmithG2(NdotV, specularCosine, alpha) / (4.0f * NdotV);
+                float bsdfPdf = GgxMicrofacet::GetReflectionPdf(NdotV, NdotH, alpha);
+                color += ray.colorFilter * specular * radiance / lightPdf * PowerHeuristic(lightPdf, bsdfPdf);
+            }
+        }
+        if (!isTransparent)
+        {
+            diffuseRay.bsdfPdf = std::max(glm::dot(normal, diffuseDirection), 0.0f) * glm::one_over_pi<float>();
+        }
+        specularRay.bsdfPdf = GgxMicrofacet::GetReflectionPdf(NdotV, glm::dot(specularNormal, specularHalf), alpha);
+    }
+    PushRay(diffuseRay, state);
+
+    // Directions below the surface are shadowed by the microfacets
+    if (specularNdotL > 0.0f)
+    {
+        PushRay(specularRay, state);
+    }
+
+    // Return emissive light, after applying the ray color filter, and the sampled light
+    return color;
+}
+
+bool CpuPathTracer::RaySphereIntersection(const Ray& ray, const glm::vec3& center, float radius, float& distance, glm::vec3& normal) const
+{
+    bool hit = false;
+
+    glm::vec3 m = ray.point - center;
+
+    float b = glm::dot(m, ray.direction);
+    float c = glm::dot(m, m) - radius * radius;
+
+    if (c <= 0.0f || b <= 0.0f)
+    {
+        float discr = b * b - c;
+        if (discr >= 0.0f)
+        {
+            float sqrtDiscr = std::sqrt(discr);
+            float d = -b - sqrtDiscr;
+            float flipNormal = 1.0f;
+            if (d < 0.0f)
+            {
+                d = -b + sqrtDiscr;
+                flipNormal = -1.0f;
+            }
+
+            if (d < distance)
+            {
+                distance = d;
+
+                glm::vec3 point = m + d * ray.direction;
+                normal = flipNormal * glm::normalize(point);
+
+                hit = true;
+            }
+        }
+    }
+
+    return hit;
+}
+
+float CpuPathTracer::GetSphereLightCone(const glm::vec3& point, const glm::vec3& center, float radius)
+{
+    glm::vec3 toCenter = center - point;
+    float sinThetaMax2 = radius * radius / glm::dot(toCenter, toCenter);
+    return sinThetaMax2 < 1.0f ? sinThetaMax2 / (1.0f + std::sqrt(1.0f - sinThetaMax2)) : 0.0f;
+}
+
+glm::vec3 CpuPathTracer::GetPrimitiveLightNormal(unsigned int instanceIndex, const glm::vec3& lightPoint) const
+{
+    const AccelerationInstance& instance = m_scene.GetAccelerationStructure().GetInstances()[instanceIndex];
+    glm::vec3 point = instance.worldToObject * glm::vec4(lightPoint, 1.0f);
+    glm::vec3 localNormal = point;
+    if (static_cast<PrimitiveType>(instance.primitiveType) != PrimitiveType::Sphere)
+    {
+        glm::vec3 absPoint = glm::abs(point);
+        int axis = absPoint.x > absPoint.y ? (absPoint.x > absPoint.z ? 0 : 2) : (absPoint.y > absPoint.z ? 1 : 2);
+        localNormal = glm::vec3(0.0f);
+        localNormal[axis] = point[axis] >= 0.0f ? 1.0f : -1.0f;
+    }
+    return glm::normalize(glm::vec3(instance.normalMatrix * glm::vec4(localNormal, 0.0f)));
+}
+
+float CpuPathTracer::GetTriangleLightPdf(const glm::vec3& emission, float distance, float cosine) const
+{
+    // Triangles emit from both sides, so their power is twice the luminance per unit area
+    return 2.0f * m_scene.GetLightPdfScale() * RaytracingScene::GetLuminance(emission) * distance * distance / std::max(std::abs(cosine), 1e-6f);
+}
+
+float CpuPathTracer::GetPrimitiveLightPdf(unsigned int instanceIndex, const glm::vec3& emission, const glm::vec3& point, float distance, float cosine) const
+{
+    const AccelerationInstance& instance = m_scene.GetAccelerationStructure().GetInstances()[instanceIndex];
+    if (static_cast<PrimitiveType>(instance.primitiveType) == PrimitiveType::Sphere)
+    {
+        float cone = GetSphereLightCone(point, glm::vec3(instance.objectToWorld[3]), glm::length(glm::vec3(instance.objectToWorld[0])));
+        float probability = m_scene.GetLightPdfScale() * RaytracingScene::GetLuminance(emission) * RaytracingScene::GetPrimitiveArea(instance);
+        return cone > 0.0f ? probability / (glm::two_pi<float>() * cone) : 0.0f;
+    }
+    return m_scene.GetLightPdfScale() * RaytracingScene::GetLuminance(emission) * distance * distance / std::max(std::abs(cosine), 1e-6f);
+}
+
+void CpuPathTracer::SamplePrimitiveLight(unsigned int instanceIndex, const glm::vec3& emission, float faceSample, const glm::vec2& pointSample,
+    const glm::vec3& point, glm::vec3& direction, float& distance, float& pdf) const
+{
+    const AccelerationInstance& instance = m_scene.GetAccelerationStructure().GetInstances()[instanceIndex];
+    direction = glm::vec3(0.0f);
+    distance = 0.0f;
+    pdf = 0.0f;
+
+    if (static_cast<PrimitiveType>(instance.primitiveType) == PrimitiveType::Sphere)
+    {
+        glm::vec3 center(instance.objectToWorld[3]);
+        float radius = glm::length(glm::vec3(instance.objectToWorld[0]));
+        float cone = GetSphereLightCone(point, center, radius);
+        if (cone > 0.0f)
+        {
+            float cosTheta = 1.0f - pointSample.x * cone;
+            float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+            float phi = glm::two_pi<float>() * pointSample.y;
+            glm::vec3 axis = glm::normalize(center - point);
+            glm::vec3 bitangent = glm::normalize(glm::cross(axis, std::abs(axis.z) < 0.5f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0)));
+            glm::vec3 tangent = glm::cross(axis, bitangent);
+            direction = sinTheta * (std::cos(phi) * bitangent + std::sin(phi) * tangent) + cosTheta * axis;
+
+            glm::vec3 normal;
+            distance = std::numeric_limits<float>::infinity();
+            if (RaySphereIntersection(Ray{ point, direction, glm::vec3(1.0f), 1.0f, 0.0f, 0.0f, 0.0f }, center, radius, distance, normal))
+            {
+                pdf = GetPrimitiveLightPdf(instanceIndex, emission, point, distance, 1.0f);
+            }
+        }
+        return;
+    }
+
+    // Pick the axis of the face with the area of its two faces, and the side with what is left of the sample
+    glm::mat3 axes(instance.objectToWorld);
+    glm::vec3 faceAreas(glm::length(glm::cross(axes[1], axes[2])), glm::length(glm::cross(axes[2], axes[0])), glm::length(glm::cross(axes[0], axes[1])));
+    faceSample *= faceAreas.x + faceAreas.y + faceAreas.z;
+    int axis = faceSample < faceAreas.x ? 0 : (faceSample < faceAreas.x + faceAreas.y ? 1 : 2);
+    float sideSample = (faceSample - (axis > 0 ? faceAreas.x : 0.0f) - (axis > 1 ? faceAreas.y : 0.0f)) / faceAreas[axis];
+
+    glm::vec3 localPoint;
+    localPoint[axis] = sideSample < 0.5f ? -1.0f : 1.0f;
+    localPoint[(axis + 1) % 3] = 2.0f * pointSample.x - 1.0f;
+    localPoint[(axis + 2) % 3] = 2.0f * pointSample.y - 1.0f;
+    glm::vec3 localNormal(0.0f);
+    localNormal[axis] = localPoint[axis];
+
+    glm::vec3 toLight = glm::vec3(instance.objectToWorld * glm::vec4(localPoint, 1.0f)) - point;
+    distance = glm::length(toLight);
+    direction = toLight / distance;
+    float lightCosine = -glm::dot(glm::normalize(glm::vec3(instance.normalMatrix * glm::vec4(localNormal, 0.0f))), direction);
+    pdf = lightCosine > 0.0f ? GetPrimitiveLightPdf(instanceIndex, emission, point, distance, lightCosine) : 0.0f;
+}
+
+glm::vec3 CpuPathTracer::SampleLight(const glm::vec3& point, glm::vec3& direction, float& distance, float& pdf, SampleState& state) const
+{
+    unsigned int lightIndex;
+    return SampleLight(point, direction, distance, pdf, lightIndex, state);
+}
+
+glm::vec3 CpuPathTracer::SampleLight(const glm::vec3& point, glm::vec3& direction, float& distance, float& pdf, unsigned int& lightIndex,
+    SampleState& state) const
+{
+    float lightSample = Rand01(state);
+    float pointSampleX = Rand01(state);
+    float pointSampleY = Rand01(state);
+
+    direction = glm::vec3(0.0f);
+    distance = 0.0f;
+    pdf = 0.0f;
+    lightIndex = NoLightIndex;
+
+    // First light with a cdf over the sample
+    const std::vector<EmissiveLight>& lights = m_scene.GetEmissiveLights();
+    if (lights.empty())
+    {
+        return glm::vec3(0.0f);
+    }
+    auto found = std::upper_bound(lights.begin(), lights.end(), lightSample,
+        [](float sample, const EmissiveLight& light) { return sample < light.cdf; });
+    const EmissiveLight& light = found != lights.end() ? *found : lights.back();
+    lightIndex = static_cast<unsigned int>(&light - lights.data());
+
+    if (light.instanceIndex != RaytracingScene::NoInstance)
+    {
+        // The position of the sample in the range of the light is a new uniform sample, for the face of a box
+        float cdfBefore = lightIndex > 0 ? lights[lightIndex - 1].cdf : 0.0f;
+        float faceSample = glm::clamp((lightSample - cdfBefore) / (light.cdf - cdfBefore), 0.0f, 0.99999994f);
+        SamplePrimitiveLight(light.instanceIndex, light.emission, faceSample, glm::vec2(pointSampleX, pointSampleY), point, direction, distance, pdf);
+        return light.emission;
+    }
+
+    // Uniform point on the triangle
+    float s = std::sqrt(pointSampleX);
+    glm::vec3 lightPoint = light.v0 + s * (1.0f - pointSampleY) * light.v1v0 + s * pointSampleY * light.v2v0;
+    glm::vec3 toLight = lightPoint - point;
+    distance = glm::length(toLight);
+    direction = toLight / distance;
+    glm::vec3 lightNormal = glm::normalize(glm::cross(light.v1v0, light.v2v0));
+    pdf = GetTriangleLightPdf(light.emission, distance, glm::dot(lightNormal, direction));
+    return light.emission;
+}
+
+bool CpuPathTracer::IsLightVisible(const glm::vec3& point, const glm::vec3& direction, float distance) const
+{
+    // Offset both ends, like the rays pushed after a hit
+    Ray shadowRay{ point + 0.0001f * direction, direction, glm::vec3(1.0f), 1.0f, 0.0f, 0.0f, 0.0f };
+    distance -= 0.0002f;
+
+    return !m_scene.GetAccelerationStructure().Occluded(shadowRay.point, shadowRay.direction, distance);
+}
+
+glm::vec3 CpuPathTracer::GetReservoirLighting(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& lightPoint, unsigned int lightIndex,
+    glm::vec3& direction, float& distance, float& geometry) const
+{
+    glm::vec3 toLight = lightPoint - position;
+    distance = glm::length(toLight);
+    direction = distance > 0.0f ? toLight / distance : normal;
+    geometry = 0.0f;
+
+    float cosine = glm::dot(normal, direction);
+    if (distance <= 0.0f || cosine <= 0.0f)
+    {
+        return glm::vec3(0.0f);
+    }
+
+    // Analytic primitives emit from their outer side, the triangles from both sides
+    const std::vector<EmissiveLight>& lights = m_scene.GetEmissiveLights();
+    if (lightIndex >= lights.size())
+    {
+        return glm::vec3(0.0f);
+    }
+    const EmissiveLight& light = lights[lightIndex];
+    float lightCosine = light.instanceIndex != RaytracingScene::NoInstance ? -glm::dot(GetPrimitiveLightNormal(light.instanceIndex, lightPoint), direction)
+        : std::abs(glm::dot(glm::normalize(glm::cross(light.v1v0, light.v2v0)), direction));
+
+    if (lightCosine <= 0.0f)
+    {
+        return glm::vec3(0.0f);
+    }
+    geometry = lightCosine / (distance * distance);
+    return light.emission * (cosine * glm::one_over_pi<float>() * geometry);
+}
+
+float CpuPathTracer::GetReservoirTarget(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& lightPoint, unsigned int lightIndex) const
+{
+    glm::vec3 direction;
+    float distance, geometry;
+    return RaytracingScene::GetLuminance(GetReservoirLighting(position, normal, lightPoint, lightIndex, direction, distance, geometry));
+}
+
+void CpuPathTracer::UpdateReservoir(LightReservoir& reservoir, const glm::vec3& lightPoint, unsigned int lightIndex, float target, float weight, float count,
+    SampleState& state) const
+{
+    reservoir.weightSum += weight;
+    reservoir.count += count;
+    if (weight > 0.0f && Rand01(state) * reservoir.weightSum < weight)
+    {
+        reservoir.lightPoint = lightPoint;
+        reservoir.lightIndex = lightIndex;
+        reservoir.target = target;
+    }
+}
+
+void CpuPathTracer::FinishReservoir(LightReservoir& reservoir)
+{
+    reservoir.weight = reservoir.target > 0.0f ? reservoir.weightSum / (reservoir.count * reservoir.target) : 0.0f;
+}
+
+void CpuPathTracer::CombineReservoir(LightReservoir& reservoir, const LightReservoir& other, const glm::vec3& position, const glm::vec3& normal,
+    SampleState& state) const
+{
+    // The weights of the reservoirs on other surfaces are not corrected, so the combination is biased where the lights they see differ
+    float target = GetReservoirTarget(position, normal, other.lightPoint, other.lightIndex);
+    UpdateReservoir(reservoir, other.lightPoint, other.lightIndex, target, target * other.weight * other.count, other.count, state);
+}
+
+CpuPathTracer::LightReservoir CpuPathTracer::SampleReservoir(const glm::vec3& position, const glm::vec3& normal, SampleState& state) const
+{
+    LightReservoir reservoir{ glm::vec3(0.0f), NoLightIndex, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (unsigned int i = 0; i < CandidateCount; ++i)
+    {
+        glm::vec3 direction;
+        float distance, pdf;
+        unsigned int lightIndex;
+        SampleLight(position, direction, distance, pdf, lightIndex, state);
+
+        glm::vec3 lightPoint = position + distance * direction;
+        float target = 0.0f;
+        float weight = 0.0f;
+        if (pdf > 0.0f)
+        {
+            glm::vec3 lightDirection;
+            float lightDistance, geometry;
+            target = RaytracingScene::GetLuminance(GetReservoirLighting(position, normal, lightPoint, lightIndex, lightDirection, lightDistance, geometry));
+            weight = target > 0.0f ? target / (pdf * geometry) : 0.0f;
+        }
+        UpdateReservoir(reservoir, lightPoint, lightIndex, target, weight, 1.0f, state);
+    }
+    return reservoir;
+}
+
+bool CpuPathTracer::ReadReservoir(const std::vector<PixelReservoir>& reservoirs, glm::ivec2 pixel, const glm::vec3& position, const glm::vec3& normal,
+    float distance, LightReservoir& reservoir) const
+{
+    reservoir = LightReservoir{ glm::vec3(0.0f), NoLightIndex, 0.0f, 0.0f, 0.0f, 0.0f };
+    if (pixel.x < 0 || pixel.y < 0 || pixel.x >= static_cast<int>(m_reservoirWidth) || pixel.y >= static_cast<int>(m_reservoirHeight))
+    {
+        return false;
+    }
+
+    const PixelReservoir& pixelReservoir = reservoirs[pixel.y * m_reservoirWidth + pixel.x];
+    if (pixelReservoir.position.w == 0.0f
+        || std::abs(glm::dot(glm::vec3(pixelReservoir.position) - position, normal)) > DepthTolerance * distance
+        || glm::dot(pixelReservoir.normal, normal) < NormalTolerance)
+    {
+        return false;
+    }
+
+    // Only the point and the weight are stored in the textures of the shaders
+    reservoir.lightPoint = pixelReservoir.reservoir.lightPoint;
+    reservoir.lightIndex = pixelReservoir.reservoir.lightIndex;
+    reservoir.weight = pixelReservoir.reservoir.weight;
+    reservoir.count = pixelReservoir.reservoir.count;
+    return true;
+}
+
+float CpuPathTracer::GetReservoirLightPoint(const glm::vec3& position, const glm::vec3& normal, float distance, glm::vec3& lightPoint, unsigned int& lightIndex,
+    SampleState& state) const
+{
+    LightReservoir reservoir{ glm::vec3(0.0f), NoLightIndex, 0.0f, 0.0f, 0.0f, 0.0f };
+    LightReservoir other;
+    if (ReadReservoir(m_reservoirs, state.pixel, position, normal, distance, other))
+    {
+        CombineReservoir(reservoir, other, position, normal, state);
+    }
+
+    for (unsigned int i = 0; i < NeighborCount; ++i)
+    {
+        // Uniform point in the disk around the pixel
+        float radius = NeighborRadius * std::sqrt(Rand01(state));
+        float angle = glm::two_pi<float>() * Rand01(state);
+        glm::ivec2 neighbor = state.pixel + glm::ivec2(glm::round(radius * glm::vec2(std::cos(angle), std::sin(angle))));
+        if (neighbor != state.pixel && ReadReservoir(m_reservoirs, neighbor, position, normal, distance, other))
+        {
+            CombineReservoir(reservoir, other, position, normal, state);
+        }
+    }
+
+    FinishReservoir(reservoir);
+    lightPoint = reservoir.lightPoint;
+    lightIndex = reservoir.lightIndex;
+    return reservoir.weight;
+}
+
+float CpuPathTracer::PowerHeuristic(float pdf, float otherPdf)
+{
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+glm::vec3 CpuPathTracer::GetDiffuseReflectionDirection(const glm::vec3& normal, SampleState& state) const
+{
+    // Random direction on the cosine weighted hemisphere oriented along the normal, projected from a uniform point on the disk
+    float phi = 6.28318530718f * Rand01(state);
+    glm::vec2 disk = glm::vec2(std::cos(phi), std::sin(phi)) * std::sqrt(Rand01(state));
+    glm::vec3 direction(disk, std::sqrt(1.0f - disk.x * disk.x - disk.y * disk.y));
+    glm::vec3 bitangent = glm::normalize(glm::cross(normal, std::abs(normal.z) > 0.5f ? glm::vec3(0, 1, 0) : glm::vec3(0, 0, 1)));
+    glm::vec3 tangent = glm::cross(normal, bitangent);
+    return direction.x * bitangent + direction.y * tangent + direction.z * normal;
+}
+
+glm::vec3 CpuPathTracer::GetGgxReflectionDirection(const Ray& ray, const glm::vec3& normal, float alpha, SampleState& state) const
+{
+    // Reflect over a normal visible from the ray, sampled in the same tangent space as the diffuse directions
+    glm::vec2 u;
+    u.x = Rand01(state);
+    u.y = Rand01(state);
+    glm::vec3 bitangent = glm::normalize(glm::cross(normal, std::abs(normal.z) > 0.5f ? glm::vec3(0, 1, 0) : glm::vec3(0, 0, 1)));
+    glm::vec3 tangent = glm::cross(normal, bitangent);
+    glm::vec3 view = -ray.direction;
+    glm::vec3 localView(glm::dot(view, bitangent), glm::dot(view, tangent), std::max(glm::dot(view, normal), 1e-6f));
+    glm::vec3 microfacetNormal = GgxMicrofacet::SampleVisibleNormal(glm::normalize(localView), alpha, u);
+    return glm::reflect(ray.direction, microfacetNormal.x * bitangent + microfacetNormal.y * tangent + microfacetNormal.z * normal);
+}
+
+glm::vec3 CpuPathTracer::FresnelSchlick(const glm::vec3& f0, const glm::vec3& viewDir, const glm::vec3& halfDir)
+{
+    return f0 + (glm::vec3(1.0f) - f0) * std::pow(1.0f - std::max(glm::dot(viewDir, halfDir), 0.0f), 5.0f);
+}
+
+float CpuPathTracer::GetTextureLod(const Ray& ray, float distance, const glm::vec3& normal, float textureLodOffset) const
+{
+    const TextureLayers& layers = m_scene.GetTextureLayers();
+    float width = ray.coneWidth + ray.coneSpread * distance;
+    float cosine = std::abs(glm::dot(normal, ray.direction));
+    return textureLodOffset + 0.5f * std::log2(static_cast<float>(layers.width) * layers.height)
+        + std::log2(std::max(width, 1e-8f)) - std::log2(std::max(cosine, 1e-4f));
+}
+
+glm::vec4 CpuPathTracer::SampleTexture(unsigned int layer, glm::vec2 uv, float lod) const
+{
+    const TextureLayers& layers = m_scene.GetTextureLayers();
+    if (layer >= layers.layerCount)
+        return glm::vec4(1.0f);
+
+    // Linear between the two closest levels. The first level is magnified with a bilinear filter
+    uv = glm::clamp(uv, glm::vec2(0.0f), glm::vec2(1.0f));
+    float maxLevel = static_cast<float>(layers.levels.size() - 1);
+    lod = std::clamp(lod, 0.0f, maxLevel);
+    unsigned int level = static_cast<unsigned int>(lod);
+    float weight = lod - level;
+    glm::vec4 color = SampleTextureLevel(layer, level, uv);
+    return weight > 0.0f ? glm::mix(color, SampleTextureLevel(layer, level + 1, uv), weight) : color;
+}
+
+glm::vec4 CpuPathTracer::SampleTextureLevel(unsigned int layer, unsigned int level, glm::vec2 uv) const
+{
+    const TextureLayers& layers = m_scene.GetTextureLayers();
+    int width = layers.GetLevelWidth(level);
+    int height = layers.GetLevelHeight(level);
+
+    // Bilinear filter, with the texel centers at half coordinates
+    glm::vec2 position = uv * glm::vec2(width, height) - 0.5f;
+    glm::vec2 base = glm::floor(position);
+    glm::vec2 weight = position - base;
+
+    // Texels outside the image are clamped to the edges
+    int x0 = std::clamp(static_cast<int>(base.x), 0, width - 1);
+    int y0 = std::clamp(static_cast<int>(base.y), 0, height - 1);
+    int x1 = std::clamp(static_cast<int>(base.x) + 1, 0, width - 1);
+    int y1 = std::clamp(static_cast<int>(base.y) + 1, 0, height - 1);
+
+    const unsigned char* texels = layers.levels[level].data() + static_cast<size_t>(layer) * width * height * 4;
+    auto getTexel = [&](int x, int y)
+        {
+            const unsigned char* texel = texels + (y * width + x) * 4;
+            return glm::vec4(texel[0], texel[1], texel[2], texel[3]) / 255.0f;
+        };
+
+    glm::vec4 bottom = glm::mix(getTexel(x0, y0), getTexel(x1, y0), weight.x);
+    glm::vec4 top = glm::mix(getTexel(x0, y1), getTexel(x1, y1), weight.x);
+    return glm::mix(bottom, top, weight.y);
+}
+
+float CpuPathTracer::Rand01(SampleState& state) const
+{
+    return m_sampler.Next(state.sampler);
+}
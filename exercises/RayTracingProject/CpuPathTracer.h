@@ -0,0 +1,343 @@
+#pragma once
+
+#include "Sampler.h"
+#include <ituGL/raytracing/AccelerationStructure.h>
+#include <cstdint>
+#include <vector>
+
+class Camera;
+class RadianceCache;
+class RaytracingScene;
+class ThreadPool;
+struct DenoiserFeatures;
+struct RaytracingMaterial;
+
+// CPU version of the ray tracer in the shaders, to render the scene without a GPU and to check the GPU output
+// It follows raytracer.glsl or pathtracer.glsl, raylibrary.glsl and intersection_checks.glsl: same intersections, same ProcessOutput material model,
+// and the same random sequences, so sample N of a pixel matches frame N of the GPU accumulation
+class CpuPathTracer
+{
+public:
+    // How the rays pushed by each hit are traced
+    enum class Integrator
+    {
+        // Trace all of them, up to the maximum number of rays, like raytracer.glsl
+        RayTree,
+        // Keep one of them to follow a single path, with Russian roulette, like pathtracer.glsl
+        Path,
+    };
+
+    CpuPathTracer(const RaytracingScene& scene);
+
+    void SetCamera(const Camera& camera);
+
+    inline Integrator GetIntegrator() const { return m_integrator; }
+    inline void SetIntegrator(Integrator integrator) { m_integrator = integrator; }
+
+    // Sample the lights at each hit, combined with the diffuse and specular rays by multiple importance sampling. NextEventEstimation in the shaders
+    inline bool GetNextEventEstimation() const { return m_nextEventEstimation; }
+    inline void SetNextEventEstimation(bool nextEventEstimation) { m_nextEventEstimation = nextEventEstimation; }
+
+    // Sequence of random numbers. SamplerType in the shaders
+    inline Sampler::Type GetSamplerType() const { return m_sampler.GetType(); }
+    inline void SetSamplerType(Sampler::Type type) { m_sampler.SetType(type); }
+
+    // Maximum number of rays traced per sample, as returned by GetRayTracerConfig. It is the maximum path length with Integrator::Path
+    inline unsigned int GetMaxRays() const { return m_maxRays; }
+    void SetMaxRays(unsigned int maxRays);
+
+    // Cache where the paths of Integrator::Path end after a diffuse bounce, and add samples when they end. RadianceCaching in the shaders
+    // Not owned, and shared by the threads. nullptr disables it
+    inline RadianceCache* GetRadianceCache() const { return m_radianceCache; }
+    inline void SetRadianceCache(RadianceCache* radianceCache) { m_radianceCache = radianceCache; }
+
+    // Resample the direct lighting of the primary hits with reservoirs, reused from the previous frame and from neighbor pixels
+    // Render then draws the frames one at a time over the whole image, each after its reservoirs. LightReservoirs in the shaders
+    inline bool GetLightReservoirs() const { return m_lightReservoirs; }
+    inline void SetLightReservoirs(bool lightReservoirs) { m_lightReservoirs = lightReservoirs; }
+
+    // Trace the primary rays of each block of PacketSize x PacketSize pixels as a packet. Otherwise they are traced one at a time
+    inline bool GetPacketTraversal() const { return m_packetTraversal; }
+    inline void SetPacketTraversal(bool packetTraversal) { m_packetTraversal = packetTraversal; }
+
+    // Render the mean of sampleCount samples per pixel. Rows are stored bottom to top, like OpenGL textures
+    // The image is split in tiles, rendered in parallel by the thread pool
+    // If features is set, it gets the primary hits of the first sample and the second moments of the pixels, to denoise the image
+    void Render(ThreadPool& threadPool, unsigned int width, unsigned int height, unsigned int sampleCount, std::vector<glm::vec3>& image,
+        DenoiserFeatures* features = nullptr);
+
+    // Statistics of the last Render
+    inline double GetRenderTime() const { return m_renderTime; }
+    inline std::uint64_t GetSampleCount() const { return m_renderSampleCount; }
+    inline std::uint64_t GetRayCount() const { return m_renderRayCount; }
+    inline double GetSamplesPerSecond() const { return m_renderTime > 0.0 ? m_renderSampleCount / m_renderTime : 0.0; }
+
+private:
+    struct Ray
+    {
+        glm::vec3 point;
+        glm::vec3 direction;
+        glm::vec3 colorFilter;
+        float ior;
+        // Density of the direction if it was sampled from the diffuse or specular lobe, with next-event estimation at its origin. 0 otherwise,
+        // and negative for the diffuse rays of the hits lit by the light reservoirs
+        float bsdfPdf;
+        // Cone around the ray, to pick the texture LOD at the hit: width at the origin, and angle added per unit of distance
+        float coneWidth;
+        float coneSpread;
+    };
+
+    // Hard limit for the number of rays, RayCapacity in the shaders
+    static constexpr unsigned int RayCapacity = 32;
+
+    // Number of rays cast before Russian roulette can end a path, RussianRouletteDepth in the shaders
+    static constexpr unsigned int RussianRouletteDepth = 3;
+
+    // Side of the square tiles that threads take one at a time
+    static constexpr unsigned int TileSize = 16;
+
+    // Spread angle added to the cone of a diffuse ray, DiffuseConeSpread in the shaders
+    static constexpr float DiffuseConeSpread = 1.0f;
+
+    // Hit of a path that adds the radiance leaving it to the cache when the path ends, PathVertex in the shaders
+    struct PathVertex
+    {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec3 colorFilter;
+        // Color of the path before the hit
+        glm::vec3 colorBefore;
+    };
+
+    // Paths longer than this only add their first vertices to the cache, PathVertexCapacity in the shaders
+    static constexpr unsigned int PathVertexCapacity = 8;
+
+    // Light point kept by a reservoir from a stream of weighted candidates, Reservoir in lightreservoirs.glsl
+    struct LightReservoir
+    {
+        glm::vec3 lightPoint;
+        // Emissive light of the point, or NoLightIndex
+        unsigned int lightIndex;
+        // Target function of the point at the surface of the reservoir
+        float target;
+        // Sum of the weights of the candidates, and the number of candidates they stand for
+        float weightSum;
+        float count;
+        // Weight of the point once all the candidates are in, an estimate of 1 / its density
+        float weight;
+    };
+
+    // Reservoir of a pixel and its primary hit, the reservoir textures in the shaders
+    struct PixelReservoir
+    {
+        LightReservoir reservoir;
+        // Distance along the primary ray in w, 0 without a reservoir
+        glm::vec4 position;
+        glm::vec3 normal;
+    };
+
+    // Index of no light, for the reservoirs without one. NoLightIndex in the shaders
+    static constexpr unsigned int NoLightIndex = 0xffffffff;
+
+    // Candidates sampled per pixel and frame, ReservoirCandidateCount in the shaders
+    static constexpr unsigned int CandidateCount = 8;
+
+    // Candidates the reservoir of the previous frame can stand for, ReservoirMaxHistoryCount in the shaders
+    static constexpr float MaxHistoryCount = 20.0f * CandidateCount;
+
+    // Neighbor reservoirs combined by the primary hits, in a disk of this radius in pixels. ReservoirNeighborCount and ReservoirNeighborRadius in the shaders
+    static constexpr unsigned int NeighborCount = 3;
+    static constexpr float NeighborRadius = 16.0f;
+
+    // Largest distance to the plane of the surface, relative to the distance along the ray, and smallest cosine between the normals
+    // of the reservoirs reused by a surface. ReservoirDepthTolerance and ReservoirNormalTolerance in the shaders
+    static constexpr float DepthTolerance = 0.02f;
+    static constexpr float NormalTolerance = 0.9f;
+
+    // Index of the sampler ray of the candidates, ReservoirSampleRay in the shaders
+    static constexpr unsigned int ReservoirSampleRay = 0xffff;
+
+    // Side of the square blocks of pixels whose primary rays are traced together
+    static constexpr unsigned int PacketSize = 8;
+    static_assert(PacketSize * PacketSize <= RayPacket::MaxSize && TileSize % PacketSize == 0);
+
+    // Surface found by a ray, HitNormal, HitAlbedo and the distance returned by CastRay in the shaders
+    struct HitFeatures
+    {
+        // 0 if the ray missed
+        glm::vec3 normal;
+        glm::vec3 albedo;
+        // Infinite if the ray missed
+        float distance;
+    };
+
+    // State of the sample being traced, kept in globals by the shaders
+    struct SampleState
+    {
+        Sampler::State sampler;
+        Ray pendingRays[RayCapacity];
+        unsigned int rayCount;
+        unsigned int rayIndex;
+        // Candidate kept for the next segment of the path, and the sum of the weights of all the candidates
+        Ray nextRay;
+        float nextRayWeight;
+        float nextRayWeightSum;
+        // Hits kept for the radiance cache, and the color of the path so far
+        PathVertex pathVertices[PathVertexCapacity];
+        unsigned int pathVertexCount;
+        glm::vec3 pathColor;
+        std::uint64_t castRayCount;
+        // Pixel of the sample, gl_FragCoord in the shaders, and whether ProcessOutput shades the hit of its primary ray
+        glm::ivec2 pixel;
+        bool isPrimaryHit;
+        // Last hit, and the hit of the primary ray
+        HitFeatures hit;
+        HitFeatures primaryHit;
+    };
+
+    // Same as main() in raytracing.frag, for the pixels [beginX, endX) x [beginY, endY) of the frame (1 for the first one)
+    // Adds the color of each pixel to colors, and its squared luminance to moments, stored in rows of PacketSize
+    // With features, the primary hits of the first frame are written to it
+    void RenderBlock(unsigned int beginX, unsigned int beginY, unsigned int endX, unsigned int endY, unsigned int width, unsigned int height,
+        unsigned int frame, SampleState& state, glm::vec3* colors, float* moments, DenoiserFeatures* features) const;
+
+    // Same as main() in reservoirs.frag, for all the pixels of the frame. The reservoirs of the previous frame are kept for its temporal reuse
+    void RenderReservoirs(ThreadPool& threadPool, unsigned int width, unsigned int height, unsigned int frame);
+
+    // Ray through the center of the pixel at x, y, in world space
+    Ray GetPrimaryRay(unsigned int x, unsigned int y, unsigned int width, unsigned int height) const;
+
+    // Trace a primary ray, given its closest hit in the scene, and all the rays it spawns
+    glm::vec3 RayTrace(const Ray& ray, bool sceneHit, const RayHit& hit, SampleState& state) const;
+
+    // Same as RayTrace, but following a single path
+    glm::vec3 TracePath(Ray ray, bool sceneHit, const RayHit& hit, SampleState& state) const;
+    glm::vec3 CastRay(const Ray& ray, SampleState& state) const;
+
+    // Rest of CastRay, once the ray was tested with the acceleration structure
+    glm::vec3 ShadeRay(const Ray& ray, bool sceneHit, const RayHit& hit, SampleState& state) const;
+
+    // Normal and textured material of the closest hit of a ray, FindHit in the shaders. Returns false if the ray missed
+    bool GetHitSurface(const Ray& ray, bool sceneHit, const RayHit& hit, glm::vec3& normal, RaytracingMaterial& material) const;
+    glm::vec3 ProcessOutput(const Ray& ray, float distance, glm::vec3 normal, const RaytracingMaterial& material, unsigned int instanceIndex,
+        SampleState& state) const;
+    bool PushRay(Ray ray, SampleState& state) const;
+
+    // Radiance cache hook of ProcessOutput, for the opaque rough hits, with the normal facing the ray
+    // Returns true, with the cached radiance leaving the hit toward the ray, if the path ends there. Otherwise the hits after a diffuse bounce
+    // are kept to add a sample
+    bool EndPathOnRadianceCache(const Ray& ray, const glm::vec3& position, const glm::vec3& normal, bool afterDiffuseBounce, glm::vec3& radiance,
+        SampleState& state) const;
+
+    // Sphere test for sampling the sphere lights, the hits of the scene come from the acceleration structure
+    bool RaySphereIntersection(const Ray& ray, const glm::vec3& center, float radius, float& distance, glm::vec3& normal) const;
+
+    // 1 - cos of the half angle of the cone subtended by a sphere from a point, or 0 if the point is inside it
+    static float GetSphereLightCone(const glm::vec3& point, const glm::vec3& center, float radius);
+
+    // Outward normal of an analytic primitive at a point of its surface, in world space
+    glm::vec3 GetPrimitiveLightNormal(unsigned int instanceIndex, const glm::vec3& lightPoint) const;
+
+    // Densities of sampling a direction toward a light, per solid angle, given the distance to the point of the light and the cosine there
+    // Directions toward a sphere are uniform in its cone, so they only depend on the point
+    float GetTriangleLightPdf(const glm::vec3& emission, float distance, float cosine) const;
+    float GetPrimitiveLightPdf(unsigned int instanceIndex, const glm::vec3& emission, const glm::vec3& point, float distance, float cosine) const;
+
+    // Direction from a point toward an emissive analytic primitive: uniform in the cone subtended by a sphere, or toward a uniform point
+    // of the surface of a box, on a face picked with faceSample with a probability proportional to its area
+    void SamplePrimitiveLight(unsigned int instanceIndex, const glm::vec3& emission, float faceSample, const glm::vec2& pointSample,
+        const glm::vec3& point, glm::vec3& direction, float& distance, float& pdf) const;
+
+    // Pick a light, with a probability proportional to its power, and a direction toward it
+    // Returns the emitted radiance, and the density of the direction per solid angle, or 0 if there is no light to sample
+    glm::vec3 SampleLight(const glm::vec3& point, glm::vec3& direction, float& distance, float& pdf, SampleState& state) const;
+
+    // Same, also returning the index of the light
+    glm::vec3 SampleLight(const glm::vec3& point, glm::vec3& direction, float& distance, float& pdf, unsigned int& lightIndex, SampleState& state) const;
+
+    // Test that nothing blocks the segment from a point to a light, at a distance along the direction
+    bool IsLightVisible(const glm::vec3& point, const glm::vec3& direction, float distance) const;
+
+    // Unshadowed lighting of the diffuse lobe of a surface by a point of a light, without the albedo, and the geometry term that converts
+    // densities per solid angle to per area. Both are 0 if the point doesn't face the surface. GetReservoirLighting in the shaders
+    glm::vec3 GetReservoirLighting(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& lightPoint, unsigned int lightIndex,
+        glm::vec3& direction, float& distance, float& geometry) const;
+
+    // Target function of a light point for a surface, the luminance of its lighting
+    float GetReservoirTarget(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& lightPoint, unsigned int lightIndex) const;
+
+    // Add a candidate, standing for count candidates, and keep it with probability weight / weightSum
+    void UpdateReservoir(LightReservoir& reservoir, const glm::vec3& lightPoint, unsigned int lightIndex, float target, float weight, float count,
+        SampleState& state) const;
+
+    // Weight of the point kept, once all the candidates are in
+    static void FinishReservoir(LightReservoir& reservoir);
+
+    // Add a finished reservoir of another pixel or frame, as a candidate that stands for all of its own, with the target of this surface
+    void CombineReservoir(LightReservoir& reservoir, const LightReservoir& other, const glm::vec3& position, const glm::vec3& normal, SampleState& state) const;
+
+    // Stream the candidates of SampleLight, weighted by their target over their density per area
+    LightReservoir SampleReservoir(const glm::vec3& position, const glm::vec3& normal, SampleState& state) const;
+
+    // Reservoir of a pixel. Returns false if the pixel is outside the image, or if its primary hit is not on the same surface
+    bool ReadReservoir(const std::vector<PixelReservoir>& reservoirs, glm::ivec2 pixel, const glm::vec3& position, const glm::vec3& normal, float distance,
+        LightReservoir& reservoir) const;
+
+    // Light point of the primary hit of the pixel of the sample, combined from its reservoir and the ones of random neighbors on the same surface
+    // Returns the weight of the point, 0 if there is none
+    float GetReservoirLightPoint(const glm::vec3& position, const glm::vec3& normal, float distance, glm::vec3& lightPoint, unsigned int& lightIndex,
+        SampleState& state) const;
+
+    // Weight of a sample from the first of two sampling techniques, with the power heuristic
+    static float PowerHeuristic(float pdf, float otherPdf);
+
+    glm::vec3 GetDiffuseReflectionDirection(const glm::vec3& normal, SampleState& state) const;
+
+    // Direction of the ray reflected over a microfacet normal, sampled from the GGX normals visible from the ray
+    glm::vec3 GetGgxReflectionDirection(const Ray& ray, const glm::vec3& normal, float alpha, SampleState& state) const;
+
+    // Schlick simplification of the Fresnel term
+    static glm::vec3 FresnelSchlick(const glm::vec3& f0, const glm::vec3& viewDir, const glm::vec3& halfDir);
+
+    // Level of the scene textures covered by the cone of a ray at a hit, given the texture LOD offset of the triangle. GetTextureLod in the shaders
+    float GetTextureLod(const Ray& ray, float distance, const glm::vec3& normal, float textureLodOffset) const;
+
+    // Trilinear sample of a layer of the scene textures at a LOD, like textureLod on the texture array of the application
+    // White if they are not loaded
+    glm::vec4 SampleTexture(unsigned int layer, glm::vec2 uv, float lod) const;
+
+    // Bilinear sample of a level of a layer of the scene textures
+    glm::vec4 SampleTextureLevel(unsigned int layer, unsigned int level, glm::vec2 uv) const;
+
+    float Rand01(SampleState& state) const;
+
+private:
+    const RaytracingScene& m_scene;
+
+    glm::mat4 m_invViewMatrix;
+    glm::mat4 m_invProjMatrix;
+
+    Integrator m_integrator;
+
+    bool m_nextEventEstimation;
+
+    RadianceCache* m_radianceCache;
+
+    bool m_lightReservoirs;
+
+    // Reservoirs of the frame being rendered and of the previous one, in rows of m_reservoirWidth pixels
+    std::vector<PixelReservoir> m_reservoirs;
+    std::vector<PixelReservoir> m_previousReservoirs;
+    unsigned int m_reservoirWidth;
+    unsigned int m_reservoirHeight;
+
+    unsigned int m_maxRays;
+
+    bool m_packetTraversal;
+
+    Sampler m_sampler;
+
+    double m_renderTime;
+    std::uint64_t m_renderSampleCount;
+    std::uint64_t m_renderRayCount;
+};
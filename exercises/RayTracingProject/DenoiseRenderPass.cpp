@@ -0,0 +1,77 @@
+#include "DenoiseRenderPass.h"
+
+#include "AccumulationRenderPass.h"
+#include <ituGL/renderer/Renderer.h>
+#include <ituGL/shader/Material.h>
+#include <ituGL/texture/Texture2DObject.h>
+#include <ituGL/texture/FramebufferObject.h>
+#include <array>
+#include <cassert>
+
+DenoiseRenderPass::DenoiseRenderPass(std::shared_ptr<Material> prepareMaterial, std::shared_ptr<Material> filterMaterial,
+    const AccumulationRenderPass& accumulationPass, int width, int height, std::shared_ptr<const FramebufferObject> targetFramebuffer)
+    : RenderPass(targetFramebuffer)
+    , m_prepareMaterial(prepareMaterial)
+    , m_filterMaterial(filterMaterial)
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        // Full precision, the illumination is not bounded once divided by the albedo
+        m_textures[i] = std::make_shared<Texture2DObject>();
+        m_textures[i]->Bind();
+        m_textures[i]->SetImage(0, width, height, TextureObject::FormatRGBA, TextureObject::InternalFormat::InternalFormatRGBA32F);
+        m_textures[i]->SetParameter(TextureObject::ParameterEnum::MinFilter, GL_NEAREST);
+        m_textures[i]->SetParameter(TextureObject::ParameterEnum::MagFilter, GL_NEAREST);
+        Texture2DObject::Unbind();
+
+        m_framebuffers[i] = std::make_shared<FramebufferObject>();
+        m_framebuffers[i]->Bind();
+        m_framebuffers[i]->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color0, *m_textures[i]);
+        m_framebuffers[i]->SetDrawBuffers(std::array<FramebufferObject::Attachment, 1>({ FramebufferObject::Attachment::Color0 }));
+        FramebufferObject::Unbind();
+    }
+
+    m_prepareMaterial->SetUniformValue("SourceTexture", accumulationPass.GetSumTexture());
+    m_prepareMaterial->SetUniformValue("MomentsTexture", accumulationPass.GetMomentsTexture());
+    m_prepareMaterial->SetUniformValue("AlbedoTexture", accumulationPass.GetAlbedoTexture());
+
+    m_filterMaterial->SetUniformValue("PositionTexture", accumulationPass.GetPositionTexture());
+    m_filterMaterial->SetUniformValue("NormalTexture", accumulationPass.GetNormalTexture());
+    m_filterMaterial->SetUniformValue("AlbedoTexture", accumulationPass.GetAlbedoTexture());
+}
+
+void DenoiseRenderPass::Render()
+{
+    Renderer& renderer = GetRenderer();
+    const Mesh* mesh = &renderer.GetFullscreenMesh();
+
+    // The renderer bound the target framebuffer before this pass
+    std::shared_ptr<const FramebufferObject> targetFramebuffer = renderer.GetCurrentFramebuffer();
+
+    assert(m_prepareMaterial && m_filterMaterial);
+    m_framebuffers[0]->Bind();
+    m_prepareMaterial->Use();
+    mesh->DrawSubmesh(0);
+
+    for (int i = 0; i < IterationCount; ++i)
+    {
+        bool lastIteration = i == IterationCount - 1;
+        if (lastIteration)
+        {
+            if (targetFramebuffer)
+                targetFramebuffer->Bind();
+            else
+                FramebufferObject::Unbind();
+        }
+        else
+        {
+            m_framebuffers[(i + 1) % 2]->Bind();
+        }
+
+        m_filterMaterial->SetUniformValue("SourceTexture", m_textures[i % 2]);
+        m_filterMaterial->SetUniformValue("StepSize", 1 << i);
+        m_filterMaterial->SetUniformValue("Remodulate", lastIteration ? 1u : 0u);
+        m_filterMaterial->Use();
+        mesh->DrawSubmesh(0);
+    }
+}
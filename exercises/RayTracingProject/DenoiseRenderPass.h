@@ -0,0 +1,33 @@
+#pragma once
+
+#include <ituGL/renderer/RenderPass.h>
+
+#include <memory>
+
+class Material;
+class Texture2DObject;
+class FramebufferObject;
+class AccumulationRenderPass;
+
+// Resolves the sums of the accumulation pass to the mean of each pixel, filtered with an edge-avoiding a-trous wavelet
+// The prepare material divides the mean by the albedo and estimates its variance, with denoise_prepare.frag
+// The filter material runs one iteration of the wavelet per draw, with denoise_atrous.frag, and the last one draws to the target
+class DenoiseRenderPass : public RenderPass
+{
+public:
+    DenoiseRenderPass(std::shared_ptr<Material> prepareMaterial, std::shared_ptr<Material> filterMaterial, const AccumulationRenderPass& accumulationPass,
+        int width, int height, std::shared_ptr<const FramebufferObject> targetFramebuffer = nullptr);
+
+    void Render() override;
+
+    // Number of iterations of the filter, each one doubles the distance between the taps
+    static constexpr int IterationCount = 5;
+
+private:
+    std::shared_ptr<Material> m_prepareMaterial;
+    std::shared_ptr<Material> m_filterMaterial;
+
+    // The iterations read from one texture and draw to the other
+    std::shared_ptr<Texture2DObject> m_textures[2];
+    std::shared_ptr<FramebufferObject> m_framebuffers[2];
+};
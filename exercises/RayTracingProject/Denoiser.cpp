@@ -0,0 +1,474 @@
+#include "Denoiser.h"
+
+#include "RaytracingScene.h"
+#include <ituGL/utils/ThreadPool.h>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+
+// The SIMD kernels are compiled for their instruction set only, like the ones of SimdIntersection.cpp
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ITUGL_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ITUGL_TARGET(instructions)
+#else
+#define ITUGL_TARGET(instructions) __attribute__((target(instructions)))
+#endif
+#endif
+
+namespace
+{
+    // Planes read and written by an iteration of the filter, indexed like the enums of Denoiser
+    struct FilterStreams
+    {
+        const float* input[4];
+        float* output[4];
+        const float* features[8];
+        // Distance between the taps, in elements
+        int step;
+        int rowStep;
+    };
+
+    // Edge-stopping functions, same constants as denoise_atrous.frag
+    constexpr float NormalScale = 128.0f;
+    constexpr float PlaneSigma = 0.01f;
+
+    // Weights of the B3 spline kernel, from the center
+    constexpr float KernelWeights[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+    constexpr float LuminanceR = 0.2126f;
+    constexpr float LuminanceG = 0.7152f;
+    constexpr float LuminanceB = 0.0722f;
+
+    // exp(x) as 2^n * 2^f, with a polynomial for 2^f in [0, 1). Below MinExponent, the result is clamped
+    constexpr float MinExponent = -87.0f;
+    constexpr float Log2E = 1.44269504f;
+    constexpr float ExpCoefficients[7] = { 1.535336188319500e-4f, 1.339887440266574e-3f, 9.618437357674640e-3f, 5.550332471162809e-2f,
+        2.402264791363012e-1f, 6.931472028550421e-1f, 1.0f };
+}
+
+// Demodulation of denoise_prepare.frag: channels with a dark albedo are not divided
+static glm::vec3 GetDemodulationAlbedo(const glm::vec3& albedo)
+{
+    return glm::vec3(albedo.r > 0.01f ? albedo.r : 1.0f, albedo.g > 0.01f ? albedo.g : 1.0f, albedo.b > 0.01f ? albedo.b : 1.0f);
+}
+
+// Scalar exp, with the same operations as the SIMD versions so all the levels give the same image
+static float FastExp(float x)
+{
+    x = x > MinExponent ? x : MinExponent;
+    float t = x * Log2E;
+    float n = std::floor(t);
+    float f = t - n;
+    float p = ExpCoefficients[0];
+    for (int i = 1; i < 7; ++i)
+    {
+        p = p * f + ExpCoefficients[i];
+    }
+    return p * std::bit_cast<float>((static_cast<int>(n) + 127) << 23);
+}
+
+static void FilterPixelsScalar(const FilterStreams& streams, unsigned int first, unsigned int count)
+{
+    for (unsigned int i = first; i < first + count; ++i)
+    {
+        float distance = streams.features[6][i];
+        if (!(distance > 0.0f))
+        {
+            // Rays that missed are not filtered
+            for (int plane = 0; plane < 4; ++plane)
+            {
+                streams.output[plane][i] = streams.input[plane][i];
+            }
+            continue;
+        }
+
+        float nx = streams.features[0][i], ny = streams.features[1][i], nz = streams.features[2][i];
+        float px = streams.features[3][i], py = streams.features[4][i], pz = streams.features[5][i];
+        float luminanceScale = streams.features[7][i];
+        float planeScale = 1.0f / (PlaneSigma * distance);
+        float luminance = streams.input[0][i] * LuminanceR + streams.input[1][i] * LuminanceG + streams.input[2][i] * LuminanceB;
+
+        float sumR = 0.0f, sumG = 0.0f, sumB = 0.0f, varianceSum = 0.0f, weightSum = 0.0f;
+        for (int y = -2; y <= 2; ++y)
+        {
+            for (int x = -2; x <= 2; ++x)
+            {
+                unsigned int j = i + y * streams.rowStep + x * streams.step;
+                float r = streams.input[0][j], g = streams.input[1][j], b = streams.input[2][j];
+
+                float luminanceDistance = std::abs(r * LuminanceR + g * LuminanceG + b * LuminanceB - luminance) * luminanceScale;
+                float cosine = nx * streams.features[0][j] + ny * streams.features[1][j] + nz * streams.features[2][j];
+                float planeDistance = std::abs((streams.features[3][j] - px) * nx + (streams.features[4][j] - py) * ny + (streams.features[5][j] - pz) * nz) * planeScale;
+                float weight = KernelWeights[std::abs(x)] * KernelWeights[std::abs(y)]
+                    * FastExp(-(luminanceDistance + (1.0f - cosine) * NormalScale + planeDistance));
+                weight = streams.features[6][j] > 0.0f ? weight : 0.0f;
+
+                sumR += weight * r;
+                sumG += weight * g;
+                sumB += weight * b;
+                varianceSum += weight * weight * streams.input[3][j];
+                weightSum += weight;
+            }
+        }
+
+        streams.output[0][i] = sumR / weightSum;
+        streams.output[1][i] = sumG / weightSum;
+        streams.output[2][i] = sumB / weightSum;
+        streams.output[3][i] = varianceSum / (weightSum * weightSum);
+    }
+}
+
+#ifdef ITUGL_SIMD_X86
+
+ITUGL_TARGET("sse4.2")
+static __m128 FastExpSSE42(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_set1_ps(MinExponent));
+    __m128 t = _mm_mul_ps(x, _mm_set1_ps(Log2E));
+    __m128 n = _mm_floor_ps(t);
+    __m128 f = _mm_sub_ps(t, n);
+    __m128 p = _mm_set1_ps(ExpCoefficients[0]);
+    for (int i = 1; i < 7; ++i)
+    {
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(ExpCoefficients[i]));
+    }
+    __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+}
+
+// 4 pixels of a row at a time. The padding of the planes holds the lanes past the end of the row
+ITUGL_TARGET("sse4.2")
+static void FilterPixelsSSE42(const FilterStreams& streams, unsigned int first, unsigned int count)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 luminanceR = _mm_set1_ps(LuminanceR);
+    const __m128 luminanceG = _mm_set1_ps(LuminanceG);
+    const __m128 luminanceB = _mm_set1_ps(LuminanceB);
+    const __m128 normalScale = _mm_set1_ps(NormalScale);
+
+    for (unsigned int i = first; i < first + count; i += 4)
+    {
+        __m128 distance = _mm_loadu_ps(streams.features[6] + i);
+        __m128 centerMask = _mm_cmpgt_ps(distance, zero);
+        __m128 centerR = _mm_loadu_ps(streams.input[0] + i);
+        __m128 centerG = _mm_loadu_ps(streams.input[1] + i);
+        __m128 centerB = _mm_loadu_ps(streams.input[2] + i);
+        __m128 centerVariance = _mm_loadu_ps(streams.input[3] + i);
+        if (_mm_movemask_ps(centerMask) == 0)
+        {
+            _mm_storeu_ps(streams.output[0] + i, centerR);
+            _mm_storeu_ps(streams.output[1] + i, centerG);
+            _mm_storeu_ps(streams.output[2] + i, centerB);
+            _mm_storeu_ps(streams.output[3] + i, centerVariance);
+            continue;
+        }
+
+        __m128 nx = _mm_loadu_ps(streams.features[0] + i);
+        __m128 ny = _mm_loadu_ps(streams.features[1] + i);
+        __m128 nz = _mm_loadu_ps(streams.features[2] + i);
+        __m128 px = _mm_loadu_ps(streams.features[3] + i);
+        __m128 py = _mm_loadu_ps(streams.features[4] + i);
+        __m128 pz = _mm_loadu_ps(streams.features[5] + i);
+        __m128 luminanceScale = _mm_loadu_ps(streams.features[7] + i);
+        __m128 planeScale = _mm_div_ps(one, _mm_mul_ps(_mm_set1_ps(PlaneSigma), distance));
+        __m128 luminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(centerR, luminanceR), _mm_mul_ps(centerG, luminanceG)), _mm_mul_ps(centerB, luminanceB));
+
+        __m128 sumR = zero, sumG = zero, sumB = zero, varianceSum = zero, weightSum = zero;
+        for (int y = -2; y <= 2; ++y)
+        {
+            for (int x = -2; x <= 2; ++x)
+            {
+                unsigned int j = i + y * streams.rowStep + x * streams.step;
+                __m128 r = _mm_loadu_ps(streams.input[0] + j);
+                __m128 g = _mm_loadu_ps(streams.input[1] + j);
+                __m128 b = _mm_loadu_ps(streams.input[2] + j);
+
+                __m128 tapLuminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, luminanceR), _mm_mul_ps(g, luminanceG)), _mm_mul_ps(b, luminanceB));
+                __m128 luminanceDistance = _mm_mul_ps(_mm_andnot_ps(signMask, _mm_sub_ps(tapLuminance, luminance)), luminanceScale);
+                __m128 cosine = _mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(nx, _mm_loadu_ps(streams.features[0] + j)),
+                    _mm_mul_ps(ny, _mm_loadu_ps(streams.features[1] + j))),
+                    _mm_mul_ps(nz, _mm_loadu_ps(streams.features[2] + j)));
+                __m128 planeDistance = _mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(streams.features[3] + j), px), nx),
+                    _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(streams.features[4] + j), py), ny)),
+                    _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(streams.features[5] + j), pz), nz));
+                planeDistance = _mm_mul_ps(_mm_andnot_ps(signMask, planeDistance), planeScale);
+
+                __m128 exponent = _mm_add_ps(_mm_add_ps(luminanceDistance, _mm_mul_ps(_mm_sub_ps(one, cosine), normalScale)), planeDistance);
+                __m128 weight = _mm_mul_ps(_mm_set1_ps(KernelWeights[std::abs(x)] * KernelWeights[std::abs(y)]), FastExpSSE42(_mm_sub_ps(zero, exponent)));
+                weight = _mm_and_ps(weight, _mm_cmpgt_ps(_mm_loadu_ps(streams.features[6] + j), zero));
+
+                sumR = _mm_add_ps(sumR, _mm_mul_ps(weight, r));
+                sumG = _mm_add_ps(sumG, _mm_mul_ps(weight, g));
+                sumB = _mm_add_ps(sumB, _mm_mul_ps(weight, b));
+                varianceSum = _mm_add_ps(varianceSum, _mm_mul_ps(_mm_mul_ps(weight, weight), _mm_loadu_ps(streams.input[3] + j)));
+                weightSum = _mm_add_ps(weightSum, weight);
+            }
+        }
+
+        _mm_storeu_ps(streams.output[0] + i, _mm_blendv_ps(centerR, _mm_div_ps(sumR, weightSum), centerMask));
+        _mm_storeu_ps(streams.output[1] + i, _mm_blendv_ps(centerG, _mm_div_ps(sumG, weightSum), centerMask));
+        _mm_storeu_ps(streams.output[2] + i, _mm_blendv_ps(centerB, _mm_div_ps(sumB, weightSum), centerMask));
+        _mm_storeu_ps(streams.output[3] + i, _mm_blendv_ps(centerVariance, _mm_div_ps(varianceSum, _mm_mul_ps(weightSum, weightSum)), centerMask));
+    }
+}
+
+ITUGL_TARGET("avx2")
+static __m256 FastExpAVX2(__m256 x)
+{
+    x = _mm256_max_ps(x, _mm256_set1_ps(MinExponent));
+    __m256 t = _mm256_mul_ps(x, _mm256_set1_ps(Log2E));
+    __m256 n = _mm256_floor_ps(t);
+    __m256 f = _mm256_sub_ps(t, n);
+    __m256 p = _mm256_set1_ps(ExpCoefficients[0]);
+    for (int i = 1; i < 7; ++i)
+    {
+        p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(ExpCoefficients[i]));
+    }
+    __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+// Same as FilterPixelsSSE42, with 8 pixels at a time
+ITUGL_TARGET("avx2")
+static void FilterPixelsAVX2(const FilterStreams& streams, unsigned int first, unsigned int count)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 luminanceR = _mm256_set1_ps(LuminanceR);
+    const __m256 luminanceG = _mm256_set1_ps(LuminanceG);
+    const __m256 luminanceB = _mm256_set1_ps(LuminanceB);
+    const __m256 normalScale = _mm256_set1_ps(NormalScale);
+
+    for (unsigned int i = first; i < first + count; i += 8)
+    {
+        __m256 distance = _mm256_loadu_ps(streams.features[6] + i);
+        __m256 centerMask = _mm256_cmp_ps(distance, zero, _CMP_GT_OQ);
+        __m256 centerR = _mm256_loadu_ps(streams.input[0] + i);
+        __m256 centerG = _mm256_loadu_ps(streams.input[1] + i);
+        __m256 centerB = _mm256_loadu_ps(streams.input[2] + i);
+        __m256 centerVariance = _mm256_loadu_ps(streams.input[3] + i);
+        if (_mm256_movemask_ps(centerMask) == 0)
+        {
+            _mm256_storeu_ps(streams.output[0] + i, centerR);
+            _mm256_storeu_ps(streams.output[1] + i, centerG);
+            _mm256_storeu_ps(streams.output[2] + i, centerB);
+            _mm256_storeu_ps(streams.output[3] + i, centerVariance);
+            continue;
+        }
+
+        __m256 nx = _mm256_loadu_ps(streams.features[0] + i);
+        __m256 ny = _mm256_loadu_ps(streams.features[1] + i);
+        __m256 nz = _mm256_loadu_ps(streams.features[2] + i);
+        __m256 px = _mm256_loadu_ps(streams.features[3] + i);
+        __m256 py = _mm256_loadu_ps(streams.features[4] + i);
+        __m256 pz = _mm256_loadu_ps(streams.features[5] + i);
+        __m256 luminanceScale = _mm256_loadu_ps(streams.features[7] + i);
+        __m256 planeScale = _mm256_div_ps(one, _mm256_mul_ps(_mm256_set1_ps(PlaneSigma), distance));
+        __m256 luminance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(centerR, luminanceR), _mm256_mul_ps(centerG, luminanceG)), _mm256_mul_ps(centerB, luminanceB));
+
+        __m256 sumR = zero, sumG = zero, sumB = zero, varianceSum = zero, weightSum = zero;
+        for (int y = -2; y <= 2; ++y)
+        {
+            for (int x = -2; x <= 2; ++x)
+            {
+                unsigned int j = i + y * streams.rowStep + x * streams.step;
+                __m256 r = _mm256_loadu_ps(streams.input[0] + j);
+                __m256 g = _mm256_loadu_ps(streams.input[1] + j);
+                __m256 b = _mm256_loadu_ps(streams.input[2] + j);
+
+                __m256 tapLuminance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r, luminanceR), _mm256_mul_ps(g, luminanceG)), _mm256_mul_ps(b, luminanceB));
+                __m256 luminanceDistance = _mm256_mul_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(tapLuminance, luminance)), luminanceScale);
+                __m256 cosine = _mm256_add_ps(_mm256_add_ps(
+                    _mm256_mul_ps(nx, _mm256_loadu_ps(streams.features[0] + j)),
+                    _mm256_mul_ps(ny, _mm256_loadu_ps(streams.features[1] + j))),
+                    _mm256_mul_ps(nz, _mm256_loadu_ps(streams.features[2] + j)));
+                __m256 planeDistance = _mm256_add_ps(_mm256_add_ps(
+                    _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(streams.features[3] + j), px), nx),
+                    _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(streams.features[4] + j), py), ny)),
+                    _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(streams.features[5] + j), pz), nz));
+                planeDistance = _mm256_mul_ps(_mm256_andnot_ps(signMask, planeDistance), planeScale);
+
+                __m256 exponent = _mm256_add_ps(_mm256_add_ps(luminanceDistance, _mm256_mul_ps(_mm256_sub_ps(one, cosine), normalScale)), planeDistance);
+                __m256 weight = _mm256_mul_ps(_mm256_set1_ps(KernelWeights[std::abs(x)] * KernelWeights[std::abs(y)]), FastExpAVX2(_mm256_sub_ps(zero, exponent)));
+                weight = _mm256_and_ps(weight, _mm256_cmp_ps(_mm256_loadu_ps(streams.features[6] + j), zero, _CMP_GT_OQ));
+
+                sumR = _mm256_add_ps(sumR, _mm256_mul_ps(weight, r));
+                sumG = _mm256_add_ps(sumG, _mm256_mul_ps(weight, g));
+                sumB = _mm256_add_ps(sumB, _mm256_mul_ps(weight, b));
+                varianceSum = _mm256_add_ps(varianceSum, _mm256_mul_ps(_mm256_mul_ps(weight, weight), _mm256_loadu_ps(streams.input[3] + j)));
+                weightSum = _mm256_add_ps(weightSum, weight);
+            }
+        }
+
+        _mm256_storeu_ps(streams.output[0] + i, _mm256_blendv_ps(centerR, _mm256_div_ps(sumR, weightSum), centerMask));
+        _mm256_storeu_ps(streams.output[1] + i, _mm256_blendv_ps(centerG, _mm256_div_ps(sumG, weightSum), centerMask));
+        _mm256_storeu_ps(streams.output[2] + i, _mm256_blendv_ps(centerB, _mm256_div_ps(sumB, weightSum), centerMask));
+        _mm256_storeu_ps(streams.output[3] + i, _mm256_blendv_ps(centerVariance, _mm256_div_ps(varianceSum, _mm256_mul_ps(weightSum, weightSum)), centerMask));
+    }
+}
+
+#endif // ITUGL_SIMD_X86
+
+Denoiser::Denoiser() : m_simdLevel(GetSupportedSimdLevel()), m_stride(0), m_denoiseTime(0.0)
+{
+}
+
+void Denoiser::SetSimdLevel(SimdLevel simdLevel)
+{
+    m_simdLevel = std::min(simdLevel, GetSupportedSimdLevel());
+}
+
+void Denoiser::Denoise(ThreadPool& threadPool, unsigned int width, unsigned int height, const DenoiserFeatures& features, std::vector<glm::vec3>& image)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    Prepare(threadPool, width, height, features, image);
+
+    for (int iteration = 0; iteration < IterationCount; ++iteration)
+    {
+        const std::vector<float>& input = m_illumination[iteration % 2];
+        std::vector<float>& output = m_illumination[(iteration + 1) % 2];
+        unsigned int planeSize = static_cast<unsigned int>(input.size()) / IlluminationPlaneCount;
+
+        UpdateLuminanceScale(threadPool, width, height, input.data() + Variance * planeSize);
+
+        FilterStreams streams;
+        for (int plane = 0; plane < IlluminationPlaneCount; ++plane)
+        {
+            streams.input[plane] = input.data() + plane * planeSize;
+            streams.output[plane] = output.data() + plane * planeSize;
+        }
+        for (int plane = 0; plane < FeaturePlaneCount; ++plane)
+        {
+            streams.features[plane] = m_features.data() + plane * planeSize;
+        }
+        streams.step = 1 << iteration;
+        streams.rowStep = streams.step * m_stride;
+
+        threadPool.ParallelFor(height, [&](unsigned int y, unsigned int)
+            {
+#ifdef ITUGL_SIMD_X86
+                if (m_simdLevel == SimdLevel::AVX2)
+                    return FilterPixelsAVX2(streams, GetIndex(0, y), width);
+                if (m_simdLevel == SimdLevel::SSE42)
+                    return FilterPixelsSSE42(streams, GetIndex(0, y), width);
+#endif
+                FilterPixelsScalar(streams, GetIndex(0, y), width);
+            });
+    }
+
+    // Multiply by the albedo again
+    const std::vector<float>& result = m_illumination[IterationCount % 2];
+    unsigned int planeSize = static_cast<unsigned int>(result.size()) / IlluminationPlaneCount;
+    threadPool.ParallelFor(height, [&](unsigned int y, unsigned int)
+        {
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                unsigned int index = GetIndex(x, y);
+                glm::vec3 illumination(result[ColorR * planeSize + index], result[ColorG * planeSize + index], result[ColorB * planeSize + index]);
+                image[y * width + x] = illumination * GetDemodulationAlbedo(features.albedo[y * width + x]);
+            }
+        });
+
+    m_denoiseTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Denoiser::Prepare(ThreadPool& threadPool, unsigned int width, unsigned int height, const DenoiserFeatures& features, const std::vector<glm::vec3>& image)
+{
+    // Rows are rounded up to the widest kernel, so its last lanes have the padding on their right too. The padding is left at 0
+    m_stride = (width + 7) / 8 * 8 + 2 * Padding;
+    unsigned int planeSize = m_stride * (height + 2 * Padding);
+    for (std::vector<float>& illumination : m_illumination)
+    {
+        illumination.assign(IlluminationPlaneCount * planeSize, 0.0f);
+    }
+    m_features.assign(FeaturePlaneCount * planeSize, 0.0f);
+
+    float* illumination = m_illumination[0].data();
+    float* variance = illumination + Variance * planeSize;
+    threadPool.ParallelFor(height, [&](unsigned int y, unsigned int)
+        {
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                unsigned int pixel = y * width + x;
+                unsigned int index = GetIndex(x, y);
+                glm::vec3 albedo = GetDemodulationAlbedo(features.albedo[pixel]);
+                glm::vec3 color = image[pixel] / albedo;
+                for (int channel = 0; channel < 3; ++channel)
+                {
+                    illumination[(ColorR + channel) * planeSize + index] = color[channel];
+                    m_features[(NormalX + channel) * planeSize + index] = features.normal[pixel][channel];
+                    m_features[(PositionX + channel) * planeSize + index] = features.position[pixel][channel];
+                }
+                m_features[Distance * planeSize + index] = features.position[pixel].w;
+
+                // Variance of the mean, from the variance of the samples
+                float sampleCount = static_cast<float>(features.sampleCount);
+                if (sampleCount >= 4.0f)
+                {
+                    float mean = RaytracingScene::GetLuminance(image[pixel]);
+                    float sampleVariance = std::max(features.luminanceMoments[pixel] - mean * mean, 0.0f) * sampleCount / (sampleCount - 1.0f);
+                    float albedoLuminance = RaytracingScene::GetLuminance(albedo);
+                    variance[index] = sampleVariance / sampleCount / (albedoLuminance * albedoLuminance);
+                }
+            }
+        });
+
+    if (features.sampleCount >= 4)
+        return;
+
+    // Too few samples: variance of the 3x3 neighbors
+    threadPool.ParallelFor(height, [&](unsigned int y, unsigned int)
+        {
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                float moment1 = 0.0f;
+                float moment2 = 0.0f;
+                for (int offsetY = -1; offsetY <= 1; ++offsetY)
+                {
+                    for (int offsetX = -1; offsetX <= 1; ++offsetX)
+                    {
+                        unsigned int index = GetIndex(std::clamp(static_cast<int>(x) + offsetX, 0, static_cast<int>(width) - 1),
+                            std::clamp(static_cast<int>(y) + offsetY, 0, static_cast<int>(height) - 1));
+                        float luminance = RaytracingScene::GetLuminance(glm::vec3(illumination[ColorR * planeSize + index],
+                            illumination[ColorG * planeSize + index], illumination[ColorB * planeSize + index]));
+                        moment1 += luminance;
+                        moment2 += luminance * luminance;
+                    }
+                }
+                moment1 /= 9.0f;
+                variance[GetIndex(x, y)] = std::max(moment2 / 9.0f - moment1 * moment1, 0.0f);
+            }
+        });
+}
+
+void Denoiser::UpdateLuminanceScale(ThreadPool& threadPool, unsigned int width, unsigned int height, const float* variance)
+{
+    float* luminanceScale = m_features.data() + LuminanceScale * (m_features.size() / FeaturePlaneCount);
+    threadPool.ParallelFor(height, [&](unsigned int y, unsigned int)
+        {
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                float blurredVariance = 0.0f;
+                for (int offsetY = -1; offsetY <= 1; ++offsetY)
+                {
+                    for (int offsetX = -1; offsetX <= 1; ++offsetX)
+                    {
+                        float weight = (2.0f - std::abs(offsetX)) * (2.0f - std::abs(offsetY)) / 16.0f;
+                        blurredVariance += weight * variance[GetIndex(std::clamp(static_cast<int>(x) + offsetX, 0, static_cast<int>(width) - 1),
+                            std::clamp(static_cast<int>(y) + offsetY, 0, static_cast<int>(height) - 1))];
+                    }
+                }
+                // LuminanceSigma of denoise_atrous.frag
+                luminanceScale[GetIndex(x, y)] = 1.0f / (4.0f * std::sqrt(blurredVariance) + 1e-6f);
+            }
+        });
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <ituGL/raytracing/SimdIntersection.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+class ThreadPool;
+
+// Primary hits and second moments of an image rendered by CpuPathTracer, like the attachments of AccumulationRenderPass
+struct DenoiserFeatures
+{
+    // Albedo of the primary hit, or 0 if the ray missed
+    std::vector<glm::vec3> albedo;
+    std::vector<glm::vec3> normal;
+    // Position of the primary hit, with the distance along the ray in w, or 0 if the ray missed
+    std::vector<glm::vec4> position;
+    // Mean of the squared luminance of the samples
+    std::vector<float> luminanceMoments;
+    unsigned int sampleCount = 0;
+};
+
+// CPU version of DenoiseRenderPass: the mean of each pixel is divided by its albedo, filtered with the edge-avoiding a-trous wavelet
+// of denoise_atrous.frag, and multiplied by the albedo again
+// The planes are padded with missed pixels, so the kernels filter 4 or 8 pixels of a row at once without checking the borders
+class Denoiser
+{
+public:
+    Denoiser();
+
+    // Kernels used by Denoise. Starts with the best supported level, and can't be set to a higher one
+    inline SimdLevel GetSimdLevel() const { return m_simdLevel; }
+    void SetSimdLevel(SimdLevel simdLevel);
+
+    // Filter the image in place. Rows are split between the threads of the pool
+    void Denoise(ThreadPool& threadPool, unsigned int width, unsigned int height, const DenoiserFeatures& features, std::vector<glm::vec3>& image);
+
+    // Duration of the last Denoise
+    inline double GetDenoiseTime() const { return m_denoiseTime; }
+
+    // Number of iterations of the filter, each one doubles the distance between the taps
+    static constexpr int IterationCount = 5;
+
+private:
+    // Planes of the illumination, read and written by each iteration
+    enum IlluminationPlane
+    {
+        ColorR, ColorG, ColorB, Variance,
+        IlluminationPlaneCount
+    };
+
+    // Planes of the primary hits, and the scale of the luminance differences of the current iteration
+    enum FeaturePlane
+    {
+        NormalX, NormalY, NormalZ, PositionX, PositionY, PositionZ, Distance, LuminanceScale,
+        FeaturePlaneCount
+    };
+
+    // Columns and rows added on each side of the planes, the reach of the last iteration
+    static constexpr unsigned int Padding = 2u << (IterationCount - 1);
+
+    inline unsigned int GetIndex(unsigned int x, unsigned int y) const { return (y + Padding) * m_stride + x + Padding; }
+
+    // Divide the image by the albedo, and estimate the variance of each pixel. Same as denoise_prepare.frag
+    void Prepare(ThreadPool& threadPool, unsigned int width, unsigned int height, const DenoiserFeatures& features, const std::vector<glm::vec3>& image);
+
+    // Standard deviation of the luminance of the iteration, from the variance blurred with a 3x3 gaussian
+    void UpdateLuminanceScale(ThreadPool& threadPool, unsigned int width, unsigned int height, const float* variance);
+
+private:
+    SimdLevel m_simdLevel;
+
+    // Padded width of the planes
+    unsigned int m_stride;
+
+    std::vector<float> m_illumination[2];
+    std::vector<float> m_features;
+
+    double m_denoiseTime;
+};
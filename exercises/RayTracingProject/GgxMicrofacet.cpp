@@ -0,0 +1,55 @@
+#include "GgxMicrofacet.h"
+
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <cmath>
+
+float GgxMicrofacet::Distribution(float NdotH, float alpha)
+{
+    float alpha2 = alpha * alpha;
+    float d = NdotH * NdotH * (alpha2 - 1.0f) + 1.0f;
+    return NdotH > 0.0f ? alpha2 / (glm::pi<float>() * d * d) : 0.0f;
+}
+
+float GgxMicrofacet::SmithLambda(float NdotV, float alpha)
+{
+    float cos2 = NdotV * NdotV;
+    return 0.5f * (std::sqrt(1.0f + alpha * alpha * (1.0f - cos2) / cos2) - 1.0f);
+}
+
+float GgxMicrofacet::SmithG1(float NdotV, float alpha)
+{
+    return 1.0f / (1.0f + SmithLambda(NdotV, alpha));
+}
+
+float GgxMicrofacet::SmithG2(float NdotV, float NdotL, float alpha)
+{
+    return 1.0f / (1.0f + SmithLambda(NdotV, alpha) + SmithLambda(NdotL, alpha));
+}
+
+float GgxMicrofacet::GetReflectionPdf(float NdotV, float NdotH, float alpha)
+{
+    // Density of the visible normals, G1 D max(VdotH, 0) / NdotV, times the Jacobian of the reflection, 1 / (4 VdotH)
+    return SmithG1(NdotV, alpha) * Distribution(NdotH, alpha) / (4.0f * NdotV);
+}
+
+glm::vec3 GgxMicrofacet::SampleVisibleNormal(const glm::vec3& view, float alpha, glm::vec2 u)
+{
+    // Stretch the view to the configuration with alpha 1, where the visible normals cover a hemisphere (Heitz 2018)
+    glm::vec3 stretchedView = glm::normalize(glm::vec3(alpha * view.x, alpha * view.y, view.z));
+    float length2 = stretchedView.x * stretchedView.x + stretchedView.y * stretchedView.y;
+    glm::vec3 t1 = length2 > 0.0f ? glm::vec3(-stretchedView.y, stretchedView.x, 0.0f) / std::sqrt(length2) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 t2 = glm::cross(stretchedView, t1);
+
+    // Point on the projected disk, warped to the visible part of the hemisphere
+    float r = std::sqrt(u.x);
+    float phi = 6.28318530718f * u.y;
+    float p1 = r * std::cos(phi);
+    float p2 = r * std::sin(phi);
+    float s = 0.5f * (1.0f + stretchedView.z);
+    p2 = (1.0f - s) * std::sqrt(1.0f - p1 * p1) + s * p2;
+    glm::vec3 microfacetNormal = p1 * t1 + p2 * t2 + std::sqrt(std::max(1.0f - p1 * p1 - p2 * p2, 0.0f)) * stretchedView;
+
+    // Unstretch
+    return glm::normalize(glm::vec3(alpha * microfacetNormal.x, alpha * microfacetNormal.y, std::max(microfacetNormal.z, 0.0f)));
+}
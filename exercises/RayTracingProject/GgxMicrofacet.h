@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// GGX microfacet model of the specular lobe, same functions as raytracing.frag
+// Alpha is the squared roughness. Vectors in tangent space have the normal along z
+class GgxMicrofacet
+{
+public:
+    // Smallest alpha, so mirrors are sampled and evaluated with finite numbers. MinGgxAlpha in the shaders
+    static constexpr float MinAlpha = 0.001f;
+
+    // Density of the microfacet normals, for the cosine between the normal and the half vector
+    static float Distribution(float NdotH, float alpha);
+
+    // Smith masking of one direction
+    static float SmithG1(float NdotV, float alpha);
+
+    // Height-correlated Smith masking and shadowing of the view and light directions
+    static float SmithG2(float NdotV, float NdotL, float alpha);
+
+    // Density per solid angle of the directions reflected over the normals returned by SampleVisibleNormal
+    static float GetReflectionPdf(float NdotV, float NdotH, float alpha);
+
+    // Sample a microfacet normal among the ones visible from the view direction, in tangent space, from two uniform numbers
+    static glm::vec3 SampleVisibleNormal(const glm::vec3& view, float alpha, glm::vec2 u);
+
+private:
+    static float SmithLambda(float NdotV, float alpha);
+};
@@ -0,0 +1,788 @@
+#include "IntersectionBenchmark.h"
+
+#include <ituGL/raytracing/AccelerationStructure.h>
+#include <ituGL/raytracing/SimdIntersection.h>
+#include <ituGL/camera/Camera.h>
+#include <ituGL/utils/ThreadPool.h>
+#include <glm/gtx/transform.hpp>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <span>
+
+// The SIMD kernels are compiled for their instruction set only, like the ones of SimdIntersection.cpp
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ITUGL_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ITUGL_TARGET(instructions)
+#else
+#define ITUGL_TARGET(instructions) __attribute__((target(instructions)))
+#endif
+#endif
+
+// Bounding boxes in structure-of-arrays layout, so a ray can be tested against 4 or 8 of them at once
+// Only measured here: the children of a BVH node are not consecutive, so the traversal tests them one at a time
+class BoxBlocks
+{
+public:
+    static constexpr unsigned int BlockSize = 8;
+
+public:
+    BoxBlocks();
+
+    void Build(std::span<const BoundingBox> boxes);
+
+    inline unsigned int GetBoxCount() const { return m_boxCount; }
+
+    inline SimdLevel GetSimdLevel() const { return m_simdLevel; }
+    void SetSimdLevel(SimdLevel simdLevel);
+
+    // Test a ray against the boxes [first, first + BlockSize), ignoring the ones past the end. first must be a valid box
+    // Returns a mask with a bit set for each box hit closer than maxDistance, and writes the entry distance of every box
+    // Same test as RayNodeIntersection in the shaders
+    unsigned int Intersect(const glm::vec3& origin, const glm::vec3& invDirection, unsigned int first, float maxDistance,
+        float distances[BlockSize]) const;
+
+private:
+    enum Stream
+    {
+        MinX, MinY, MinZ,
+        MaxX, MaxY, MaxZ,
+        StreamCount
+    };
+
+    inline const float* GetStream(Stream stream) const { return m_data.data() + stream * m_stride; }
+
+private:
+    std::vector<float> m_data;
+    unsigned int m_stride;
+    unsigned int m_boxCount;
+    SimdLevel m_simdLevel;
+};
+
+// Arrays of a BoxBlocks, one per component
+struct BoxStreams
+{
+    const float* boundsMin[3];
+    const float* boundsMax[3];
+};
+
+static unsigned int IntersectBoxesScalar(const BoxStreams& streams, const glm::vec3& origin, const glm::vec3& invDirection,
+    unsigned int first, unsigned int count, float maxDistance, float* distances)
+{
+    unsigned int mask = 0;
+    for (unsigned int lane = 0; lane < BoxBlocks::BlockSize; ++lane)
+    {
+        unsigned int i = first + lane;
+        glm::vec3 distancesA = (glm::vec3(streams.boundsMin[0][i], streams.boundsMin[1][i], streams.boundsMin[2][i]) - origin) * invDirection;
+        glm::vec3 distancesB = (glm::vec3(streams.boundsMax[0][i], streams.boundsMax[1][i], streams.boundsMax[2][i]) - origin) * invDirection;
+        glm::vec3 distancesMin = glm::min(distancesA, distancesB);
+        glm::vec3 distancesMax = glm::max(distancesA, distancesB);
+
+        float distanceMin = std::max(std::max(distancesMin.x, distancesMin.y), std::max(distancesMin.z, 0.0f));
+        float distanceMax = std::min(std::min(distancesMax.x, distancesMax.y), std::min(distancesMax.z, maxDistance));
+
+        distances[lane] = distanceMin;
+        if (lane < count && distanceMin <= distanceMax)
+        {
+            mask |= 1u << lane;
+        }
+    }
+    return mask;
+}
+
+#ifdef ITUGL_SIMD_X86
+
+ITUGL_TARGET("sse4.2")
+static unsigned int IntersectBoxesSSE42(const BoxStreams& streams, const glm::vec3& origin, const glm::vec3& invDirection,
+    unsigned int first, unsigned int count, float maxDistance, float* distances)
+{
+    const __m128 originX = _mm_set1_ps(origin.x);
+    const __m128 originY = _mm_set1_ps(origin.y);
+    const __m128 originZ = _mm_set1_ps(origin.z);
+    const __m128 invDirectionX = _mm_set1_ps(invDirection.x);
+    const __m128 invDirectionY = _mm_set1_ps(invDirection.y);
+    const __m128 invDirectionZ = _mm_set1_ps(invDirection.z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 maxDistances = _mm_set1_ps(maxDistance);
+
+    // Two halves of 4 boxes
+    unsigned int mask = 0;
+    for (unsigned int offset = 0; offset < BoxBlocks::BlockSize; offset += 4)
+    {
+        unsigned int i = first + offset;
+        __m128 ax = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(streams.boundsMin[0] + i), originX), invDirectionX);
+        __m128 ay = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(streams.boundsMin[1] + i), originY), invDirectionY);
+        __m128 az = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(streams.boundsMin[2] + i), originZ), invDirectionZ);
+        __m128 bx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(streams.boundsMax[0] + i), originX), invDirectionX);
+        __m128 by = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(streams.boundsMax[1] + i), originY), invDirectionY);
+        __m128 bz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(streams.boundsMax[2] + i), originZ), invDirectionZ);
+
+        __m128 distanceMin = _mm_max_ps(_mm_max_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_max_ps(_mm_min_ps(az, bz), zero));
+        __m128 distanceMax = _mm_min_ps(_mm_min_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_min_ps(_mm_max_ps(az, bz), maxDistances));
+
+        _mm_storeu_ps(distances + offset, distanceMin);
+        mask |= static_cast<unsigned int>(_mm_movemask_ps(_mm_cmple_ps(distanceMin, distanceMax))) << offset;
+    }
+    return mask & ((1u << count) - 1u);
+}
+
+ITUGL_TARGET("avx2")
+static unsigned int IntersectBoxesAVX2(const BoxStreams& streams, const glm::vec3& origin, const glm::vec3& invDirection,
+    unsigned int first, unsigned int count, float maxDistance, float* distances)
+{
+    const __m256 originX = _mm256_set1_ps(origin.x);
+    const __m256 originY = _mm256_set1_ps(origin.y);
+    const __m256 originZ = _mm256_set1_ps(origin.z);
+    const __m256 invDirectionX = _mm256_set1_ps(invDirection.x);
+    const __m256 invDirectionY = _mm256_set1_ps(invDirection.y);
+    const __m256 invDirectionZ = _mm256_set1_ps(invDirection.z);
+
+    __m256 ax = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(streams.boundsMin[0] + first), originX), invDirectionX);
+    __m256 ay = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(streams.boundsMin[1] + first), originY), invDirectionY);
+    __m256 az = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(streams.boundsMin[2] + first), originZ), invDirectionZ);
+    __m256 bx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(streams.boundsMax[0] + first), originX), invDirectionX);
+    __m256 by = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(streams.boundsMax[1] + first), originY), invDirectionY);
+    __m256 bz = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(streams.boundsMax[2] + first), originZ), invDirectionZ);
+
+    __m256 distanceMin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(ax, bx), _mm256_min_ps(ay, by)), _mm256_max_ps(_mm256_min_ps(az, bz), _mm256_setzero_ps()));
+    __m256 distanceMax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(ax, bx), _mm256_max_ps(ay, by)), _mm256_min_ps(_mm256_max_ps(az, bz), _mm256_set1_ps(maxDistance)));
+
+    _mm256_storeu_ps(distances, distanceMin);
+    unsigned int mask = static_cast<unsigned int>(_mm256_movemask_ps(_mm256_cmp_ps(distanceMin, distanceMax, _CMP_LE_OQ)));
+    return mask & ((1u << count) - 1u);
+}
+
+#endif // ITUGL_SIMD_X86
+
+BoxBlocks::BoxBlocks() : m_stride(0), m_boxCount(0), m_simdLevel(GetSupportedSimdLevel())
+{
+}
+
+void BoxBlocks::Build(std::span<const BoundingBox> boxes)
+{
+    m_boxCount = static_cast<unsigned int>(boxes.size());
+
+    // Round up to whole blocks, and add one more so a block can start at the last box
+    m_stride = (m_boxCount + BlockSize - 1) / BlockSize * BlockSize + BlockSize;
+    m_data.assign(StreamCount * m_stride, 0.0f);
+
+    for (unsigned int i = 0; i < m_boxCount; ++i)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_data[(MinX + axis) * m_stride + i] = boxes[i].boundsMin[axis];
+            m_data[(MaxX + axis) * m_stride + i] = boxes[i].boundsMax[axis];
+        }
+    }
+}
+
+void BoxBlocks::SetSimdLevel(SimdLevel simdLevel)
+{
+    m_simdLevel = std::min(simdLevel, GetSupportedSimdLevel());
+}
+
+unsigned int BoxBlocks::Intersect(const glm::vec3& origin, const glm::vec3& invDirection, unsigned int first, float maxDistance,
+    float distances[BlockSize]) const
+{
+    assert(first < m_boxCount);
+
+    BoxStreams streams = {
+        { GetStream(MinX), GetStream(MinY), GetStream(MinZ) },
+        { GetStream(MaxX), GetStream(MaxY), GetStream(MaxZ) },
+    };
+    unsigned int count = std::min(BlockSize, m_boxCount - first);
+
+#ifdef ITUGL_SIMD_X86
+    if (m_simdLevel == SimdLevel::AVX2)
+        return IntersectBoxesAVX2(streams, origin, invDirection, first, count, maxDistance, distances);
+    if (m_simdLevel == SimdLevel::SSE42)
+        return IntersectBoxesSSE42(streams, origin, invDirection, first, count, maxDistance, distances);
+#endif
+    return IntersectBoxesScalar(streams, origin, invDirection, first, count, maxDistance, distances);
+}
+
+// Ray of the benchmark, with the range of primitives it is tested against
+struct BenchmarkRay
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+    unsigned int first;
+};
+
+// Run the test for every ray, and return the number of tests per second. Each call returns the primitive hit, or -1
+static double MeasureThroughput(const std::vector<BenchmarkRay>& rays, unsigned int testsPerRay, std::vector<int>& results,
+    const std::function<int(const BenchmarkRay&)>& test)
+{
+    results.resize(rays.size());
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        results[i] = test(rays[i]);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds > 0.0 ? rays.size() * static_cast<double>(testsPerRay) / seconds : 0.0;
+}
+
+// Returns the number of results that differ from the reference
+static size_t PrintResult(const char* name, double throughput, double referenceThroughput, const std::vector<int>& results, const std::vector<int>& referenceResults)
+{
+    size_t mismatches = 0;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        mismatches += results[i] != referenceResults[i];
+    }
+
+    std::cout << "  " << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(1)
+        << std::setw(8) << throughput / 1e6 << " M/s  " << std::setprecision(2) << throughput / referenceThroughput << "x";
+    if (mismatches > 0)
+    {
+        std::cout << "  (" << mismatches << " different hits)";
+    }
+    std::cout << std::endl;
+    return mismatches;
+}
+
+// Closest hit as one number: the triangle for meshes, and past the triangles the sorted instance for analytic primitives,
+// as their hits don't set the triangle
+static int GetHitId(const AccelerationStructure& accelerationStructure, const RayHit& hit)
+{
+    const AccelerationInstance& instance = accelerationStructure.GetInstances()[hit.instanceIndex];
+    return static_cast<PrimitiveType>(instance.primitiveType) == PrimitiveType::Mesh ? static_cast<int>(hit.triangleIndex)
+        : static_cast<int>(accelerationStructure.GetTriangles().size() + hit.instanceIndex);
+}
+
+// Primary rays of a square image, like in raytracing.frag, in packets of 8x8 pixels like the CPU path tracer
+// The size is rounded down to whole packets
+static std::vector<RayPacket> CreatePrimaryRays(const Camera& camera, unsigned int& imageSize)
+{
+    const unsigned int packetSide = 8;
+    imageSize = std::max(packetSide, imageSize / packetSide * packetSide);
+
+    glm::mat4 invViewMatrix = glm::inverse(camera.GetViewMatrix());
+    glm::mat4 invProjMatrix = glm::inverse(camera.GetProjectionMatrix());
+    std::vector<RayPacket> packets;
+    for (unsigned int blockY = 0; blockY < imageSize; blockY += packetSide)
+    {
+        for (unsigned int blockX = 0; blockX < imageSize; blockX += packetSide)
+        {
+            RayPacket& packet = packets.emplace_back();
+            packet.size = 0;
+            for (unsigned int y = blockY; y < blockY + packetSide; ++y)
+            {
+                for (unsigned int x = blockX; x < blockX + packetSide; ++x, ++packet.size)
+                {
+                    glm::vec2 texCoord((x + 0.5f) / imageSize, (y + 0.5f) / imageSize);
+                    glm::vec4 viewPos = invProjMatrix * glm::vec4(texCoord * 2.0f - 1.0f, 0.0f, 1.0f);
+                    glm::vec3 origin = glm::vec3(viewPos) / viewPos.w;
+                    packet.origins[packet.size] = invViewMatrix * glm::vec4(origin, 1.0f);
+                    packet.directions[packet.size] = invViewMatrix * glm::vec4(glm::normalize(origin), 0.0f);
+                }
+            }
+        }
+    }
+    return packets;
+}
+
+// Trace the packets, or each of their rays on its own. Results are the hit of each ray, as in GetHitId, or -1. Returns the rays per second
+static double TracePrimaryRays(const AccelerationStructure& accelerationStructure, const std::vector<RayPacket>& packets, bool usePackets,
+    std::vector<int>& results)
+{
+    results.clear();
+    auto start = std::chrono::steady_clock::now();
+    for (const RayPacket& packet : packets)
+    {
+        RayHit hits[RayPacket::MaxSize];
+        for (unsigned int i = 0; i < packet.size; ++i)
+        {
+            hits[i].distance = std::numeric_limits<float>::infinity();
+        }
+
+        std::uint64_t found = 0;
+        if (usePackets)
+        {
+            found = accelerationStructure.Intersect(packet, hits);
+        }
+        else
+        {
+            for (unsigned int i = 0; i < packet.size; ++i)
+            {
+                found |= static_cast<std::uint64_t>(accelerationStructure.Intersect(packet.origins[i], packet.directions[i], hits[i])) << i;
+            }
+        }
+
+        for (unsigned int i = 0; i < packet.size; ++i)
+        {
+            results.push_back((found >> i) & 1 ? GetHitId(accelerationStructure, hits[i]) : -1);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds > 0.0 ? results.size() / seconds : 0.0;
+}
+
+// Compare single rays and packets with the primary rays of the camera. Returns the number of rays with different hits
+static size_t MeasurePrimaryRays(const char* name, const AccelerationStructure& accelerationStructure, const Camera& camera, unsigned int imageSize)
+{
+    std::vector<RayPacket> packets = CreatePrimaryRays(camera, imageSize);
+
+    std::cout << "Primary rays, " << name << " with " << accelerationStructure.GetTriangles().size() << " triangles, "
+        << imageSize << "x" << imageSize << " in packets of 8x8:" << std::endl;
+
+    std::vector<int> referenceResults, results;
+    double referenceThroughput = TracePrimaryRays(accelerationStructure, packets, false, referenceResults);
+    PrintResult("Single", referenceThroughput, referenceThroughput, referenceResults, referenceResults);
+    double packetThroughput = TracePrimaryRays(accelerationStructure, packets, true, results);
+    return PrintResult("Packets", packetThroughput, referenceThroughput, results, referenceResults);
+}
+
+// Compare the build modes of the hierarchies, on one thread and with the pool: build time, SAH cost, and primary rays traced per second
+// Building with the pool must give the same hierarchy as on one thread. Returns the number of build modes where it doesn't
+static size_t MeasureBuild(const char* name, const Mesh& mesh, const Camera& camera, ThreadPool& threadPool, unsigned int imageSize)
+{
+    std::vector<RayPacket> packets = CreatePrimaryRays(camera, imageSize);
+
+    size_t mismatches = 0;
+    std::cout << "Build, " << name << " with " << mesh.GetTriangleData().size() << " triangles, "
+        << imageSize << "x" << imageSize << " primary rays:" << std::endl;
+
+    for (BVH::BuildMode buildMode : { BVH::BuildMode::SAH, BVH::BuildMode::Morton })
+    {
+        std::vector<BVHNode> referenceNodes;
+        for (ThreadPool* buildThreadPool : { static_cast<ThreadPool*>(nullptr), &threadPool })
+        {
+            // Best of a few builds, as they are short
+            BVH bvh;
+            bvh.SetBuildMode(buildMode);
+            bvh.SetThreadPool(buildThreadPool);
+            double buildTime = std::numeric_limits<double>::max();
+            for (int i = 0; i < 3; ++i)
+            {
+                auto start = std::chrono::steady_clock::now();
+                bvh.Build(mesh.GetTriangleVertices(), mesh.GetTriangleData());
+                buildTime = std::min(buildTime, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+
+            unsigned int threadCount = buildThreadPool ? buildThreadPool->GetThreadCount() : 1;
+            std::cout << "  " << std::left << std::setw(8) << (buildMode == BVH::BuildMode::SAH ? "SAH" : "Morton")
+                << std::right << std::setw(3) << threadCount << (threadCount == 1 ? " thread " : " threads")
+                << std::fixed << std::setprecision(1) << std::setw(9) << buildTime * 1000.0 << " ms";
+
+            if (!buildThreadPool)
+            {
+                referenceNodes = bvh.GetNodes();
+
+                AccelerationStructure accelerationStructure;
+                accelerationStructure.SetBuildMode(buildMode);
+                accelerationStructure.AddInstance(mesh, glm::translate(glm::vec3(0.0f, 2.3f, -5.0f)) * glm::scale(glm::vec3(2.0f)), 0);
+                accelerationStructure.Build();
+                std::vector<int> results;
+                double throughput = TracePrimaryRays(accelerationStructure, packets, false, results);
+                std::cout << "   cost " << std::setw(6) << bvh.GetCost() << std::setw(8) << throughput / 1e6 << " Mrays/s" << std::endl;
+            }
+            else
+            {
+                const std::vector<BVHNode>& nodes = bvh.GetNodes();
+                bool sameNodes = nodes.size() == referenceNodes.size() && std::equal(nodes.begin(), nodes.end(), referenceNodes.begin(),
+                    [](const BVHNode& a, const BVHNode& b)
+                    {
+                        return a.boundsMin == b.boundsMin && a.boundsMax == b.boundsMax && a.childOrFirst == b.childOrFirst && a.primitiveCount == b.primitiveCount;
+                    });
+                std::cout << (sameNodes ? "   same hierarchy" : "   DIFFERENT HIERARCHY") << std::endl;
+                mismatches += !sameNodes;
+            }
+        }
+    }
+    return mismatches;
+}
+
+// Unit sphere with the given number of segments around and half of them from pole to pole
+static void CreateSphereMesh(Mesh& mesh, unsigned int segmentCount)
+{
+    unsigned int ringCount = segmentCount / 2;
+    std::vector<TriangleVertex> vertices;
+    for (unsigned int ring = 0; ring <= ringCount; ++ring)
+    {
+        float theta = 3.14159265359f * ring / ringCount;
+        for (unsigned int segment = 0; segment <= segmentCount; ++segment)
+        {
+            float phi = 6.28318530718f * segment / segmentCount;
+            glm::vec3 position(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            vertices.push_back(TriangleVertex{ position, position, glm::vec2(static_cast<float>(segment) / segmentCount, static_cast<float>(ring) / ringCount) });
+        }
+    }
+
+    std::vector<Triangle> triangles;
+    for (unsigned int ring = 0; ring < ringCount; ++ring)
+    {
+        for (unsigned int segment = 0; segment < segmentCount; ++segment)
+        {
+            unsigned int i = ring * (segmentCount + 1) + segment;
+            triangles.push_back(Triangle{ glm::uvec3(i, i + 1, i + segmentCount + 1), 0, 0 });
+            triangles.push_back(Triangle{ glm::uvec3(i + 1, i + segmentCount + 2, i + segmentCount + 1), 0, 0 });
+        }
+    }
+
+    mesh.SetTriangleVertices(vertices);
+    mesh.SetTriangleData(triangles);
+}
+
+// Instance of the refit check, a mesh or an analytic primitive
+struct RefitInstance
+{
+    PrimitiveType type;
+    glm::mat4 transform;
+};
+
+static void AddRefitInstances(AccelerationStructure& accelerationStructure, const Mesh& mesh, const std::vector<RefitInstance>& instances)
+{
+    for (const RefitInstance& instance : instances)
+    {
+        if (instance.type == PrimitiveType::Mesh)
+        {
+            accelerationStructure.AddInstance(mesh, instance.transform, 0);
+        }
+        else
+        {
+            accelerationStructure.AddPrimitive(instance.type, instance.transform, 0);
+        }
+    }
+}
+
+// Number of rays whose closest hit is not the same instance, triangle for meshes, and distance in both structures
+// The instances are compared by the index they were added with, as each structure sorts them in its own order
+static size_t CountDifferentHits(const AccelerationStructure& accelerationStructure, const AccelerationStructure& referenceStructure,
+    const std::vector<BenchmarkRay>& rays)
+{
+    size_t mismatches = 0;
+    for (const BenchmarkRay& ray : rays)
+    {
+        RayHit hit{}, referenceHit{};
+        hit.distance = referenceHit.distance = std::numeric_limits<float>::infinity();
+        bool found = accelerationStructure.Intersect(ray.origin, ray.direction, hit);
+        bool referenceFound = referenceStructure.Intersect(ray.origin, ray.direction, referenceHit);
+        if (found != referenceFound)
+        {
+            ++mismatches;
+        }
+        else if (found)
+        {
+            const AccelerationInstance& instance = accelerationStructure.GetInstances()[hit.instanceIndex];
+            const AccelerationInstance& referenceInstance = referenceStructure.GetInstances()[referenceHit.instanceIndex];
+            bool isMesh = static_cast<PrimitiveType>(instance.primitiveType) == PrimitiveType::Mesh;
+            mismatches += hit.distance != referenceHit.distance || instance.instanceId != referenceInstance.instanceId
+                || (isMesh && hit.triangleIndex != referenceHit.triangleIndex);
+        }
+    }
+    return mismatches;
+}
+
+// Move some instances of a grid of meshes, spheres and boxes, and compare Update with building the structure again
+// Small moves are expected to be refitted, and large ones to make the cost grow past the rebuild threshold
+// Either way, Update must find the same hits as a new build. Returns the number of rays with different hits
+static size_t MeasureRefit(const Mesh& mesh, unsigned int rayCount)
+{
+    const unsigned int gridSize = 8;
+    const float spacing = 2.0f;
+    std::vector<RefitInstance> instances;
+    for (unsigned int z = 0; z < gridSize / 2; ++z)
+    {
+        for (unsigned int y = 0; y < gridSize; ++y)
+        {
+            for (unsigned int x = 0; x < gridSize; ++x)
+            {
+                PrimitiveType type = static_cast<PrimitiveType>(instances.size() % 3);
+                instances.push_back(RefitInstance{ type, glm::translate(spacing * glm::vec3(x, y, z)) * glm::scale(glm::vec3(0.6f)) });
+            }
+        }
+    }
+
+    AccelerationStructure accelerationStructure;
+    AddRefitInstances(accelerationStructure, mesh, instances);
+    accelerationStructure.Build();
+
+    // Random rays inside the grid, always the same ones
+    BoundingBox bounds = accelerationStructure.GetBounds();
+    std::mt19937 generator(5678);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    auto randomPoint = [&]() { return bounds.boundsMin + bounds.GetSize() * glm::vec3(uniform(generator), uniform(generator), uniform(generator)); };
+    std::vector<BenchmarkRay> rays(rayCount);
+    for (BenchmarkRay& ray : rays)
+    {
+        ray.origin = randomPoint();
+        ray.direction = glm::normalize(randomPoint() - ray.origin);
+    }
+
+    unsigned int topLevelNodeCount = 2 * accelerationStructure.GetInstanceCount() - 1;
+    std::cout << "Refit, " << instances.size() << " instances of meshes, spheres and boxes:" << std::endl;
+
+    // Small moves stay close to the cell of the instance, large ones go anywhere in the grid. Each case starts where the previous one ended
+    struct RefitCase
+    {
+        const char* name;
+        unsigned int firstInstance;
+        unsigned int instanceStride;
+        bool largeMoves;
+    };
+    unsigned int instanceCount = static_cast<unsigned int>(instances.size());
+    size_t totalMismatches = 0;
+    for (const RefitCase& refitCase : { RefitCase{ "1 small", instanceCount / 2, instanceCount, false },
+        RefitCase{ "1/4 small", 0, 4, false }, RefitCase{ "1/4 large", 0, 4, true } })
+    {
+        for (unsigned int instanceIndex = refitCase.firstInstance; instanceIndex < instanceCount; instanceIndex += refitCase.instanceStride)
+        {
+            glm::mat4& transform = instances[instanceIndex].transform;
+            glm::vec3 offset = 0.25f * spacing * (glm::vec3(uniform(generator), uniform(generator), uniform(generator)) - 0.5f);
+            glm::vec3 position = refitCase.largeMoves ? randomPoint() : glm::vec3(transform[3]) + offset;
+            transform[3] = glm::vec4(position, 1.0f);
+            accelerationStructure.SetInstanceTransform(instanceIndex, transform);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        accelerationStructure.Update();
+        double updateTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        AccelerationStructure referenceStructure;
+        AddRefitInstances(referenceStructure, mesh, instances);
+        start = std::chrono::steady_clock::now();
+        referenceStructure.Build();
+        double buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Uploaded with one call per run
+        const std::vector<BVH::Range>& nodeRuns = accelerationStructure.GetUpdatedNodes();
+        const std::vector<BVH::Range>& instanceRuns = accelerationStructure.GetUpdatedInstances();
+        unsigned int nodeCount = 0, updatedInstanceCount = 0;
+        for (const BVH::Range& range : nodeRuns)
+        {
+            nodeCount += range.count;
+        }
+        for (const BVH::Range& range : instanceRuns)
+        {
+            updatedInstanceCount += range.count;
+        }
+        size_t mismatches = CountDifferentHits(accelerationStructure, referenceStructure, rays);
+
+        std::cout << "  " << std::left << std::setw(10) << refitCase.name << std::right
+            << (accelerationStructure.IsTopLevelRebuilt() ? " rebuilt" : " refit  ") << std::fixed << std::setprecision(3)
+            << std::setw(8) << updateTime * 1000.0 << " ms, build " << std::setw(6) << buildTime * 1000.0 << " ms"
+            << std::setprecision(2) << "  cost " << accelerationStructure.GetTopLevelCost() / referenceStructure.GetTopLevelCost() << "x of a build"
+            << "  uploaded " << nodeCount << "/" << topLevelNodeCount << " nodes in " << nodeRuns.size() << " runs, "
+            << updatedInstanceCount << "/" << instanceCount << " instances in " << instanceRuns.size() << " runs";
+        if (mismatches > 0)
+        {
+            std::cout << "  (" << mismatches << " different hits)";
+        }
+        std::cout << std::endl;
+        totalMismatches += mismatches;
+    }
+    return totalMismatches;
+}
+
+bool RunIntersectionBenchmark(AccelerationStructure& accelerationStructure, const Camera& camera, ThreadPool& threadPool, unsigned int rayCount)
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    std::vector<SimdLevel> simdLevels = { SimdLevel::Scalar };
+    if (GetSupportedSimdLevel() >= SimdLevel::SSE42) simdLevels.push_back(SimdLevel::SSE42);
+    if (GetSupportedSimdLevel() >= SimdLevel::AVX2) simdLevels.push_back(SimdLevel::AVX2);
+
+    std::cout << rayCount << " rays, supported: " << GetSimdLevelName(GetSupportedSimdLevel()) << std::endl;
+
+    // Random rays inside the scene, always the same ones
+    BoundingBox bounds = accelerationStructure.GetBounds();
+    std::mt19937 generator(1234);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    auto randomPoint = [&]() { return bounds.boundsMin + bounds.GetSize() * glm::vec3(uniform(generator), uniform(generator), uniform(generator)); };
+    std::vector<BenchmarkRay> rays(rayCount);
+    for (BenchmarkRay& ray : rays)
+    {
+        ray.origin = randomPoint();
+        float z = 2.0f * uniform(generator) - 1.0f;
+        float phi = 6.28318530718f * uniform(generator);
+        float r = std::sqrt(1.0f - z * z);
+        ray.direction = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+    }
+
+    // The kernels are measured with random primitives, so there are enough of them to not all fit in the cache
+    const unsigned int primitiveCount = 1 << 16;
+    const glm::vec3 primitiveSize = 0.05f * bounds.GetSize();
+
+    std::vector<glm::vec3> positions(3 * primitiveCount);
+    std::vector<Triangle> triangles(primitiveCount);
+    for (unsigned int i = 0; i < primitiveCount; ++i)
+    {
+        glm::vec3 center = randomPoint();
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            positions[3 * i + j] = center + primitiveSize * glm::vec3(uniform(generator), uniform(generator), uniform(generator));
+        }
+        triangles[i].indices = glm::uvec3(3 * i, 3 * i + 1, 3 * i + 2);
+    }
+
+    std::vector<BVHNode> nodes(primitiveCount);
+    std::vector<BoundingBox> boxes(primitiveCount);
+    for (unsigned int i = 0; i < primitiveCount; ++i)
+    {
+        glm::vec3 corner = randomPoint();
+        boxes[i] = BoundingBox(corner, corner + primitiveSize);
+        nodes[i].boundsMin = boxes[i].boundsMin;
+        nodes[i].boundsMax = boxes[i].boundsMax;
+    }
+
+    std::vector<int> referenceResults, results;
+    size_t mismatches = 0;
+
+    // Triangles, in ranges like the leaves of the hierarchies and in longer ranges that fill all the lanes
+    TriangleBlocks triangleBlocks;
+    triangleBlocks.Build(positions, triangles);
+    for (unsigned int rangeSize : { 4u, 64u })
+    {
+        for (BenchmarkRay& ray : rays)
+        {
+            ray.first = static_cast<unsigned int>(uniform(generator) * (triangles.size() - rangeSize));
+        }
+
+        std::cout << "Ray-triangle, " << rangeSize << " consecutive triangles per ray:" << std::endl;
+
+        // Port of RayTriangleIntersection, reading the vertices through the indices like the shader
+        double referenceThroughput = MeasureThroughput(rays, rangeSize, referenceResults, [&](const BenchmarkRay& ray)
+            {
+                float distance = infinity;
+                int hitIndex = -1;
+                for (unsigned int i = ray.first; i < ray.first + rangeSize; ++i)
+                {
+                    const glm::uvec3& indices = triangles[i].indices;
+                    const glm::vec3& v0 = positions[indices.x];
+                    float t, u, v;
+                    if (AccelerationStructure::IntersectTriangle(ray.origin, ray.direction, v0, positions[indices.y] - v0, positions[indices.z] - v0, t, u, v)
+                        && t < distance)
+                    {
+                        distance = t;
+                        hitIndex = static_cast<int>(i);
+                    }
+                }
+                return hitIndex;
+            });
+        PrintResult("Reference", referenceThroughput, referenceThroughput, referenceResults, referenceResults);
+
+        for (SimdLevel simdLevel : simdLevels)
+        {
+            triangleBlocks.SetSimdLevel(simdLevel);
+            double throughput = MeasureThroughput(rays, rangeSize, results, [&](const BenchmarkRay& ray)
+                {
+                    float distance = infinity, u, v;
+                    unsigned int hitIndex;
+                    return triangleBlocks.Intersect(ray.origin, ray.direction, ray.first, rangeSize, distance, hitIndex, u, v) ? static_cast<int>(hitIndex) : -1;
+                });
+            mismatches += PrintResult(GetSimdLevelName(simdLevel), throughput, referenceThroughput, results, referenceResults);
+        }
+    }
+
+    // Boxes, a block at a time
+    BoxBlocks boxBlocks;
+    boxBlocks.Build(boxes);
+    {
+        for (BenchmarkRay& ray : rays)
+        {
+            ray.first = static_cast<unsigned int>(uniform(generator) * (boxes.size() - BoxBlocks::BlockSize));
+        }
+
+        std::cout << "Ray-box, " << BoxBlocks::BlockSize << " consecutive nodes per ray:" << std::endl;
+
+        // Port of RayNodeIntersection. Results are the mask of boxes hit
+        double referenceThroughput = MeasureThroughput(rays, BoxBlocks::BlockSize, referenceResults, [&](const BenchmarkRay& ray)
+            {
+                glm::vec3 invDirection = 1.0f / ray.direction;
+                int mask = 0;
+                for (unsigned int lane = 0; lane < BoxBlocks::BlockSize; ++lane)
+                {
+                    if (AccelerationStructure::IntersectNode(nodes[ray.first + lane], ray.origin, invDirection, infinity) != infinity)
+                    {
+                        mask |= 1 << lane;
+                    }
+                }
+                return mask;
+            });
+        PrintResult("Reference", referenceThroughput, referenceThroughput, referenceResults, referenceResults);
+
+        for (SimdLevel simdLevel : simdLevels)
+        {
+            boxBlocks.SetSimdLevel(simdLevel);
+            double throughput = MeasureThroughput(rays, BoxBlocks::BlockSize, results, [&](const BenchmarkRay& ray)
+                {
+                    float distances[BoxBlocks::BlockSize];
+                    return static_cast<int>(boxBlocks.Intersect(ray.origin, 1.0f / ray.direction, ray.first, infinity, distances));
+                });
+            mismatches += PrintResult(GetSimdLevelName(simdLevel), throughput, referenceThroughput, results, referenceResults);
+        }
+    }
+
+    // Complete closest hit queries in the scene, with the kernels used in the leaves
+    std::cout << "Closest hit in the scene, " << accelerationStructure.GetTriangles().size() << " triangles:" << std::endl;
+    SimdLevel previousLevel = accelerationStructure.GetSimdLevel();
+    double referenceThroughput = 0.0;
+    for (SimdLevel simdLevel : simdLevels)
+    {
+        accelerationStructure.SetSimdLevel(simdLevel);
+        double throughput = MeasureThroughput(rays, 1, results, [&](const BenchmarkRay& ray)
+            {
+                RayHit hit;
+                hit.distance = infinity;
+                return accelerationStructure.Intersect(ray.origin, ray.direction, hit) ? GetHitId(accelerationStructure, hit) : -1;
+            });
+        if (simdLevel == SimdLevel::Scalar)
+        {
+            referenceThroughput = throughput;
+            referenceResults = results;
+        }
+        mismatches += PrintResult(GetSimdLevelName(simdLevel), throughput, referenceThroughput, results, referenceResults);
+    }
+    accelerationStructure.SetSimdLevel(previousLevel);
+
+    // Visibility queries, like the shadow rays: the closest hit query against the any hit query
+    std::cout << "Occlusion in the scene:" << std::endl;
+    referenceThroughput = MeasureThroughput(rays, 1, referenceResults, [&](const BenchmarkRay& ray)
+        {
+            RayHit hit;
+            hit.distance = infinity;
+            return accelerationStructure.Intersect(ray.origin, ray.direction, hit) ? 1 : 0;
+        });
+    PrintResult("Closest", referenceThroughput, referenceThroughput, referenceResults, referenceResults);
+    double throughput = MeasureThroughput(rays, 1, results, [&](const BenchmarkRay& ray)
+        {
+            return accelerationStructure.Occluded(ray.origin, ray.direction, infinity) ? 1 : 0;
+        });
+    mismatches += PrintResult("Any", throughput, referenceThroughput, results, referenceResults);
+
+    // Primary rays, with the scene and with a mesh that has many more triangles, like a scanned model
+    unsigned int imageSize = std::max(8u, static_cast<unsigned int>(std::sqrt(static_cast<float>(rayCount))));
+    mismatches += MeasurePrimaryRays("scene", accelerationStructure, camera, imageSize);
+
+    Mesh sphereMesh;
+    CreateSphereMesh(sphereMesh, 256);
+    AccelerationStructure sphereStructure;
+    sphereStructure.AddInstance(sphereMesh, glm::translate(glm::vec3(0.0f, 2.3f, -5.0f)) * glm::scale(glm::vec3(2.0f)), 0);
+    sphereStructure.Build();
+    mismatches += MeasurePrimaryRays("sphere", sphereStructure, camera, imageSize);
+
+    // Moving instances, with a small mesh
+    Mesh smallSphereMesh;
+    CreateSphereMesh(smallSphereMesh, 16);
+    mismatches += MeasureRefit(smallSphereMesh, rayCount);
+
+    // Build modes, with a mesh that is slow to build
+    Mesh bigSphereMesh;
+    CreateSphereMesh(bigSphereMesh, 512);
+    mismatches += MeasureBuild("sphere", bigSphereMesh, camera, threadPool, imageSize);
+
+    if (mismatches > 0)
+    {
+        std::cout << mismatches << " results differ from the reference" << std::endl;
+    }
+    return mismatches == 0;
+}
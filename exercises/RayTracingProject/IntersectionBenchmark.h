@@ -0,0 +1,12 @@
+#pragma once
+
+class AccelerationStructure;
+class Camera;
+class ThreadPool;
+
+// Measure the SIMD intersection kernels against the scalar port of the shader functions, with random rays over the scene
+// Prints the throughput of each level supported by the CPU, and checks that all of them find the same hits
+// Then compares single rays and packets with the primary rays of the camera, refitting moved instances with building them again,
+// and the build modes of the hierarchies
+// Returns false if any of them finds different hits, or builds a different hierarchy with the thread pool
+bool RunIntersectionBenchmark(AccelerationStructure& accelerationStructure, const Camera& camera, ThreadPool& threadPool, unsigned int rayCount);
@@ -7,50 +7,83 @@
 #include <ituGL/lighting/DirectionalLight.h>
 #include <ituGL/shader/Material.h>
 #include <ituGL/texture/Texture2DObject.h>
+#include <ituGL/texture/Texture2DArrayObject.h>
 #include <ituGL/texture/FramebufferObject.h>
 #include <ituGL/renderer/PostFXRenderPass.h>
+#include <ituGL/renderer/GBufferRenderPass.h>
+#include <ituGL/geometry/Model.h>
+#include "AccumulationRenderPass.h"
+#include "DenoiseRenderPass.h"
+#include "RadianceCache.h"
+#include "ReservoirRenderPass.h"
 #include <ituGL/scene/RendererSceneVisitor.h>
+#include <ituGL/utils/ThreadPool.h>
 #include <imgui.h>
 #include <iostream>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtx/euler_angles.hpp>
 
-#include "stb_image.h"
 #include "ituGL/asset/ModelLoader.h"
 #include "ituGL/geometry/ShaderStorageBufferObject.h"
 #include "ituGL/scene/SceneModel.h"
 
-MeshRaytracingApplication::MeshRaytracingApplication()
+MeshRaytracingApplication::MeshRaytracingApplication(const RaytracingOptions& options)
     : Application(1024, 1024, "Ray-tracing demo")
+    , m_accumulationPass(nullptr)
+    , m_options(options)
+    , m_viewProjMatrix(1.0f)
+    , m_samplingMaskFrame(1)
+    , m_reservoirPass(nullptr)
     , m_renderer(GetDevice())
-    , m_frameCount(0)
-    , m_sphereCenter(0, 4, 4)
-    , m_boxMatrix(glm::translate(glm::vec3(3, 0, 0)))
-    , m_meshMatrix(glm::translate(glm::vec3(0, 0, 0)))
+    , m_emissiveLightCount(0)
+    , m_radianceCacheEpoch(0)
 {
 }
 
-std::shared_ptr<Texture2DObject> MeshRaytracingApplication::LoadTexture(const char* path)
+template<typename T>
+void MeshRaytracingApplication::SetRaytracingUniformValue(const char* name, const T& value)
 {
-    std::shared_ptr<Texture2DObject> texture = std::make_shared<Texture2DObject>();
-
-    int width = 0;
-    int height = 0;
-    int components = 0;
+    m_material->SetUniformValue(name, value);
+    if (m_reservoirMaterial)
+    {
+        m_reservoirMaterial->SetUniformValue(name, value);
+    }
+}
 
-    // Load the texture data here
-    unsigned char* data = stbi_load(path, &width, &height, &components, 4);
-    stbi_set_flip_vertically_on_load(true);
+std::shared_ptr<Texture2DObject> MeshRaytracingApplication::CreateBlueNoiseTexture(const Sampler& sampler)
+{
+    // Ranks in a 16-bit texture, scaled to its range. The shaders read them with texelFetch
+    std::vector<std::uint16_t> data(sampler.GetBlueNoise().size());
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<std::uint16_t>(sampler.GetBlueNoise()[i] << 4);
+    }
 
+    std::shared_ptr<Texture2DObject> texture = std::make_shared<Texture2DObject>();
     texture->Bind();
-    texture->SetImage(0, width, height, TextureObject::FormatRGBA, TextureObject::InternalFormatRGBA, std::span<const unsigned char>(data, width * height * 4));
-
-    // Generate mipmaps
-    texture->GenerateMipmap();
+    texture->SetImage(0, Sampler::BlueNoiseSize, Sampler::BlueNoiseSize, TextureObject::FormatR, TextureObject::InternalFormatR16, std::span<const std::uint16_t>(data));
+    texture->SetParameter(TextureObject::ParameterEnum::MinFilter, GL_NEAREST);
+    texture->SetParameter(TextureObject::ParameterEnum::MagFilter, GL_NEAREST);
+    Texture2DObject::Unbind();
+    return texture;
+}
 
-    // Release texture data
-    stbi_image_free(data);
+std::shared_ptr<Texture2DArrayObject> MeshRaytracingApplication::CreateTextureArray(const TextureLayers& layers)
+{
+    std::shared_ptr<Texture2DArrayObject> texture = std::make_shared<Texture2DArrayObject>();
+    texture->Bind();
 
+    // Full mip chain of each layer, built by the scene so the CPU path tracer reads the same texels
+    for (unsigned int level = 0; level < layers.levels.size(); ++level)
+    {
+        texture->SetImage(level, layers.GetLevelWidth(level), layers.GetLevelHeight(level), layers.layerCount,
+            TextureObject::FormatRGBA, TextureObject::InternalFormatRGBA, std::span<const unsigned char>(layers.levels[level]));
+    }
+    texture->SetParameter(TextureObject::ParameterEnum::WrapS, GL_CLAMP_TO_EDGE);
+    texture->SetParameter(TextureObject::ParameterEnum::WrapT, GL_CLAMP_TO_EDGE);
+    texture->SetParameter(TextureObject::ParameterEnum::MinFilter, GL_LINEAR_MIPMAP_LINEAR);
+    texture->SetParameter(TextureObject::ParameterEnum::MagFilter, GL_LINEAR);
+    Texture2DArrayObject::Unbind();
     return texture;
 }
 
@@ -67,7 +100,6 @@ void MeshRaytracingApplication::Initialize()
     InitializeRenderer();
     InitializeModels();
     InitializeSSBO();
-    //InitializeTextureArray();
 }
 
 void MeshRaytracingApplication::Update()
@@ -77,25 +109,39 @@ void MeshRaytracingApplication::Update()
     // Update camera controller
     m_cameraController.Update(GetMainWindow(), GetDeltaTime());
 
-    // Invalidate accumulation when moving the camera
-    if (m_cameraController.IsEnabled())
+    // Reproject the accumulation when the camera moved, keeping the samples of the surfaces still visible
+    const Camera& camera = *m_cameraController.GetCamera()->GetCamera();
+    glm::mat4 viewProjMatrix = camera.GetViewProjectionMatrix();
+    if (viewProjMatrix != m_viewProjMatrix)
     {
-        InvalidateScene();
+        m_accumulationPass->Reproject(m_viewProjMatrix);
+        m_viewProjMatrix = viewProjMatrix;
     }
 
+    // Apply the models moved since the last frame
+    if (m_options.animate)
+    {
+        m_raytracingScene.Animate(GetCurrentTime());
+    }
+    UpdateAccelerationStructure();
+
     // Set renderer camera
-    const Camera& camera = *m_cameraController.GetCamera()->GetCamera();
     m_renderer.SetCurrentCamera(camera);
 
-    // Update the material properties
+    // The rasterized meshes follow the transforms they are traced with
+    if (m_options.hybrid)
+    {
+        for (unsigned int modelIndex = 0; modelIndex < m_rasterModels.size(); ++modelIndex)
+        {
+            m_renderer.AddModel(*m_rasterModels[modelIndex], m_raytracingScene.GetModelTransform(modelIndex));
+        }
+    }
+
+    // Update the material properties. Rays are traced in world space, and all the inverse matrices are computed here once per frame
     glm::mat4 viewMatrix = camera.GetViewMatrix();
-    m_material->SetUniformValue("ViewMatrix", viewMatrix);
+    SetRaytracingUniformValue("InvViewMatrix", glm::inverse(viewMatrix));
     m_material->SetUniformValue("ProjMatrix", camera.GetProjectionMatrix());
-    m_material->SetUniformValue("InvProjMatrix", glm::inverse(camera.GetProjectionMatrix()));
-    m_material->SetUniformValue("SphereCenter", glm::vec3(viewMatrix * glm::vec4(m_sphereCenter, 1.0f)));
-    m_material->SetUniformValue("BoxMatrix", viewMatrix * m_boxMatrix);
-    m_material->SetUniformValue("MeshMatrix", viewMatrix * m_meshMatrix);
-    m_material->SetUniformValue("FrameCount", ++m_frameCount);
+    SetRaytracingUniformValue("InvProjMatrix", glm::inverse(camera.GetProjectionMatrix()));
 }
 
 void MeshRaytracingApplication::Render()
@@ -104,9 +150,31 @@ void MeshRaytracingApplication::Render()
 
     GetDevice().Clear(true, Color(0.0f, 0.0f, 0.0f, 1.0f), true, 1.0f);
 
+    // Start again after the scene was invalidated, or stop sampling the pixels that converged
+    unsigned int sampleCount = m_accumulationPass->GetSampleCount();
+    if (sampleCount == 0)
+    {
+        ResetSamplingMask();
+    }
+    else if (m_options.adaptiveTargetError > 0.0f && sampleCount >= MinSampleCount && sampleCount % SamplingMaskPeriod == 0 && !m_accumulationPass->IsComplete())
+    {
+        UpdateSamplingMask();
+    }
+
     // Render the scene
     m_renderer.Render();
 
+    // The cells written by the rays of this frame are read by the next one
+    if (m_options.radianceCache)
+    {
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    if (m_accumulationPass->IsComplete() && sampleCount < m_accumulationPass->GetSampleCount())
+    {
+        std::cout << m_accumulationPass->GetSampleCount() << " samples per pixel" << std::endl;
+    }
+
     // Render the debug user interface
     RenderGUI();
 }
@@ -121,16 +189,46 @@ void MeshRaytracingApplication::Cleanup()
 
 void MeshRaytracingApplication::InvalidateScene()
 {
-    m_frameCount = 0;
+    m_accumulationPass->Reset();
+
+    // The reservoirs have the lights of the old scene
+    if (m_reservoirPass)
+    {
+        m_reservoirPass->Reset();
+    }
+
+    // The radiance cache is not cleared, it starts a new epoch where the cells fade the radiance of the old scene
+    if (m_options.radianceCache)
+    {
+        m_material->SetUniformValue("RadianceCacheEpoch", ++m_radianceCacheEpoch);
+    }
+}
+
+void MeshRaytracingApplication::ResetSamplingMask()
+{
+    m_samplingMaskFramebuffer->Bind();
+    GetDevice().Clear(Color(0.0f, 0.0f, 0.0f, 0.0f));
+
+    m_samplingMaskFrame = 1;
+    m_material->SetUniformValue("SamplingMaskFrame", m_samplingMaskFrame);
+}
+
+void MeshRaytracingApplication::UpdateSamplingMask()
+{
+    // The sums include all the samples before the one of this frame
+    m_samplingMaskFramebuffer->Bind();
+    m_samplingMaskMaterial->Use();
+    m_renderer.GetFullscreenMesh().DrawSubmesh(0);
+
+    m_samplingMaskFrame = m_accumulationPass->GetSampleCount() + 1;
+    m_material->SetUniformValue("SamplingMaskFrame", m_samplingMaskFrame);
 }
 
 void MeshRaytracingApplication::InitializeCamera()
 {
     // Create the main camera
     std::shared_ptr<Camera> camera = std::make_shared<Camera>();
-    camera->SetViewMatrix(glm::vec3(0, 2.0f, 0), glm::vec3(0.0f, 2.3, -7), glm::vec3(0.0f, 1.0f, 0.0));
-    float fov = 1.57f;
-    camera->SetPerspectiveProjectionMatrix(fov, GetMainWindow().GetAspectRatio(), 0.1f, 100.0f);
+    RaytracingScene::InitializeCamera(*camera, GetMainWindow().GetAspectRatio());
 
     // Create a scene node for the camera
     std::shared_ptr<SceneCamera> sceneCamera = std::make_shared<SceneCamera>("camera", camera);
@@ -143,44 +241,38 @@ void MeshRaytracingApplication::InitializeMaterial()
 {
     m_material = CreateRaytracingMaterial("shaders/intersection_checks.glsl");
 
-    // Initialize material uniforms
-    m_material->SetUniformValue("SphereCenter", m_sphereCenter);
-    m_material->SetUniformValue("SphereRadius", 1.25f);
-    m_material->SetUniformValue("SphereColor", glm::vec3(1.f));
-    m_material->SetUniformValue("SphereRoughness", 0.f);
-    m_material->SetUniformValue("SphereMetalness", 1.f);
-
-    m_material->SetUniformValue("BoxMatrix", m_boxMatrix);
-    m_material->SetUniformValue("BoxSize", glm::vec3(1, 1, 1));
-    m_material->SetUniformValue("BoxColor", glm::vec3(1, 0, 0));
-    m_material->SetUniformValue("BoxRoughness", 1.f);
-    m_material->SetUniformValue("BoxMetalness", 0.5f);
-
-    m_material->SetUniformValue("MeshMatrix", m_meshMatrix);
-    m_material->SetUniformValue("MeshColor", glm::vec3(0, 1, 0));
-    m_material->SetUniformValue("MeshRoughness", 0.f);
-    m_material->SetUniformValue("MeshMetalness", 1.f);
+    // Same scene, camera and sampler uniforms as the ray tracing material
+    if (m_options.lightReservoirs)
+    {
+        m_reservoirMaterial = CreateRaytracingMaterial("shaders/intersection_checks.glsl", "shaders/reservoirs.frag");
+    }
 
-    m_material->SetUniformValue("LightColor", glm::vec3(1.0f));
-    m_material->SetUniformValue("LightIntensity", 4.0f);
-    m_material->SetUniformValue("LightSize", glm::vec2(3.0f));
+    m_raytracingScene.InitializeMaterials();
 
-    m_materials.emplace_back(0, glm::vec4(glm::vec4(1, 0, 0,0)), 0.5f,0.f,1.35f);
+    // Initialize material uniforms. The objects are in the primitive table of the acceleration structure, and the lights in their own buffer
+    SetRaytracingUniformValue("LightSize", glm::vec2(3.0f));
+    m_material->SetUniformValue("NextEventEstimation", m_options.nextEventEstimation ? 1u : 0u);
+    m_material->SetUniformValue("RadianceCaching", m_options.radianceCache ? 1u : 0u);
 
-    m_material->SetUniformValue("WallTexture", LoadTexture("models/Wall.jpg"));
-    m_materials.emplace_back(1, glm::vec4(1.f), 1.f);
+    // Sequence of random numbers, the same as the CPU path tracer
+    Sampler sampler;
+    SetRaytracingUniformValue("SamplerType", static_cast<unsigned int>(m_options.samplerType));
+    SetRaytracingUniformValue("BlueNoiseTexture", CreateBlueNoiseTexture(sampler));
 
-    m_material->SetUniformValue("FloorTexture", LoadTexture("models/Floor.jpg"));
-    m_materials.emplace_back(2, glm::vec4(1.f), 0.0f, 1.f);
+    // Each material has a layer of the texture array
+    m_raytracingScene.LoadTextures();
+    std::shared_ptr<Texture2DArrayObject> textureArray = CreateTextureArray(m_raytracingScene.GetTextureLayers());
+    SetRaytracingUniformValue("TextureArray", textureArray);
 
-    m_material->SetUniformValue("MonaTexture", LoadTexture("models/Mona.jpg"));
-    m_materials.emplace_back(3, glm::vec4(1.f), 1.f, 0.f);
+    // The rasterized meshes read the same materials and textures as the rays
+    m_gbufferMaterial = CreateGBufferMaterial();
+    m_gbufferMaterial->SetUniformValue("TextureArray", textureArray);
 
     //m_material->SetBlendEquation(Material::BlendEquation::None);
 
-    // Enable blending and set the blending parameters to alpha blending
-    m_material->SetBlendEquation(Material::BlendEquation::Add);
-    m_material->SetBlendParams(Material::BlendParam::SourceAlpha, Material::BlendParam::OneMinusSourceAlpha);
+    // Adaptive sampling. The mask is built after the framebuffer
+    m_material->SetUniformValue("AdaptiveSampling", m_options.adaptiveTargetError > 0.0f ? 1u : 0u);
+    m_material->SetUniformValue("SamplingMaskFrame", m_samplingMaskFrame);
 }
 
 void MeshRaytracingApplication::InitializeFramebuffer()
@@ -188,87 +280,268 @@ void MeshRaytracingApplication::InitializeFramebuffer()
     int width, height;
     GetMainWindow().GetDimensions(width, height);
 
-    // Scene Texture
-    m_sceneTexture = std::make_shared<Texture2DObject>();
-    m_sceneTexture->Bind();
-    m_sceneTexture->SetImage(0, width, height, TextureObject::FormatRGBA, TextureObject::InternalFormat::InternalFormatRGBA16F);
-    m_sceneTexture->SetParameter(TextureObject::ParameterEnum::MinFilter, GL_LINEAR);
-    m_sceneTexture->SetParameter(TextureObject::ParameterEnum::MagFilter, GL_LINEAR);
+    // Sampling mask texture
+    m_samplingMaskTexture = std::make_shared<Texture2DObject>();
+    m_samplingMaskTexture->Bind();
+    m_samplingMaskTexture->SetImage(0, width, height, TextureObject::FormatR, TextureObject::InternalFormat::InternalFormatR32F);
+    m_samplingMaskTexture->SetParameter(TextureObject::ParameterEnum::MinFilter, GL_NEAREST);
+    m_samplingMaskTexture->SetParameter(TextureObject::ParameterEnum::MagFilter, GL_NEAREST);
     Texture2DObject::Unbind();
 
-    // Scene framebuffer
-    m_sceneFramebuffer = std::make_shared<FramebufferObject>();
-    m_sceneFramebuffer->Bind();
-    m_sceneFramebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color0, *m_sceneTexture);
-    m_sceneFramebuffer->SetDrawBuffers(std::array<FramebufferObject::Attachment, 1>({ FramebufferObject::Attachment::Color0 }));
+    // Sampling mask framebuffer
+    m_samplingMaskFramebuffer = std::make_shared<FramebufferObject>();
+    m_samplingMaskFramebuffer->Bind();
+    m_samplingMaskFramebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color0, *m_samplingMaskTexture);
+    m_samplingMaskFramebuffer->SetDrawBuffers(std::array<FramebufferObject::Attachment, 1>({ FramebufferObject::Attachment::Color0 }));
     FramebufferObject::Unbind();
+
+    m_material->SetUniformValue("SamplingMask", m_samplingMaskTexture);
 }
 
 void MeshRaytracingApplication::InitializeRenderer()
 {
-    m_renderer.AddRenderPass(std::make_unique<PostFXRenderPass>(m_material, m_sceneFramebuffer));
+    int width, height;
+    GetMainWindow().GetDimensions(width, height);
+
+    if (m_options.hybrid)
+    {
+        // The G-buffer replaces the primary rays on the meshes. Rays hit both sides of the triangles, so nothing is culled
+        std::unique_ptr<GBufferRenderPass> gbufferPass = std::make_unique<GBufferRenderPass>(width, height);
+        SetRaytracingUniformValue("HybridPrimaryRays", 1u);
+        SetRaytracingUniformValue("GBufferDepth", gbufferPass->GetDepthTexture());
+        SetRaytracingUniformValue("GBufferAlbedo", gbufferPass->GetAlbedoTexture());
+        SetRaytracingUniformValue("GBufferNormal", gbufferPass->GetNormalTexture());
+        SetRaytracingUniformValue("GBufferOthers", gbufferPass->GetOthersTexture());
+        m_renderer.AddRenderPass(std::move(gbufferPass));
+        GetDevice().DisableFeature(GL_CULL_FACE);
+
+        // Same transforms as the rays: world space normals, and the projection to rebuild the cones of the primary rays
+        std::shared_ptr<ShaderProgram> shaderProgram = m_gbufferMaterial->GetShaderProgram();
+        ShaderProgram::Location worldMatrixLocation = shaderProgram->GetUniformLocation("WorldMatrix");
+        ShaderProgram::Location normalMatrixLocation = shaderProgram->GetUniformLocation("NormalMatrix");
+        ShaderProgram::Location viewMatrixLocation = shaderProgram->GetUniformLocation("ViewMatrix");
+        ShaderProgram::Location viewProjMatrixLocation = shaderProgram->GetUniformLocation("ViewProjMatrix");
+        ShaderProgram::Location invProjMatrixLocation = shaderProgram->GetUniformLocation("InvProjMatrix");
+        ShaderProgram::Location cameraPositionLocation = shaderProgram->GetUniformLocation("CameraPosition");
+        m_renderer.RegisterShaderProgram(shaderProgram,
+            [=](const ShaderProgram& shaderProgram, const glm::mat4& worldMatrix, const Camera& camera, bool cameraChanged)
+            {
+                if (cameraChanged)
+                {
+                    shaderProgram.SetUniform(viewMatrixLocation, camera.GetViewMatrix());
+                    shaderProgram.SetUniform(viewProjMatrixLocation, camera.GetViewProjectionMatrix());
+                    shaderProgram.SetUniform(invProjMatrixLocation, glm::inverse(camera.GetProjectionMatrix()));
+                    shaderProgram.SetUniform(cameraPositionLocation, camera.ExtractTranslation());
+                }
+                shaderProgram.SetUniform(worldMatrixLocation, worldMatrix);
+                shaderProgram.SetUniform(normalMatrixLocation, glm::transpose(glm::inverse(worldMatrix)));
+            },
+            nullptr);
+    }
 
-    std::shared_ptr<Material> copyMaterial = CreateCopyMaterial();
-    copyMaterial->SetUniformValue("SourceTexture", m_sceneTexture);
-    m_renderer.AddRenderPass(std::make_unique<PostFXRenderPass>(copyMaterial, m_renderer.GetDefaultFramebuffer()));
+    // The reservoirs of the primary hits are drawn before the samples that read them
+    if (m_options.lightReservoirs)
+    {
+        std::unique_ptr<ReservoirRenderPass> reservoirPass = std::make_unique<ReservoirRenderPass>(m_reservoirMaterial, m_material, width, height);
+        m_reservoirPass = reservoirPass.get();
+        m_renderer.AddRenderPass(std::move(reservoirPass));
+    }
+
+    // The ray tracing material adds one sample per frame to the sums
+    std::unique_ptr<AccumulationRenderPass> accumulationPass = std::make_unique<AccumulationRenderPass>(m_material, width, height);
+    accumulationPass->SetTargetSampleCount(m_options.targetSampleCount);
+    m_accumulationPass = accumulationPass.get();
+    m_accumulationPass->SetReprojectionMaterials(CreateFullscreenMaterial("shaders/history.frag"), CreateFullscreenMaterial("shaders/reprojection.frag"));
+    m_renderer.AddRenderPass(std::move(accumulationPass));
+
+    m_samplingMaskMaterial = CreateFullscreenMaterial("shaders/sampling_mask.frag");
+    m_samplingMaskMaterial->SetUniformValue("SourceTexture", m_accumulationPass->GetSumTexture());
+    m_samplingMaskMaterial->SetUniformValue("MomentsTexture", m_accumulationPass->GetMomentsTexture());
+    m_samplingMaskMaterial->SetUniformValue("TargetError", m_options.adaptiveTargetError);
+    m_samplingMaskMaterial->SetUniformValue("MinSampleCount", static_cast<float>(MinSampleCount));
+
+    if (m_options.denoise)
+    {
+        // Resolve the sums to the mean of each pixel, and filter the noise
+        m_renderer.AddRenderPass(std::make_unique<DenoiseRenderPass>(CreateFullscreenMaterial("shaders/denoise_prepare.frag"),
+            CreateFullscreenMaterial("shaders/denoise_atrous.frag"), *m_accumulationPass, width, height, m_renderer.GetDefaultFramebuffer()));
+    }
+    else
+    {
+        // Resolve the sums to the mean of each pixel
+        std::shared_ptr<Material> copyMaterial = CreateFullscreenMaterial("shaders/resolve.frag");
+        copyMaterial->SetUniformValue("SourceTexture", m_accumulationPass->GetSumTexture());
+        m_renderer.AddRenderPass(std::make_unique<PostFXRenderPass>(copyMaterial, m_renderer.GetDefaultFramebuffer()));
+    }
 }
 
 void MeshRaytracingApplication::InitializeModels()
 {
-    // Configure loader
-    ModelLoader loader(m_material);
-
-    //LoadModel(loader, "models/Box.obj", 0, glm::translate(glm::vec3(1.0f, 2.3, -3)) * glm::scale(glm::vec3(0.75f)));
-    LoadModel(loader, "models/Wall_East.obj", 1);
-    LoadModel(loader, "models/Wall_West.obj", 1);
-    LoadModel(loader, "models/Wall_South.obj", 1);
-    LoadModel(loader, "models/Wall_North.obj", 1);
-    LoadModel(loader, "models/Ceiling.obj", 1);
-    LoadModel(loader, "models/Floor.obj", 2);
-    LoadModel(loader, "models/Mona.obj", 3);
+    // Configure loader. The vertex attributes are bound to the inputs of the G-buffer vertex shader
+    ModelLoader loader(m_gbufferMaterial);
+    loader.SetMaterialAttribute(VertexAttribute::Semantic::Position, "VertexPosition");
+    loader.SetMaterialAttribute(VertexAttribute::Semantic::Normal, "VertexNormal");
+    loader.SetMaterialAttribute(VertexAttribute::Semantic::TexCoord0, "VertexTexCoord");
+
+    m_raytracingScene.InitializeModels(loader);
+    if (m_options.primitives)
+    {
+        m_raytracingScene.InitializePrimitives();
+    }
+    if (m_options.lightPanels)
+    {
+        m_raytracingScene.InitializeLightPanels(loader);
+    }
+
+    InitializeRasterModels();
 }
 
-void MeshRaytracingApplication::LoadModel(ModelLoader &loader, const char* path, unsigned int materialId, glm::mat4 transform)
+void MeshRaytracingApplication::InitializeRasterModels()
 {
-    std::shared_ptr<Model> model = loader.LoadShared(path);
-    m_transforms.push_back(transform);
-    int transformId = m_transforms.size() - 1;
+    // Loaded models are shared by the instances of the same file, so each instance gets its own model on the same mesh
+    for (unsigned int modelIndex = 0; modelIndex < m_raytracingScene.GetModelCount(); ++modelIndex)
+    {
+        const std::shared_ptr<Model>& model = m_raytracingScene.GetModel(modelIndex);
+        std::shared_ptr<Model> rasterModel = std::make_shared<Model>(std::shared_ptr<Mesh>(model, &model->GetMesh()));
+
+        // Submeshes follow the materials of the model, like the triangles of the acceleration structure
+        unsigned int materialId = m_raytracingScene.GetModelMaterialId(modelIndex);
+        for (unsigned int submeshIndex = 0; submeshIndex < model->GetMesh().GetSubmeshCount(); ++submeshIndex)
+        {
+            std::shared_ptr<Material> material = std::make_shared<Material>(*m_gbufferMaterial);
+            material->SetUniformValue("MaterialId", materialId + submeshIndex);
+            rasterModel->AddMaterial(material);
+        }
+        m_rasterModels.push_back(rasterModel);
+    }
+}
+
+void MeshRaytracingApplication::UpdateAccelerationStructure()
+{
+    AccelerationStructure& accelerationStructure = m_raytracingScene.GetAccelerationStructure();
+    if (!accelerationStructure.Update())
+        return;
+
+    // Upload only the runs of nodes and instances that changed
+    m_ssboBVHNodes.Bind();
+    for (const BVH::Range& range : accelerationStructure.GetUpdatedNodes())
+    {
+        m_ssboBVHNodes.UpdateData(std::span(accelerationStructure.GetNodes()).subspan(range.first, range.count), range.first * sizeof(BVHNode));
+    }
+
+    m_ssboInstances.Bind();
+    for (const BVH::Range& range : accelerationStructure.GetUpdatedInstances())
+    {
+        m_ssboInstances.UpdateData(std::span(accelerationStructure.GetInstances()).subspan(range.first, range.count), range.first * sizeof(AccelerationInstance));
+    }
 
-    model->GetMesh().SetTriangleMaterialID(materialId);
-    model->GetMesh().SetTriangleTransformID(transformId);
+    ShaderStorageBufferObject::Unbind();
+
+    // Emissive triangles and primitives may have moved, and the sorted instances of the lights may have changed
+    UpdateLights();
 
-    m_models.push_back(model);
+    InvalidateScene();
 }
 
 void MeshRaytracingApplication::InitializeSSBO()
 {
-    std::vector<Triangle> collectedTriangleData;
-	for (const auto& model : m_models)
-	{
-        const std::vector<Triangle>& meshData = model->GetMesh().GetTriangleData();
-        collectedTriangleData.insert(collectedTriangleData.end(), meshData.begin(), meshData.end());
-	}
+    AccelerationStructure& accelerationStructure = m_raytracingScene.GetAccelerationStructure();
+
+    // Build the hierarchies of each mesh in object space, and the hierarchy over the instances
+    // Big meshes are built in parallel by a pool that only lives for the build
+    ThreadPool threadPool;
+    accelerationStructure.SetThreadPool(&threadPool);
+    accelerationStructure.Build();
+    accelerationStructure.SetThreadPool(nullptr);
+
+    // Positions are read for every triangle tested, attributes only for the closest hit
+    m_ssboVertexPositions.Bind();
+    m_ssboVertexPositions.AllocateData(std::span(accelerationStructure.GetVertexPositions()), BufferObject::Usage::StaticDraw);
+    m_ssboVertexPositions.BindSSBO(1);
+
+    ShaderStorageBufferObject::Unbind();
+
+    m_ssboVertexAttributes.Bind();
+    m_ssboVertexAttributes.AllocateData(std::span(accelerationStructure.GetVertexAttributes()), BufferObject::Usage::StaticDraw);
+    m_ssboVertexAttributes.BindSSBO(5);
+
+    ShaderStorageBufferObject::Unbind();
 
     m_ssboTriangles.Bind();
-    m_ssboTriangles.AllocateData(std::span(collectedTriangleData), BufferObject::Usage::StaticDraw);
-    m_ssboTriangles.BindSSBO(1);
+    m_ssboTriangles.AllocateData(std::span(accelerationStructure.GetTriangles()), BufferObject::Usage::StaticDraw);
+    m_ssboTriangles.BindSSBO(6);
 
     ShaderStorageBufferObject::Unbind();
 
-    m_ssboTransforms.Bind();
-    m_ssboTransforms.AllocateData(std::span(m_transforms), BufferObject::Usage::StaticDraw);
-    m_ssboTransforms.BindSSBO(2);
+    m_ssboInstances.Bind();
+    m_ssboInstances.AllocateData(std::span(accelerationStructure.GetInstances()), BufferObject::Usage::DynamicDraw);
+    m_ssboInstances.BindSSBO(2);
 
     ShaderStorageBufferObject::Unbind();
 
     m_ssboMaterials.Bind();
-    m_ssboMaterials.AllocateData(sizeof(RaytracingMaterial) * m_materials.size(), m_materials.data(), BufferObject::Usage::StaticDraw);
+    m_ssboMaterials.AllocateData(std::span(m_raytracingScene.GetMaterials()), BufferObject::Usage::StaticDraw);
     m_ssboMaterials.BindSSBO(3);
 
     ShaderStorageBufferObject::Unbind();
+
+    m_ssboBVHNodes.Bind();
+    m_ssboBVHNodes.AllocateData(std::span(accelerationStructure.GetNodes()), BufferObject::Usage::DynamicDraw);
+    m_ssboBVHNodes.BindSSBO(4);
+
+    ShaderStorageBufferObject::Unbind();
+
+    // The shaders take the number of cells from the size of the buffer. It is also bound without the cache, but never read
+    m_ssboRadianceCache.Bind();
+    m_ssboRadianceCache.AllocateData<RadianceCacheCell>(RadianceCache::Capacity, BufferObject::Usage::DynamicCopy);
+    m_ssboRadianceCache.BindSSBO(8);
+    ClearRadianceCache();
+
+    // The lights reference the sorted instances, so they are collected after the build. UpdateLights only uploads them again
+    m_raytracingScene.UpdateLights();
+    m_ssboEmissiveLights.Bind();
+    m_ssboEmissiveLights.AllocateData(std::span(m_raytracingScene.GetEmissiveLights()), BufferObject::Usage::DynamicDraw);
+    m_ssboEmissiveLights.BindSSBO(7);
+    m_emissiveLightCount = static_cast<unsigned int>(m_raytracingScene.GetEmissiveLights().size());
+
+    ShaderStorageBufferObject::Unbind();
+
+    SetRaytracingUniformValue("LightPdfScale", m_raytracingScene.GetLightPdfScale());
+}
+
+void MeshRaytracingApplication::UpdateLights()
+{
+    m_raytracingScene.UpdateLights();
+
+    // The shaders take the number of lights from the size of the buffer
+    const std::vector<EmissiveLight>& emissiveLights = m_raytracingScene.GetEmissiveLights();
+    m_ssboEmissiveLights.Bind();
+    if (emissiveLights.size() != m_emissiveLightCount)
+    {
+        m_ssboEmissiveLights.AllocateData(std::span(emissiveLights), BufferObject::Usage::DynamicDraw);
+        m_ssboEmissiveLights.BindSSBO(7);
+        m_emissiveLightCount = static_cast<unsigned int>(emissiveLights.size());
+    }
+    else if (!emissiveLights.empty())
+    {
+        m_ssboEmissiveLights.UpdateData(std::span(emissiveLights));
+    }
+
+    ShaderStorageBufferObject::Unbind();
+
+    SetRaytracingUniformValue("LightPdfScale", m_raytracingScene.GetLightPdfScale());
+}
+
+void MeshRaytracingApplication::ClearRadianceCache()
+{
+    // Empty cells are all zeros, filled on the GPU without uploading them
+    m_ssboRadianceCache.Bind();
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    ShaderStorageBufferObject::Unbind();
 }
 
-std::shared_ptr<Material> MeshRaytracingApplication::CreateRaytracingMaterial(const char* fragmentShaderPath)
+std::shared_ptr<Material> MeshRaytracingApplication::CreateRaytracingMaterial(const char* fragmentShaderPath, const char* mainShaderPath)
 {
     // We could keep this vertex shader and reuse it, but it looks simpler this way
     std::vector<const char*> vertexShaderPaths;
@@ -279,11 +552,15 @@ std::shared_ptr<Material> MeshRaytracingApplication::CreateRaytracingMaterial(co
     std::vector<const char*> fragmentShaderPaths; 
 	fragmentShaderPaths.push_back("shaders/version330.glsl");
 	fragmentShaderPaths.push_back("shaders/utils.glsl");
+	fragmentShaderPaths.push_back("shaders/sampler.glsl");
+	fragmentShaderPaths.push_back("shaders/radiancecache.glsl");
 	fragmentShaderPaths.push_back("shaders/transform.glsl");
-	fragmentShaderPaths.push_back("shaders/raytracer.glsl");
+	fragmentShaderPaths.push_back(m_options.pathIntegrator ? "shaders/pathtracer.glsl" : "shaders/raytracer.glsl");
 	fragmentShaderPaths.push_back("shaders/raylibrary.glsl");
 	fragmentShaderPaths.push_back(fragmentShaderPath);
-	fragmentShaderPaths.push_back("shaders/raytracing.frag");
+	fragmentShaderPaths.push_back("shaders/lightreservoirs.glsl");
+	fragmentShaderPaths.push_back("shaders/raytracing.glsl");
+	fragmentShaderPaths.push_back(mainShaderPath);
     Shader fragmentShader = ShaderLoader(Shader::FragmentShader).Load(fragmentShaderPaths);
 
     m_shaderProgramPtr = std::make_shared<ShaderProgram>();
@@ -294,7 +571,30 @@ std::shared_ptr<Material> MeshRaytracingApplication::CreateRaytracingMaterial(co
     return material;
 }
 
-std::shared_ptr<Material> MeshRaytracingApplication::CreateCopyMaterial()
+std::shared_ptr<Material> MeshRaytracingApplication::CreateGBufferMaterial()
+{
+    std::vector<const char*> vertexShaderPaths;
+    vertexShaderPaths.push_back("shaders/version330.glsl");
+    vertexShaderPaths.push_back("shaders/gbuffer.vert");
+    Shader vertexShader = ShaderLoader(Shader::VertexShader).Load(vertexShaderPaths);
+
+    std::vector<const char*> fragmentShaderPaths;
+    fragmentShaderPaths.push_back("shaders/version330.glsl");
+    fragmentShaderPaths.push_back("shaders/utils.glsl");
+    fragmentShaderPaths.push_back("shaders/gbuffer.frag");
+    Shader fragmentShader = ShaderLoader(Shader::FragmentShader).Load(fragmentShaderPaths);
+
+    std::shared_ptr<ShaderProgram> shaderProgramPtr = std::make_shared<ShaderProgram>();
+    shaderProgramPtr->Build(vertexShader, fragmentShader);
+
+    // The transforms are set by the renderer for each drawcall
+    std::shared_ptr<Material> material = std::make_shared<Material>(shaderProgramPtr,
+        Material::NameSet({ "WorldMatrix", "NormalMatrix", "ViewMatrix", "ViewProjMatrix", "InvProjMatrix", "CameraPosition" }));
+
+    return material;
+}
+
+std::shared_ptr<Material> MeshRaytracingApplication::CreateFullscreenMaterial(const char* fragmentShaderPath)
 {
     std::vector<const char*> vertexShaderPaths;
     vertexShaderPaths.push_back("shaders/version330.glsl");
@@ -304,7 +604,7 @@ std::shared_ptr<Material> MeshRaytracingApplication::CreateCopyMaterial()
     std::vector<const char*> fragmentShaderPaths;
     fragmentShaderPaths.push_back("shaders/version330.glsl");
     fragmentShaderPaths.push_back("shaders/utils.glsl");
-    fragmentShaderPaths.push_back("shaders/renderer/copy.frag");
+    fragmentShaderPaths.push_back(fragmentShaderPath);
     Shader fragmentShader = ShaderLoader(Shader::FragmentShader).Load(fragmentShaderPaths);
 
     std::shared_ptr<ShaderProgram> shaderProgramPtr = std::make_shared<ShaderProgram>();
@@ -379,55 +679,3 @@ void MeshRaytracingApplication::RenderGUI()
 
     //m_imGui.EndFrame();
 }
-
-//void MeshRaytracingApplication::InitializeTextureArray() {
-//    if (m_textureFiles.empty()) {
-//        std::cerr << "No file paths provided for texture array.\n";
-//        return;
-//    }
-//
-//    int width, height, channels;
-//    stbi_set_flip_vertically_on_load(true); // Optional, depending on your texture orientation
-//
-//    // Load the first image to get dimensions and format
-//    unsigned char* data = stbi_load(m_textureFiles[0].c_str(), &width, &height, &channels, STBI_rgb_alpha);
-//    if (!data) {
-//        std::cerr << "Failed to load texture: " << m_textureFiles[0] << "\n";
-//        return;
-//    }
-//    stbi_image_free(data); // We'll reload each image in the loop below
-//
-//    glGenTextures(1, &texture);
-//    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
-//
-//    GLsizei layerCount = static_cast<GLsizei>(m_textureFiles.size());
-//    glTexImage3D(texture, 0, GL_RGBA8, width, height, layerCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-//
-//    for (GLsizei i = 0; i < layerCount; ++i) {
-//        data = stbi_load(m_textureFiles[i].c_str(), &width, &height, &channels, STBI_rgb_alpha);
-//        if (!data) {
-//            std::cerr << "Failed to load texture: " << m_textureFiles[i] << "\n";
-//            glDeleteTextures(1, &texture);
-//            return;
-//        }
-//
-//        glTexSubImage3D(
-//            texture,
-//            0,                // mipmap level
-//            0, 0, i,          // x, y, z offset
-//            width, height, 1, // width, height, depth (one layer)
-//            GL_RGBA,
-//            GL_UNSIGNED_BYTE,
-//            data
-//        );
-//        stbi_image_free(data);
-//    }
-//
-//    // Set texture parameters
-//    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-//    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-//    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-//    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-//
-//    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
-//}
\ No newline at end of file
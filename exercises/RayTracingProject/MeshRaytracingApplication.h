@@ -9,36 +9,52 @@
 #include "glm/ext/matrix_transform.hpp"
 #include "ituGL/geometry/ShaderStorageBufferObject.h"
 #include "ituGL/scene/Scene.h"
+#include "RaytracingScene.h"
+#include "Sampler.h"
 
 class ModelLoader;
-
-struct RaytracingMaterial {
-    RaytracingMaterial(const unsigned int materialId, glm::vec4 albedo = glm::vec4(0.f), const float roughness = 0.f, const float metallic = 0.f,
-        const float ior = 0.f, const glm::vec4 emissive = glm::vec4(0.f)) {
-        m_materialId = materialId;
-        m_albedo = albedo;
-        m_roughness = roughness;
-        m_metallic = metallic;
-        m_ior = ior;
-        m_emissive = emissive;
-    }
-
-    unsigned int m_materialId;
-    float m_roughness = 0.f;
-    float m_metallic = 0.f;
-    float m_ior = 0.f;
-    glm::vec4 m_albedo = glm::vec4(0.f);
-    glm::vec4 m_emissive = glm::vec4(0.f);
-};
+class Model;
+class AccumulationRenderPass;
+class ReservoirRenderPass;
 
 class Material;
 class Texture2DObject;
+class Texture2DArrayObject;
 class FramebufferObject;
 
+// Options of the application, filled from the command line
+struct RaytracingOptions
+{
+    // Follow a single path per sample instead of the tree of rays of raytracer.glsl
+    bool pathIntegrator = false;
+    // Sample the lights at each hit
+    bool nextEventEstimation = true;
+    // Sequence of random numbers, the same as the CPU path tracer
+    Sampler::Type samplerType = Sampler::Type::Sobol;
+    // Above 0, pixels stop getting samples once their error is below it. See sampling_mask.frag
+    float adaptiveTargetError = 0.0f;
+    // Above 0, accumulation stops after this number of samples per pixel
+    unsigned int targetSampleCount = 0;
+    // Filter the mean of the pixels with the features of the primary hits. See DenoiseRenderPass
+    bool denoise = false;
+    // Rasterize the primary hits on the meshes in a G-buffer, and only trace the later bounces
+    bool hybrid = false;
+    // End the paths of the path integrator on the radiance cache after a diffuse bounce. See radiancecache.glsl
+    bool radianceCache = false;
+    // Resample the direct lighting of the primary hits with reservoirs reused across frames and pixels. See ReservoirRenderPass
+    bool lightReservoirs = false;
+    // Move the sphere light and the painting every frame, refitting the acceleration structure. See RaytracingScene::Animate
+    bool animate = false;
+    // Add a grid of analytic spheres and boxes, some of them emissive. See RaytracingScene::InitializePrimitives
+    bool primitives = false;
+    // Add a grid of emissive panels under the ceiling. See RaytracingScene::InitializeLightPanels
+    bool lightPanels = false;
+};
+
 class MeshRaytracingApplication : public Application
 {
 public:
-    MeshRaytracingApplication();
+    explicit MeshRaytracingApplication(const RaytracingOptions& options = RaytracingOptions());
 
 protected:
     void Initialize() override;
@@ -53,33 +69,71 @@ private:
     void InitializeRenderer();
     void InitializeModels();
     void InitializeSSBO();
-    void InitializeTextureArray();
 
-    std::shared_ptr<Material> CreateCopyMaterial();
-    std::shared_ptr<Material> CreateRaytracingMaterial(const char* fragmentShaderPath);
+    // Material drawn on the fullscreen mesh, with this fragment shader after utils.glsl
+    std::shared_ptr<Material> CreateFullscreenMaterial(const char* fragmentShaderPath);
+    // Material that traces the scene, with the main function of mainShaderPath
+    std::shared_ptr<Material> CreateRaytracingMaterial(const char* fragmentShaderPath, const char* mainShaderPath = "shaders/raytracing.frag");
+
+    // Set a uniform of the scene, the camera or the sampler in all the materials that trace the scene
+    template<typename T>
+    void SetRaytracingUniformValue(const char* name, const T& value);
+
+    // Material of the meshes rasterized in the G-buffer
+    std::shared_ptr<Material> CreateGBufferMaterial();
 
     void InvalidateScene();
 
+    // Make all the pixels active again
+    void ResetSamplingMask();
+
+    // Build the mask of the pixels that still need samples, from the sums of the frames so far
+    void UpdateSamplingMask();
+
     void RenderGUI();
-    void SendTexturesToShader(GLuint textures[20]);
-    std::shared_ptr<Texture2DObject> LoadTexture(const char* path);
-    void LoadModel(ModelLoader& loader, const char* path, unsigned int materialId = 0, glm::mat4 transform = glm::mat4(1.0f));
+
+    // Texture array with the layers of the scene textures, and their mipmaps
+    std::shared_ptr<Texture2DArrayObject> CreateTextureArray(const TextureLayers& layers);
+
+    // Texture with the blue noise tile of the sampler
+    std::shared_ptr<Texture2DObject> CreateBlueNoiseTexture(const Sampler& sampler);
+
+    // Upload the parts of the acceleration structure changed by the models moved since the last frame
+    void UpdateAccelerationStructure();
+
+    // Upload the emissive triangles and primitives, and the probabilities of picking each light
+    // The buffer is only allocated again if the number of lights changed
+    void UpdateLights();
+
+    // Empty all the cells of the radiance cache
+    void ClearRadianceCache();
+
+    // Models of the scene with a G-buffer material per submesh, for the material ids they are traced with
+    void InitializeRasterModels();
 
 private:
     // Helper object for debug GUI
     DearImGui m_imGui;
 
-    // Frame counter
-    unsigned int m_frameCount;
+    // Sums of the samples of each pixel, owned by the renderer
+    AccumulationRenderPass* m_accumulationPass;
+
+    RaytracingOptions m_options;
+
+    // Camera of the last frame, to detect when it moves
+    glm::mat4 m_viewProjMatrix;
+
+    // Frame from which the sampling mask is used
+    unsigned int m_samplingMaskFrame;
 
-    // World position for sphere center
-    glm::vec3 m_sphereCenter;
+    // Reservoirs of the lights of the primary hits, owned by the renderer. nullptr without light reservoirs
+    ReservoirRenderPass* m_reservoirPass;
 
-    // World matrix for cube
-    glm::mat4 m_boxMatrix;
+    // Pixels need at least this number of samples to be converged
+    static constexpr unsigned int MinSampleCount = 32;
 
-    // World matrix for mesh
-	glm::mat4 m_meshMatrix;
+    // Number of frames between updates of the sampling mask
+    static constexpr unsigned int SamplingMaskPeriod = 16;
 
     // Camera controller
     CameraController m_cameraController;
@@ -90,29 +144,45 @@ private:
     // Materials
     std::shared_ptr<Material> m_material;
 
+    // Draws the light reservoirs, with reservoirs.frag. nullptr without light reservoirs
+    std::shared_ptr<Material> m_reservoirMaterial;
+
     std::shared_ptr<RaytracingMaterial> m_meshMaterial;
 
-    // Framebuffer
-    std::shared_ptr<Texture2DObject> m_sceneTexture;
+    // Sample count of each pixel that still needs samples, or -1
+    std::shared_ptr<Texture2DObject> m_samplingMaskTexture;
+
+    std::shared_ptr<FramebufferObject> m_samplingMaskFramebuffer;
 
-    std::shared_ptr<FramebufferObject> m_sceneFramebuffer;
+    std::shared_ptr<Material> m_samplingMaskMaterial;
 
     // Default material
     std::shared_ptr<Material> m_defaultMaterial;
 
+    // Reference of the loader, and of the materials of the raster models
+    std::shared_ptr<Material> m_gbufferMaterial;
+
+    // Same meshes as the models of the scene, in the same order
+    std::vector<std::shared_ptr<Model>> m_rasterModels;
+
+    ShaderStorageBufferObject m_ssboVertexPositions;
+    ShaderStorageBufferObject m_ssboVertexAttributes;
     ShaderStorageBufferObject m_ssboTriangles;
     ShaderStorageBufferObject m_ssboMaterials;
-    ShaderStorageBufferObject m_ssboTransforms;
-
-    std::vector<std::shared_ptr<Model>> m_models;
-    std::vector<RaytracingMaterial> m_materials;
-    std::vector<std::string> m_textureFiles;
+    ShaderStorageBufferObject m_ssboInstances;
+    ShaderStorageBufferObject m_ssboBVHNodes;
+    ShaderStorageBufferObject m_ssboEmissiveLights;
+    // Number of lights m_ssboEmissiveLights was allocated for. Moving instances doesn't change it
+    unsigned int m_emissiveLightCount;
+    ShaderStorageBufferObject m_ssboRadianceCache;
+    // RadianceCacheEpoch in the shaders, incremented by InvalidateScene
+    unsigned int m_radianceCacheEpoch;
+
+    // Models, materials and light, shared with the CPU path tracer
+    RaytracingScene m_raytracingScene;
 
-    std::vector<glm::mat4> m_transforms;
     std::shared_ptr<ShaderProgram> m_shaderProgramPtr;
 
     // Global scene
     Scene m_scene;
-
-    GLuint texture;
 };
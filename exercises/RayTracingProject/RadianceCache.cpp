@@ -0,0 +1,123 @@
+#include "RadianceCache.h"
+
+#include "Sampler.h"
+#include <algorithm>
+#include <atomic>
+
+static_assert(sizeof(RadianceCacheCell) == 24, "RadianceCacheCell must match the std430 struct of radiancecache.glsl");
+
+RadianceCache::RadianceCache() : m_cells(Capacity), m_epoch(0)
+{
+    Clear();
+}
+
+void RadianceCache::Clear()
+{
+    std::fill(m_cells.begin(), m_cells.end(), RadianceCacheCell{});
+    m_epoch = 0;
+}
+
+void RadianceCache::NextEpoch()
+{
+    ++m_epoch;
+}
+
+glm::uint RadianceCache::GetKey(const glm::vec3& position, const glm::vec3& normal)
+{
+    glm::ivec3 cell(glm::floor(position / CellSize));
+    glm::vec3 absNormal = glm::abs(normal);
+    unsigned int axis = absNormal.x > absNormal.y ? (absNormal.x > absNormal.z ? 0 : 2) : (absNormal.y > absNormal.z ? 1 : 2);
+    unsigned int side = 2 * axis + (normal[axis] >= 0.0f ? 0 : 1);
+    glm::uint key = Sampler::Hash(static_cast<glm::uint>(cell.x) ^ Sampler::Hash(static_cast<glm::uint>(cell.y)
+        ^ Sampler::Hash(static_cast<glm::uint>(cell.z) ^ Sampler::Hash(side))));
+    return std::max(key, 1u);
+}
+
+int RadianceCache::FindCell(glm::uint key, bool insert) const
+{
+    for (unsigned int probe = 0; probe < ProbeCount; ++probe)
+    {
+        unsigned int index = (key + probe) % Capacity;
+        std::atomic_ref<glm::uint> cellKey(m_cells[index].key);
+        glm::uint value = cellKey.load(std::memory_order_relaxed);
+        if (value == 0)
+        {
+            if (!insert)
+            {
+                return -1;
+            }
+
+            // Take the empty cell, unless another thread took it first
+            if (cellKey.compare_exchange_strong(value, key, std::memory_order_relaxed))
+            {
+                return static_cast<int>(index);
+            }
+        }
+        if (value == key)
+        {
+            return static_cast<int>(index);
+        }
+    }
+    return -1;
+}
+
+void RadianceCache::AddSample(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& radiance)
+{
+    int index = FindCell(GetKey(position, normal), true);
+    if (index < 0)
+        return;
+
+    RadianceCacheCell& cell = m_cells[index];
+    std::atomic_ref<glm::uint> sampleCount(cell.sampleCount);
+
+    // The first sample since the scene moved ages the cell, so the radiance of the old scene fades
+    std::atomic_ref<glm::uint> epoch(cell.epoch);
+    if (epoch.load(std::memory_order_relaxed) != m_epoch && epoch.exchange(m_epoch, std::memory_order_relaxed) != m_epoch
+        && sampleCount.load(std::memory_order_relaxed) >= AgingSampleCount)
+    {
+        HalveCell(cell);
+    }
+
+    glm::uvec3 value(glm::clamp(radiance, 0.0f, MaxRadiance) * RadianceScale + 0.5f);
+    for (int c = 0; c < 3; ++c)
+    {
+        std::atomic_ref<glm::uint>(cell.radiance[c]).fetch_add(value[c], std::memory_order_relaxed);
+    }
+
+    // The sample that fills the cell halves it, so it keeps taking samples
+    if (sampleCount.fetch_add(1, std::memory_order_relaxed) + 1 == MaxSampleCount)
+    {
+        HalveCell(cell);
+    }
+}
+
+void RadianceCache::HalveCell(RadianceCacheCell& cell)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        std::atomic_ref<glm::uint> sum(cell.radiance[c]);
+        sum.fetch_sub(sum.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+    std::atomic_ref<glm::uint> sampleCount(cell.sampleCount);
+    sampleCount.fetch_sub(sampleCount.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+}
+
+bool RadianceCache::GetRadiance(const glm::vec3& position, const glm::vec3& normal, glm::vec3& radiance) const
+{
+    radiance = glm::vec3(0.0f);
+    int index = FindCell(GetKey(position, normal), false);
+    if (index < 0)
+        return false;
+
+    RadianceCacheCell& cell = m_cells[index];
+    glm::uint sampleCount = std::min(std::atomic_ref<glm::uint>(cell.sampleCount).load(std::memory_order_relaxed), MaxSampleCount);
+    if (sampleCount < MinSampleCount)
+        return false;
+
+    for (int c = 0; c < 3; ++c)
+    {
+        radiance[c] = static_cast<float>(std::atomic_ref<glm::uint>(cell.radiance[c]).load(std::memory_order_relaxed));
+    }
+    radiance /= RadianceScale * static_cast<float>(sampleCount);
+    return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Cell of the radiance cache, laid out to match the std430 struct used in the shaders
+struct RadianceCacheCell
+{
+    // Hash of the quantized position and normal, 0 if the cell is empty
+    glm::uint key;
+    glm::uint sampleCount;
+    // Sums of the radiance of the samples, in fixed point
+    glm::uint radiance[3];
+    // Epoch of the scene when the cell was last sampled
+    glm::uint epoch;
+};
+
+// CPU version of radiancecache.glsl: a world-space hash grid of cells keyed by the quantized position and the dominant axis of the normal
+// Each cell sums the radiance leaving the surfaces in it toward the paths that hit them. Paths end on it after a diffuse bounce
+// Cells are updated with atomics, so the threads of the CPU path tracer can share it like the pixels of the shaders
+class RadianceCache
+{
+public:
+    RadianceCache();
+
+    // Empty all the cells
+    void Clear();
+
+    // Start fading the radiance of the old scene, when it moves: the first sample of each cell in the new epoch halves the cell
+    void NextEpoch();
+
+    // Add the radiance leaving a hit toward the path. Ignored if the probed cells are taken by other keys
+    // A cell that reaches MaxSampleCount is halved, and so is a cell sampled for the first time since NextEpoch
+    void AddSample(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& radiance);
+
+    // Mean radiance of the cell of a hit. Returns false if the cell doesn't have MinSampleCount samples yet
+    bool GetRadiance(const glm::vec3& position, const glm::vec3& normal, glm::vec3& radiance) const;
+
+    // Number of cells. The shaders use the length of the buffer
+    static constexpr unsigned int Capacity = 1u << 16;
+
+    // Side of the cells in world units. The Cornell box is 10 units wide
+    static constexpr float CellSize = 0.25f;
+
+    // Surfaces with a lower roughness reflect too much of the view to be cached
+    static constexpr float MinRoughness = 0.75f;
+
+    // Cells tested after the one of the hash, before giving up
+    static constexpr unsigned int ProbeCount = 8;
+
+    // Samples a cell needs before paths end on it, and at which it is halved
+    static constexpr unsigned int MinSampleCount = 16;
+    static constexpr unsigned int MaxSampleCount = 1024;
+
+    // Cells with fewer samples aren't halved by a new epoch, so they stay usable while the scene moves every frame
+    static constexpr unsigned int AgingSampleCount = 4 * MinSampleCount;
+
+    // Paths that could end on a cell continue with this probability, to keep adding samples
+    static constexpr float TrainingProbability = 0.125f;
+
+    // Fixed point scale of the sums. Samples are clamped to MaxRadiance, so the MaxSampleCount samples of a full cell can't overflow
+    static constexpr float RadianceScale = 1024.0f;
+    static constexpr float MaxRadiance = 64.0f;
+
+private:
+    // Hash of the cell of the position and of the side of the normal. Never 0
+    static glm::uint GetKey(const glm::vec3& position, const glm::vec3& normal);
+
+    // Index of the cell with the key, or of an empty cell taken for it if insert is set. -1 if none of the probed cells has it
+    int FindCell(glm::uint key, bool insert) const;
+
+    // Halve the sums and the sample count of a cell. Samples added by other threads meanwhile are halved or not,
+    // which only shifts the mean slightly
+    static void HalveCell(RadianceCacheCell& cell);
+
+private:
+    // Mutable so lookups can use atomic_ref on the cells
+    mutable std::vector<RadianceCacheCell> m_cells;
+
+    glm::uint m_epoch;
+};
@@ -0,0 +1,361 @@
+#include "RaytracingScene.h"
+
+#include <ituGL/asset/ModelLoader.h>
+#include <ituGL/camera/Camera.h>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "stb_image.h"
+
+RaytracingScene::RaytracingScene()
+    : m_paintingModel(~0u)
+    , m_sphereCenter(0, 4, 4)
+    , m_sphereRadius(1.25f)
+    , m_sphereInstance(~0u)
+    , m_sphereMaterial(0)
+    , m_primitiveMaterial(0)
+    , m_lightColor(1.0f)
+    , m_lightIntensity(4.0f)
+    , m_lightPdfScale(0.0f)
+{
+}
+
+void RaytracingScene::InitializeMaterials()
+{
+    AddMaterial(RaytracingMaterial(0, glm::vec4(glm::vec4(1, 0, 0,0)), 0.5f,0.f,1.35f));
+    AddMaterial(RaytracingMaterial(1, glm::vec4(1.f), 1.f), "models/Wall.jpg");
+    AddMaterial(RaytracingMaterial(2, glm::vec4(1.f), 0.0f, 1.f), "models/Floor.jpg");
+    AddMaterial(RaytracingMaterial(3, glm::vec4(1.f), 1.f, 0.f), "models/Mona.jpg");
+
+    // Sphere light
+    m_sphereMaterial = static_cast<unsigned int>(m_materials.size());
+    AddMaterial(RaytracingMaterial(SphereLightMaterialId, glm::vec4(0.0f), 0.0f, 0.0f, 0.0f, glm::vec4(m_lightIntensity * m_lightColor, 0.f)));
+
+    // Materials of InitializePrimitives, the emissive ones also used by InitializeLightPanels
+    m_primitiveMaterial = static_cast<unsigned int>(m_materials.size());
+    AddMaterial(RaytracingMaterial(4, glm::vec4(0.8f, 0.8f, 0.75f, 1.0f), 0.8f));
+    AddMaterial(RaytracingMaterial(5, glm::vec4(0.95f, 0.7f, 0.35f, 1.0f), 0.3f, 1.0f));
+    AddMaterial(RaytracingMaterial(6, glm::vec4(0.0f), 0.0f, 0.0f, 0.0f, glm::vec4(6.0f, 3.0f, 1.0f, 0.0f)));
+    AddMaterial(RaytracingMaterial(7, glm::vec4(0.0f), 0.0f, 0.0f, 0.0f, glm::vec4(1.0f, 3.0f, 6.0f, 0.0f)));
+}
+
+// Bilinear resampling of an RGBA image, with the texel centers at half coordinates and the edges clamped
+static void ResizeTexture(const unsigned char* source, int sourceWidth, int sourceHeight, unsigned char* target, int targetWidth, int targetHeight)
+{
+    for (int y = 0; y < targetHeight; ++y)
+    {
+        float sourceY = std::max((y + 0.5f) * sourceHeight / targetHeight - 0.5f, 0.0f);
+        int y0 = std::min(static_cast<int>(sourceY), sourceHeight - 1);
+        int y1 = std::min(y0 + 1, sourceHeight - 1);
+        float weightY = sourceY - y0;
+        for (int x = 0; x < targetWidth; ++x)
+        {
+            float sourceX = std::max((x + 0.5f) * sourceWidth / targetWidth - 0.5f, 0.0f);
+            int x0 = std::min(static_cast<int>(sourceX), sourceWidth - 1);
+            int x1 = std::min(x0 + 1, sourceWidth - 1);
+            float weightX = sourceX - x0;
+            for (int component = 0; component < 4; ++component)
+            {
+                float bottom = glm::mix<float>(source[(y0 * sourceWidth + x0) * 4 + component], source[(y0 * sourceWidth + x1) * 4 + component], weightX);
+                float top = glm::mix<float>(source[(y1 * sourceWidth + x0) * 4 + component], source[(y1 * sourceWidth + x1) * 4 + component], weightX);
+                target[(y * targetWidth + x) * 4 + component] = static_cast<unsigned char>(glm::mix(bottom, top, weightY) + 0.5f);
+            }
+        }
+    }
+}
+
+void RaytracingScene::LoadTextures()
+{
+    struct Image
+    {
+        int width = 1;
+        int height = 1;
+        // Opaque black if the file can't be loaded, like an incomplete OpenGL texture
+        std::vector<unsigned char> texels = { 0, 0, 0, 255 };
+    };
+
+    // With the first row at the bottom, as OpenGL expects
+    stbi_set_flip_vertically_on_load(true);
+
+    std::vector<Image> images(m_textureFiles.size());
+    int width = 1;
+    int height = 1;
+    for (size_t i = 0; i < m_textureFiles.size(); ++i)
+    {
+        int components = 0;
+        unsigned char* data = stbi_load(m_textureFiles[i].c_str(), &images[i].width, &images[i].height, &components, 4);
+        if (!data)
+        {
+            std::cerr << "Failed to load texture: " << m_textureFiles[i] << std::endl;
+            images[i] = Image();
+            continue;
+        }
+        images[i].texels.assign(data, data + images[i].width * images[i].height * 4);
+        stbi_image_free(data);
+
+        width = std::max(width, images[i].width);
+        height = std::max(height, images[i].height);
+    }
+
+    m_textureLayers.width = std::min(width, MaxTextureSize);
+    m_textureLayers.height = std::min(height, MaxTextureSize);
+    m_textureLayers.layerCount = static_cast<unsigned int>(images.size()) + 1;
+    size_t layerSize = static_cast<size_t>(m_textureLayers.width) * m_textureLayers.height * 4;
+
+    // Layer 0 is white
+    m_textureLayers.levels.clear();
+    std::vector<unsigned char>& texels = m_textureLayers.levels.emplace_back(m_textureLayers.layerCount * layerSize, 255);
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        ResizeTexture(images[i].texels.data(), images[i].width, images[i].height,
+            texels.data() + (i + 1) * layerSize, m_textureLayers.width, m_textureLayers.height);
+    }
+
+    // Each mipmap halves the previous one. The bilinear resize averages 2x2 texels when the size is even
+    for (unsigned int level = 1; m_textureLayers.GetLevelWidth(level - 1) > 1 || m_textureLayers.GetLevelHeight(level - 1) > 1; ++level)
+    {
+        int sourceWidth = m_textureLayers.GetLevelWidth(level - 1);
+        int sourceHeight = m_textureLayers.GetLevelHeight(level - 1);
+        int targetWidth = m_textureLayers.GetLevelWidth(level);
+        int targetHeight = m_textureLayers.GetLevelHeight(level);
+        std::vector<unsigned char> target(m_textureLayers.layerCount * targetWidth * targetHeight * 4);
+        for (unsigned int layer = 0; layer < m_textureLayers.layerCount; ++layer)
+        {
+            ResizeTexture(m_textureLayers.levels.back().data() + layer * sourceWidth * sourceHeight * 4, sourceWidth, sourceHeight,
+                target.data() + layer * targetWidth * targetHeight * 4, targetWidth, targetHeight);
+        }
+        m_textureLayers.levels.push_back(std::move(target));
+    }
+}
+
+void RaytracingScene::InitializeModels(ModelLoader& loader)
+{
+    //LoadModel(loader, "models/Box.obj", 0, glm::translate(glm::vec3(1.0f, 2.3, -3)) * glm::scale(glm::vec3(0.75f)));
+    LoadModel(loader, "models/Wall_East.obj", 1);
+    LoadModel(loader, "models/Wall_West.obj", 1);
+    LoadModel(loader, "models/Wall_South.obj", 1);
+    LoadModel(loader, "models/Wall_North.obj", 1);
+    LoadModel(loader, "models/Ceiling.obj", 1);
+    LoadModel(loader, "models/Floor.obj", 2);
+    m_paintingModel = GetModelCount();
+    LoadModel(loader, "models/Mona.obj", 3);
+
+    m_sphereInstance = m_accelerationStructure.AddPrimitive(PrimitiveType::Sphere, GetSphereTransform(), m_sphereMaterial);
+}
+
+void RaytracingScene::InitializePrimitives()
+{
+    // Spheres and boxes alternate on a grid in front of the camera, and the boxes turn around the vertical axis
+    const unsigned int columns = 16;
+    const unsigned int rows = 10;
+    const float spacing = 0.4f;
+    const float size = 0.15f;
+    for (unsigned int row = 0; row < rows; ++row)
+    {
+        for (unsigned int column = 0; column < columns; ++column)
+        {
+            unsigned int index = row * columns + column;
+            glm::vec3 center((column - 0.5f * (columns - 1)) * spacing, size, -2.0f - row * spacing);
+
+            // One in seven is emissive, alternating the two colors. The others alternate matte and metal
+            unsigned int materialId = index % 7 == 3 ? m_primitiveMaterial + 2 + (index / 7) % 2 : m_primitiveMaterial + index % 2;
+            if ((row + column) % 2 == 0)
+            {
+                m_accelerationStructure.AddPrimitive(PrimitiveType::Sphere, glm::translate(center) * glm::scale(glm::vec3(size)), materialId);
+            }
+            else
+            {
+                glm::mat4 rotation = glm::rotate(0.3f * index, glm::vec3(0.0f, 1.0f, 0.0f));
+                m_accelerationStructure.AddPrimitive(PrimitiveType::Box, glm::translate(center) * rotation * glm::scale(glm::vec3(size)), materialId);
+            }
+        }
+    }
+}
+
+void RaytracingScene::InitializeLightPanels(ModelLoader& loader)
+{
+    // The ceiling quad is centered and scaled down to the size of a panel, facing down. Its bounds are taken from the loaded mesh
+    const char* ceilingPath = "models/Ceiling.obj";
+    BoundingBox ceilingBounds;
+    for (const TriangleVertex& vertex : loader.LoadShared(ceilingPath)->GetMesh().GetTriangleVertices())
+    {
+        ceilingBounds.Grow(vertex.position);
+    }
+    const glm::vec3 ceilingCenter = ceilingBounds.GetCenter();
+    const glm::vec3 ceilingSize = ceilingBounds.GetSize();
+
+    const unsigned int columns = 16;
+    const unsigned int rows = 16;
+    const float spacing = 0.55f;
+    const float size = 0.2f;
+    // Distance of the panels below the ceiling
+    const float drop = 0.19f;
+    for (unsigned int row = 0; row < rows; ++row)
+    {
+        for (unsigned int column = 0; column < columns; ++column)
+        {
+            glm::vec3 center((column - 0.5f * (columns - 1)) * spacing + ceilingCenter.x, ceilingCenter.y - drop, (row - 0.5f * (rows - 1)) * spacing + ceilingCenter.z);
+            glm::mat4 transform = glm::translate(center) * glm::scale(glm::vec3(size / ceilingSize.x, 1.0f, size / ceilingSize.z)) * glm::translate(-ceilingCenter);
+
+            // All of the same warm color, so the noise comes from picking the lights and not from their colors
+            LoadModel(loader, ceilingPath, m_primitiveMaterial + 2, transform);
+        }
+    }
+}
+
+void RaytracingScene::InitializeCamera(Camera& camera, float aspectRatio)
+{
+    camera.SetViewMatrix(glm::vec3(0, 2.0f, 0), glm::vec3(0.0f, 2.3, -7), glm::vec3(0.0f, 1.0f, 0.0));
+    float fov = 1.57f;
+    camera.SetPerspectiveProjectionMatrix(fov, aspectRatio, 0.1f, 100.0f);
+}
+
+void RaytracingScene::LoadModel(ModelLoader& loader, const char* path, unsigned int materialId, glm::mat4 transform)
+{
+    // Models are shared by path, so placing the same model again only adds a new instance
+    std::shared_ptr<Model> model = loader.LoadShared(path);
+    unsigned int instanceIndex = m_accelerationStructure.AddInstance(model->GetMesh(), transform, materialId);
+    m_models.push_back(ModelEntry{ model, transform, materialId, instanceIndex });
+}
+
+void RaytracingScene::SetModelTransform(unsigned int modelIndex, const glm::mat4& transform)
+{
+    if (transform == m_models[modelIndex].transform)
+        return;
+
+    m_models[modelIndex].transform = transform;
+    m_accelerationStructure.SetInstanceTransform(m_models[modelIndex].instanceIndex, transform);
+}
+
+void RaytracingScene::SetSphereCenter(const glm::vec3& sphereCenter)
+{
+    if (sphereCenter == m_sphereCenter)
+        return;
+
+    m_sphereCenter = sphereCenter;
+    if (m_sphereInstance != ~0u)
+    {
+        m_accelerationStructure.SetInstanceTransform(m_sphereInstance, GetSphereTransform());
+    }
+}
+
+void RaytracingScene::Animate(float time)
+{
+    // The sphere circles around the middle of the box, starting at (0, 4, 4)
+    float angle = 0.5f * time;
+    SetSphereCenter(glm::vec3(2.0f * std::sin(angle), 4.0f, 2.0f + 2.0f * std::cos(angle)));
+
+    // The painting slides from side to side along its wall
+    if (m_paintingModel < GetModelCount())
+    {
+        SetModelTransform(m_paintingModel, glm::translate(glm::vec3(1.5f * std::sin(0.8f * time), 0.0f, 0.0f)));
+    }
+}
+
+glm::mat4 RaytracingScene::GetSphereTransform() const
+{
+    return glm::translate(m_sphereCenter) * glm::scale(glm::vec3(m_sphereRadius));
+}
+
+void RaytracingScene::UpdateLights()
+{
+    const std::vector<AccelerationInstance>& instances = m_accelerationStructure.GetInstances();
+    const std::vector<Triangle>& triangles = m_accelerationStructure.GetTriangles();
+    const std::vector<glm::vec3>& positions = m_accelerationStructure.GetVertexPositions();
+
+    // Accumulate the power of the lights in cdf first, and normalize it when the total is known
+    m_emissiveLights.clear();
+    float totalPower = 0.0f;
+    for (unsigned int instanceIndex = 0; instanceIndex < instances.size(); ++instanceIndex)
+    {
+        const AccelerationInstance& instance = instances[instanceIndex];
+
+        // Analytic primitives emit from their outer side
+        if (static_cast<PrimitiveType>(instance.primitiveType) != PrimitiveType::Mesh)
+        {
+            if (instance.materialId >= m_materials.size())
+                continue;
+
+            glm::vec3 emission(m_materials[instance.materialId].m_emissive);
+            float luminance = GetLuminance(emission);
+            float area = GetPrimitiveArea(instance);
+            if (luminance <= 0.0f || area <= 0.0f)
+                continue;
+
+            totalPower += luminance * area;
+            m_emissiveLights.push_back(EmissiveLight{ glm::vec3(0.0f), totalPower, glm::vec3(0.0f), area, glm::vec3(0.0f), instance.materialId,
+                emission, instanceIndex });
+            continue;
+        }
+
+        unsigned int first, count;
+        m_accelerationStructure.GetInstanceTriangles(instanceIndex, first, count);
+        for (unsigned int triangleIndex = first; triangleIndex < first + count; ++triangleIndex)
+        {
+            const Triangle& triangle = triangles[triangleIndex];
+            unsigned int materialId = instance.materialId + triangle.materialId;
+            if (materialId >= m_materials.size())
+                continue;
+
+            glm::vec3 emission(m_materials[materialId].m_emissive);
+            float luminance = GetLuminance(emission);
+            if (luminance <= 0.0f)
+                continue;
+
+            glm::vec3 v0 = instance.objectToWorld * glm::vec4(positions[triangle.indices.x], 1.0f);
+            glm::vec3 v1 = instance.objectToWorld * glm::vec4(positions[triangle.indices.y], 1.0f);
+            glm::vec3 v2 = instance.objectToWorld * glm::vec4(positions[triangle.indices.z], 1.0f);
+            float area = 0.5f * glm::length(glm::cross(v1 - v0, v2 - v0));
+            if (area <= 0.0f)
+                continue;
+
+            // Triangles emit on both sides
+            totalPower += luminance * 2.0f * area;
+            m_emissiveLights.push_back(EmissiveLight{ v0, totalPower, v1 - v0, area, v2 - v0, materialId, emission, NoInstance });
+        }
+    }
+
+    m_lightPdfScale = totalPower > 0.0f ? 1.0f / totalPower : 0.0f;
+    for (EmissiveLight& emissiveLight : m_emissiveLights)
+    {
+        emissiveLight.cdf *= m_lightPdfScale;
+    }
+    if (!m_emissiveLights.empty())
+    {
+        m_emissiveLights.back().cdf = 1.0f;
+    }
+}
+
+float RaytracingScene::GetPrimitiveArea(const AccelerationInstance& instance)
+{
+    // Columns of the transform, the axes of the unit primitive in world space
+    glm::vec3 axisX(instance.objectToWorld[0]);
+    glm::vec3 axisY(instance.objectToWorld[1]);
+    glm::vec3 axisZ(instance.objectToWorld[2]);
+    if (static_cast<PrimitiveType>(instance.primitiveType) == PrimitiveType::Sphere)
+    {
+        float radius = glm::length(axisX);
+        return 4.0f * glm::pi<float>() * radius * radius;
+    }
+
+    // Two faces per axis, each one 2x2 in object space
+    return 8.0f * (glm::length(glm::cross(axisY, axisZ)) + glm::length(glm::cross(axisZ, axisX)) + glm::length(glm::cross(axisX, axisY)));
+}
+
+float RaytracingScene::GetLuminance(const glm::vec3& color)
+{
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+void RaytracingScene::AddMaterial(const RaytracingMaterial& material, const char* textureFile)
+{
+    m_materials.push_back(material);
+    if (*textureFile)
+    {
+        m_textureFiles.push_back(textureFile);
+        m_materials.back().m_textureLayer = static_cast<unsigned int>(m_textureFiles.size());
+    }
+}
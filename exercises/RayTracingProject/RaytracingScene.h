@@ -0,0 +1,196 @@
+#pragma once
+
+#include <ituGL/raytracing/AccelerationStructure.h>
+#include <glm/mat4x4.hpp>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Camera;
+class Model;
+class ModelLoader;
+
+// Laid out to match the std430 struct used in the shaders
+struct RaytracingMaterial {
+    RaytracingMaterial(const unsigned int materialId, glm::vec4 albedo = glm::vec4(0.f), const float roughness = 0.f, const float metallic = 0.f,
+        const float ior = 0.f, const glm::vec4 emissive = glm::vec4(0.f)) {
+        m_materialId = materialId;
+        m_albedo = albedo;
+        m_roughness = roughness;
+        m_metallic = metallic;
+        m_ior = ior;
+        m_emissive = emissive;
+    }
+
+    unsigned int m_materialId;
+    float m_roughness = 0.f;
+    float m_metallic = 0.f;
+    float m_ior = 0.f;
+    glm::vec4 m_albedo = glm::vec4(0.f);
+    glm::vec4 m_emissive = glm::vec4(0.f);
+    // Layer of the texture array multiplied with the albedo. Layer 0 is white, for the materials without texture
+    unsigned int m_textureLayer = 0;
+    float m_padding[3] = {};
+};
+
+// Textures of the materials, resized to the same size so they can be the layers of a single texture array
+// The mipmaps are built here, so the CPU path tracer filters the same texels as the GPU
+struct TextureLayers {
+    // Size of the first level. Each level halves it, down to 1x1
+    int width = 0;
+    int height = 0;
+    unsigned int layerCount = 0;
+    // RGBA texels of each level, one layer after the other, with the first row at the bottom as OpenGL expects
+    std::vector<std::vector<unsigned char>> levels;
+
+    inline int GetLevelWidth(unsigned int level) const { return std::max(width >> level, 1); }
+    inline int GetLevelHeight(unsigned int level) const { return std::max(height >> level, 1); }
+};
+
+// Light sampled by next-event estimation: a triangle with an emissive material in world space, or an analytic primitive with one
+// Each light is picked with a probability proportional to its power. Laid out to match the std430 struct used in the shaders
+struct EmissiveLight {
+    // First vertex of the triangle, and its two edges from it. Primitives are placed by their instance
+    glm::vec3 v0;
+    // Probability of picking this light, or any light before it
+    float cdf;
+    glm::vec3 v1v0;
+    // Surface area in world space
+    float area;
+    glm::vec3 v2v0;
+    unsigned int materialId;
+    glm::vec3 emission;
+    // Instance of the analytic primitive, in AccelerationStructure::GetInstances(), or NoInstance for a triangle
+    unsigned int instanceIndex;
+};
+
+// Scene traced by both the shaders and the CPU path tracer: the mesh instances, their materials and the sphere light
+// It doesn't create any OpenGL object, so it can be loaded without a window
+class RaytracingScene
+{
+public:
+    RaytracingScene();
+
+    // Add the materials, with the texture of each one
+    void InitializeMaterials();
+
+    // Load the models of the Cornell box, and place the sphere light
+    // Call it after InitializeMaterials, the sphere light has its own material
+    void InitializeModels(ModelLoader& loader);
+
+    // Add a grid of analytic spheres and oriented boxes on the floor, some of them emissive, to trace many primitives and lights
+    // Call it after InitializeMaterials
+    void InitializePrimitives();
+
+    // Hang a grid of small emissive panels under the ceiling, instances of its quad, to light the room with many emissive triangles
+    // Call it after InitializeModels
+    void InitializeLightPanels(ModelLoader& loader);
+
+    // Place the camera looking into the box
+    static void InitializeCamera(Camera& camera, float aspectRatio);
+
+    void LoadModel(ModelLoader& loader, const char* path, unsigned int materialId = 0, glm::mat4 transform = glm::mat4(1.0f));
+
+    // Move a loaded model. The acceleration structure applies it on its next Update. Moving it where it already is does nothing
+    void SetModelTransform(unsigned int modelIndex, const glm::mat4& transform);
+
+    // Move the sphere light and the painting along fixed paths, to the place they have at this time in seconds
+    // They are at their initial place at time 0
+    void Animate(float time);
+
+    // Loaded models, in the order of LoadModel, to rasterize them with the placement and materials they are traced with
+    inline unsigned int GetModelCount() const { return static_cast<unsigned int>(m_models.size()); }
+    inline const std::shared_ptr<Model>& GetModel(unsigned int modelIndex) const { return m_models[modelIndex].model; }
+    inline const glm::mat4& GetModelTransform(unsigned int modelIndex) const { return m_models[modelIndex].transform; }
+    // Material of the first submesh. The material of each other submesh follows it
+    inline unsigned int GetModelMaterialId(unsigned int modelIndex) const { return m_models[modelIndex].materialId; }
+
+    // Collect the triangles and the analytic primitives with emissive materials, and pick each light with a probability proportional to its power
+    // Call it after building or updating the acceleration structure, the lights reference the sorted instances
+    void UpdateLights();
+
+    inline AccelerationStructure& GetAccelerationStructure() { return m_accelerationStructure; }
+    inline const AccelerationStructure& GetAccelerationStructure() const { return m_accelerationStructure; }
+
+    inline const std::vector<RaytracingMaterial>& GetMaterials() const { return m_materials; }
+
+    // Id of the material of the sphere light
+    static constexpr unsigned int SphereLightMaterialId = 103;
+
+    // Load the textures of the materials, and pack them in layers of the size of the largest one, up to MaxTextureSize
+    void LoadTextures();
+
+    inline const TextureLayers& GetTextureLayers() const { return m_textureLayers; }
+
+    static constexpr int MaxTextureSize = 2048;
+
+    inline const glm::vec3& GetSphereCenter() const { return m_sphereCenter; }
+    // Move the sphere light. The acceleration structure applies it on its next Update. Moving it where it already is does nothing
+    void SetSphereCenter(const glm::vec3& sphereCenter);
+    inline float GetSphereRadius() const { return m_sphereRadius; }
+
+    inline const glm::vec3& GetLightColor() const { return m_lightColor; }
+    inline float GetLightIntensity() const { return m_lightIntensity; }
+
+    inline const std::vector<EmissiveLight>& GetEmissiveLights() const { return m_emissiveLights; }
+
+    // EmissiveLight::instanceIndex of the triangles. NoInstance in the shaders
+    static constexpr unsigned int NoInstance = 0xffffffff;
+
+    // Inverse of the total power of the lights, so the probability of picking a light is its power times this
+    // The power of a light is the luminance of its emission times its area, twice for the triangles, which emit from both sides
+    inline float GetLightPdfScale() const { return m_lightPdfScale; }
+
+    // Surface area of an analytic primitive in world space. Spheres must be scaled uniformly. GetPrimitiveArea in the shaders
+    static float GetPrimitiveArea(const AccelerationInstance& instance);
+
+    // Same as GetLuminance in the shaders
+    static float GetLuminance(const glm::vec3& color);
+
+private:
+    void AddMaterial(const RaytracingMaterial& material, const char* textureFile = "");
+
+    // Placement of the unit sphere primitive for the sphere light
+    glm::mat4 GetSphereTransform() const;
+
+    // Model placed by LoadModel, and its instance in the acceleration structure
+    struct ModelEntry
+    {
+        std::shared_ptr<Model> model;
+        glm::mat4 transform;
+        unsigned int materialId;
+        unsigned int instanceIndex;
+    };
+
+private:
+    // Per-mesh hierarchies, and a hierarchy over the mesh instances
+    AccelerationStructure m_accelerationStructure;
+
+    std::vector<ModelEntry> m_models;
+
+    // Model moved by Animate
+    unsigned int m_paintingModel;
+
+    std::vector<RaytracingMaterial> m_materials;
+
+    // Texture of each layer after the white one
+    std::vector<std::string> m_textureFiles;
+
+    TextureLayers m_textureLayers;
+
+    // The sphere light, an analytic primitive of the acceleration structure with its own material
+    glm::vec3 m_sphereCenter;
+    float m_sphereRadius;
+    unsigned int m_sphereInstance;
+    unsigned int m_sphereMaterial;
+
+    // First of the materials of InitializePrimitives: matte, metal, and two emissive colors
+    unsigned int m_primitiveMaterial;
+    glm::vec3 m_lightColor;
+    float m_lightIntensity;
+
+    // Lights from the materials of the meshes and the primitives, the sphere light among them
+    std::vector<EmissiveLight> m_emissiveLights;
+    float m_lightPdfScale;
+};
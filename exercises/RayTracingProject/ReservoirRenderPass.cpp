@@ -0,0 +1,83 @@
+#include "ReservoirRenderPass.h"
+
+#include <ituGL/camera/Camera.h>
+#include <ituGL/renderer/Renderer.h>
+#include <ituGL/shader/Material.h>
+#include <ituGL/texture/Texture2DObject.h>
+#include <ituGL/texture/FramebufferObject.h>
+#include <array>
+#include <cassert>
+
+static std::shared_ptr<Texture2DObject> CreateTexture(int width, int height)
+{
+    // Full precision: the light points and positions are compared in world space, and the light indices are stored as floats
+    std::shared_ptr<Texture2DObject> texture = std::make_shared<Texture2DObject>();
+    texture->Bind();
+    texture->SetImage(0, width, height, TextureObject::FormatRGBA, TextureObject::InternalFormat::InternalFormatRGBA32F);
+    texture->SetParameter(TextureObject::ParameterEnum::MinFilter, GL_NEAREST);
+    texture->SetParameter(TextureObject::ParameterEnum::MagFilter, GL_NEAREST);
+    Texture2DObject::Unbind();
+    return texture;
+}
+
+ReservoirRenderPass::Buffers::Buffers(int width, int height)
+    : lightTexture(CreateTexture(width, height))
+    , positionTexture(CreateTexture(width, height))
+    , weightTexture(CreateTexture(width, height))
+    , framebuffer(std::make_shared<FramebufferObject>())
+{
+    framebuffer->Bind();
+    framebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color0, *lightTexture);
+    framebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color1, *positionTexture);
+    framebuffer->SetTexture(FramebufferObject::Target::Draw, FramebufferObject::Attachment::Color2, *weightTexture);
+    framebuffer->SetDrawBuffers(std::array<FramebufferObject::Attachment, 3>({ FramebufferObject::Attachment::Color0, FramebufferObject::Attachment::Color1,
+        FramebufferObject::Attachment::Color2 }));
+    FramebufferObject::Unbind();
+}
+
+ReservoirRenderPass::ReservoirRenderPass(std::shared_ptr<Material> material, std::shared_ptr<Material> shadingMaterial, int width, int height)
+    : m_material(material)
+    , m_shadingMaterial(shadingMaterial)
+    , m_buffers{ Buffers(width, height), Buffers(width, height) }
+    , m_currentBuffers(0)
+    , m_frameCount(0)
+    , m_hasPrevious(false)
+    , m_previousViewProjMatrix(1.0f)
+{
+    m_shadingMaterial->SetUniformValue("LightReservoirs", 1u);
+}
+
+void ReservoirRenderPass::Reset()
+{
+    m_hasPrevious = false;
+}
+
+void ReservoirRenderPass::Render()
+{
+    Renderer& renderer = GetRenderer();
+
+    const Buffers& previous = m_buffers[m_currentBuffers];
+    m_currentBuffers = 1 - m_currentBuffers;
+    const Buffers& current = m_buffers[m_currentBuffers];
+
+    assert(m_material);
+    m_material->SetUniformValue("FrameCount", ++m_frameCount);
+    m_material->SetUniformValue("TemporalReuse", m_hasPrevious ? 1u : 0u);
+    m_material->SetUniformValue("PreviousViewProjMatrix", m_previousViewProjMatrix);
+    m_material->SetUniformValue("ReservoirLightTexture", previous.lightTexture);
+    m_material->SetUniformValue("ReservoirPositionTexture", previous.positionTexture);
+    m_material->SetUniformValue("ReservoirWeightTexture", previous.weightTexture);
+
+    // Pixels without an opaque primary hit write empty reservoirs, so there is nothing to clear
+    current.framebuffer->Bind();
+    m_material->Use();
+    renderer.GetFullscreenMesh().DrawSubmesh(0);
+
+    // The primary hits of the frame read the new reservoirs
+    m_shadingMaterial->SetUniformValue("ReservoirLightTexture", current.lightTexture);
+    m_shadingMaterial->SetUniformValue("ReservoirPositionTexture", current.positionTexture);
+    m_shadingMaterial->SetUniformValue("ReservoirWeightTexture", current.weightTexture);
+
+    m_previousViewProjMatrix = renderer.GetCurrentCamera().GetViewProjectionMatrix();
+    m_hasPrevious = true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <ituGL/renderer/RenderPass.h>
+
+#include <glm/mat4x4.hpp>
+#include <memory>
+
+class Material;
+class Texture2DObject;
+class FramebufferObject;
+
+// Resamples the lights of the primary hit of each pixel with weighted reservoirs, for the direct lighting of the shading material
+// The material draws the reservoirs with reservoirs.frag: the candidates of each pixel, and the reservoir of the previous frame where
+// the previous camera saw the same surface. The shading material reads them, and its neighbors, in the primary hits. See lightreservoirs.glsl
+class ReservoirRenderPass : public RenderPass
+{
+public:
+    ReservoirRenderPass(std::shared_ptr<Material> material, std::shared_ptr<Material> shadingMaterial, int width, int height);
+
+    void Render() override;
+
+    // Drop the reservoirs of the previous frame, for example when the scene changed
+    void Reset();
+
+private:
+    // Light, position and weight textures, attached to a framebuffer in this order
+    struct Buffers
+    {
+        Buffers(int width, int height);
+
+        std::shared_ptr<Texture2DObject> lightTexture;
+        std::shared_ptr<Texture2DObject> positionTexture;
+        std::shared_ptr<Texture2DObject> weightTexture;
+
+        std::shared_ptr<FramebufferObject> framebuffer;
+    };
+
+private:
+    std::shared_ptr<Material> m_material;
+    std::shared_ptr<Material> m_shadingMaterial;
+
+    // Each frame draws to one set and reads the previous frame from the other
+    Buffers m_buffers[2];
+    unsigned int m_currentBuffers;
+
+    // Frames drawn, never reset so the candidates of each frame are new
+    unsigned int m_frameCount;
+
+    // The previous buffers have the reservoirs of the previous frame
+    bool m_hasPrevious;
+
+    // Camera of the previous frame
+    glm::mat4 m_previousViewProjMatrix;
+};
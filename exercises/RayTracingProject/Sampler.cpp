@@ -0,0 +1,254 @@
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Direction numbers of the first 4 dimensions of the Sobol sequence, for each bit of the index
+static const unsigned int SobolDirections[32][4] =
+{
+    { 0x80000000u, 0x80000000u, 0x80000000u, 0x80000000u },
+    { 0x40000000u, 0xc0000000u, 0xc0000000u, 0xc0000000u },
+    { 0x20000000u, 0xa0000000u, 0x60000000u, 0x20000000u },
+    { 0x10000000u, 0xf0000000u, 0x90000000u, 0x50000000u },
+    { 0x08000000u, 0x88000000u, 0xe8000000u, 0xf8000000u },
+    { 0x04000000u, 0xcc000000u, 0x5c000000u, 0x74000000u },
+    { 0x02000000u, 0xaa000000u, 0x8e000000u, 0xa2000000u },
+    { 0x01000000u, 0xff000000u, 0xc5000000u, 0x93000000u },
+    { 0x00800000u, 0x80800000u, 0x68800000u, 0xd8800000u },
+    { 0x00400000u, 0xc0c00000u, 0x9cc00000u, 0x25400000u },
+    { 0x00200000u, 0xa0a00000u, 0xee600000u, 0x59e00000u },
+    { 0x00100000u, 0xf0f00000u, 0x55900000u, 0xe6d00000u },
+    { 0x00080000u, 0x88880000u, 0x80680000u, 0x78080000u },
+    { 0x00040000u, 0xcccc0000u, 0xc09c0000u, 0xb40c0000u },
+    { 0x00020000u, 0xaaaa0000u, 0x60ee0000u, 0x82020000u },
+    { 0x00010000u, 0xffff0000u, 0x90550000u, 0xc3050000u },
+    { 0x00008000u, 0x80008000u, 0xe8808000u, 0x208f8000u },
+    { 0x00004000u, 0xc000c000u, 0x5cc0c000u, 0x51474000u },
+    { 0x00002000u, 0xa000a000u, 0x8e606000u, 0xfbea2000u },
+    { 0x00001000u, 0xf000f000u, 0xc5909000u, 0x75d93000u },
+    { 0x00000800u, 0x88008800u, 0x6868e800u, 0xa0858800u },
+    { 0x00000400u, 0xcc00cc00u, 0x9c9c5c00u, 0x914e5400u },
+    { 0x00000200u, 0xaa00aa00u, 0xeeee8e00u, 0xdbe79e00u },
+    { 0x00000100u, 0xff00ff00u, 0x5555c500u, 0x25db6d00u },
+    { 0x00000080u, 0x80808080u, 0x8000e880u, 0x58800080u },
+    { 0x00000040u, 0xc0c0c0c0u, 0xc0005cc0u, 0xe54000c0u },
+    { 0x00000020u, 0xa0a0a0a0u, 0x60008e60u, 0x79e00020u },
+    { 0x00000010u, 0xf0f0f0f0u, 0x9000c590u, 0xb6d00050u },
+    { 0x00000008u, 0x88888888u, 0xe8006868u, 0x800800f8u },
+    { 0x00000004u, 0xccccccccu, 0x5c009c9cu, 0xc00c0074u },
+    { 0x00000002u, 0xaaaaaaaau, 0x8e00eeeeu, 0x200200a2u },
+    { 0x00000001u, 0xffffffffu, 0xc5005555u, 0x50050093u }
+};
+
+Sampler::Sampler() : m_type(Type::Sobol)
+{
+    CreateBlueNoise(m_blueNoise);
+}
+
+void Sampler::StartSample(State& state, unsigned int x, unsigned int y, unsigned int sampleIndex) const
+{
+    unsigned int seedX = x, seedY = y, seedTime = sampleIndex + 1;
+    state.randSeed = LCG(seedX) ^ LCG(seedY) ^ LCG(seedTime);
+
+    state.pixelX = x;
+    state.pixelY = y;
+    state.pixelSeed = m_type == Type::BlueNoise ? 0u : Hash(x ^ Hash(y));
+    state.sampleIndex = sampleIndex;
+    state.raySeed = 0;
+    state.dimension = 0;
+}
+
+void Sampler::StartRay(State& state, unsigned int rayIndex) const
+{
+    state.raySeed = Hash(state.pixelSeed ^ Hash(rayIndex));
+    state.dimension = 0;
+}
+
+float Sampler::Next(State& state) const
+{
+    if (m_type == Type::Random)
+    {
+        return static_cast<float>(LCG(state.randSeed)) / static_cast<float>(0x01000000u);
+    }
+
+    // The 4 points of a group are computed together, when its first dimension is taken
+    unsigned int dimension = state.dimension++;
+    if (dimension % 4 == 0)
+    {
+        state.groupSeed = Hash(state.raySeed ^ Hash(dimension / 4));
+        Sobol(NestedUniformScramble(state.sampleIndex, state.groupSeed), state.groupPoints);
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            state.groupPoints[i] = NestedUniformScramble(state.groupPoints[i], Hash(state.groupSeed + i + 1));
+        }
+    }
+    unsigned int x = state.groupPoints[dimension % 4];
+
+    if (m_type == Type::BlueNoise)
+    {
+        // Shift the tile for each dimension, so the dimensions are not correlated
+        unsigned int shift = Hash(state.groupSeed ^ dimension);
+        unsigned int texelX = (state.pixelX + shift) & (BlueNoiseSize - 1);
+        unsigned int texelY = (state.pixelY + (shift >> 16)) & (BlueNoiseSize - 1);
+        x += static_cast<unsigned int>(m_blueNoise[texelY * BlueNoiseSize + texelX]) << 20;
+    }
+
+    return static_cast<float>(x >> 8) / static_cast<float>(0x01000000u);
+}
+
+unsigned int Sampler::LCG(unsigned int& prev)
+{
+    const unsigned int LCG_A = 1664525u;
+    const unsigned int LCG_C = 1013904223u;
+    prev = (LCG_A * prev + LCG_C);
+    return prev & 0x00FFFFFFu;
+}
+
+unsigned int Sampler::Hash(unsigned int x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+void Sampler::Sobol(unsigned int index, unsigned int points[4])
+{
+    points[0] = points[1] = points[2] = points[3] = 0;
+    for (unsigned int bit = 0; index != 0; ++bit, index >>= 1)
+    {
+        // Masked instead of branching, the bits of the shuffled indices are random
+        unsigned int mask = 0u - (index & 1);
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            points[i] ^= SobolDirections[bit][i] & mask;
+        }
+    }
+}
+
+unsigned int Sampler::NestedUniformScramble(unsigned int x, unsigned int seed)
+{
+    // Each bit is flipped depending on the bits above it (Laine-Karras hash, with the constants of Helmer et al. 2021)
+    x = ReverseBits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1u;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return ReverseBits(x);
+}
+
+unsigned int Sampler::ReverseBits(unsigned int x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+void Sampler::CreateBlueNoise(std::vector<std::uint16_t>& ranks)
+{
+    const unsigned int size = BlueNoiseSize;
+    const unsigned int mask = size - 1;
+    const unsigned int pixelCount = size * size;
+    const float sigma = 1.5f;
+
+    // Gaussian of the toroidal distance between two pixels, indexed by the wrapped offset between them
+    std::vector<float> kernel(pixelCount);
+    for (unsigned int y = 0; y < size; ++y)
+    {
+        for (unsigned int x = 0; x < size; ++x)
+        {
+            float dx = static_cast<float>(std::min(x, size - x));
+            float dy = static_cast<float>(std::min(y, size - y));
+            kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+    }
+
+    // Energy of each pixel: sum of the kernel from all the pixels set in the pattern
+    std::vector<float> energy(pixelCount, 0.0f);
+    std::vector<bool> pattern(pixelCount, false);
+    auto togglePixel = [&](unsigned int pixel)
+    {
+        pattern[pixel] = !pattern[pixel];
+        float sign = pattern[pixel] ? 1.0f : -1.0f;
+        unsigned int px = pixel % size, py = pixel / size;
+        for (unsigned int y = 0; y < size; ++y)
+        {
+            for (unsigned int x = 0; x < size; ++x)
+            {
+                energy[y * size + x] += sign * kernel[((y - py) & mask) * size + ((x - px) & mask)];
+            }
+        }
+    };
+
+    // Tightest cluster is the set pixel with the highest energy, and largest void the unset pixel with the lowest one
+    auto findTightestCluster = [&]()
+    {
+        unsigned int best = 0;
+        for (unsigned int pixel = 1; pixel < pixelCount; ++pixel)
+        {
+            best = pattern[pixel] && (!pattern[best] || energy[pixel] > energy[best]) ? pixel : best;
+        }
+        return best;
+    };
+    auto findLargestVoid = [&]()
+    {
+        unsigned int best = 0;
+        for (unsigned int pixel = 1; pixel < pixelCount; ++pixel)
+        {
+            best = !pattern[pixel] && (pattern[best] || energy[pixel] < energy[best]) ? pixel : best;
+        }
+        return best;
+    };
+
+    // Initial pattern with a tenth of the pixels, at random
+    unsigned int seed = 1;
+    unsigned int initialCount = pixelCount / 10;
+    for (unsigned int count = 0; count < initialCount; )
+    {
+        unsigned int pixel = LCG(seed) % pixelCount;
+        if (!pattern[pixel])
+        {
+            togglePixel(pixel);
+            ++count;
+        }
+    }
+
+    // Move the pixels of the tightest clusters to the largest voids, until it is the same pixel
+    while (true)
+    {
+        unsigned int cluster = findTightestCluster();
+        togglePixel(cluster);
+        unsigned int largestVoid = findLargestVoid();
+        togglePixel(largestVoid);
+        if (largestVoid == cluster)
+        {
+            break;
+        }
+    }
+    std::vector<bool> prototypePattern = pattern;
+    std::vector<float> prototypeEnergy = energy;
+
+    // Rank the initial pixels, removing the tightest clusters first
+    ranks.assign(pixelCount, 0);
+    for (unsigned int rank = initialCount; rank-- > 0; )
+    {
+        unsigned int cluster = findTightestCluster();
+        togglePixel(cluster);
+        ranks[cluster] = static_cast<std::uint16_t>(rank);
+    }
+
+    // Rank the rest, filling the largest voids first
+    pattern = prototypePattern;
+    energy = prototypeEnergy;
+    for (unsigned int rank = initialCount; rank < pixelCount; ++rank)
+    {
+        unsigned int largestVoid = findLargestVoid();
+        togglePixel(largestVoid);
+        ranks[largestVoid] = static_cast<std::uint16_t>(rank);
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Random numbers of the path tracer, indexed by pixel, sample index and dimension. Same sequences as sampler.glsl
+// Each ray of a sample starts a new range of dimensions. The dimensions of each ray are split in groups of 4, and each group is
+// a 4D Sobol sequence with nested uniform scrambling seeded by the pixel, the ray and the group, and a shuffled sample index
+class Sampler
+{
+public:
+    // SamplerType in the shaders
+    enum class Type : unsigned int
+    {
+        // LCG seeded by the pixel and the sample index, the original generator
+        Random = 0,
+        // Scrambled Sobol sequence, with a different scrambling for each pixel
+        Sobol = 1,
+        // Scrambled Sobol sequence shared by all the pixels, shifted by the value of a blue noise tile
+        BlueNoise = 2,
+    };
+
+    // Side of the blue noise tile
+    static constexpr unsigned int BlueNoiseSize = 64;
+
+    // Position in the sequence of a sample of a pixel
+    struct State
+    {
+        unsigned int randSeed;
+        unsigned int pixelX, pixelY;
+        unsigned int pixelSeed;
+        unsigned int sampleIndex;
+        unsigned int raySeed;
+        unsigned int dimension;
+        // Points of the current group of dimensions, and the seed of the group
+        unsigned int groupPoints[4];
+        unsigned int groupSeed;
+    };
+
+    Sampler();
+
+    inline Type GetType() const { return m_type; }
+    inline void SetType(Type type) { m_type = type; }
+
+    // Ranks of the pixels of the blue noise tile, from 0 to BlueNoiseSize^2 - 1, in rows
+    inline const std::vector<std::uint16_t>& GetBlueNoise() const { return m_blueNoise; }
+
+    // Start the sequence of a sample of a pixel. InitSampler in the shaders
+    void StartSample(State& state, unsigned int x, unsigned int y, unsigned int sampleIndex) const;
+
+    // Start the range of dimensions of the ray cast at this index of the sample. StartSampleRay in the shaders
+    void StartRay(State& state, unsigned int rayIndex) const;
+
+    // Next number of the sequence, between 0 and 1. SampleNext in the shaders
+    float Next(State& state) const;
+
+    static unsigned int LCG(unsigned int& prev);
+
+    // Integer hash with good avalanche (lowbias32). Hash in the shaders
+    static unsigned int Hash(unsigned int x);
+
+private:
+    // Point of the first 4 dimensions of the Sobol sequence, as 32-bit fractions
+    static void Sobol(unsigned int index, unsigned int points[4]);
+
+    // Random permutation of a 32-bit fraction that keeps the stratification of the sequence, like Owen scrambling
+    static unsigned int NestedUniformScramble(unsigned int x, unsigned int seed);
+
+    static unsigned int ReverseBits(unsigned int x);
+
+    // Rank the pixels of a tile with the void-and-cluster method (Ulichney 1993), so the pixels with the lowest ranks
+    // are spread evenly for any threshold
+    static void CreateBlueNoise(std::vector<std::uint16_t>& ranks);
+
+private:
+    Type m_type;
+
+    std::vector<std::uint16_t> m_blueNoise;
+};
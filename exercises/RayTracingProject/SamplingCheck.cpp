@@ -0,0 +1,165 @@
+#include "SamplingCheck.h"
+
+#include "GgxMicrofacet.h"
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Bins of the histogram over the sphere of reflected directions, uniform in the polar and azimuthal angles
+static constexpr unsigned int ThetaBins = 90;
+static constexpr unsigned int PhiBins = 180;
+
+// Quadrature points per side of each bin
+static constexpr unsigned int BinSubdivisions = 8;
+
+// Expected count below which bins are pooled together for the chi-square test
+static constexpr double MinExpectedCount = 5.0;
+
+// Reflectance used for the Fresnel term, so the weight check includes it
+static constexpr float Reflectance = 0.5f;
+
+static float FresnelSchlick(float f0, float VdotH)
+{
+    return f0 + (1.0f - f0) * std::pow(1.0f - std::max(VdotH, 0.0f), 5.0f);
+}
+
+static unsigned int GetBin(const glm::vec3& direction)
+{
+    float theta = std::acos(std::clamp(direction.z, -1.0f, 1.0f));
+    float phi = std::atan2(direction.y, direction.x);
+    phi = phi < 0.0f ? phi + glm::two_pi<float>() : phi;
+    unsigned int thetaBin = std::min(static_cast<unsigned int>(theta / glm::pi<float>() * ThetaBins), ThetaBins - 1);
+    unsigned int phiBin = std::min(static_cast<unsigned int>(phi / glm::two_pi<float>() * PhiBins), PhiBins - 1);
+    return thetaBin * PhiBins + phiBin;
+}
+
+// Integrate the density of the reflected directions over each bin, and the BRDF times the cosine over the upper hemisphere
+static void IntegrateBins(const glm::vec3& view, float alpha, std::vector<double>& binPdfs, double& brdfIntegral)
+{
+    const double thetaStep = glm::pi<double>() / (ThetaBins * BinSubdivisions);
+    const double phiStep = glm::two_pi<double>() / (PhiBins * BinSubdivisions);
+
+    binPdfs.assign(ThetaBins * PhiBins, 0.0);
+    brdfIntegral = 0.0;
+    for (unsigned int i = 0; i < ThetaBins * BinSubdivisions; ++i)
+    {
+        double theta = (i + 0.5) * thetaStep;
+        double solidAngle = std::sin(theta) * thetaStep * phiStep;
+        for (unsigned int j = 0; j < PhiBins * BinSubdivisions; ++j)
+        {
+            double phi = (j + 0.5) * phiStep;
+            glm::vec3 light(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+            glm::vec3 halfVector = glm::normalize(view + light);
+            float pdf = GgxMicrofacet::GetReflectionPdf(view.z, halfVector.z, alpha);
+            binPdfs[(i / BinSubdivisions) * PhiBins + j / BinSubdivisions] += pdf * solidAngle;
+
+            if (light.z > 0.0f)
+            {
+                // F D G2 / (4 NdotV), like the specular term of the next-event estimation
+                float brdfCosine = FresnelSchlick(Reflectance, glm::dot(view, halfVector)) * GgxMicrofacet::Distribution(halfVector.z, alpha)
+                    * GgxMicrofacet::SmithG2(view.z, light.z, alpha) / (4.0f * view.z);
+                brdfIntegral += brdfCosine * solidAngle;
+            }
+        }
+    }
+}
+
+// Chi-square statistic of the histogram, divided by its degrees of freedom. Bins with few expected samples are pooled
+static double GetChiSquare(const std::vector<unsigned int>& histogram, const std::vector<double>& binPdfs, unsigned int sampleCount)
+{
+    double chiSquare = 0.0;
+    unsigned int degreesOfFreedom = 0;
+    double pooledExpected = 0.0, pooledObserved = 0.0;
+    for (size_t bin = 0; bin < histogram.size(); ++bin)
+    {
+        double expected = binPdfs[bin] * sampleCount;
+        if (expected < MinExpectedCount)
+        {
+            pooledExpected += expected;
+            pooledObserved += histogram[bin];
+            continue;
+        }
+        double difference = histogram[bin] - expected;
+        chiSquare += difference * difference / expected;
+        ++degreesOfFreedom;
+    }
+    if (pooledExpected >= MinExpectedCount)
+    {
+        double difference = pooledObserved - pooledExpected;
+        chiSquare += difference * difference / pooledExpected;
+        ++degreesOfFreedom;
+    }
+    return degreesOfFreedom > 1 ? chiSquare / (degreesOfFreedom - 1) : 0.0;
+}
+
+bool RunSamplingCheck(unsigned int sampleCount)
+{
+    const float alphas[] = { 0.05f, 0.2f, 0.5f, 1.0f };
+    const float viewAngles[] = { 0.0f, 45.0f, 80.0f };
+
+    // Tolerances of the pdf integral, of the chi-square per degree of freedom, and of the relative error of the mean weight
+    const double pdfTolerance = 0.01;
+    const double chiSquareTolerance = 1.5;
+    const double weightTolerance = 0.01;
+
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    std::cout << "GGX sampling, " << sampleCount << " samples per case" << std::endl;
+    std::cout << "  alpha  view    pdf integral   chi2/dof   mean weight   BRDF integral" << std::endl;
+
+    bool passed = true;
+    std::vector<double> binPdfs;
+    std::vector<unsigned int> histogram(ThetaBins * PhiBins);
+    for (float alpha : alphas)
+    {
+        for (float viewAngle : viewAngles)
+        {
+            float angle = glm::radians(viewAngle);
+            glm::vec3 view(std::sin(angle), 0.0f, std::cos(angle));
+
+            double brdfIntegral;
+            IntegrateBins(view, alpha, binPdfs, brdfIntegral);
+            double pdfIntegral = 0.0;
+            for (double binPdf : binPdfs)
+            {
+                pdfIntegral += binPdf;
+            }
+
+            // Sample like CpuPathTracer::ProcessOutput. Directions below the surface are kept in the histogram, but have no weight
+            std::fill(histogram.begin(), histogram.end(), 0u);
+            double weightSum = 0.0;
+            for (unsigned int sample = 0; sample < sampleCount; ++sample)
+            {
+                glm::vec2 u;
+                u.x = uniform(generator);
+                u.y = uniform(generator);
+                glm::vec3 microfacetNormal = GgxMicrofacet::SampleVisibleNormal(view, alpha, u);
+                glm::vec3 light = glm::reflect(-view, microfacetNormal);
+                ++histogram[GetBin(light)];
+                if (light.z > 0.0f)
+                {
+                    glm::vec3 halfVector = glm::normalize(view + light);
+                    weightSum += FresnelSchlick(Reflectance, glm::dot(view, halfVector))
+                        * GgxMicrofacet::SmithG2(view.z, light.z, alpha) / GgxMicrofacet::SmithG1(view.z, alpha);
+                }
+            }
+            double chiSquare = GetChiSquare(histogram, binPdfs, sampleCount);
+            double meanWeight = weightSum / sampleCount;
+
+            bool casePassed = std::abs(pdfIntegral - 1.0) <= pdfTolerance && chiSquare <= chiSquareTolerance
+                && std::abs(meanWeight - brdfIntegral) <= weightTolerance * brdfIntegral;
+            passed = passed && casePassed;
+
+            std::cout << std::fixed << "  " << std::setprecision(2) << alpha << std::setw(6) << std::setprecision(0) << viewAngle
+                << std::setprecision(4) << std::setw(16) << pdfIntegral << std::setw(11) << chiSquare
+                << std::setw(14) << meanWeight << std::setw(16) << brdfIntegral << (casePassed ? "" : "  FAILED") << std::endl;
+        }
+    }
+    std::cout << (passed ? "Passed" : "Failed") << std::endl;
+    return passed;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Check the sampling of the GGX specular lobe against numerical integration of its density, for a range of roughness and view angles
+// The density must integrate to 1 over the sphere, a histogram of sampled directions must match the density integrated over its bins,
+// and the mean weight of the samples must match the integral of the BRDF times the cosine
+// Prints the results, and returns false if any of them is off
+bool RunSamplingCheck(unsigned int sampleCount);
@@ -1,7 +1,251 @@
 #include "MeshRaytracingApplication.h"
 
-int main()
+#include "CpuPathTracer.h"
+#include "Denoiser.h"
+#include "IntersectionBenchmark.h"
+#include "RadianceCache.h"
+#include "RaytracingScene.h"
+#include "SamplingCheck.h"
+#include <ituGL/asset/ModelLoader.h>
+#include <ituGL/camera/Camera.h>
+#include <ituGL/utils/ThreadPool.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Options of the CPU renderer
+struct CpuRenderOptions
+{
+    const char* outputPath = "render.ppm";
+    unsigned int width = 1024;
+    unsigned int height = 1024;
+    unsigned int sampleCount = 16;
+    // Rays per sample, or path length, as returned by GetRayTracerConfig in the shaders
+    unsigned int maxRays = 12;
+    // 0 uses all the cores
+    unsigned int threadCount = 0;
+    // Trace the primary rays in packets
+    bool packetTraversal = true;
+    // Algorithm used to build the bottom-level hierarchies
+    BVH::BuildMode buildMode = BVH::BuildMode::SAH;
+    // Options shared with the application: the integrator, the sampler, the denoiser, the radiance cache, the light reservoirs,
+    // the primitives and the light panels are used by both renderers, the others only by the application
+    RaytracingOptions raytracing;
+};
+
+// Encode a linear color value in sRGB, like the framebuffer of the application with GL_FRAMEBUFFER_SRGB enabled
+static float LinearToSRGB(float value)
+{
+    value = glm::clamp(value, 0.0f, 1.0f);
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Write the image as binary PPM, with 8 bits per component in sRGB
+static bool WriteImage(const char* path, unsigned int width, unsigned int height, const std::vector<glm::vec3>& image)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+
+    // Rows are stored bottom to top
+    std::vector<unsigned char> row(width * 3);
+    for (unsigned int y = height; y-- > 0; )
+    {
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            const glm::vec3& color = image[y * width + x];
+            row[3 * x + 0] = static_cast<unsigned char>(LinearToSRGB(color.r) * 255.0f + 0.5f);
+            row[3 * x + 1] = static_cast<unsigned char>(LinearToSRGB(color.g) * 255.0f + 0.5f);
+            row[3 * x + 2] = static_cast<unsigned char>(LinearToSRGB(color.b) * 255.0f + 0.5f);
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+    return file.good();
+}
+
+// Load the scene and build its acceleration structure, without creating a window or an OpenGL context
+static void InitializeSceneOnCpu(RaytracingScene& scene, ThreadPool& threadPool, BVH::BuildMode buildMode, bool primitives, bool lightPanels)
 {
-    MeshRaytracingApplication raytracingApplication;
+    // Only the ray tracing geometry is loaded
+    ModelLoader loader;
+    loader.SetCreateSubmeshes(false);
+
+    scene.InitializeMaterials();
+    scene.InitializeModels(loader);
+    if (primitives)
+    {
+        scene.InitializePrimitives();
+    }
+    if (lightPanels)
+    {
+        scene.InitializeLightPanels(loader);
+    }
+
+    AccelerationStructure& accelerationStructure = scene.GetAccelerationStructure();
+    accelerationStructure.SetThreadPool(&threadPool);
+    accelerationStructure.SetBuildMode(buildMode);
+    auto start = std::chrono::steady_clock::now();
+    accelerationStructure.Build();
+    std::cout << "Acceleration structure built in "
+        << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+
+    scene.UpdateLights();
+}
+
+// Render the scene with the CPU path tracer
+static int RenderOnCpu(const CpuRenderOptions& options)
+{
+    ThreadPool threadPool(options.threadCount);
+    RaytracingScene scene;
+    InitializeSceneOnCpu(scene, threadPool, options.buildMode, options.raytracing.primitives, options.raytracing.lightPanels);
+    scene.LoadTextures();
+
+    Camera camera;
+    RaytracingScene::InitializeCamera(camera, static_cast<float>(options.width) / options.height);
+
+    CpuPathTracer pathTracer(scene);
+    pathTracer.SetCamera(camera);
+    pathTracer.SetPacketTraversal(options.packetTraversal);
+    pathTracer.SetIntegrator(options.raytracing.pathIntegrator ? CpuPathTracer::Integrator::Path : CpuPathTracer::Integrator::RayTree);
+    pathTracer.SetMaxRays(options.maxRays);
+    pathTracer.SetNextEventEstimation(options.raytracing.nextEventEstimation);
+    pathTracer.SetSamplerType(options.raytracing.samplerType);
+    pathTracer.SetLightReservoirs(options.raytracing.lightReservoirs);
+
+    // Filled by the samples of all the passes, so the later ones end more paths on it
+    RadianceCache radianceCache;
+    if (options.raytracing.radianceCache)
+    {
+        pathTracer.SetRadianceCache(&radianceCache);
+    }
+
+    std::vector<glm::vec3> image;
+    DenoiserFeatures features;
+    pathTracer.Render(threadPool, options.width, options.height, options.sampleCount, image, options.raytracing.denoise ? &features : nullptr);
+
+    std::cout << options.width << "x" << options.height << ", " << options.sampleCount << " samples per pixel, "
+        << threadPool.GetThreadCount() << " threads: " << pathTracer.GetRenderTime() << " s, "
+        << pathTracer.GetSamplesPerSecond() / 1e6 << " Msamples/s, "
+        << pathTracer.GetRayCount() / pathTracer.GetRenderTime() / 1e6 << " Mrays/s" << std::endl;
+
+    if (options.raytracing.denoise)
+    {
+        Denoiser denoiser;
+        denoiser.Denoise(threadPool, options.width, options.height, features, image);
+        std::cout << "Denoised with " << GetSimdLevelName(denoiser.GetSimdLevel()) << " kernels: " << denoiser.GetDenoiseTime() * 1000.0 << " ms" << std::endl;
+    }
+
+    if (!WriteImage(options.outputPath, options.width, options.height, image))
+    {
+        std::cerr << "Failed to write " << options.outputPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Run with --cpu to render on the CPU instead of opening the window:
+// --cpu [--output render.ppm] [--width 1024] [--height 1024] [--samples 16] [--max-rays 12] [--threads 0] [--no-packets] [--build sah|morton]
+// [--integrator tree|path] [--no-nee] [--sampler random|sobol|bluenoise] [--denoise] [--radiance-cache]
+// [--light-reservoirs] [--primitives] [--light-panels], also used by the application without --cpu
+// The application also takes [--adaptive 0.05], to stop sampling the pixels whose error is below the target,
+// and [--max-samples 0], to stop accumulating after this number of samples per pixel,
+// and [--hybrid], to rasterize the primary hits on the meshes in a G-buffer and only trace the later bounces,
+// and [--animate], to move the sphere light and the painting every frame
+// Or with --benchmark [--rays 1000000] to measure the intersection kernels. Returns 1 if any of them finds different hits
+// Or with --check-sampling [--rays 1000000] to check the sampling of the specular lobe. Returns 1 if it fails
+int main(int argc, char* argv[])
+{
+    bool cpu = false;
+    bool benchmark = false;
+    bool checkSampling = false;
+    unsigned int benchmarkRayCount = 1000000;
+    CpuRenderOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (std::strcmp(argv[i], "--cpu") == 0)
+            cpu = true;
+        else if (std::strcmp(argv[i], "--no-packets") == 0)
+            options.packetTraversal = false;
+        else if (std::strcmp(argv[i], "--no-nee") == 0)
+            options.raytracing.nextEventEstimation = false;
+        else if (std::strcmp(argv[i], "--denoise") == 0)
+            options.raytracing.denoise = true;
+        else if (std::strcmp(argv[i], "--radiance-cache") == 0)
+            options.raytracing.radianceCache = true;
+        else if (std::strcmp(argv[i], "--light-reservoirs") == 0)
+            options.raytracing.lightReservoirs = true;
+        else if (std::strcmp(argv[i], "--build") == 0 && value && (std::strcmp(value, "sah") == 0 || std::strcmp(value, "morton") == 0))
+            options.buildMode = std::strcmp(argv[++i], "morton") == 0 ? BVH::BuildMode::Morton : BVH::BuildMode::SAH;
+        else if (std::strcmp(argv[i], "--integrator") == 0 && value && (std::strcmp(value, "tree") == 0 || std::strcmp(value, "path") == 0))
+            options.raytracing.pathIntegrator = std::strcmp(argv[++i], "path") == 0;
+        else if (std::strcmp(argv[i], "--sampler") == 0 && value
+            && (std::strcmp(value, "random") == 0 || std::strcmp(value, "sobol") == 0 || std::strcmp(value, "bluenoise") == 0))
+            options.raytracing.samplerType = std::strcmp(argv[++i], "random") == 0 ? Sampler::Type::Random
+                : std::strcmp(value, "sobol") == 0 ? Sampler::Type::Sobol : Sampler::Type::BlueNoise;
+        else if (std::strcmp(argv[i], "--adaptive") == 0 && value)
+            options.raytracing.adaptiveTargetError = std::max(0.0f, static_cast<float>(std::atof(argv[++i])));
+        else if (std::strcmp(argv[i], "--max-samples") == 0 && value)
+            options.raytracing.targetSampleCount = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--hybrid") == 0)
+            options.raytracing.hybrid = true;
+        else if (std::strcmp(argv[i], "--primitives") == 0)
+            options.raytracing.primitives = true;
+        else if (std::strcmp(argv[i], "--light-panels") == 0)
+            options.raytracing.lightPanels = true;
+        else if (std::strcmp(argv[i], "--animate") == 0)
+            options.raytracing.animate = true;
+        else if (std::strcmp(argv[i], "--benchmark") == 0)
+            benchmark = true;
+        else if (std::strcmp(argv[i], "--check-sampling") == 0)
+            checkSampling = true;
+        else if (std::strcmp(argv[i], "--rays") == 0 && value)
+            benchmarkRayCount = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--output") == 0 && value)
+            options.outputPath = argv[++i];
+        else if (std::strcmp(argv[i], "--width") == 0 && value)
+            options.width = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--height") == 0 && value)
+            options.height = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--samples") == 0 && value)
+            options.sampleCount = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--max-rays") == 0 && value)
+            options.maxRays = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--threads") == 0 && value)
+            options.threadCount = std::max(0, std::atoi(argv[++i]));
+        else
+        {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    if (checkSampling)
+    {
+        return RunSamplingCheck(benchmarkRayCount) ? 0 : 1;
+    }
+
+    if (benchmark)
+    {
+        ThreadPool threadPool(options.threadCount);
+        RaytracingScene scene;
+        InitializeSceneOnCpu(scene, threadPool, options.buildMode, options.raytracing.primitives, options.raytracing.lightPanels);
+        Camera camera;
+        RaytracingScene::InitializeCamera(camera, 1.0f);
+        return RunIntersectionBenchmark(scene.GetAccelerationStructure(), camera, threadPool, benchmarkRayCount) ? 0 : 1;
+    }
+
+    if (cpu)
+    {
+        return RenderOnCpu(options);
+    }
+
+    MeshRaytracingApplication raytracingApplication(options.raytracing);
     return raytracingApplication.Run();
 }
@@ -0,0 +1,105 @@
+//Inputs
+in vec2 TexCoord;
+
+//Outputs
+// Filtered illumination, with its variance in alpha. Or the final color, multiplied by the albedo again
+out vec4 FragColor;
+
+//Uniforms
+// Illumination, with its variance in alpha
+uniform sampler2D SourceTexture;
+
+// Primary hits: position, with the distance along the ray in w, or 0 if it missed, normal and albedo
+uniform sampler2D PositionTexture;
+uniform sampler2D NormalTexture;
+uniform sampler2D AlbedoTexture;
+
+// Distance between the taps of the 5x5 kernel, doubled in each iteration
+uniform int StepSize;
+
+// Multiply by the albedo, in the last iteration
+uniform uint Remodulate;
+
+// Edge-stopping functions, as in Dammertz et al. 2010 and Schied et al. 2017 (SVGF)
+// Luminance differences, relative to the standard deviation
+const float LuminanceSigma = 4.0f;
+// 1 - cosine between the normals
+const float NormalSigma = 1.0f / 128.0f;
+// Distance to the plane of the center pixel, relative to its distance along the ray
+const float PlaneSigma = 0.01f;
+
+// Weights of the B3 spline kernel, from the center
+const float KernelWeights[3] = float[3](3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f);
+
+vec3 GetDemodulationAlbedo(vec3 albedo)
+{
+	return mix(vec3(1.0f), albedo, greaterThan(albedo, vec3(0.01f)));
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	ivec2 maxPixel = textureSize(SourceTexture, 0) - ivec2(1);
+	vec4 center = texelFetch(SourceTexture, pixel, 0);
+	vec4 position = texelFetch(PositionTexture, pixel, 0);
+	vec3 normal = texelFetch(NormalTexture, pixel, 0).xyz;
+
+	// Rays that missed are not filtered
+	vec4 result = center;
+	if (position.w > 0.0f)
+	{
+		// Standard deviation of the luminance, from the variance blurred with a 3x3 gaussian to make it more stable
+		float variance = 0.0f;
+		for (int y = -1; y <= 1; ++y)
+		{
+			for (int x = -1; x <= 1; ++x)
+			{
+				float weight = (2.0f - abs(float(x))) * (2.0f - abs(float(y))) / 16.0f;
+				variance += weight * texelFetch(SourceTexture, clamp(pixel + ivec2(x, y), ivec2(0), maxPixel), 0).a;
+			}
+		}
+		float luminanceScale = 1.0f / (LuminanceSigma * sqrt(variance) + 1e-6f);
+		float luminance = GetLuminance(center.rgb);
+
+		vec3 colorSum = vec3(0.0f);
+		float varianceSum = 0.0f;
+		float weightSum = 0.0f;
+		for (int y = -2; y <= 2; ++y)
+		{
+			for (int x = -2; x <= 2; ++x)
+			{
+				ivec2 tapPixel = pixel + ivec2(x, y) * StepSize;
+				if (any(lessThan(tapPixel, ivec2(0))) || any(greaterThan(tapPixel, maxPixel)))
+				{
+					continue;
+				}
+
+				vec4 tap = texelFetch(SourceTexture, tapPixel, 0);
+				vec4 tapPosition = texelFetch(PositionTexture, tapPixel, 0);
+				vec3 tapNormal = texelFetch(NormalTexture, tapPixel, 0).xyz;
+				if (tapPosition.w == 0.0f)
+				{
+					continue;
+				}
+
+				float distance = abs(GetLuminance(tap.rgb) - luminance) * luminanceScale
+					+ (1.0f - dot(normal, tapNormal)) / NormalSigma
+					+ abs(dot(tapPosition.xyz - position.xyz, normal)) / (PlaneSigma * position.w);
+				float weight = KernelWeights[abs(x)] * KernelWeights[abs(y)] * exp(-distance);
+
+				colorSum += weight * tap.rgb;
+				varianceSum += weight * weight * tap.a;
+				weightSum += weight;
+			}
+		}
+
+		// The center always has a weight
+		result = vec4(colorSum / weightSum, varianceSum / (weightSum * weightSum));
+	}
+
+	if (Remodulate != 0u)
+	{
+		result = vec4(result.rgb * GetDemodulationAlbedo(texelFetch(AlbedoTexture, pixel, 0).rgb), 1.0f);
+	}
+	FragColor = result;
+}
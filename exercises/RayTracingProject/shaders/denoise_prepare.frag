@@ -0,0 +1,68 @@
+//Inputs
+in vec2 TexCoord;
+
+//Outputs
+// Mean of the pixel divided by the albedo of the primary hit, with the variance of its luminance in alpha
+out vec4 FragColor;
+
+//Uniforms
+// Sum of the samples of each pixel, with the sample count in alpha
+uniform sampler2D SourceTexture;
+
+// Sum of the squared luminance of the samples of each pixel
+uniform sampler2D MomentsTexture;
+
+uniform sampler2D AlbedoTexture;
+
+// Below this number of samples, the variance is estimated from the neighbors
+const float MinTemporalSampleCount = 4.0f;
+
+// Channels with a dark albedo are not divided, they would only amplify the noise
+vec3 GetDemodulationAlbedo(vec3 albedo)
+{
+	return mix(vec3(1.0f), albedo, greaterThan(albedo, vec3(0.01f)));
+}
+
+vec3 GetIllumination(ivec2 pixel)
+{
+	vec4 sum = texelFetch(SourceTexture, pixel, 0);
+	return sum.rgb / max(sum.a, 1.0f) / GetDemodulationAlbedo(texelFetch(AlbedoTexture, pixel, 0).rgb);
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 sum = texelFetch(SourceTexture, pixel, 0);
+	vec3 illumination = GetIllumination(pixel);
+	float sampleCount = sum.a;
+
+	float variance = 0.0f;
+	if (sampleCount >= MinTemporalSampleCount)
+	{
+		// Variance of the mean, from the variance of the samples
+		float mean = GetLuminance(sum.rgb) / sampleCount;
+		float sampleVariance = max(texelFetch(MomentsTexture, pixel, 0).r / sampleCount - mean * mean, 0.0f) * sampleCount / (sampleCount - 1.0f);
+		float albedoLuminance = GetLuminance(GetDemodulationAlbedo(texelFetch(AlbedoTexture, pixel, 0).rgb));
+		variance = sampleVariance / sampleCount / (albedoLuminance * albedoLuminance);
+	}
+	else
+	{
+		// Variance of the 3x3 neighbors
+		ivec2 maxPixel = textureSize(SourceTexture, 0) - ivec2(1);
+		float moment1 = 0.0f;
+		float moment2 = 0.0f;
+		for (int y = -1; y <= 1; ++y)
+		{
+			for (int x = -1; x <= 1; ++x)
+			{
+				float luminance = GetLuminance(GetIllumination(clamp(pixel + ivec2(x, y), ivec2(0), maxPixel)));
+				moment1 += luminance;
+				moment2 += luminance * luminance;
+			}
+		}
+		moment1 /= 9.0f;
+		variance = max(moment2 / 9.0f - moment1 * moment1, 0.0f);
+	}
+
+	FragColor = vec4(illumination, variance);
+}
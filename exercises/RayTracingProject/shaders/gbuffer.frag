@@ -0,0 +1,77 @@
+//Inputs
+in vec3 WorldPosition;
+in vec3 WorldNormal;
+in vec2 TexCoord;
+
+//Outputs
+// Textures of GBufferRenderPass: albedo multiplied by the texture, octahedral normal, and material index in the 8-bit alpha of the others
+layout(location = 0) out vec4 FragAlbedo;
+layout(location = 1) out vec2 FragNormal;
+layout(location = 2) out vec4 FragOthers;
+
+//Uniforms
+uniform mat4 ViewMatrix;
+uniform mat4 ViewProjMatrix;
+uniform mat4 InvProjMatrix;
+uniform vec3 CameraPosition;
+
+// Index of the material of the submesh
+uniform uint MaterialId;
+
+// Same as in intersection_checks.glsl
+struct Material
+{
+	uint materialId;
+	float roughness;
+	float metalness;
+	float ior;
+	vec4 albedo;
+	vec4 emissive;
+	uint textureLayer;
+};
+
+layout(binding = 3, std430) readonly buffer MaterialBuffer {
+    Material Materials[];
+};
+
+uniform sampler2DArray TextureArray;
+
+// Level of the texture array picked by GetTextureLod in intersection_checks.glsl for the primary ray of this pixel
+// The cone and the texture LOD offset of the triangle come from the screen space derivatives
+float GetPrimaryRayTextureLod(vec3 normal, vec3 direction)
+{
+	// Cone of the primary ray, as in raytracing.frag. It starts on the near side of the frustum, not at the camera
+	vec4 clipPosition = ViewProjMatrix * vec4(WorldPosition, 1.0f);
+	vec2 ndcPosition = clipPosition.xy / clipPosition.w;
+	float coneSpread = atan(InvProjMatrix[1][1] * abs(dFdy(ndcPosition.y)));
+	vec4 origin = InvProjMatrix * vec4(ndcPosition, 0.0f, 1.0f);
+	float distance = length((ViewMatrix * vec4(WorldPosition, 1.0f)).xyz) - length(origin.xyz / origin.w);
+
+	// Log2 of the uv area over the world area of the triangle, halved. The derivatives stay on the plane of the triangle
+	vec3 positionDx = dFdx(WorldPosition);
+	vec3 positionDy = dFdy(WorldPosition);
+	vec2 uvDx = dFdx(TexCoord);
+	vec2 uvDy = dFdy(TexCoord);
+	float uvArea = abs(uvDx.x * uvDy.y - uvDx.y * uvDy.x);
+	float area = length(cross(positionDx, positionDy));
+	float textureLodOffset = uvArea > 0.0f && area > 0.0f ? 0.5f * log2(uvArea / area) : 0.0f;
+
+	vec2 size = vec2(textureSize(TextureArray, 0).xy);
+	float width = coneSpread * distance;
+	float cosine = abs(dot(normal, direction));
+	return textureLodOffset + 0.5f * log2(size.x * size.y) + log2(max(width, 1e-8f)) - log2(max(cosine, 1e-4f));
+}
+
+void main()
+{
+	vec3 normal = normalize(WorldNormal);
+	vec3 direction = normalize(WorldPosition - CameraPosition);
+
+	Material material = Materials[MaterialId];
+	vec2 uv = clamp(TexCoord, vec2(0.0f), vec2(1.0f));
+	vec4 albedo = material.albedo * textureLod(TextureArray, vec3(uv, material.textureLayer), GetPrimaryRayTextureLod(normal, direction));
+
+	FragAlbedo = vec4(albedo.rgb, 1.0f);
+	FragNormal = EncodeOctahedral(normal);
+	FragOthers = vec4(0.0f, 0.0f, 0.0f, float(MaterialId) / 255.0f);
+}
@@ -0,0 +1,26 @@
+//Inputs
+layout (location = 0) in vec3 VertexPosition;
+layout (location = 1) in vec3 VertexNormal;
+layout (location = 2) in vec2 VertexTexCoord;
+
+//Outputs
+out vec3 WorldPosition;
+out vec3 WorldNormal;
+out vec2 TexCoord;
+
+//Uniforms
+uniform mat4 WorldMatrix;
+uniform mat4 NormalMatrix;
+uniform mat4 ViewProjMatrix;
+
+void main()
+{
+	WorldPosition = (WorldMatrix * vec4(VertexPosition, 1.0f)).xyz;
+
+	// Not normalized: the interpolated normal is normalized per fragment, like the normal of a ray hit
+	WorldNormal = (NormalMatrix * vec4(VertexNormal, 0.0f)).xyz;
+
+	TexCoord = VertexTexCoord;
+
+	gl_Position = ViewProjMatrix * vec4(WorldPosition, 1.0f);
+}
@@ -0,0 +1,27 @@
+//Inputs
+in vec2 TexCoord;
+
+//Outputs
+// Copy of the accumulation, kept as the history of the previous camera while the next frame is drawn
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragMoments;
+layout(location = 2) out vec4 FragPosition;
+layout(location = 3) out vec4 FragNormal;
+layout(location = 4) out vec4 FragAlbedo;
+
+//Uniforms
+uniform sampler2D SourceTexture;
+uniform sampler2D MomentsTexture;
+uniform sampler2D PositionTexture;
+uniform sampler2D NormalTexture;
+uniform sampler2D AlbedoTexture;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	FragColor = texelFetch(SourceTexture, pixel, 0);
+	FragMoments = texelFetch(MomentsTexture, pixel, 0);
+	FragPosition = texelFetch(PositionTexture, pixel, 0);
+	FragNormal = texelFetch(NormalTexture, pixel, 0);
+	FragAlbedo = texelFetch(AlbedoTexture, pixel, 0);
+}
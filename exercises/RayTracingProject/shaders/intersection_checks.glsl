@@ -1,37 +1,14 @@
 
 // Uniforms
-uniform vec3 SphereColor = vec3(0, 0, 1);
-uniform vec3 SphereCenter = vec3(-3, 0, 0);
-uniform float SphereRadius = 1.25f;
-
-uniform vec3 BoxColor = vec3(1, 0, 0);
-uniform mat4 BoxMatrix = mat4(1,0,0,0,   0,1,0,0,   0,0,1,0,   3,0,0,1);
-uniform vec3 BoxSize = vec3(1, 1, 1);
-uniform mat4 MeshMatrix = mat4(1,0,0,0,   0,1,0,0,   0,0,1,0,   3,0,0,1);
-
-uniform vec3 MeshColor = vec3(1, 0, 0);
-
-uniform float SphereRoughness;
-uniform float BoxRoughness;
-uniform float MeshRoughness;
-
-uniform float SphereMetalness;
-uniform float BoxMetalness;
-uniform float MeshMetalness;
-
-uniform vec3 LightColor = vec3(1.0f);
-uniform float LightIntensity = 4.0f;
 uniform vec2 LightSize = vec2(3.0f);
 
-uniform sampler2D WoodTexture;
-uniform sampler2D WallTexture;
-uniform sampler2D FloorTexture;
-uniform sampler2D MonaTexture;
+// Next-event estimation: sample the lights at each hit, and combine with the diffuse and specular rays by multiple importance sampling
+uniform uint NextEventEstimation = 1u;
+// Inverse of the total power of the lights, the probability of picking a light per unit of its power. GetLightPdfScale in RaytracingScene
+uniform float LightPdfScale = 0.0f;
 
 const vec3 CornellBoxSize = vec3(10.0f);
 
-uniform mat4 ViewMatrix;
-
 // Materials
 
 struct Material
@@ -42,35 +19,76 @@ struct Material
 	float ior;
 	vec4 albedo;
 	vec4 emissive;
+	// Layer of TextureArray multiplied with the albedo. Layer 0 is white
+	uint textureLayer;
 };
 
 layout(binding = 3, std430) readonly buffer MaterialBuffer {
     Material Materials[];
 };
 
+// Textures of the materials, resized to the same size
 uniform sampler2DArray TextureArray;
 
-Material SphereMaterial = Material(99, SphereRoughness, SphereMetalness, 0.f, vec4(SphereColor, 0.f), vec4(0.0f));
-Material BoxMaterial = Material(100, BoxRoughness, BoxMetalness, 1.1f, vec4(BoxColor, 0.f),  vec4(0.0f));
-Material MeshMaterial = Material(101, MeshRoughness, MeshMetalness, 0.f, vec4(MeshColor, 0.f), vec4(0.0f));
+// Triangles with an emissive material in world space, and analytic primitives with one, placed by their instance
+struct EmissiveLight {
+    vec3 v0;            // Triangles only, with the two edges from it
+    float cdf;          // Probability of picking this light, or any light before it
+    vec3 v1v0;
+    float area;
+    vec3 v2v0;
+    uint materialId;
+    vec3 emission;
+    uint instanceIndex; // Instance of the analytic primitive, or NoInstance for a triangle
+};
+
+layout(binding = 7, std430) readonly buffer EmissiveLights {
+    EmissiveLight emissiveLights[];
+};
 
-Material CornellMaterial = Material(102, 0.75f, 0.0f, 0.0f, vec4(1.0f), vec4(0.0f));
-Material LightMaterial = Material(103, 0.0f, 0.0f, 0.0f, vec4(0.0f), vec4(LightIntensity * LightColor, 0.f));
+Material CornellMaterial = Material(102, 0.75f, 0.0f, 0.0f, vec4(1.0f), vec4(0.0f), 0u);
 
 // Forward declare ProcessOutput function
-vec3 ProcessOutput(Ray ray, float distance, vec3 normal, Material material);
+vec3 ProcessOutput(Ray ray, float distance, vec3 normal, Material material, uint instance);
 
-vec4 GetColorFromTexture(sampler2D sampler, vec2 uv) {
-    uv = clamp(uv, vec2(0.0), vec2(1.0));
-    
-    return texture(sampler, uv);
+// Spread angle added to the cone of a diffuse ray, about the width of the cosine lobe
+const float DiffuseConeSpread = 1.0f;
+
+// Level of the texture array covered by the cone of a ray at a hit, given the texture LOD offset of the triangle
+float GetTextureLod(Ray ray, float distance, vec3 normal, float textureLodOffset)
+{
+	vec2 size = vec2(textureSize(TextureArray, 0).xy);
+	float width = ray.coneWidth + ray.coneSpread * distance;
+	float cosine = abs(dot(normal, ray.direction));
+	return textureLodOffset + 0.5f * log2(size.x * size.y) + log2(max(width, 1e-8f)) - log2(max(cosine, 1e-4f));
 }
 
-vec4 GetColorFromTextureArray(vec2 uv, uint layer) {
+// The LOD is explicit, rays don't have screen space derivatives
+vec4 GetColorFromTextureArray(vec2 uv, uint layer, float lod) {
 	
     uv = clamp(uv, vec2(0.0), vec2(1.0));
     
-    return texture(TextureArray, vec3(uv, layer));
+    return textureLod(TextureArray, vec3(uv, layer), lod);
+}
+
+// Closest hit of a ray in the scene, with its normal, its material with the albedo multiplied by the texture, and the instance hit
+// Returns false, with a zero normal, if the ray missed
+bool FindHit(Ray ray, inout float distance, out vec3 normal, out Material material, out uint instance)
+{
+	vec2 uv;
+	uint materialId;
+	float textureLodOffset;
+	instance = NoInstance;
+
+	// Meshes and analytic primitives, the sphere light among them
+	if (RayMeshIntersection(ray, distance, normal, uv, materialId, textureLodOffset, instance))
+	{
+		material = Materials[materialId];
+		material.albedo *= GetColorFromTextureArray(uv, material.textureLayer, GetTextureLod(ray, distance, normal, textureLodOffset));
+	}
+
+	// We check if normal == vec3(0) to detect if there was a hit
+	return dot(normal, normal) > 0;
 }
 
 // Main function for casting rays: Defines the objects in the scene
@@ -78,36 +96,63 @@ vec3 CastRay(Ray ray, inout float distance)
 {
 	Material material;
 	vec3 normal;
-	vec2 uv;
-	uint materialId;
+	uint instance;
+	bool hit = FindHit(ray, distance, normal, material, instance);
 
-	// Sphere
-	if (RaySphereIntersection(ray, SphereCenter, SphereRadius, distance, normal))
+	HitNormal = normal;
+	HitAlbedo = material.albedo.rgb;
+	return hit ? ProcessOutput(ray, distance, normal, material, instance) : vec3(0.0f);
+}
+
+// Hybrid rendering: the primary hits on the meshes are read from the G-buffer rasterized by GBufferRenderPass instead of traced
+uniform uint HybridPrimaryRays = 0u;
+
+// Forward declare the G-buffer read, at the pixel of the primary ray
+// Returns false, with an infinite distance and a zero normal, if no mesh was rasterized there
+bool GetGBufferHit(Ray ray, out float distance, out vec3 normal, out Material material);
+
+// Same as FindHit, for the first ray of each sample. The hits on the rasterized meshes have no instance
+bool FindPrimaryHit(Ray ray, inout float distance, out vec3 normal, out Material material, out uint instance)
+{
+	if (HybridPrimaryRays == 0u)
 	{
-		material = LightMaterial;
+		return FindHit(ray, distance, normal, material, instance);
 	}
 
-	// Mesh
-	if (RayMeshIntersection(ray, ViewMatrix, distance, normal, uv, materialId))
+	vec2 uv;
+	uint materialId;
+	float textureLodOffset;
+	instance = NoInstance;
+
+	GetGBufferHit(ray, distance, normal, material);
+
+	// Analytic primitives are not rasterized, they are traced up to the rasterized hit
+	if (RayPrimitivesIntersection(ray, distance, normal, uv, materialId, textureLodOffset, instance))
 	{
 		material = Materials[materialId];
-
-		if (materialId == 1) 
-		{
-			material.albedo *= GetColorFromTexture(WallTexture, uv);
-		}
-		if (materialId == 2) 
-		{
-			material.albedo *= GetColorFromTexture(FloorTexture, uv);
-		}
-		if (materialId == 3)
-		{
-			material.albedo *= GetColorFromTexture(MonaTexture, uv);
-		}
+		material.albedo *= GetColorFromTextureArray(uv, material.textureLayer, GetTextureLod(ray, distance, normal, textureLodOffset));
 	}
 
-	// We check if normal == vec3(0) to detect if there was a hit
-	return dot(normal, normal) > 0 ? ProcessOutput(ray, distance, normal, material) : vec3(0.0f);
+	return dot(normal, normal) > 0;
+}
+
+// True while ProcessOutput shades the hit of the primary ray
+bool _IsPrimaryHit = false;
+
+// Same as CastRay, for the first ray of each sample
+vec3 CastPrimaryRay(Ray ray, inout float distance)
+{
+	Material material;
+	vec3 normal;
+	uint instance;
+	bool hit = FindPrimaryHit(ray, distance, normal, material, instance);
+
+	HitNormal = normal;
+	HitAlbedo = material.albedo.rgb;
+	_IsPrimaryHit = true;
+	vec3 color = hit ? ProcessOutput(ray, distance, normal, material, instance) : vec3(0.0f);
+	_IsPrimaryHit = false;
+	return color;
 }
 
 // Forward declare helper functions
@@ -116,16 +161,233 @@ vec3 GetReflectance(Material material);
 vec3 FresnelSchlick(vec3 f0, vec3 viewDir, vec3 halfDir);
 vec3 GetDiffuseReflectionDirection(Ray ray, vec3 normal);
 vec3 GetSpecularReflectionDirection(Ray ray, vec3 normal);
+vec3 GetGgxReflectionDirection(Ray ray, vec3 normal, float alpha);
+float GgxDistribution(float NdotH, float alpha);
+float SmithG1(float NdotV, float alpha);
+float SmithG2(float NdotV, float NdotL, float alpha);
+float GetGgxReflectionPdf(float NdotV, float NdotH, float alpha);
+
+// Smallest GGX alpha, so mirrors are sampled and evaluated with finite numbers
+const float MinGgxAlpha = 0.001f;
 vec3 GetRefractedDirection(Ray ray, vec3 normal, float f);
 
 // Creates a new derived ray using the specified position and direction
+// The cone keeps the width it has at the position, and the spread of the ray
 Ray GetDerivedRay(Ray ray, vec3 position, vec3 direction)
 {
-	return Ray(position, direction, ray.colorFilter, ray.ior);
+	float coneWidth = ray.coneWidth + ray.coneSpread * distance(ray.point, position);
+	return Ray(position, direction, ray.colorFilter, ray.ior, 0.0f, coneWidth, ray.coneSpread);
+}
+
+// Forward declare random function
+float Rand01();
+
+// Forward declare the radiance cache hook of the integrator, with the normal facing the ray
+// Returns true, with the cached radiance leaving the hit toward the ray, if the path ends there
+bool EndPathOnRadianceCache(Ray ray, vec3 position, vec3 normal, bool afterDiffuseBounce, out vec3 radiance);
+
+// Forward declare the light resampling of the primary hits, from lightreservoirs.glsl
+uniform uint LightReservoirs = 0u;
+float GetReservoirLightPoint(vec3 position, vec3 normal, float distance, out vec3 lightPoint, out uint lightIndex);
+vec3 GetReservoirLighting(vec3 position, vec3 normal, vec3 lightPoint, uint lightIndex, out vec3 direction, out float distance, out float geometry);
+
+// Weight of a sample from the first of two sampling techniques, with the power heuristic
+float PowerHeuristic(float pdf, float otherPdf)
+{
+	return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// 1 - cos of the half angle of the cone subtended by a sphere from a point, or 0 if the point is inside it
+float GetSphereLightCone(vec3 point, vec3 center, float radius)
+{
+	vec3 toCenter = center - point;
+	float sinThetaMax2 = radius * radius / dot(toCenter, toCenter);
+	return sinThetaMax2 < 1.0f ? sinThetaMax2 / (1.0f + sqrt(1.0f - sinThetaMax2)) : 0.0f;
+}
+
+// Surface area of an analytic primitive in world space. Spheres must be scaled uniformly. GetPrimitiveArea in RaytracingScene
+float GetPrimitiveArea(uint instanceIndex)
+{
+	mat3 axes = mat3(instances[instanceIndex].objectToWorld);
+	if (instances[instanceIndex].primitiveType == PrimitiveSphere)
+	{
+		return 4.0f * Pi * dot(axes[0], axes[0]);
+	}
+
+	// Two faces per axis, each one 2x2 in object space
+	return 8.0f * (length(cross(axes[1], axes[2])) + length(cross(axes[2], axes[0])) + length(cross(axes[0], axes[1])));
+}
+
+// Outward normal of an analytic primitive at a point of its surface, in world space
+vec3 GetPrimitiveLightNormal(uint instanceIndex, vec3 lightPoint)
+{
+	vec3 point = (instances[instanceIndex].worldToObject * vec4(lightPoint, 1.0f)).xyz;
+	vec3 localNormal = point;
+	if (instances[instanceIndex].primitiveType != PrimitiveSphere)
+	{
+		vec3 absPoint = abs(point);
+		int axis = absPoint.x > absPoint.y ? (absPoint.x > absPoint.z ? 0 : 2) : (absPoint.y > absPoint.z ? 1 : 2);
+		localNormal = vec3(0.0f);
+		localNormal[axis] = point[axis] >= 0.0f ? 1.0f : -1.0f;
+	}
+	return normalize((instances[instanceIndex].normalMatrix * vec4(localNormal, 0.0f)).xyz);
+}
+
+// Density of sampling a direction toward a point of an emissive triangle, per solid angle
+float GetTriangleLightPdf(vec3 emission, float distance, float cosine)
+{
+	// Triangles emit from both sides, so their power is twice the luminance per unit area
+	return 2.0f * LightPdfScale * GetLuminance(emission) * distance * distance / max(abs(cosine), 1e-6f);
+}
+
+// Density of sampling a direction from a point toward an emissive analytic primitive, per solid angle, given the distance to the point
+// of its surface in that direction and the cosine there. Directions toward a sphere are uniform in its cone, the distance and cosine are not used
+float GetPrimitiveLightPdf(uint instanceIndex, vec3 emission, vec3 point, float distance, float cosine)
+{
+	if (instances[instanceIndex].primitiveType == PrimitiveSphere)
+	{
+		mat4 objectToWorld = instances[instanceIndex].objectToWorld;
+		float cone = GetSphereLightCone(point, objectToWorld[3].xyz, length(objectToWorld[0].xyz));
+		float probability = LightPdfScale * GetLuminance(emission) * GetPrimitiveArea(instanceIndex);
+		return cone > 0.0f ? probability / (2.0f * Pi * cone) : 0.0f;
+	}
+	return LightPdfScale * GetLuminance(emission) * distance * distance / max(abs(cosine), 1e-6f);
+}
+
+// Index of no light, for the reservoirs without one. NoLightIndex in CpuPathTracer
+const uint NoLightIndex = 0xffffffffu;
+
+// Direction from a point toward an emissive analytic primitive: uniform in the cone subtended by a sphere, or toward a uniform point
+// of the surface of a box, on a face picked with faceSample with a probability proportional to its area
+// The density is 0 if the point is inside the sphere, or if the point of the box faces away from it
+void SamplePrimitiveLight(uint instanceIndex, vec3 emission, float faceSample, vec2 pointSample, vec3 point,
+	out vec3 direction, out float distance, out float pdf)
+{
+	mat4 objectToWorld = instances[instanceIndex].objectToWorld;
+	direction = vec3(0.0f);
+	distance = 0.0f;
+	pdf = 0.0f;
+
+	if (instances[instanceIndex].primitiveType == PrimitiveSphere)
+	{
+		vec3 center = objectToWorld[3].xyz;
+		float radius = length(objectToWorld[0].xyz);
+		float cone = GetSphereLightCone(point, center, radius);
+		if (cone > 0.0f)
+		{
+			float cosTheta = 1.0f - pointSample.x * cone;
+			float sinTheta = sqrt(max(1.0f - cosTheta * cosTheta, 0.0f));
+			float phi = 2.0f * Pi * pointSample.y;
+			vec3 axis = normalize(center - point);
+			vec3 bitangent = normalize(cross(axis, abs(axis.z) < 0.5f ? vec3(0, 0, 1) : vec3(0, 1, 0)));
+			vec3 tangent = cross(axis, bitangent);
+			direction = sinTheta * (cos(phi) * bitangent + sin(phi) * tangent) + cosTheta * axis;
+
+			vec3 normal;
+			distance = 1.0f / 0.0f;
+			if (RaySphereIntersection(Ray(point, direction, vec3(1.0f), 1.0f, 0.0f, 0.0f, 0.0f), center, radius, distance, normal))
+			{
+				pdf = GetPrimitiveLightPdf(instanceIndex, emission, point, distance, 1.0f);
+			}
+		}
+		return;
+	}
+
+	// Pick the axis of the face with the area of its two faces, and the side with what is left of the sample
+	mat3 axes = mat3(objectToWorld);
+	vec3 faceAreas = vec3(length(cross(axes[1], axes[2])), length(cross(axes[2], axes[0])), length(cross(axes[0], axes[1])));
+	faceSample *= faceAreas.x + faceAreas.y + faceAreas.z;
+	int axis = faceSample < faceAreas.x ? 0 : (faceSample < faceAreas.x + faceAreas.y ? 1 : 2);
+	float sideSample = (faceSample - (axis > 0 ? faceAreas.x : 0.0f) - (axis > 1 ? faceAreas.y : 0.0f)) / faceAreas[axis];
+
+	vec3 localPoint;
+	localPoint[axis] = sideSample < 0.5f ? -1.0f : 1.0f;
+	localPoint[(axis + 1) % 3] = 2.0f * pointSample.x - 1.0f;
+	localPoint[(axis + 2) % 3] = 2.0f * pointSample.y - 1.0f;
+	vec3 localNormal = vec3(0.0f);
+	localNormal[axis] = localPoint[axis];
+
+	vec3 toLight = (objectToWorld * vec4(localPoint, 1.0f)).xyz - point;
+	distance = length(toLight);
+	direction = toLight / distance;
+	float lightCosine = -dot(normalize((instances[instanceIndex].normalMatrix * vec4(localNormal, 0.0f)).xyz), direction);
+	pdf = lightCosine > 0.0f ? GetPrimitiveLightPdf(instanceIndex, emission, point, distance, lightCosine) : 0.0f;
+}
+
+// Pick a light, with a probability proportional to its power, and a direction toward it
+// Returns the emitted radiance, and the density of the direction per solid angle, or 0 if there is no light to sample
+vec3 SampleLight(vec3 point, out vec3 direction, out float distance, out float pdf, out uint lightIndex)
+{
+	float lightSample = Rand01();
+	vec2 pointSample = vec2(Rand01(), Rand01());
+
+	direction = vec3(0.0f);
+	distance = 0.0f;
+	pdf = 0.0f;
+	lightIndex = NoLightIndex;
+
+	uint count = uint(emissiveLights.length());
+	if (count == 0u)
+	{
+		return vec3(0.0f);
+	}
+
+	// Binary search of the first light with a cdf over the sample
+	uint first = 0u;
+	while (count > 0u)
+	{
+		uint halfCount = count / 2u;
+		if (emissiveLights[first + halfCount].cdf <= lightSample)
+		{
+			first += halfCount + 1u;
+			count -= halfCount + 1u;
+		}
+		else
+		{
+			count = halfCount;
+		}
+	}
+	lightIndex = min(first, uint(emissiveLights.length()) - 1u);
+	EmissiveLight light = emissiveLights[lightIndex];
+
+	if (light.instanceIndex != NoInstance)
+	{
+		// The position of the sample in the range of the light is a new uniform sample, for the face of a box
+		float cdfBefore = lightIndex > 0u ? emissiveLights[lightIndex - 1u].cdf : 0.0f;
+		float faceSample = clamp((lightSample - cdfBefore) / (light.cdf - cdfBefore), 0.0f, 0.99999994f);
+		SamplePrimitiveLight(light.instanceIndex, light.emission, faceSample, pointSample, point, direction, distance, pdf);
+		return light.emission;
+	}
+
+	// Uniform point on the triangle
+	float s = sqrt(pointSample.x);
+	vec3 lightPoint = light.v0 + s * (1.0f - pointSample.y) * light.v1v0 + s * pointSample.y * light.v2v0;
+	vec3 toLight = lightPoint - point;
+	distance = length(toLight);
+	direction = toLight / distance;
+	vec3 lightNormal = normalize(cross(light.v1v0, light.v2v0));
+	pdf = GetTriangleLightPdf(light.emission, distance, dot(lightNormal, direction));
+	return light.emission;
+}
+
+vec3 SampleLight(vec3 point, out vec3 direction, out float distance, out float pdf)
+{
+	uint lightIndex;
+	return SampleLight(point, direction, distance, pdf, lightIndex);
 }
 
-// Produce a color value after computing the intersection
-vec3 ProcessOutput(Ray ray, float distance, vec3 normal, Material material)
+// Test that nothing blocks the segment from a point to a light, at a distance along the direction
+bool IsLightVisible(vec3 point, vec3 direction, float distance)
+{
+	// Offset both ends, like the rays pushed after a hit
+	Ray shadowRay = Ray(point + 0.0001f * direction, direction, vec3(1.0f), 1.0f, 0.0f, 0.0f, 0.0f);
+	distance -= 0.0002f;
+
+	return !Occluded(shadowRay, distance);
+}
+
+// Produce a color value after computing the intersection with an instance, or NoInstance for a rasterized mesh
+vec3 ProcessOutput(Ray ray, float distance, vec3 normal, Material material, uint instance)
 {
 	if (distance < 0.001f) { return vec3(0.f); }
 
@@ -134,8 +396,31 @@ vec3 ProcessOutput(Ray ray, float distance, vec3 normal, Material material)
 	// Find the position where the ray hit the surface
 	vec3 contactPosition = ray.point + distance * ray.direction;
 
+	// The radiance of opaque rough surfaces is cached, as if it didn't depend on the view. Lights keep their emission weighted for the ray
+	// Specular rays as rough as the diffuse lobe also count as a diffuse bounce
+	vec3 cachedRadiance;
+	bool isCached = material.ior == 0.0f && material.roughness >= RadianceCacheMinRoughness && dot(material.emissive.xyz, material.emissive.xyz) == 0.0f;
+	if (isCached && EndPathOnRadianceCache(ray, contactPosition, dot(normal, ray.direction) < 0.0f ? normal : -normal,
+		ray.coneSpread >= DiffuseConeSpread, cachedRadiance))
+	{
+		return ray.colorFilter * cachedRadiance;
+	}
+
+	// A light hit by a diffuse or specular ray could also have been sampled at its origin: weight both with multiple importance sampling
+	// The lighting of the diffuse rays of the hits that read the reservoirs already has all the lights
+	float emissiveWeight = ray.bsdfPdf < 0.0f ? 0.0f : 1.0f;
+	if (ray.bsdfPdf > 0.0f && dot(material.emissive.xyz, material.emissive.xyz) > 0.0f)
+	{
+		bool isPrimitive = instance != NoInstance && instances[instance].primitiveType != PrimitiveMesh;
+		float lightPdf = isPrimitive ? GetPrimitiveLightPdf(instance, material.emissive.xyz, ray.point, distance, dot(normal, ray.direction))
+			: GetTriangleLightPdf(material.emissive.xyz, distance, dot(normal, ray.direction));
+		emissiveWeight = PowerHeuristic(ray.bsdfPdf, lightPdf);
+	}
+	vec3 color = max(vec3(0.f), ray.colorFilter * material.emissive.xyz) * emissiveWeight;
+
 	// Compute the fresnel
-	vec3 fresnel = FresnelSchlick(GetReflectance(material), -ray.direction, normal);
+	vec3 reflectance = GetReflectance(material);
+	vec3 fresnel = FresnelSchlick(reflectance, -ray.direction, normal);
 
 	//PushRay(shadowRay);
 
@@ -154,18 +439,82 @@ vec3 ProcessOutput(Ray ray, float distance, vec3 normal, Material material)
 	}
 	diffuseRay.colorFilter *= (1.0f - fresnel);
 	diffuseRay.ior = ior;
-	PushRay(diffuseRay);
+	if (!isTransparent)
+	{
+		diffuseRay.coneSpread += DiffuseConeSpread;
+	}
 
-	// Add a ray to compute the specular lighting
-	float roughness = material.roughness * material.roughness;
-	vec3 reflectedDirection = GetSpecularReflectionDirection(ray, normal);
-	vec3 specularDirection = mix(reflectedDirection, diffuseDirection, roughness);
+	// Add a ray to compute the specular lighting, reflected over a microfacet normal visible from the ray
+	// Sampling the visible normals leaves only the Fresnel and the shadowing in the weight of the ray
+	// The lobe is around the normal facing the ray, so rays inside transparent objects also reflect
+	vec3 view = -ray.direction;
+	vec3 specularNormal = dot(normal, view) < 0.0f ? -normal : normal;
+	float NdotV = dot(specularNormal, view);
+	float alpha = max(material.roughness * material.roughness, MinGgxAlpha);
+	vec3 specularDirection = GetGgxReflectionDirection(ray, specularNormal, alpha);
+	vec3 specularHalf = normalize(view + specularDirection);
+	float specularNdotL = dot(specularNormal, specularDirection);
 	Ray specularRay = GetDerivedRay(ray, contactPosition, specularDirection);
-	specularRay.colorFilter *= fresnel;
-	PushRay(specularRay);
+	specularRay.coneSpread += alpha;
+	specularRay.colorFilter *= FresnelSchlick(reflectance, view, specularHalf) * SmithG2(NdotV, specularNdotL, alpha) / SmithG1(NdotV, alpha);
+
+	// The primary hits on opaque surfaces light the diffuse lobe with the light point picked by the reservoirs, with a single shadow ray
+	// The specular lobe only gets the lights hit by its ray
+	if (LightReservoirs != 0u && _IsPrimaryHit && !isTransparent)
+	{
+		vec3 lightPoint, lightDirection;
+		uint lightIndex;
+		float lightDistance, geometry;
+		float weight = GetReservoirLightPoint(contactPosition, normal, distance, lightPoint, lightIndex);
+		vec3 lighting = GetReservoirLighting(contactPosition, normal, lightPoint, lightIndex, lightDirection, lightDistance, geometry);
+		if (weight > 0.0f && geometry > 0.0f && IsLightVisible(contactPosition, lightDirection, lightDistance))
+		{
+			color += diffuseRay.colorFilter * lighting * weight;
+		}
+		diffuseRay.bsdfPdf = -1.0f;
+	}
+	// Sample a light for the diffuse and specular lobes. The random numbers are taken even if it isn't used, so the sequences stay the same
+	else if (NextEventEstimation != 0u)
+	{
+		vec3 lightDirection;
+		float lightDistance, lightPdf;
+		vec3 radiance = SampleLight(contactPosition, lightDirection, lightDistance, lightPdf);
+		float cosine = dot(normal, lightDirection);
+		float specularCosine = dot(specularNormal, lightDirection);
+		if (lightPdf > 0.0f && (cosine > 0.0f || specularCosine > 0.0f) && IsLightVisible(contactPosition, lightDirection, lightDistance))
+		{
+			if (!isTransparent && cosine > 0.0f)
+			{
+				float bsdfPdf = cosine * InvPi;
+				color += diffuseRay.colorFilter * radiance * (bsdfPdf / lightPdf) * PowerHeuristic(lightPdf, bsdfPdf);
+			}
+			if (specularCosine > 0.0f)
+			{
+				// Microfacet BRDF times the cosine: F D G2 / (4 NdotV)
+				vec3 lightHalf = normalize(view + lightDirection);
+				float NdotH = dot(specularNormal, lightHalf);
+				vec3 specular = FresnelSchlick(reflectance, view, lightHalf) * GgxDistribution(NdotH, alpha)
+					* SmithG2(NdotV, specularCosine, alpha) / (4.0f * NdotV);
+				float bsdfPdf = GetGgxReflectionPdf(NdotV, NdotH, alpha);
+				color += ray.colorFilter * specular * radiance / lightPdf * PowerHeuristic(lightPdf, bsdfPdf);
+			}
+		}
+		if (!isTransparent)
+		{
+			diffuseRay.bsdfPdf = max(dot(normal, diffuseDirection), 0.0f) * InvPi;
+		}
+		specularRay.bsdfPdf = GetGgxReflectionPdf(NdotV, dot(specularNormal, specularHalf), alpha);
+	}
+	PushRay(diffuseRay);
+
+	// Directions below the surface are shadowed by the microfacets
+	if (specularNdotL > 0.0f)
+	{
+		PushRay(specularRay);
+	}
 
-	// Return emissive light, after applying the ray color filter
-	return max(vec3(0.f), ray.colorFilter * material.emissive.xyz);
+	// Return emissive light, after applying the ray color filter, and the sampled light
+	return color;
 }
 
 // Configure ray tracer
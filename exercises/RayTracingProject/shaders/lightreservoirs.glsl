@@ -0,0 +1,200 @@
+// Light reservoirs: resampling of the direct lighting of the primary hits with weighted reservoirs (ReSTIR, Bitterli et al. 2020)
+// ReservoirRenderPass draws reservoirs.frag first: each pixel streams the candidates of SampleLight through a reservoir, and adds its reservoir
+// of the previous frame. Then the primary hits of raytracing.frag combine the reservoir of their pixel with a few neighbors on the same surface,
+// and trace a single shadow ray toward the light point picked. Enabled by LightReservoirs. See CpuPathTracer for the CPU version
+// The target function is the luminance of the unshadowed lighting of the diffuse lobe without the albedo, so textures don't stop the reuse
+
+// Light point kept by a reservoir from a stream of weighted candidates
+struct Reservoir
+{
+	vec3 lightPoint;
+	// Emissive light of the point, or NoLightIndex
+	uint lightIndex;
+	// Target function of the point at the surface of the reservoir
+	float target;
+	// Sum of the weights of the candidates, and the number of candidates they stand for
+	float weightSum;
+	float count;
+	// Weight of the point once all the candidates are in, an estimate of 1 / its density
+	float weight;
+};
+
+// Reservoirs of the pixels, from the current frame in raytracing.frag and the previous one in reservoirs.frag
+// Light point with the light index plus one in w, position of the primary hit with the distance along the ray in w or 0 without a reservoir,
+// and the weight, the candidate count and the octahedral normal of the hit
+uniform sampler2D ReservoirLightTexture;
+uniform sampler2D ReservoirPositionTexture;
+uniform sampler2D ReservoirWeightTexture;
+
+// Candidates sampled per pixel and frame. CandidateCount in CpuPathTracer
+const uint ReservoirCandidateCount = 8u;
+
+// Candidates the reservoir of the previous frame can stand for, so the reservoirs follow the changes of the lighting. MaxHistoryCount in CpuPathTracer
+const float ReservoirMaxHistoryCount = 20.0f * float(ReservoirCandidateCount);
+
+// Neighbor reservoirs combined by the primary hits, in a disk of this radius in pixels. NeighborCount and NeighborRadius in CpuPathTracer
+const uint ReservoirNeighborCount = 3u;
+const float ReservoirNeighborRadius = 16.0f;
+
+// Largest distance to the plane of the surface, relative to the distance along the ray, and smallest cosine between the normals
+// of the reservoirs reused by a surface, like the history of reprojection.frag. DepthTolerance and NormalTolerance in CpuPathTracer
+const float ReservoirDepthTolerance = 0.02f;
+const float ReservoirNormalTolerance = 0.9f;
+
+// Index of the sampler ray of the candidates, after the ones of the paths. ReservoirSampleRay in CpuPathTracer
+const uint ReservoirSampleRay = 0xffffu;
+
+Reservoir GetEmptyReservoir()
+{
+	return Reservoir(vec3(0.0f), NoLightIndex, 0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+// Unshadowed lighting of the diffuse lobe of a surface by a point of a light, without the albedo
+// Returns the direction and the distance to the point, and the geometry term, the cosine at the light over the squared distance,
+// that converts densities per solid angle to per area. The lighting and the geometry are 0 if the point doesn't face the surface
+vec3 GetReservoirLighting(vec3 position, vec3 normal, vec3 lightPoint, uint lightIndex, out vec3 direction, out float distance, out float geometry)
+{
+	vec3 toLight = lightPoint - position;
+	distance = length(toLight);
+	direction = distance > 0.0f ? toLight / distance : normal;
+	geometry = 0.0f;
+
+	float cosine = dot(normal, direction);
+	if (distance <= 0.0f || cosine <= 0.0f)
+	{
+		return vec3(0.0f);
+	}
+
+	// Analytic primitives emit from their outer side, the triangles from both sides
+	if (lightIndex >= uint(emissiveLights.length()))
+	{
+		return vec3(0.0f);
+	}
+	EmissiveLight light = emissiveLights[lightIndex];
+	float lightCosine = light.instanceIndex != NoInstance ? -dot(GetPrimitiveLightNormal(light.instanceIndex, lightPoint), direction)
+		: abs(dot(normalize(cross(light.v1v0, light.v2v0)), direction));
+
+	if (lightCosine <= 0.0f)
+	{
+		return vec3(0.0f);
+	}
+	geometry = lightCosine / (distance * distance);
+	return light.emission * (cosine * InvPi * geometry);
+}
+
+// Target function of a light point for a surface
+float GetReservoirTarget(vec3 position, vec3 normal, vec3 lightPoint, uint lightIndex)
+{
+	vec3 direction;
+	float distance, geometry;
+	return GetLuminance(GetReservoirLighting(position, normal, lightPoint, lightIndex, direction, distance, geometry));
+}
+
+// Add a candidate, standing for count candidates, and keep it with probability weight / weightSum
+void UpdateReservoir(inout Reservoir reservoir, vec3 lightPoint, uint lightIndex, float target, float weight, float count)
+{
+	reservoir.weightSum += weight;
+	reservoir.count += count;
+	if (weight > 0.0f && Rand01() * reservoir.weightSum < weight)
+	{
+		reservoir.lightPoint = lightPoint;
+		reservoir.lightIndex = lightIndex;
+		reservoir.target = target;
+	}
+}
+
+// Weight of the point kept, once all the candidates are in
+void FinishReservoir(inout Reservoir reservoir)
+{
+	reservoir.weight = reservoir.target > 0.0f ? reservoir.weightSum / (reservoir.count * reservoir.target) : 0.0f;
+}
+
+// Add a finished reservoir of another pixel or frame, as a candidate that stands for all of its own, with the target of this surface
+// The weights of the reservoirs on other surfaces are not corrected, so the combination is biased where the lights they see differ
+void CombineReservoir(inout Reservoir reservoir, Reservoir other, vec3 position, vec3 normal)
+{
+	float target = GetReservoirTarget(position, normal, other.lightPoint, other.lightIndex);
+	UpdateReservoir(reservoir, other.lightPoint, other.lightIndex, target, target * other.weight * other.count, other.count);
+}
+
+// Stream the candidates of SampleLight, weighted by their target over their density per area
+Reservoir SampleReservoir(vec3 position, vec3 normal)
+{
+	Reservoir reservoir = GetEmptyReservoir();
+	for (uint i = 0u; i < ReservoirCandidateCount; ++i)
+	{
+		vec3 direction;
+		float distance, pdf;
+		uint lightIndex;
+		SampleLight(position, direction, distance, pdf, lightIndex);
+
+		vec3 lightPoint = position + distance * direction;
+		float target = 0.0f;
+		float weight = 0.0f;
+		if (pdf > 0.0f)
+		{
+			vec3 lightDirection;
+			float lightDistance, geometry;
+			target = GetLuminance(GetReservoirLighting(position, normal, lightPoint, lightIndex, lightDirection, lightDistance, geometry));
+			weight = target > 0.0f ? target / (pdf * geometry) : 0.0f;
+		}
+		UpdateReservoir(reservoir, lightPoint, lightIndex, target, weight, 1.0f);
+	}
+	return reservoir;
+}
+
+// Reservoir of a pixel of the reservoir textures. Returns false if the pixel is outside them, or if its primary hit is not on the same surface
+bool ReadReservoir(ivec2 pixel, vec3 position, vec3 normal, float distance, out Reservoir reservoir)
+{
+	reservoir = GetEmptyReservoir();
+	if (any(lessThan(pixel, ivec2(0))) || any(greaterThanEqual(pixel, textureSize(ReservoirPositionTexture, 0))))
+	{
+		return false;
+	}
+
+	vec4 reservoirPosition = texelFetch(ReservoirPositionTexture, pixel, 0);
+	vec4 reservoirWeight = texelFetch(ReservoirWeightTexture, pixel, 0);
+	if (reservoirPosition.w == 0.0f
+		|| abs(dot(reservoirPosition.xyz - position, normal)) > ReservoirDepthTolerance * distance
+		|| dot(DecodeOctahedral(reservoirWeight.zw), normal) < ReservoirNormalTolerance)
+	{
+		return false;
+	}
+
+	vec4 light = texelFetch(ReservoirLightTexture, pixel, 0);
+	reservoir.lightPoint = light.xyz;
+	reservoir.lightIndex = uint(light.w) - 1u;
+	reservoir.weight = reservoirWeight.x;
+	reservoir.count = reservoirWeight.y;
+	return true;
+}
+
+// Light point of the primary hit of the pixel, combined from its reservoir and the ones of random neighbors on the same surface
+// Returns the weight of the point, 0 if there is none
+float GetReservoirLightPoint(vec3 position, vec3 normal, float distance, out vec3 lightPoint, out uint lightIndex)
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	Reservoir reservoir = GetEmptyReservoir();
+	Reservoir other;
+	if (ReadReservoir(pixel, position, normal, distance, other))
+	{
+		CombineReservoir(reservoir, other, position, normal);
+	}
+
+	for (uint i = 0u; i < ReservoirNeighborCount; ++i)
+	{
+		// Uniform point in the disk around the pixel
+		float radius = ReservoirNeighborRadius * sqrt(Rand01());
+		float angle = 2.0f * Pi * Rand01();
+		ivec2 neighbor = pixel + ivec2(round(radius * vec2(cos(angle), sin(angle))));
+		if (neighbor != pixel && ReadReservoir(neighbor, position, normal, distance, other))
+		{
+			CombineReservoir(reservoir, other, position, normal);
+		}
+	}
+
+	FinishReservoir(reservoir);
+	lightPoint = reservoir.lightPoint;
+	lightIndex = reservoir.lightIndex;
+	return reservoir.weight;
+}
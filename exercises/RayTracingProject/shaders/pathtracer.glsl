@@ -0,0 +1,171 @@
+
+struct Ray
+{
+	vec3 point;
+	vec3 direction;
+	vec3 colorFilter;
+	float ior;
+	// Density of the direction if it was sampled from the diffuse or specular lobe, with next-event estimation at its origin. 0 otherwise,
+	// and negative for the diffuse rays of the hits lit by the light reservoirs
+	float bsdfPdf;
+	// Cone around the ray, to pick the texture LOD at the hit: width at the origin, and angle added per unit of distance
+	float coneWidth;
+	float coneSpread;
+};
+
+// Forward declare distance function
+vec3 CastRay(Ray ray, inout float distance);
+vec3 CastRay(Ray ray)
+{
+	const float infinity = 1.0f/0.0f;
+	float distance = infinity;
+	return CastRay(ray, distance);
+}
+
+// Same as CastRay, but the hits on the meshes may come from a G-buffer instead
+vec3 CastPrimaryRay(Ray ray, inout float distance);
+
+// Normal and albedo of the last hit found by CastRay
+vec3 HitNormal = vec3(0.0f);
+vec3 HitAlbedo = vec3(0.0f);
+
+// First hit of the primary ray, used to reproject the accumulated samples when the camera moves, and by the denoiser
+// The distance is infinite if it missed
+float PrimaryHitDistance = 1.0f / 0.0f;
+vec3 PrimaryHitNormal = vec3(0.0f);
+vec3 PrimaryHitAlbedo = vec3(0.0f);
+
+// Forward declare config function
+void GetRayTracerConfig(out uint maxRays);
+
+// Forward declare random function
+float Rand01();
+
+// Alternative to raytracer.glsl that follows a single path per sample, instead of tracing the tree of rays pushed by each hit
+// The rays pushed by a hit are candidates for the next segment of the path. One of them is kept, with probability proportional
+// to its luminance, so the lobe is picked by its Fresnel weight and only one pending ray is stored
+
+// Number of rays cast before Russian roulette can end the path
+const uint RussianRouletteDepth = 3u;
+
+Ray _NextRay;
+float _NextRayWeight = 0.0f;
+float _NextRayWeightSum = 0.0f;
+
+bool PushRay(in Ray ray)
+{
+	bool pushed = false;
+	float weight = GetLuminance(ray.colorFilter);
+	if (weight > 0.0f)
+	{
+		// Replace the kept candidate with probability weight / weightSum
+		_NextRayWeightSum += weight;
+		if (Rand01() * _NextRayWeightSum < weight)
+		{
+			// Offset in the ray direction
+			ray.point += 0.0001f * ray.direction;
+			_NextRay = ray;
+			_NextRayWeight = weight;
+			pushed = true;
+		}
+	}
+	return pushed;
+}
+
+// Hit of the path that adds the radiance leaving it to the cache when the path ends: the color added after it, divided by the filter it was hit with
+struct PathVertex
+{
+	vec3 position;
+	vec3 normal;
+	vec3 colorFilter;
+	vec3 colorBefore;
+};
+
+// Paths longer than this only add their first vertices to the cache
+const uint PathVertexCapacity = 8u;
+PathVertex _PathVertices[PathVertexCapacity];
+uint _PathVertexCount = 0u;
+
+// Color of the path so far
+vec3 _PathColor = vec3(0.0f);
+
+// Radiance cache hook of ProcessOutput, for the opaque rough hits
+// After a diffuse bounce, the path ends on the cell of the hit once it has enough samples, except for a few paths that keep training it
+// The others are kept to add a sample when the path ends. Lookups and samples have the same directions, so the cells don't learn the view of the camera
+bool EndPathOnRadianceCache(Ray ray, vec3 position, vec3 normal, bool afterDiffuseBounce, out vec3 radiance)
+{
+	radiance = vec3(0.0f);
+	if (RadianceCaching == 0u || !afterDiffuseBounce)
+	{
+		return false;
+	}
+
+	if (LookupRadianceCache(position, normal, radiance) && Rand01() >= RadianceCacheTrainingProbability)
+	{
+		return true;
+	}
+
+	if (_PathVertexCount < PathVertexCapacity)
+	{
+		_PathVertices[_PathVertexCount++] = PathVertex(position, normal, ray.colorFilter, _PathColor);
+	}
+	return false;
+}
+
+// The cone of the primary ray starts at the point, with the spread angle of a pixel
+vec3 RayTrace(vec3 point, vec3 direction, float coneSpread)
+{
+	_PathColor = vec3(0.0f);
+	_PathVertexCount = 0u;
+
+	// Maximum length of the path
+	uint maxRays;
+	GetRayTracerConfig(maxRays);
+
+	Ray ray = Ray(point, direction, vec3(1.0f), 1.0f, 0.0f, 0.0f, coneSpread);
+
+	for (uint rayCount = 1u; rayCount <= maxRays; ++rayCount)
+	{
+		_NextRayWeightSum = 0.0f;
+		StartSampleRay(rayCount - 1u);
+		float distance = 1.0f / 0.0f;
+		_PathColor += rayCount == 1u ? CastPrimaryRay(ray, distance) : CastRay(ray, distance);
+		if (rayCount == 1u)
+		{
+			PrimaryHitDistance = distance;
+			PrimaryHitNormal = HitNormal;
+			PrimaryHitAlbedo = HitAlbedo;
+		}
+		if (_NextRayWeightSum == 0.0f)
+		{
+			break;
+		}
+
+		// Continue with the kept candidate, divided by the probability of keeping it
+		ray = _NextRay;
+		ray.colorFilter *= _NextRayWeightSum / _NextRayWeight;
+
+		// Russian roulette: end paths that carry little light, and boost the ones that survive
+		if (rayCount >= RussianRouletteDepth)
+		{
+			float survival = min(1.0f, max(ray.colorFilter.r, max(ray.colorFilter.g, ray.colorFilter.b)));
+			if (Rand01() >= survival)
+			{
+				break;
+			}
+			ray.colorFilter /= survival;
+		}
+	}
+
+	// Each vertex kept by the cache gets the radiance brought by the rest of the path. Filters with a zero component can't be divided
+	for (uint vertexIndex = 0u; vertexIndex < _PathVertexCount; ++vertexIndex)
+	{
+		PathVertex vertex = _PathVertices[vertexIndex];
+		if (all(greaterThan(vertex.colorFilter, vec3(0.0f))))
+		{
+			AddRadianceCacheSample(vertex.position, vertex.normal, (_PathColor - vertex.colorBefore) / vertex.colorFilter);
+		}
+	}
+
+	return _PathColor;
+}
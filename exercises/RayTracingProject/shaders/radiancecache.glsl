@@ -0,0 +1,146 @@
+// Radiance cache: a world-space hash grid of cells keyed by the quantized position and the dominant axis of the normal
+// Each cell sums the radiance leaving the surfaces in it toward the paths that hit them. See RadianceCache for the CPU version
+
+struct RadianceCacheCell
+{
+	// Hash of the quantized position and normal, 0 if the cell is empty
+	uint key;
+	uint sampleCount;
+	// Sums of the radiance of the samples, in fixed point
+	uint radiance[3];
+	// Epoch of the scene when the cell was last sampled
+	uint epoch;
+};
+
+// Written by all the pixels of the frame with atomics. Cleared by the application when it starts, then aged as the scene moves
+layout(binding = 8, std430) coherent buffer RadianceCacheBuffer {
+	RadianceCacheCell RadianceCacheCells[];
+};
+
+// Paths end on the cache after a diffuse bounce. Only the path integrator uses it
+uniform uint RadianceCaching = 0u;
+
+// Incremented by the application each time the scene moves. The first sample of each cell in a new epoch halves the cell
+uniform uint RadianceCacheEpoch = 0u;
+
+// Side of the cells in world units. CellSize in RadianceCache
+const float RadianceCacheCellSize = 0.25f;
+
+// Surfaces with a lower roughness reflect too much of the view to be cached. MinRoughness in RadianceCache
+const float RadianceCacheMinRoughness = 0.75f;
+
+// Cells tested after the one of the hash, before giving up. ProbeCount in RadianceCache
+const uint RadianceCacheProbeCount = 8u;
+
+// Samples a cell needs before paths end on it, and at which it is halved. MinSampleCount and MaxSampleCount in RadianceCache
+const uint RadianceCacheMinSamples = 16u;
+const uint RadianceCacheMaxSamples = 1024u;
+
+// Cells with fewer samples aren't halved by a new epoch, so they stay usable while the scene moves every frame. AgingSampleCount in RadianceCache
+const uint RadianceCacheAgingSamples = 4u * RadianceCacheMinSamples;
+
+// Paths that could end on a cell continue with this probability, to keep adding samples. TrainingProbability in RadianceCache
+const float RadianceCacheTrainingProbability = 0.125f;
+
+// Fixed point scale of the sums. Samples are clamped to the max radiance, so the max samples of a full cell can't overflow. RadianceScale and MaxRadiance in RadianceCache
+const float RadianceCacheScale = 1024.0f;
+const float RadianceCacheMaxRadiance = 64.0f;
+
+// Hash of the cell of the position and of the side of the normal. Never 0
+uint GetRadianceCacheKey(vec3 position, vec3 normal)
+{
+	uvec3 cell = uvec3(ivec3(floor(position / RadianceCacheCellSize)));
+	vec3 absNormal = abs(normal);
+	uint axis = absNormal.x > absNormal.y ? (absNormal.x > absNormal.z ? 0u : 2u) : (absNormal.y > absNormal.z ? 1u : 2u);
+	uint side = 2u * axis + (normal[axis] >= 0.0f ? 0u : 1u);
+	return max(Hash(cell.x ^ Hash(cell.y ^ Hash(cell.z ^ Hash(side)))), 1u);
+}
+
+// Index of the cell with the key, or of an empty cell taken for it if insert is set. -1 if none of the probed cells has it
+int FindRadianceCacheCell(uint key, bool insert)
+{
+	uint capacity = uint(RadianceCacheCells.length());
+	for (uint probe = 0u; probe < RadianceCacheProbeCount; ++probe)
+	{
+		uint index = (key + probe) % capacity;
+		uint value = RadianceCacheCells[index].key;
+		if (value == 0u)
+		{
+			if (!insert)
+			{
+				return -1;
+			}
+
+			// Take the empty cell, unless another pixel took it first
+			value = atomicCompSwap(RadianceCacheCells[index].key, 0u, key);
+			if (value == 0u)
+			{
+				return int(index);
+			}
+		}
+		if (value == key)
+		{
+			return int(index);
+		}
+	}
+	return -1;
+}
+
+// Halve the sums and the sample count of a cell. Samples added by other pixels meanwhile are halved or not, which only shifts the mean slightly
+void HalveRadianceCacheCell(int index)
+{
+	atomicAdd(RadianceCacheCells[index].radiance[0], 0u - RadianceCacheCells[index].radiance[0] / 2u);
+	atomicAdd(RadianceCacheCells[index].radiance[1], 0u - RadianceCacheCells[index].radiance[1] / 2u);
+	atomicAdd(RadianceCacheCells[index].radiance[2], 0u - RadianceCacheCells[index].radiance[2] / 2u);
+	atomicAdd(RadianceCacheCells[index].sampleCount, 0u - RadianceCacheCells[index].sampleCount / 2u);
+}
+
+// Add the radiance leaving a hit toward the path. Ignored if the probed cells are taken by other keys
+// A cell that reaches the max samples is halved, and so is a cell sampled for the first time in a new epoch
+void AddRadianceCacheSample(vec3 position, vec3 normal, vec3 radiance)
+{
+	int index = FindRadianceCacheCell(GetRadianceCacheKey(position, normal), true);
+	if (index < 0)
+	{
+		return;
+	}
+
+	// The first sample since the scene moved ages the cell, so the radiance of the old scene fades
+	if (RadianceCacheCells[index].epoch != RadianceCacheEpoch && atomicExchange(RadianceCacheCells[index].epoch, RadianceCacheEpoch) != RadianceCacheEpoch
+		&& RadianceCacheCells[index].sampleCount >= RadianceCacheAgingSamples)
+	{
+		HalveRadianceCacheCell(index);
+	}
+
+	uvec3 value = uvec3(clamp(radiance, 0.0f, RadianceCacheMaxRadiance) * RadianceCacheScale + 0.5f);
+	atomicAdd(RadianceCacheCells[index].radiance[0], value.r);
+	atomicAdd(RadianceCacheCells[index].radiance[1], value.g);
+	atomicAdd(RadianceCacheCells[index].radiance[2], value.b);
+
+	// The sample that fills the cell halves it, so it keeps taking samples
+	if (atomicAdd(RadianceCacheCells[index].sampleCount, 1u) + 1u == RadianceCacheMaxSamples)
+	{
+		HalveRadianceCacheCell(index);
+	}
+}
+
+// Mean radiance of the cell of a hit. Returns false if the cell doesn't have the min samples yet
+bool LookupRadianceCache(vec3 position, vec3 normal, out vec3 radiance)
+{
+	radiance = vec3(0.0f);
+	int index = FindRadianceCacheCell(GetRadianceCacheKey(position, normal), false);
+	if (index < 0)
+	{
+		return false;
+	}
+
+	uint sampleCount = min(RadianceCacheCells[index].sampleCount, RadianceCacheMaxSamples);
+	if (sampleCount < RadianceCacheMinSamples)
+	{
+		return false;
+	}
+
+	radiance = vec3(RadianceCacheCells[index].radiance[0], RadianceCacheCells[index].radiance[1], RadianceCacheCells[index].radiance[2]);
+	radiance /= RadianceCacheScale * float(sampleCount);
+	return true;
+}
@@ -1,28 +1,64 @@
-struct Triangle {
-    vec4 v0;
-    vec4 v1;
-    vec4 v2;
+// Vertex positions read while testing intersections, 3 floats per vertex
+layout(binding = 1, std430) readonly buffer VertexPositions {
+    float vertexPositions[];
+};
 
-    vec4 normal0;  
-    vec4 normal1;  
-    vec4 normal2;   
+// Vertex data read only for the closest hit
+struct VertexAttributes {
+    uint normal; // Octahedral encoding, 2 snorm16
+    uint uv;     // 2 half floats
+};
 
-    vec2 uv0;
-    vec2 uv1;
-    vec2 uv2;
+layout(binding = 5, std430) readonly buffer VertexAttributesBuffer {
+    VertexAttributes vertexAttributes[];
+};
 
+// Triangles: indices of the 3 vertices in xyz. In w, the submesh material, relative to the instance material, in the low 16 bits,
+// and the texture LOD offset of the triangle as a half float in the high 16 bits
+layout(binding = 6, std430) readonly buffer Triangles {
+    uvec4 triangles[];
+};
+
+// Kinds of instances, PrimitiveType on the CPU
+const uint PrimitiveMesh = 0u;
+const uint PrimitiveSphere = 1u; // Radius 1 at the origin of the object space
+const uint PrimitiveBox = 2u;    // From -1 to 1 on each axis of the object space
+
+// Placement of a mesh in the scene, pointing at the hierarchy of the mesh, or of an analytic primitive
+struct Instance {
+    mat4 objectToWorld;
+    mat4 worldToObject;
+    mat4 normalMatrix;   // Inverse transpose of objectToWorld
+    uint nodeOffset;     // Root node of the mesh hierarchy
+    uint triangleOffset; // First triangle of the mesh, leaves of the mesh hierarchy are relative to it
     uint materialId;
-    uint transformId;
+    uint instanceId;
+    uint primitiveType;  // Analytic primitives are tested directly in the leaves of the hierarchy over the instances
 };
 
-layout(binding = 1, std430) readonly buffer Triangles {
-    Triangle triangles[];
+layout(binding = 2, std430) readonly buffer Instances {
+    Instance instances[];
 };
 
-layout(binding = 2, std430) readonly buffer MeshTransforms {
-    mat4 meshTransforms[];
+// Index of no instance: for the hits rasterized in the G-buffer, and for the emissive triangles in the lights. NoInstance in RaytracingScene
+const uint NoInstance = 0xffffffffu;
+
+// Flattened BVHs in depth-first order: the hierarchy over the instances first, then the hierarchy of each mesh
+// Child indices are relative to the root of their hierarchy
+struct BVHNode {
+    vec3 boundsMin;
+    uint childOrFirst;   // Interior: index of the second child. Leaf: index of the first instance or triangle
+    vec3 boundsMax;
+    uint primitiveCount; // 0 for interior nodes
 };
 
+layout(binding = 4, std430) readonly buffer BVHNodes {
+    BVHNode bvhNodes[];
+};
+
+// Must match BVH::MaxDepth, so the traversal stack never overflows
+const uint BVHStackSize = 32u;
+
 // Test intersection between a ray and a sphere
 bool RaySphereIntersection(Ray ray, vec3 center, float radius, inout float distance, inout vec3 normal)
 {
@@ -64,54 +100,70 @@ bool RaySphereIntersection(Ray ray, vec3 center, float radius, inout float dista
 }
 
 
-// Test intersection between a ray and an axis aligned box
-bool RayAABBIntersection(Ray ray, vec3 size, inout float distance, inout vec3 normal)
+// Test intersection between a ray in object space and the sphere of radius 1 at the origin. The direction is not normalized
+// If the ray starts inside, the hit is where it exits
+bool RayUnitSphereIntersection(vec3 origin, vec3 direction, inout float distance)
 {
-	bool hit = false;
-
-	vec3 dirSign = mix(vec3(-1), vec3(1), greaterThanEqual(ray.direction, vec3(0)));
-	vec3 distancesMin = (-dirSign * size - ray.point) / ray.direction;
-	vec3 distancesMax = ( dirSign * size - ray.point) / ray.direction;
-
-	float distanceMin = max(distancesMin.x, max(distancesMin.y, distancesMin.z));
-	float distanceMax = min(distancesMax.x, min(distancesMax.y, distancesMax.z));
-
-	if (distanceMin < distanceMax)
+	float a = dot(direction, direction);
+	float b = dot(origin, direction);
+	float c = dot(origin, origin) - 1.0f;
+	float discr = b * b - a * c;
+	if (discr < 0.0f)
 	{
-		if (distanceMin < 0)
-		{
-			distanceMin = distanceMax;
-			distancesMin = distancesMax;
-		}
-
-		if (distanceMin > 0 && distanceMin < distance)
-		{
-			distance = distanceMin;
-			normal = mix(vec3(0.0f), -dirSign, equal(distancesMin, vec3(distance)));
+		return false;
+	}
 
-			hit = true;
-		}
+	float sqrtDiscr = sqrt(discr);
+	float t = (-b - sqrtDiscr) / a;
+	if (t < 0.0f)
+	{
+		t = (-b + sqrtDiscr) / a;
 	}
-	return hit;
+	if (t < 0.0f || t >= distance)
+	{
+		return false;
+	}
+
+	distance = t;
+	return true;
 }
 
-// Test intersection between a ray and a box
-bool RayBoxIntersection(Ray ray, mat4 matrix, vec3 size, inout float distance, inout vec3 normal)
+// Test intersection between a ray in object space and the box from -1 to 1
+// If the ray starts inside, the hit is where it exits
+bool RayUnitBoxIntersection(vec3 origin, vec3 direction, inout float distance)
 {
-	ray.point = (inverse(matrix) * vec4(ray.point, 1)).xyz;
-	ray.direction = (inverse(matrix) * vec4(ray.direction, 0)).xyz;
-	bool hit = RayAABBIntersection(ray, size, distance, normal);
-	if (hit)
+	vec3 invDirection = 1.0f / direction;
+	vec3 distancesA = (vec3(-1.0f) - origin) * invDirection;
+	vec3 distancesB = (vec3(1.0f) - origin) * invDirection;
+	vec3 distancesMin = min(distancesA, distancesB);
+	vec3 distancesMax = max(distancesA, distancesB);
+
+	float distanceMin = max(max(distancesMin.x, distancesMin.y), distancesMin.z);
+	float distanceMax = min(min(distancesMax.x, distancesMax.y), distancesMax.z);
+	if (distanceMin > distanceMax || distanceMax < 0.0f)
 	{
-		normal = (matrix * vec4(normal, 0)).xyz;
+		return false;
 	}
 
-	return hit;
+	float t = distanceMin >= 0.0f ? distanceMin : distanceMax;
+	if (t >= distance)
+	{
+		return false;
+	}
+
+	distance = t;
+	return true;
 }
 
-bool RayTriangleIntersection( vec3 ro, vec3 rd, vec3 v0, vec3 v1, vec3 v2, inout float distance , inout float hitU, inout float hitV)
+// Test intersection between a ray in object space and an analytic primitive
+bool RayPrimitiveIntersection(uint primitiveType, vec3 origin, vec3 direction, inout float distance)
 {
-    vec3 v1v0 = v1-v0, v2v0 = v2-v0, rov0 = ro-v0;
+	return primitiveType == PrimitiveSphere ? RayUnitSphereIntersection(origin, direction, distance) : RayUnitBoxIntersection(origin, direction, distance);
+}
+
+bool RayTriangleIntersection( vec3 ro, vec3 rd, vec3 v0, vec3 v1v0, vec3 v2v0, inout float distance , inout float hitU, inout float hitV)
+{
+    vec3 rov0 = ro-v0;
  
     vec3  n = cross( v1v0, v2v0 );
     vec3  q = cross( rov0, rd );
@@ -130,55 +182,503 @@ bool RayTriangleIntersection( vec3 ro, vec3 rd, vec3 v0, vec3 v1, vec3 v2, inout
     return true;
 }
 
-bool RayMeshIntersection(Ray ray, mat4 view, inout float distance, inout vec3 normal, inout vec2 uv, inout uint material)
+// Get the position of a vertex from the positions buffer
+vec3 GetVertexPosition(uint vertexIndex)
+{
+	uint offset = 3u * vertexIndex;
+	return vec3(vertexPositions[offset], vertexPositions[offset + 1u], vertexPositions[offset + 2u]);
+}
+
+// Test intersection between a ray and an indexed triangle
+bool RayTriangleIntersection(vec3 ro, vec3 rd, uvec3 indices, inout float distance, inout float hitU, inout float hitV)
 {
-	uint lastTransformId = uint(-1);
-	mat4 modelMatrix, modelViewMatrix, invModelViewMatrix;
-	Ray localRay;
+	vec3 v0 = GetVertexPosition(indices.x);
+	vec3 v1 = GetVertexPosition(indices.y);
+	vec3 v2 = GetVertexPosition(indices.z);
+	return RayTriangleIntersection(ro, rd, v0, v1 - v0, v2 - v0, distance, hitU, hitV);
+}
+
+// Decode a normal stored in octahedral encoding
+vec3 UnpackNormal(uint packedNormal)
+{
+	return DecodeOctahedral(unpackSnorm2x16(packedNormal));
+}
+
+// Test intersection between a ray and the bounds of a BVH node. Returns the entry distance, or infinity if there is no hit
+float RayNodeIntersection(vec3 origin, vec3 invDirection, uint nodeIndex, float maxDistance)
+{
+	vec3 distancesA = (bvhNodes[nodeIndex].boundsMin - origin) * invDirection;
+	vec3 distancesB = (bvhNodes[nodeIndex].boundsMax - origin) * invDirection;
+	vec3 distancesMin = min(distancesA, distancesB);
+	vec3 distancesMax = max(distancesA, distancesB);
+
+	float distanceMin = max(max(distancesMin.x, distancesMin.y), max(distancesMin.z, 0.0f));
+	float distanceMax = min(min(distancesMax.x, distancesMax.y), min(distancesMax.z, maxDistance));
+
+	return distanceMin <= distanceMax ? distanceMin : 1.0f / 0.0f;
+}
+
+// Traverse the hierarchy of a mesh instance to find the closest triangle, or test its analytic primitive. The ray is transformed
+// to object space without normalizing the direction, so distances are the same as in world space
+// hitIndex is only set by triangles
+bool RayInstanceIntersection(uint instanceIndex, vec3 worldOrigin, vec3 worldDirection, inout float distance, inout int hitIndex, inout float hitU, inout float hitV)
+{
+	const float infinity = 1.0f / 0.0f;
+
+	uint nodeOffset = instances[instanceIndex].nodeOffset;
+	uint triangleOffset = instances[instanceIndex].triangleOffset;
+
+	vec3 origin = (instances[instanceIndex].worldToObject * vec4(worldOrigin, 1.0f)).xyz;
+	vec3 direction = (instances[instanceIndex].worldToObject * vec4(worldDirection, 0.0f)).xyz;
+
+	uint primitiveType = instances[instanceIndex].primitiveType;
+	if (primitiveType != PrimitiveMesh)
+	{
+		return RayPrimitiveIntersection(primitiveType, origin, direction, distance);
+	}
+
+	vec3 invDirection = 1.0f / direction;
+
+	uint stack[BVHStackSize];
+	uint stackSize = 0u;
+	uint nodeIndex = nodeOffset;
 	bool hit = false;
 
-	for (int i = 0; i < triangles.length(); ++i) {
-		uint currentTransformId = triangles[i].transformId;
+	while (true)
+	{
+		uint primitiveCount = bvhNodes[nodeIndex].primitiveCount;
+		if (primitiveCount > 0u)
+		{
+			// Leaf: test all its triangles
+			uint first = triangleOffset + bvhNodes[nodeIndex].childOrFirst;
+			for (uint i = first; i < first + primitiveCount; ++i)
+			{
+				float t, u, v;
+				if (RayTriangleIntersection(origin, direction, triangles[i].xyz, t, u, v) && t < distance)
+				{
+					distance = t;
+					hitIndex = int(i);
+					hitU = u;
+					hitV = v;
+					hit = true;
+				}
+			}
+		}
+		else
+		{
+			// Interior: visit the closest child first and keep the other one for later
+			uint nearIndex = nodeIndex + 1u;
+			uint farIndex = nodeOffset + bvhNodes[nodeIndex].childOrFirst;
+			float nearDistance = RayNodeIntersection(origin, invDirection, nearIndex, distance);
+			float farDistance = RayNodeIntersection(origin, invDirection, farIndex, distance);
+			if (farDistance < nearDistance)
+			{
+				uint index = nearIndex; nearIndex = farIndex; farIndex = index;
+				float d = nearDistance; nearDistance = farDistance; farDistance = d;
+			}
 
-		if (currentTransformId != lastTransformId) {
-			lastTransformId = currentTransformId;
-			modelMatrix = meshTransforms[currentTransformId];
-			modelViewMatrix = view * modelMatrix;
-			invModelViewMatrix = inverse(modelViewMatrix);
+			if (nearDistance != infinity)
+			{
+				if (farDistance != infinity)
+				{
+					stack[stackSize++] = farIndex;
+				}
+				nodeIndex = nearIndex;
+				continue;
+			}
+		}
 
-			localRay.point = (invModelViewMatrix * vec4(ray.point, 1.0)).xyz;
-			localRay.direction = normalize((invModelViewMatrix * vec4(ray.direction, 0.0)).xyz);
+		// Pop the next node that is still closer than the current hit
+		bool found = false;
+		while (!found && stackSize > 0u)
+		{
+			nodeIndex = stack[--stackSize];
+			found = RayNodeIntersection(origin, invDirection, nodeIndex, distance) != infinity;
+		}
+		if (!found)
+		{
+			break;
 		}
+	}
+
+	return hit;
+}
+
+// Outward normal and parametric coordinates of the hit on an analytic primitive, and log2 of the uv area over the surface area, halved
+// The normal faces the ray origin if it is inside the primitive
+void GetPrimitiveHitAttributes(uint instanceIndex, vec3 origin, vec3 direction, float distance, out vec3 normal, out vec2 uv, out float textureLodOffset)
+{
+	vec3 objectOrigin = (instances[instanceIndex].worldToObject * vec4(origin, 1.0f)).xyz;
+	vec3 point = (instances[instanceIndex].worldToObject * vec4(origin + distance * direction, 1.0f)).xyz;
+	vec3 localNormal;
+	float localLodOffset;
+	bool inside;
+	if (instances[instanceIndex].primitiveType == PrimitiveSphere)
+	{
+		localNormal = point;
+		uv = vec2(0.5f + atan(point.z, point.x) * 0.5f * InvPi, acos(clamp(point.y, -1.0f, 1.0f)) * InvPi);
+		localLodOffset = -0.5f * log2(4.0f * Pi);
+		inside = dot(objectOrigin, objectOrigin) < 1.0f;
+	}
+	else
+	{
+		vec3 absPoint = abs(point);
+		int axis = absPoint.x > absPoint.y ? (absPoint.x > absPoint.z ? 0 : 2) : (absPoint.y > absPoint.z ? 1 : 2);
+		localNormal = vec3(0.0f);
+		localNormal[axis] = point[axis] >= 0.0f ? 1.0f : -1.0f;
+		uv = 0.5f + 0.5f * vec2(point[(axis + 1) % 3], point[(axis + 2) % 3]);
+		localLodOffset = -1.0f;
+		inside = all(lessThan(abs(objectOrigin), vec3(1.0f)));
+	}
 
-		vec3 v0 = triangles[i].v0.xyz;
-		vec3 v1 = triangles[i].v1.xyz;
-		vec3 v2 = triangles[i].v2.xyz;
+	vec3 scaledNormal = (instances[instanceIndex].normalMatrix * vec4(localNormal, 0.f)).xyz;
+	normal = normalize(inside ? -scaledNormal : scaledNormal);
 
-		float t, u, v;
-		if (RayTriangleIntersection(localRay.point, localRay.direction, v0, v1, v2, t, u, v) && t < distance) {
-			distance = t;
-			hit = true;
+	float areaScale = abs(determinant(mat3(instances[instanceIndex].objectToWorld))) * length(scaledNormal);
+	textureLodOffset = localLodOffset - 0.5f * log2(areaScale);
+}
 
-			vec3 n0 = triangles[i].normal0.xyz;
-			vec3 n1 = triangles[i].normal1.xyz;
-			vec3 n2 = triangles[i].normal2.xyz;
+// Test only the analytic primitives, traversing the hierarchy over the instances and skipping the mesh instances in its leaves
+// Used with the meshes rasterized instead of traced
+bool RayPrimitivesIntersection(Ray ray, inout float distance, inout vec3 normal, inout vec2 uv, inout uint material, inout float textureLodOffset,
+	inout uint instance)
+{
+	const float infinity = 1.0f / 0.0f;
 
-			vec3 localNormal = normalize(n0 * (1.0 - u - v) + n1 * u + n2 * v);
+	vec3 invDirection = 1.0f / ray.direction;
 
-			if (ray.ior != 1.0f && dot(localNormal, ray.direction) > 0.0)
+	if (instances.length() == 0 || RayNodeIntersection(ray.point, invDirection, 0u, distance) == infinity)
+	{
+		return false;
+	}
+
+	uint stack[BVHStackSize];
+	uint stackSize = 0u;
+	uint nodeIndex = 0u;
+
+	bool hit = false;
+	uint hitInstance = 0u;
+
+	while (true)
+	{
+		uint primitiveCount = bvhNodes[nodeIndex].primitiveCount;
+		if (primitiveCount > 0u)
+		{
+			// Leaf: test the analytic primitives among its instances
+			uint first = bvhNodes[nodeIndex].childOrFirst;
+			for (uint i = first; i < first + primitiveCount; ++i)
+			{
+				uint primitiveType = instances[i].primitiveType;
+				if (primitiveType == PrimitiveMesh)
+				{
+					continue;
+				}
+
+				vec3 origin = (instances[i].worldToObject * vec4(ray.point, 1.0f)).xyz;
+				vec3 direction = (instances[i].worldToObject * vec4(ray.direction, 0.0f)).xyz;
+				if (RayPrimitiveIntersection(primitiveType, origin, direction, distance))
+				{
+					hitInstance = i;
+					hit = true;
+				}
+			}
+		}
+		else
+		{
+			// Interior: visit the closest child first and keep the other one for later
+			uint nearIndex = nodeIndex + 1u;
+			uint farIndex = bvhNodes[nodeIndex].childOrFirst;
+			float nearDistance = RayNodeIntersection(ray.point, invDirection, nearIndex, distance);
+			float farDistance = RayNodeIntersection(ray.point, invDirection, farIndex, distance);
+			if (farDistance < nearDistance)
 			{
-				localNormal = -localNormal;
+				uint index = nearIndex; nearIndex = farIndex; farIndex = index;
+				float d = nearDistance; nearDistance = farDistance; farDistance = d;
 			}
 
-			vec2 uv0 = triangles[i].uv0;
-			vec2 uv1 = triangles[i].uv1;
-			vec2 uv2 = triangles[i].uv2;
+			if (nearDistance != infinity)
+			{
+				if (farDistance != infinity)
+				{
+					stack[stackSize++] = farIndex;
+				}
+				nodeIndex = nearIndex;
+				continue;
+			}
+		}
 
-			normal = normalize((modelViewMatrix * vec4(localNormal, 0.f)).xyz);
-			uv = uv0 * (1.0 - u - v) + uv1 * u + uv2 * v;
-			material = triangles[i].materialId;
+		// Pop the next node that is still closer than the current hit
+		bool found = false;
+		while (!found && stackSize > 0u)
+		{
+			nodeIndex = stack[--stackSize];
+			found = RayNodeIntersection(ray.point, invDirection, nodeIndex, distance) != infinity;
+		}
+		if (!found)
+		{
+			break;
 		}
 	}
 
+	if (hit)
+	{
+		GetPrimitiveHitAttributes(hitInstance, ray.point, ray.direction, distance, normal, uv, textureLodOffset);
+		material = instances[hitInstance].materialId;
+		instance = hitInstance;
+	}
 	return hit;
 }
+
+// Traverse the hierarchy over the instances, and the hierarchy of each instance hit, to find the closest triangle or analytic primitive
+// Rays are in world space, and so is the returned normal
+// textureLodOffset is 0.5 * log2 of the texture coordinate area over the world area of the hit surface, and instance is the one hit
+bool RayMeshIntersection(Ray ray, inout float distance, inout vec3 normal, inout vec2 uv, inout uint material, inout float textureLodOffset,
+	inout uint instance)
+{
+	const float infinity = 1.0f / 0.0f;
+
+	vec3 origin = ray.point;
+	vec3 direction = ray.direction;
+	vec3 invDirection = 1.0f / direction;
+
+	if (instances.length() == 0 || RayNodeIntersection(origin, invDirection, 0u, distance) == infinity)
+	{
+		return false;
+	}
+
+	uint stack[BVHStackSize];
+	uint stackSize = 0u;
+	uint nodeIndex = 0u;
+
+	bool hit = false;
+	int hitIndex = -1;
+	uint hitInstance = 0u;
+	float hitU = 0.0f, hitV = 0.0f;
+
+	while (true)
+	{
+		uint primitiveCount = bvhNodes[nodeIndex].primitiveCount;
+		if (primitiveCount > 0u)
+		{
+			// Leaf: enter the hierarchy of each instance
+			uint first = bvhNodes[nodeIndex].childOrFirst;
+			for (uint i = first; i < first + primitiveCount; ++i)
+			{
+				if (RayInstanceIntersection(i, origin, direction, distance, hitIndex, hitU, hitV))
+				{
+					hitInstance = i;
+					hit = true;
+				}
+			}
+		}
+		else
+		{
+			// Interior: visit the closest child first and keep the other one for later
+			uint nearIndex = nodeIndex + 1u;
+			uint farIndex = bvhNodes[nodeIndex].childOrFirst;
+			float nearDistance = RayNodeIntersection(origin, invDirection, nearIndex, distance);
+			float farDistance = RayNodeIntersection(origin, invDirection, farIndex, distance);
+			if (farDistance < nearDistance)
+			{
+				uint index = nearIndex; nearIndex = farIndex; farIndex = index;
+				float d = nearDistance; nearDistance = farDistance; farDistance = d;
+			}
+
+			if (nearDistance != infinity)
+			{
+				if (farDistance != infinity)
+				{
+					stack[stackSize++] = farIndex;
+				}
+				nodeIndex = nearIndex;
+				continue;
+			}
+		}
+
+		// Pop the next node that is still closer than the current hit
+		bool found = false;
+		while (!found && stackSize > 0u)
+		{
+			nodeIndex = stack[--stackSize];
+			found = RayNodeIntersection(origin, invDirection, nodeIndex, distance) != infinity;
+		}
+		if (!found)
+		{
+			break;
+		}
+	}
+
+	if (hit)
+	{
+		instance = hitInstance;
+	}
+
+	uint hitType = instances[hitInstance].primitiveType;
+	if (hit && hitType != PrimitiveMesh)
+	{
+		GetPrimitiveHitAttributes(hitInstance, origin, direction, distance, normal, uv, textureLodOffset);
+		material = instances[hitInstance].materialId;
+	}
+	else if (hit)
+	{
+		float u = hitU, v = hitV;
+
+		uvec4 triangle = triangles[hitIndex];
+		VertexAttributes attributes0 = vertexAttributes[triangle.x];
+		VertexAttributes attributes1 = vertexAttributes[triangle.y];
+		VertexAttributes attributes2 = vertexAttributes[triangle.z];
+
+		vec3 n0 = UnpackNormal(attributes0.normal);
+		vec3 n1 = UnpackNormal(attributes1.normal);
+		vec3 n2 = UnpackNormal(attributes2.normal);
+
+		vec3 localNormal = normalize(n0 * (1.0 - u - v) + n1 * u + n2 * v);
+		vec3 scaledNormal = (instances[hitInstance].normalMatrix * vec4(localNormal, 0.f)).xyz;
+		vec3 worldNormal = normalize(scaledNormal);
+
+		if (ray.ior != 1.0f && dot(worldNormal, direction) > 0.0)
+		{
+			worldNormal = -worldNormal;
+		}
+
+		vec2 uv0 = unpackHalf2x16(attributes0.uv);
+		vec2 uv1 = unpackHalf2x16(attributes1.uv);
+		vec2 uv2 = unpackHalf2x16(attributes2.uv);
+
+		normal = worldNormal;
+		uv = uv0 * (1.0 - u - v) + uv1 * u + uv2 * v;
+		material = instances[hitInstance].materialId + (triangle.w & 0xFFFFu);
+
+		// An area with this normal is scaled by the determinant times the length of the transformed normal
+		float areaScale = abs(determinant(mat3(instances[hitInstance].objectToWorld))) * length(scaledNormal);
+		textureLodOffset = unpackHalf2x16(triangle.w).y - 0.5f * log2(areaScale);
+	}
+
+	return hit;
+}
+
+// Traverse the hierarchy of a mesh instance until a triangle closer than maxDistance is found, or test its analytic primitive
+// The distance never shrinks, so the nodes on the stack were already tested, and the children don't need to be sorted
+bool RayInstanceOccluded(uint instanceIndex, vec3 worldOrigin, vec3 worldDirection, float maxDistance)
+{
+	const float infinity = 1.0f / 0.0f;
+
+	uint nodeOffset = instances[instanceIndex].nodeOffset;
+	uint triangleOffset = instances[instanceIndex].triangleOffset;
+
+	vec3 origin = (instances[instanceIndex].worldToObject * vec4(worldOrigin, 1.0f)).xyz;
+	vec3 direction = (instances[instanceIndex].worldToObject * vec4(worldDirection, 0.0f)).xyz;
+
+	uint primitiveType = instances[instanceIndex].primitiveType;
+	if (primitiveType != PrimitiveMesh)
+	{
+		return RayPrimitiveIntersection(primitiveType, origin, direction, maxDistance);
+	}
+
+	vec3 invDirection = 1.0f / direction;
+
+	uint stack[BVHStackSize];
+	uint stackSize = 0u;
+	uint nodeIndex = nodeOffset;
+
+	while (true)
+	{
+		uint primitiveCount = bvhNodes[nodeIndex].primitiveCount;
+		if (primitiveCount > 0u)
+		{
+			uint first = triangleOffset + bvhNodes[nodeIndex].childOrFirst;
+			for (uint i = first; i < first + primitiveCount; ++i)
+			{
+				float t, u, v;
+				if (RayTriangleIntersection(origin, direction, triangles[i].xyz, t, u, v) && t < maxDistance)
+				{
+					return true;
+				}
+			}
+		}
+		else
+		{
+			uint firstIndex = nodeIndex + 1u;
+			uint secondIndex = nodeOffset + bvhNodes[nodeIndex].childOrFirst;
+			bool firstHit = RayNodeIntersection(origin, invDirection, firstIndex, maxDistance) != infinity;
+			bool secondHit = RayNodeIntersection(origin, invDirection, secondIndex, maxDistance) != infinity;
+			if (firstHit || secondHit)
+			{
+				if (firstHit && secondHit)
+				{
+					stack[stackSize++] = secondIndex;
+				}
+				nodeIndex = firstHit ? firstIndex : secondIndex;
+				continue;
+			}
+		}
+
+		if (stackSize == 0u)
+		{
+			break;
+		}
+		nodeIndex = stack[--stackSize];
+	}
+
+	return false;
+}
+
+// Test if any triangle or analytic primitive is hit by a world space ray closer than maxDistance, for shadow rays
+// Returns at the first hit found, without the normal, texture coordinates and material of RayMeshIntersection
+bool Occluded(Ray ray, float maxDistance)
+{
+	const float infinity = 1.0f / 0.0f;
+
+	vec3 origin = ray.point;
+	vec3 direction = ray.direction;
+	vec3 invDirection = 1.0f / direction;
+
+	if (instances.length() == 0 || RayNodeIntersection(origin, invDirection, 0u, maxDistance) == infinity)
+	{
+		return false;
+	}
+
+	uint stack[BVHStackSize];
+	uint stackSize = 0u;
+	uint nodeIndex = 0u;
+
+	while (true)
+	{
+		uint primitiveCount = bvhNodes[nodeIndex].primitiveCount;
+		if (primitiveCount > 0u)
+		{
+			uint first = bvhNodes[nodeIndex].childOrFirst;
+			for (uint i = first; i < first + primitiveCount; ++i)
+			{
+				if (RayInstanceOccluded(i, origin, direction, maxDistance))
+				{
+					return true;
+				}
+			}
+		}
+		else
+		{
+			uint firstIndex = nodeIndex + 1u;
+			uint secondIndex = bvhNodes[nodeIndex].childOrFirst;
+			bool firstHit = RayNodeIntersection(origin, invDirection, firstIndex, maxDistance) != infinity;
+			bool secondHit = RayNodeIntersection(origin, invDirection, secondIndex, maxDistance) != infinity;
+			if (firstHit || secondHit)
+			{
+				if (firstHit && secondHit)
+				{
+					stack[stackSize++] = secondIndex;
+				}
+				nodeIndex = firstHit ? firstIndex : secondIndex;
+				continue;
+			}
+		}
+
+		if (stackSize == 0u)
+		{
+			break;
+		}
+		nodeIndex = stack[--stackSize];
+	}
+
+	return false;
+}
@@ -6,6 +6,12 @@ struct Ray
 	vec3 direction;
 	vec3 colorFilter;
 	float ior;
+	// Density of the direction if it was sampled from the diffuse or specular lobe, with next-event estimation at its origin. 0 otherwise,
+	// and negative for the diffuse rays of the hits lit by the light reservoirs
+	float bsdfPdf;
+	// Cone around the ray, to pick the texture LOD at the hit: width at the origin, and angle added per unit of distance
+	float coneWidth;
+	float coneSpread;
 };
 
 // Forward declare distance function
@@ -17,6 +23,19 @@ vec3 CastRay(Ray ray)
 	return CastRay(ray, distance);
 }
 
+// Same as CastRay, but the hits on the meshes may come from a G-buffer instead
+vec3 CastPrimaryRay(Ray ray, inout float distance);
+
+// Normal and albedo of the last hit found by CastRay
+vec3 HitNormal = vec3(0.0f);
+vec3 HitAlbedo = vec3(0.0f);
+
+// First hit of the primary ray, used to reproject the accumulated samples when the camera moves, and by the denoiser
+// The distance is infinite if it missed
+float PrimaryHitDistance = 1.0f / 0.0f;
+vec3 PrimaryHitNormal = vec3(0.0f);
+vec3 PrimaryHitAlbedo = vec3(0.0f);
+
 // Forward declare config function
 void GetRayTracerConfig(out uint maxRays);
 
@@ -53,7 +72,15 @@ bool GetPendingRay(out Ray ray)
 	return found;
 }
 
-vec3 RayTrace(vec3 point, vec3 direction)
+// Radiance cache hook of ProcessOutput. The tree of rays doesn't use the cache
+bool EndPathOnRadianceCache(Ray ray, vec3 position, vec3 normal, bool afterDiffuseBounce, out vec3 radiance)
+{
+	radiance = vec3(0.0f);
+	return false;
+}
+
+// The cone of the primary ray starts at the point, with the spread angle of a pixel
+vec3 RayTrace(vec3 point, vec3 direction, float coneSpread)
 {
 	vec3 color = vec3(0);
 
@@ -61,11 +88,20 @@ vec3 RayTrace(vec3 point, vec3 direction)
 	GetRayTracerConfig(maxRays);
 	_RayMaxCount = min(_RayMaxCount, maxRays);
 
-	Ray ray = Ray(point, direction, vec3(1.0f), 1.0f);
+	Ray ray = Ray(point, direction, vec3(1.0f), 1.0f, 0.0f, 0.0f, coneSpread);
 
+	uint castCount = 0u;
 	do
 	{
-		color += CastRay(ray);
+		StartSampleRay(castCount);
+		float distance = 1.0f / 0.0f;
+		color += castCount == 0u ? CastPrimaryRay(ray, distance) : CastRay(ray, distance);
+		if (castCount++ == 0u)
+		{
+			PrimaryHitDistance = distance;
+			PrimaryHitNormal = HitNormal;
+			PrimaryHitAlbedo = HitAlbedo;
+		}
 	} while(GetPendingRay(ray));
 
 	return color;
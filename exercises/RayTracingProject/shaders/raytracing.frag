@@ -1,92 +1,69 @@
-//Inputs
-in vec2 TexCoord;
-
 //Outputs
-out vec4 FragColor;
+// Added to the accumulation: the color, with 1 in alpha to count the samples, and the squared luminance
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragMoments;
+// Position, with the distance along the primary ray in w, normal and albedo of the primary hit. Only written by the first sample
+layout(location = 2) out vec4 FragPosition;
+layout(location = 3) out vec4 FragNormal;
+layout(location = 4) out vec4 FragAlbedo;
 
 //Uniforms
 uniform mat4 ProjMatrix;
-uniform mat4 InvProjMatrix;
 uniform uint FrameCount;
 
-void InitRandomSeed();
-float Rand01();
+// Samples drawn before the accumulation was last reset, so the frames after a camera move don't repeat the same samples
+uniform uint SampleOffset;
 
-void main()
-{
-	InitRandomSeed();
+// Adaptive sampling: the mask has the sample count of each pixel when it was built, in frame SamplingMaskFrame,
+// or -1 if the pixel has converged
+uniform uint AdaptiveSampling;
+uniform sampler2D SamplingMask;
+uniform uint SamplingMaskFrame;
 
-	// Start from transformed position
-	vec4 viewPos = InvProjMatrix * vec4(TexCoord.xy * 2.0f - 1.0f, 0.0f, 1.0f);
-	vec3 origin = viewPos.xyz / viewPos.w;
+void InitRandomSeed(uint sampleIndex);
 
-	// Normalize to get view direction
-	vec3 dir = normalize(origin);
+void main()
+{
+	// Angle between the rays of two neighbor pixels, the spread of the cones of the primary rays. Taken before any discard
+	float coneSpread = atan(2.0f * InvProjMatrix[1][1] * abs(dFdy(TexCoord.y)));
+
+	// Skip the converged pixels. The others got one sample per frame since the mask was built
+	uint sampleIndex = SampleOffset + FrameCount - 1u;
+	if (AdaptiveSampling != 0u)
+	{
+		float maskedSampleCount = texelFetch(SamplingMask, ivec2(gl_FragCoord.xy), 0).r;
+		if (maskedSampleCount < 0.0f)
+		{
+			discard;
+		}
+		sampleIndex = SampleOffset + uint(maskedSampleCount) + FrameCount - SamplingMaskFrame;
+	}
+
+	InitRandomSeed(sampleIndex);
+
+	vec3 origin, dir;
+	GetPrimaryRay(origin, dir);
 
 	// Raytrace the scene
-	vec3 color = RayTrace(origin, dir);
-
-	// Compute the alpha to blend between frames of the path tracer
-	float alpha = 1.0f / FrameCount;
-	FragColor = vec4(color, alpha);
+	vec3 color = RayTrace(origin, dir, coneSpread);
+
+	// Add the sample to the sums of the pixel, resolved to the mean by resolve.frag
+	float luminance = GetLuminance(color);
+	FragColor = vec4(color, 1.0f);
+	FragMoments = vec4(luminance * luminance, 0.0f, 0.0f, 0.0f);
+
+	// The later samples add 0, the primary hit doesn't change while the camera is still
+	bool hit = FrameCount == 1u && !isinf(PrimaryHitDistance);
+	FragPosition = hit ? vec4(origin + PrimaryHitDistance * dir, PrimaryHitDistance) : vec4(0.0f);
+	FragNormal = hit ? vec4(PrimaryHitNormal, 0.0f) : vec4(0.0f);
+	FragAlbedo = hit ? vec4(PrimaryHitAlbedo, 0.0f) : vec4(0.0f);
 }
 
 
 // Additional functions
 
-uint RandSeed;
-
-// Initalize random seed
-void InitRandomSeed()
-{
-	uint seedTime = FrameCount;
-	uint seedX = uint(gl_FragCoord.x);
-	uint seedY = uint(gl_FragCoord.y);
-	RandSeed = LCG(seedX) ^ LCG(seedY) ^ LCG(seedTime);
-}
-
-// Generates a random float between 0 and 1
-float Rand01()
-{
-	return float(LCG(RandSeed)) / float(0x01000000u);
-}
-
-// Returns a random direction on the cosine weighted hemisphere oriented along the normal
-vec3 GetDiffuseReflectionDirection(Ray ray, vec3 normal)
-{
-	float phi = 6.28318530718f * Rand01();
-	vec3 direction = GetImplicitNormal(vec2(cos(phi), sin(phi)) * Rand01());
-	vec3 bitangent = normalize(cross(normal, normal.z > 0.5f ? vec3(0, 1, 0) : vec3(0, 0, 1)));
-	vec3 tangent = cross(normal, bitangent);
-	return direction.x * bitangent + direction.y * tangent + direction.z * normal;
-}
-
-// Returns the direction of the ray reflected over the normal
-vec3 GetSpecularReflectionDirection(Ray ray, vec3 normal)
-{
-	return reflect(ray.direction, normal);
-}
-
-// Returns the direction of the ray refracted 
-vec3 GetRefractedDirection(Ray ray, vec3 normal, float f)
-{
-	return refract(ray.direction, normal, f);
-}
-
-vec3 GetAlbedo(Material material)
-{
-	// Metals have a black albedo
-	return mix(material.albedo.xyz, vec3(0), material.metalness);
-}
-
-vec3 GetReflectance(Material material)
-{
-	// We use a fixed value for dielectric, with a typical value for these materials (4%)
-	return mix(vec3(0.04f), material.albedo.xyz, material.metalness);
-}
-
-// Schlick simplification of the Fresnel term
-vec3 FresnelSchlick(vec3 f0, vec3 viewDir, vec3 halfDir)
+// Initalize random seed, for the sample of the pixel with this index
+void InitRandomSeed(uint sampleIndex)
 {
-	return f0 + (vec3(1.0f) - f0) * pow(1.0f - ClampedDot(viewDir, halfDir), 5.0f);
+	InitSampler(uvec2(gl_FragCoord.xy), sampleIndex);
 }
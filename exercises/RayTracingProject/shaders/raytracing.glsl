@@ -0,0 +1,172 @@
+// Inputs, uniforms and functions of the ray tracing fragment shaders, shared by raytracing.frag and reservoirs.frag
+
+//Inputs
+in vec2 TexCoord;
+
+//Uniforms
+uniform mat4 InvProjMatrix;
+uniform mat4 InvViewMatrix;
+
+// Hybrid rendering: depth, albedo, octahedral normal and material index (alpha of the others texture) of the rasterized meshes
+uniform sampler2D GBufferDepth;
+uniform sampler2D GBufferAlbedo;
+uniform sampler2D GBufferNormal;
+uniform sampler2D GBufferOthers;
+
+// Primary ray of the pixel, in world space. It starts on the near plane, not at the camera
+void GetPrimaryRay(out vec3 origin, out vec3 direction)
+{
+	// Start from transformed position
+	vec4 viewPos = InvProjMatrix * vec4(TexCoord.xy * 2.0f - 1.0f, 0.0f, 1.0f);
+	origin = viewPos.xyz / viewPos.w;
+
+	// Normalize to get view direction
+	direction = normalize(origin);
+
+	// Rays are traced in world space
+	origin = (InvViewMatrix * vec4(origin, 1.0f)).xyz;
+	direction = (InvViewMatrix * vec4(direction, 0.0f)).xyz;
+}
+
+// Hit of the primary ray on the meshes rasterized by GBufferRenderPass
+bool GetGBufferHit(Ray ray, out float distance, out vec3 normal, out Material material)
+{
+	float depth = texture(GBufferDepth, TexCoord).r;
+	if (depth >= 1.0f)
+	{
+		distance = 1.0f / 0.0f;
+		normal = vec3(0.0f);
+		return false;
+	}
+
+	vec3 viewPosition = ReconstructViewPosition(GBufferDepth, TexCoord, InvProjMatrix);
+
+	// The depth is quantized, so the hit is pulled back toward the camera by 2 steps of the 24-bit depth: it must stay in
+	// front of the surface, or the rays leaving it could hit it again. A step grows with the square of the view depth,
+	// and InvProjMatrix[2][3] is (near - far) / (2 * far * near)
+	viewPosition *= 1.0f - 2.0f * (2.0f / 16777216.0f) * InvProjMatrix[2][3] * viewPosition.z;
+	vec3 position = (InvViewMatrix * vec4(viewPosition, 1.0f)).xyz;
+
+	// Distance along the ray, that starts on the near side of the frustum and not at the camera
+	distance = dot(position - ray.point, ray.direction);
+	normal = DecodeOctahedral(texture(GBufferNormal, TexCoord).rg);
+
+	// The albedo is already multiplied by the texture
+	material = Materials[uint(texture(GBufferOthers, TexCoord).a * 255.0f + 0.5f)];
+	material.albedo.rgb = texture(GBufferAlbedo, TexCoord).rgb;
+	return true;
+}
+
+// Generates a random float between 0 and 1
+float Rand01()
+{
+	return SampleNext();
+}
+
+// Returns a random direction on the cosine weighted hemisphere oriented along the normal
+vec3 GetDiffuseReflectionDirection(Ray ray, vec3 normal)
+{
+	float phi = 6.28318530718f * Rand01();
+	vec3 direction = GetImplicitNormal(vec2(cos(phi), sin(phi)) * sqrt(Rand01()));
+	vec3 bitangent = normalize(cross(normal, abs(normal.z) > 0.5f ? vec3(0, 1, 0) : vec3(0, 0, 1)));
+	vec3 tangent = cross(normal, bitangent);
+	return direction.x * bitangent + direction.y * tangent + direction.z * normal;
+}
+
+// Returns the direction of the ray reflected over the normal
+vec3 GetSpecularReflectionDirection(Ray ray, vec3 normal)
+{
+	return reflect(ray.direction, normal);
+}
+
+// GGX distribution of the microfacet normals, for the cosine between the normal and the half vector. Alpha is the squared roughness
+float GgxDistribution(float NdotH, float alpha)
+{
+	float alpha2 = alpha * alpha;
+	float d = NdotH * NdotH * (alpha2 - 1.0f) + 1.0f;
+	return NdotH > 0.0f ? alpha2 / (Pi * d * d) : 0.0f;
+}
+
+// Smith Lambda function of the GGX distribution, for a direction with the given cosine to the normal
+float SmithLambda(float NdotV, float alpha)
+{
+	float cos2 = NdotV * NdotV;
+	return 0.5f * (sqrt(1.0f + alpha * alpha * (1.0f - cos2) / cos2) - 1.0f);
+}
+
+// Smith masking of one direction
+float SmithG1(float NdotV, float alpha)
+{
+	return 1.0f / (1.0f + SmithLambda(NdotV, alpha));
+}
+
+// Height-correlated Smith masking and shadowing of the view and light directions
+float SmithG2(float NdotV, float NdotL, float alpha)
+{
+	return 1.0f / (1.0f + SmithLambda(NdotV, alpha) + SmithLambda(NdotL, alpha));
+}
+
+// Density per solid angle of the directions returned by GetGgxReflectionDirection
+float GetGgxReflectionPdf(float NdotV, float NdotH, float alpha)
+{
+	return SmithG1(NdotV, alpha) * GgxDistribution(NdotH, alpha) / (4.0f * NdotV);
+}
+
+// Sample a microfacet normal among the ones visible from the view direction (Heitz 2018)
+// Vectors are in tangent space, with the normal along z
+vec3 SampleGgxVisibleNormal(vec3 view, float alpha, vec2 u)
+{
+	// Stretch the view to the configuration with alpha 1, where the visible normals cover a hemisphere
+	vec3 stretchedView = normalize(vec3(alpha * view.xy, view.z));
+	float length2 = dot(stretchedView.xy, stretchedView.xy);
+	vec3 t1 = length2 > 0.0f ? vec3(-stretchedView.y, stretchedView.x, 0.0f) / sqrt(length2) : vec3(1.0f, 0.0f, 0.0f);
+	vec3 t2 = cross(stretchedView, t1);
+
+	// Point on the projected disk, warped to the visible part of the hemisphere
+	float r = sqrt(u.x);
+	float phi = 6.28318530718f * u.y;
+	float p1 = r * cos(phi);
+	float p2 = r * sin(phi);
+	float s = 0.5f * (1.0f + stretchedView.z);
+	p2 = (1.0f - s) * sqrt(1.0f - p1 * p1) + s * p2;
+	vec3 microfacetNormal = p1 * t1 + p2 * t2 + sqrt(max(1.0f - p1 * p1 - p2 * p2, 0.0f)) * stretchedView;
+
+	// Unstretch
+	return normalize(vec3(alpha * microfacetNormal.xy, max(microfacetNormal.z, 0.0f)));
+}
+
+// Returns the direction of the ray reflected over a microfacet normal, sampled from the GGX normals visible from the ray
+vec3 GetGgxReflectionDirection(Ray ray, vec3 normal, float alpha)
+{
+	vec2 u = vec2(Rand01(), Rand01());
+	vec3 bitangent = normalize(cross(normal, abs(normal.z) > 0.5f ? vec3(0, 1, 0) : vec3(0, 0, 1)));
+	vec3 tangent = cross(normal, bitangent);
+	vec3 view = -ray.direction;
+	vec3 localView = vec3(dot(view, bitangent), dot(view, tangent), max(dot(view, normal), 1e-6f));
+	vec3 microfacetNormal = SampleGgxVisibleNormal(normalize(localView), alpha, u);
+	return reflect(ray.direction, microfacetNormal.x * bitangent + microfacetNormal.y * tangent + microfacetNormal.z * normal);
+}
+
+// Returns the direction of the ray refracted 
+vec3 GetRefractedDirection(Ray ray, vec3 normal, float f)
+{
+	return refract(ray.direction, normal, f);
+}
+
+vec3 GetAlbedo(Material material)
+{
+	// Metals have a black albedo
+	return mix(material.albedo.xyz, vec3(0), material.metalness);
+}
+
+vec3 GetReflectance(Material material)
+{
+	// We use a fixed value for dielectric, with a typical value for these materials (4%)
+	return mix(vec3(0.04f), material.albedo.xyz, material.metalness);
+}
+
+// Schlick simplification of the Fresnel term. The dot product can round above 1, and pow is undefined for a negative base
+vec3 FresnelSchlick(vec3 f0, vec3 viewDir, vec3 halfDir)
+{
+	return f0 + (vec3(1.0f) - f0) * pow(max(1.0f - ClampedDot(viewDir, halfDir), 0.0f), 5.0f);
+}
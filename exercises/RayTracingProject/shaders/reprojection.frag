@@ -0,0 +1,93 @@
+//Inputs
+in vec2 TexCoord;
+
+//Outputs
+// Added to the accumulation: the sums of the history samples that see the same surface, and their squared luminance
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragMoments;
+
+//Uniforms
+// Primary hits of the current camera
+uniform sampler2D PositionTexture;
+uniform sampler2D NormalTexture;
+
+// Accumulation of the previous camera
+uniform sampler2D HistorySourceTexture;
+uniform sampler2D HistoryMomentsTexture;
+uniform sampler2D HistoryPositionTexture;
+uniform sampler2D HistoryNormalTexture;
+
+uniform mat4 PreviousViewProjMatrix;
+
+// History is scaled down to this number of samples, so the view dependent lighting and the resampling blur fade out
+uniform float MaxHistorySampleCount;
+
+// Largest distance between the hits of the current and the previous camera, relative to the distance along the ray
+const float DepthTolerance = 0.02f;
+
+// Smallest cosine between the normals of the current and the previous hit
+const float NormalTolerance = 0.9f;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 position = texelFetch(PositionTexture, pixel, 0);
+	vec3 normal = texelFetch(NormalTexture, pixel, 0).xyz;
+
+	// Rays that missed have no history
+	if (position.w == 0.0f)
+	{
+		discard;
+	}
+
+	// Pixel of the previous camera that saw this hit
+	vec4 previousClip = PreviousViewProjMatrix * vec4(position.xyz, 1.0f);
+	if (previousClip.w <= 0.0f)
+	{
+		discard;
+	}
+	vec2 previousPixel = (previousClip.xy / previousClip.w * 0.5f + 0.5f) * vec2(textureSize(HistorySourceTexture, 0)) - 0.5f;
+
+	// Bilinear filter of the 4 nearest history pixels, keeping the ones where the previous camera saw the same surface
+	ivec2 basePixel = ivec2(floor(previousPixel));
+	vec2 fraction = previousPixel - vec2(basePixel);
+	ivec2 maxPixel = textureSize(HistorySourceTexture, 0) - ivec2(1);
+	vec4 historySum = vec4(0.0f);
+	float historyMoments = 0.0f;
+	float weightSum = 0.0f;
+	for (int i = 0; i < 4; ++i)
+	{
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 tapPixel = basePixel + offset;
+		if (any(lessThan(tapPixel, ivec2(0))) || any(greaterThan(tapPixel, maxPixel)))
+		{
+			continue;
+		}
+
+		// Disocclusion: the previous hit is on another surface
+		vec4 historyPosition = texelFetch(HistoryPositionTexture, tapPixel, 0);
+		vec3 historyNormal = texelFetch(HistoryNormalTexture, tapPixel, 0).xyz;
+		if (historyPosition.w == 0.0f
+			|| abs(dot(historyPosition.xyz - position.xyz, normal)) > DepthTolerance * position.w
+			|| dot(historyNormal, normal) < NormalTolerance)
+		{
+			continue;
+		}
+
+		vec2 bilinear = mix(vec2(1.0f) - fraction, fraction, vec2(offset));
+		float weight = bilinear.x * bilinear.y;
+		historySum += weight * texelFetch(HistorySourceTexture, tapPixel, 0);
+		historyMoments += weight * texelFetch(HistoryMomentsTexture, tapPixel, 0).r;
+		weightSum += weight;
+	}
+
+	if (weightSum <= 0.0f || historySum.a <= 0.0f)
+	{
+		discard;
+	}
+
+	// Normalize over the valid taps, then limit the number of samples
+	float scale = min(1.0f / weightSum, MaxHistorySampleCount / historySum.a);
+	FragColor = scale * historySum;
+	FragMoments = vec4(scale * historyMoments, 0.0f, 0.0f, 0.0f);
+}
@@ -0,0 +1,63 @@
+//Outputs
+// Reservoir of the primary hit of the pixel, read by the primary hits of raytracing.frag and by this shader in the next frame
+// See ReservoirLightTexture, ReservoirPositionTexture and ReservoirWeightTexture in lightreservoirs.glsl
+layout(location = 0) out vec4 FragLight;
+layout(location = 1) out vec4 FragPosition;
+layout(location = 2) out vec4 FragWeight;
+
+//Uniforms
+// Index of the frame plus one, that seeds the candidates
+uniform uint FrameCount;
+
+// Add the reservoir of the previous frame, at the pixel where the previous camera saw the hit
+uniform uint TemporalReuse;
+uniform mat4 PreviousViewProjMatrix;
+
+void main()
+{
+	FragLight = vec4(0.0f);
+	FragPosition = vec4(0.0f);
+	FragWeight = vec4(0.0f);
+
+	// The candidates take their own range of dimensions
+	InitSampler(uvec2(gl_FragCoord.xy), FrameCount - 1u);
+	StartSampleRay(ReservoirSampleRay);
+
+	// Same primary hit as raytracing.frag. Only the opaque hits shaded by ProcessOutput have a reservoir
+	vec3 origin, direction;
+	GetPrimaryRay(origin, direction);
+	Ray ray = Ray(origin, direction, vec3(1.0f), 1.0f, 0.0f, 0.0f, 0.0f);
+	float distance = 1.0f / 0.0f;
+	vec3 normal;
+	Material material;
+	uint instance;
+	if (!FindPrimaryHit(ray, distance, normal, material, instance) || distance < 0.001f || material.ior != 0.0f)
+	{
+		return;
+	}
+	normal = normalize(normal);
+	vec3 position = ray.point + distance * ray.direction;
+
+	Reservoir reservoir = SampleReservoir(position, normal);
+
+	if (TemporalReuse != 0u)
+	{
+		// Nearest pixel of the previous camera
+		vec4 previousClip = PreviousViewProjMatrix * vec4(position, 1.0f);
+		if (previousClip.w > 0.0f)
+		{
+			vec2 previousPixel = (previousClip.xy / previousClip.w * 0.5f + 0.5f) * vec2(textureSize(ReservoirPositionTexture, 0));
+			Reservoir previous;
+			if (ReadReservoir(ivec2(floor(previousPixel)), position, normal, distance, previous))
+			{
+				previous.count = min(previous.count, ReservoirMaxHistoryCount);
+				CombineReservoir(reservoir, previous, position, normal);
+			}
+		}
+	}
+
+	FinishReservoir(reservoir);
+	FragLight = vec4(reservoir.lightPoint, float(reservoir.lightIndex + 1u));
+	FragPosition = vec4(position, distance);
+	FragWeight = vec4(reservoir.weight, reservoir.count, EncodeOctahedral(normal));
+}
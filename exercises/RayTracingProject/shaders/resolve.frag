@@ -0,0 +1,15 @@
+//Inputs
+in vec2 TexCoord;
+
+//Outputs
+out vec4 FragColor;
+
+//Uniforms
+// Sum of the samples of each pixel, with the sample count in alpha
+uniform sampler2D SourceTexture;
+
+void main()
+{
+	vec4 sum = texture(SourceTexture, TexCoord);
+	FragColor = vec4(sum.rgb / max(sum.a, 1.0f), 1.0f);
+}
@@ -0,0 +1,158 @@
+
+// Random numbers of the path tracer, indexed by pixel, sample index and dimension
+// Each ray of a sample starts a new range of dimensions, so the numbers taken by a hit don't depend on the ones taken before it
+// The dimensions of each ray are split in groups of 4, and each group is a 4D Sobol sequence with nested uniform (Owen) scrambling
+// seeded by the pixel, the ray and the group, and a shuffled sample index (Burley 2020)
+// With the blue noise sampler, all the pixels share the same scrambling, and each pixel shifts the points by the value of a
+// blue noise tile, so the error of neighbor pixels is decorrelated at low sample counts
+
+// Sampler types, the same as Sampler::Type on the CPU
+const uint SamplerRandom = 0u;
+const uint SamplerSobol = 1u;
+const uint SamplerBlueNoise = 2u;
+
+// Side of the blue noise tile, a power of 2
+const uint BlueNoiseSize = 64u;
+
+uniform uint SamplerType;
+
+// Ranks of the blue noise tile, multiplied by 16 to use the range of a 16-bit texture
+uniform sampler2D BlueNoiseTexture;
+
+// Direction numbers of the first 4 dimensions of the Sobol sequence, for each bit of the index
+const uvec4 SobolDirections[32] = uvec4[32](
+	uvec4(0x80000000u, 0x80000000u, 0x80000000u, 0x80000000u),
+	uvec4(0x40000000u, 0xc0000000u, 0xc0000000u, 0xc0000000u),
+	uvec4(0x20000000u, 0xa0000000u, 0x60000000u, 0x20000000u),
+	uvec4(0x10000000u, 0xf0000000u, 0x90000000u, 0x50000000u),
+	uvec4(0x08000000u, 0x88000000u, 0xe8000000u, 0xf8000000u),
+	uvec4(0x04000000u, 0xcc000000u, 0x5c000000u, 0x74000000u),
+	uvec4(0x02000000u, 0xaa000000u, 0x8e000000u, 0xa2000000u),
+	uvec4(0x01000000u, 0xff000000u, 0xc5000000u, 0x93000000u),
+	uvec4(0x00800000u, 0x80800000u, 0x68800000u, 0xd8800000u),
+	uvec4(0x00400000u, 0xc0c00000u, 0x9cc00000u, 0x25400000u),
+	uvec4(0x00200000u, 0xa0a00000u, 0xee600000u, 0x59e00000u),
+	uvec4(0x00100000u, 0xf0f00000u, 0x55900000u, 0xe6d00000u),
+	uvec4(0x00080000u, 0x88880000u, 0x80680000u, 0x78080000u),
+	uvec4(0x00040000u, 0xcccc0000u, 0xc09c0000u, 0xb40c0000u),
+	uvec4(0x00020000u, 0xaaaa0000u, 0x60ee0000u, 0x82020000u),
+	uvec4(0x00010000u, 0xffff0000u, 0x90550000u, 0xc3050000u),
+	uvec4(0x00008000u, 0x80008000u, 0xe8808000u, 0x208f8000u),
+	uvec4(0x00004000u, 0xc000c000u, 0x5cc0c000u, 0x51474000u),
+	uvec4(0x00002000u, 0xa000a000u, 0x8e606000u, 0xfbea2000u),
+	uvec4(0x00001000u, 0xf000f000u, 0xc5909000u, 0x75d93000u),
+	uvec4(0x00000800u, 0x88008800u, 0x6868e800u, 0xa0858800u),
+	uvec4(0x00000400u, 0xcc00cc00u, 0x9c9c5c00u, 0x914e5400u),
+	uvec4(0x00000200u, 0xaa00aa00u, 0xeeee8e00u, 0xdbe79e00u),
+	uvec4(0x00000100u, 0xff00ff00u, 0x5555c500u, 0x25db6d00u),
+	uvec4(0x00000080u, 0x80808080u, 0x8000e880u, 0x58800080u),
+	uvec4(0x00000040u, 0xc0c0c0c0u, 0xc0005cc0u, 0xe54000c0u),
+	uvec4(0x00000020u, 0xa0a0a0a0u, 0x60008e60u, 0x79e00020u),
+	uvec4(0x00000010u, 0xf0f0f0f0u, 0x9000c590u, 0xb6d00050u),
+	uvec4(0x00000008u, 0x88888888u, 0xe8006868u, 0x800800f8u),
+	uvec4(0x00000004u, 0xccccccccu, 0x5c009c9cu, 0xc00c0074u),
+	uvec4(0x00000002u, 0xaaaaaaaau, 0x8e00eeeeu, 0x200200a2u),
+	uvec4(0x00000001u, 0xffffffffu, 0xc5005555u, 0x50050093u)
+);
+
+uint _SamplerRandSeed;
+uvec2 _SamplerPixel;
+uint _SamplerPixelSeed;
+uint _SamplerIndex;
+uint _SamplerRaySeed;
+uint _SamplerDimension;
+
+// Points of the current group of dimensions, and the seed of the group
+uvec4 _SamplerGroupPoints;
+uint _SamplerGroupSeed;
+
+// Integer hash with good avalanche (lowbias32)
+uint Hash(uint x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// Point of the first 4 dimensions of the Sobol sequence, as 32-bit fractions
+uvec4 Sobol(uint index)
+{
+	uvec4 x = uvec4(0u);
+	for (uint bit = 0u; index != 0u; ++bit, index >>= 1)
+	{
+		// Masked instead of branching, the bits of the shuffled indices are random
+		x ^= SobolDirections[bit] & uvec4(0u - (index & 1u));
+	}
+	return x;
+}
+
+// Random permutation of a 32-bit fraction that keeps the stratification of the sequence, like Owen scrambling
+// Each bit is flipped depending on the bits above it (Laine-Karras hash, with the constants of Helmer et al. 2021)
+uint NestedUniformScramble(uint x, uint seed)
+{
+	x = bitfieldReverse(x);
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return bitfieldReverse(x);
+}
+
+// Start the sequence of a sample of a pixel
+void InitSampler(uvec2 pixel, uint sampleIndex)
+{
+	uint seedX = pixel.x;
+	uint seedY = pixel.y;
+	uint seedTime = sampleIndex + 1u;
+	_SamplerRandSeed = LCG(seedX) ^ LCG(seedY) ^ LCG(seedTime);
+
+	_SamplerPixel = pixel;
+	_SamplerPixelSeed = SamplerType == SamplerBlueNoise ? 0u : Hash(pixel.x ^ Hash(pixel.y));
+	_SamplerIndex = sampleIndex;
+	_SamplerRaySeed = 0u;
+	_SamplerDimension = 0u;
+}
+
+// Start the range of dimensions of the ray cast at this index of the sample
+void StartSampleRay(uint rayIndex)
+{
+	_SamplerRaySeed = Hash(_SamplerPixelSeed ^ Hash(rayIndex));
+	_SamplerDimension = 0u;
+}
+
+// Next number of the sequence, between 0 and 1
+float SampleNext()
+{
+	if (SamplerType == SamplerRandom)
+	{
+		return float(LCG(_SamplerRandSeed)) / float(0x01000000u);
+	}
+
+	// The 4 points of a group are computed together, when its first dimension is taken
+	uint dimension = _SamplerDimension++;
+	if (dimension % 4u == 0u)
+	{
+		_SamplerGroupSeed = Hash(_SamplerRaySeed ^ Hash(dimension / 4u));
+		uvec4 points = Sobol(NestedUniformScramble(_SamplerIndex, _SamplerGroupSeed));
+		for (uint i = 0u; i < 4u; ++i)
+		{
+			_SamplerGroupPoints[i] = NestedUniformScramble(points[i], Hash(_SamplerGroupSeed + i + 1u));
+		}
+	}
+	uint x = _SamplerGroupPoints[dimension % 4u];
+
+	if (SamplerType == SamplerBlueNoise)
+	{
+		// Shift the tile for each dimension, so the dimensions are not correlated
+		uint shift = Hash(_SamplerGroupSeed ^ dimension);
+		uvec2 texel = (_SamplerPixel + uvec2(shift, shift >> 16)) & (BlueNoiseSize - 1u);
+		uint rank = uint(round(texelFetch(BlueNoiseTexture, ivec2(texel), 0).r * 65535.0f)) >> 4;
+		x += rank << 20;
+	}
+
+	return float(x >> 8) / float(0x01000000u);
+}
@@ -0,0 +1,55 @@
+//Inputs
+in vec2 TexCoord;
+
+//Outputs
+// Sample count of the pixel, or -1 if it has converged
+out vec4 FragColor;
+
+//Uniforms
+// Sum of the samples of each pixel, with the sample count in alpha
+uniform sampler2D SourceTexture;
+
+// Sum of the squared luminance of the samples of each pixel
+uniform sampler2D MomentsTexture;
+
+// Largest error of a converged pixel, in units of the square root of the luminance, close to the display encoding
+uniform float TargetError;
+
+// Pixels with fewer samples are never converged, so their variance estimate is reliable
+uniform float MinSampleCount;
+
+// Standard error of the mean of the pixel, in units of the square root of the luminance
+float GetError(ivec2 pixel)
+{
+	vec4 sum = texelFetch(SourceTexture, pixel, 0);
+	float sampleCount = sum.a;
+	if (sampleCount < 2.0f)
+	{
+		return 1.0f / 0.0f;
+	}
+	float mean = GetLuminance(sum.rgb) / sampleCount;
+	float variance = max(texelFetch(MomentsTexture, pixel, 0).r / sampleCount - mean * mean, 0.0f) * sampleCount / (sampleCount - 1.0f);
+
+	// d(sqrt(L)) = dL / (2 sqrt(L))
+	return sqrt(variance / sampleCount) / (2.0f * sqrt(max(mean, 0.0001f)));
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	ivec2 maxPixel = textureSize(SourceTexture, 0) - ivec2(1);
+	float sampleCount = texelFetch(SourceTexture, pixel, 0).a;
+
+	// Take the largest error of the neighbors, so a pixel isn't stopped by a lucky low variance estimate
+	float error = 0.0f;
+	for (int y = -1; y <= 1; ++y)
+	{
+		for (int x = -1; x <= 1; ++x)
+		{
+			error = max(error, GetError(clamp(pixel + ivec2(x, y), ivec2(0), maxPixel)));
+		}
+	}
+
+	bool converged = sampleCount >= MinSampleCount && error <= TargetError;
+	FragColor = vec4(converged ? -1.0f : sampleCount);
+}
@@ -5,31 +5,31 @@ vec3 TransformToLocalPoint(vec3 p, vec3 position)
 	return p - position;
 }
 
-// Transform point relative to a specific position back to view space
+// Transform point relative to a specific position back to world space
 vec3 TransformFromLocalPoint(vec3 p, vec3 position)
 {
 	return p + position;
 }
 
-// Transform point relative to a transform matrix
-vec3 TransformToLocalPoint(vec3 p, mat4 m)
+// Transform point relative to a transform matrix, using its inverse computed on the CPU
+vec3 TransformToLocalPoint(vec3 p, mat4 invM)
 {
-	return (inverse(m) * vec4(p, 1)).xyz;
+	return (invM * vec4(p, 1)).xyz;
 }
 
-// Transform point relative to a transform matrix back to view space
+// Transform point relative to a transform matrix back to world space
 vec3 TransformFromLocalPoint(vec3 p, mat4 m)
 {
 	return (m * vec4(p, 1)).xyz;
 }
 
-// Transform vector relative to a transform matrix
-vec3 TransformToLocalVector(vec3 v, mat4 m)
+// Transform vector relative to a transform matrix, using its inverse computed on the CPU
+vec3 TransformToLocalVector(vec3 v, mat4 invM)
 {
-	return (inverse(m) * vec4(v, 0)).xyz;
+	return (invM * vec4(v, 0)).xyz;
 }
 
-// Transform vector relative to a transform matrix back to view space
+// Transform vector relative to a transform matrix back to world space
 vec3 TransformFromLocalVector(vec3 v, mat4 m)
 {
 	return (m * vec4(v, 0)).xyz;
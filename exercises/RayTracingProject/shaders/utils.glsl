@@ -75,6 +75,23 @@ vec3 ReconstructViewPosition(sampler2D depthTexture, vec2 texCoord, mat4 invProj
 	return viewPosition.xyz / viewPosition.w;
 }
 
+// Octahedral encoding of a unit vector: project on the octahedron, and unfold the lower half over the upper one
+vec2 EncodeOctahedral(vec3 normal)
+{
+	vec2 encoded = normal.xy / (abs(normal.x) + abs(normal.y) + abs(normal.z));
+	vec2 signs = mix(vec2(-1.0f), vec2(1.0f), greaterThanEqual(encoded, vec2(0.0f)));
+	return normal.z < 0.0f ? (1.0f - abs(encoded.yx)) * signs : encoded;
+}
+
+// Decode a unit vector stored with EncodeOctahedral
+vec3 DecodeOctahedral(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+	float fold = max(-normal.z, 0.0f);
+	normal.xy += mix(vec2(fold), vec2(-fold), greaterThanEqual(normal.xy, vec2(0.0f)));
+	return normalize(normal);
+}
+
 float GetLuminance(vec3 color)
 {
    return dot(color, vec3(0.2126f, 0.7152f, 0.0722f));
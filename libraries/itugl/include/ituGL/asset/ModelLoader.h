@@ -27,6 +27,10 @@ public:
     bool GetCreateMaterials() const;
     void SetCreateMaterials(bool createMaterials);
 
+    // If disabled, only the ray tracing geometry is loaded, and no OpenGL object is created
+    bool GetCreateSubmeshes() const;
+    void SetCreateSubmeshes(bool createSubmeshes);
+
     Texture2DLoader& GetTexture2DLoader();
     const Texture2DLoader& GetTexture2DLoader() const;
 
@@ -82,6 +86,9 @@ private:
     // Should create new materials for each submesh or use the reference material
     bool m_createMaterials;
 
+    // Should create the vertex data and drawcalls of each submesh
+    bool m_createSubmeshes;
+
     // Texture loader to cache already loaded shared textures
     mutable Texture2DLoader m_textureLoader;
 };
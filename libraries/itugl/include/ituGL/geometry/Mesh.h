@@ -10,21 +10,21 @@
 #include <unordered_map>
 
 
-struct Triangle {
-    glm::vec4 v0;
-    glm::vec4 v1;
-    glm::vec4 v2;
-
-    glm::vec4 normal0;  
-    glm::vec4 normal1;  
-    glm::vec4 normal2;
-
-    glm::vec2 uv0;
-    glm::vec2 uv1;
-    glm::vec2 uv2;
+// Vertex of the geometry used for ray tracing, shared by all the triangles that reference it
+struct TriangleVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 uv;
+};
 
-    glm::uint materialId;
-    glm::uint transformId;
+// Triangle of the geometry used for ray tracing, referencing 3 vertices by index
+// Laid out as a uvec4 in the shaders, with the material and the texture LOD offset packed in w
+struct Triangle {
+    glm::uvec3 indices;
+    // Index of the material of the submesh, in the materials of the model
+    glm::uint16 materialId;
+    // 0.5 * log2 of the texture coordinate area over the object space area, as a half float, to pick the texture LOD of a ray cone
+    glm::uint16 textureLodOffset;
 };
 
 // Class that groups several VBO, EBO and VAO that are part of the same object
@@ -131,11 +131,13 @@ public:
     inline const VertexArrayObject& GetSubmeshVertexArray(unsigned int submeshIndex) const { return m_vaos[m_submeshes[submeshIndex].vaoIndex]; }
     inline const Drawcall& GetSubmeshDrawcall(unsigned int submeshIndex) const { return m_submeshes[submeshIndex].drawcall; }
 
+    inline const std::vector<TriangleVertex>& GetTriangleVertices() const { return m_triangleVertices; }
+    inline void SetTriangleVertices(const std::vector<TriangleVertex>& vertices) { m_triangleVertices = vertices; }
+
     inline const std::vector<Triangle>& GetTriangleData() const { return m_triangleData; }
     inline void SetTriangleData(const std::vector<Triangle>& data) { m_triangleData = data; }
 
     void SetTriangleMaterialID(unsigned int id);
-    void SetTriangleTransformID(unsigned int id);
 
     // Draws a submesh
     void DrawSubmesh(int submeshIndex) const;
@@ -176,6 +178,8 @@ private:
     // Submeshes contained in this mesh
     std::vector<Submesh> m_submeshes;
 
+    // Geometry used for ray tracing, kept on the CPU
+    std::vector<TriangleVertex> m_triangleVertices;
     std::vector<Triangle> m_triangleData;
 };
 
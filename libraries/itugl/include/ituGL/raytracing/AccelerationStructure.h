@@ -0,0 +1,303 @@
+#pragma once
+
+#include <ituGL/raytracing/BVH.h>
+#include <ituGL/raytracing/SimdIntersection.h>
+#include <ituGL/geometry/Mesh.h>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+// Kind of primitive placed in the scene by an instance
+enum class PrimitiveType : glm::uint
+{
+    // Triangles of a mesh, with its own bottom-level hierarchy
+    Mesh,
+    // Sphere of radius 1 at the origin of the instance space
+    Sphere,
+    // Box from -1 to 1 on each axis of the instance space
+    Box,
+};
+
+// Instance of a mesh or an analytic primitive, laid out to match the std430 struct used in the shaders
+// The matrices are computed on the CPU when the instance moves, so the shaders don't need to invert anything
+struct AccelerationInstance
+{
+    glm::mat4 objectToWorld;
+    glm::mat4 worldToObject;
+    // Inverse transpose of objectToWorld, to transform normals to world space
+    glm::mat4 normalMatrix;
+    // Root node of the bottom-level hierarchy of the mesh
+    glm::uint nodeOffset;
+    // First triangle of the mesh. Leaf ranges of the bottom-level hierarchy are relative to it
+    glm::uint triangleOffset;
+    glm::uint materialId;
+    // Index returned by AddInstance or AddPrimitive
+    glm::uint instanceId;
+    // PrimitiveType. Analytic primitives are tested directly in the top-level leaves, without nodes or triangles
+    glm::uint primitiveType;
+    glm::uint padding[3];
+};
+
+// Vertex data only read for the closest hit, laid out to match the std430 struct used in the shaders
+struct VertexAttributes
+{
+    // Normal in octahedral encoding, as 2 snorm16
+    glm::uint normal;
+    // Texture coordinates as 2 half floats
+    glm::uint uv;
+};
+
+// Closest hit found by AccelerationStructure::Intersect
+struct RayHit
+{
+    // Distance along the ray, in units of the ray direction
+    float distance;
+    // Hit triangle, in GetTriangles(). Not set for analytic primitives
+    unsigned int triangleIndex;
+    // Hit instance, in GetInstances()
+    unsigned int instanceIndex;
+    // Barycentric coordinates of the hit, weights of the second and third vertices
+    float u, v;
+};
+
+// Rays traced together by AccelerationStructure::Intersect, like the primary rays of a block of pixels
+struct RayPacket
+{
+    static constexpr unsigned int MaxSize = 64;
+
+    glm::vec3 origins[MaxSize];
+    glm::vec3 directions[MaxSize];
+    unsigned int size;
+};
+
+// Two-level acceleration structure for ray tracing
+// Each mesh gets a bottom-level BVH over its triangles in object space, built only once even if the mesh is used by many instances
+// A top-level BVH over the world bounds of the instances points at them. Analytic spheres and boxes are instances too,
+// so they share the top-level BVH with the meshes instead of being tested by every ray
+class AccelerationStructure
+{
+public:
+    AccelerationStructure();
+
+    // Add an instance of a mesh. Meshes are identified by address, so they must stay alive while the structure is used
+    // Returns the instance index
+    unsigned int AddInstance(const Mesh& mesh, const glm::mat4& transform, unsigned int materialId);
+
+    // Add an analytic primitive, the unit sphere or box placed by the transform. Returns the instance index
+    unsigned int AddPrimitive(PrimitiveType type, const glm::mat4& transform, unsigned int materialId);
+
+    // Move an instance. The change is applied on the next call to Update
+    void SetInstanceTransform(unsigned int instanceIndex, const glm::mat4& transform);
+
+    // Remove all the meshes and instances
+    void Clear();
+
+    // Build the bottom-level hierarchies of the new meshes and the top-level hierarchy
+    void Build();
+
+    // Apply the moved instances by refitting the top-level hierarchy. If refitting makes its cost grow past the rebuild threshold,
+    // the top-level hierarchy is built again instead. Returns false if nothing changed
+    // The changed data is reported by GetUpdatedNodes and GetUpdatedInstances, so it can be uploaded without the rest
+    bool Update();
+
+    // Runs of consecutive nodes changed by the last Update
+    inline const std::vector<BVH::Range>& GetUpdatedNodes() const { return m_updatedNodes; }
+
+    // Runs of consecutive sorted instances changed by the last Update
+    inline const std::vector<BVH::Range>& GetUpdatedInstances() const { return m_updatedInstances; }
+
+    // True if the last Update built the top-level hierarchy again instead of refitting it
+    inline bool IsTopLevelRebuilt() const { return m_topLevelRebuilt; }
+
+    // Expected cost of tracing a ray through the top-level hierarchy, as it is now and as it was when it was last built
+    inline float GetTopLevelCost() const { return m_topLevel.GetCost(); }
+    inline float GetTopLevelBuildCost() const { return m_topLevelBuildCost; }
+
+    // Maximum ratio between the cost of the refitted top-level hierarchy and its cost when it was built
+    inline float GetRebuildThreshold() const { return m_rebuildThreshold; }
+    inline void SetRebuildThreshold(float rebuildThreshold) { m_rebuildThreshold = rebuildThreshold; }
+
+    // Algorithm used to build the bottom-level hierarchies. Changing it rebuilds all of them on the next Build
+    inline BVH::BuildMode GetBuildMode() const { return m_buildMode; }
+    void SetBuildMode(BVH::BuildMode buildMode);
+
+    // Pool used to build the bottom-level hierarchies in parallel, or null to build them on the calling thread
+    inline ThreadPool* GetThreadPool() const { return m_threadPool; }
+    inline void SetThreadPool(ThreadPool* threadPool) { m_threadPool = threadPool; }
+
+    inline unsigned int GetMeshCount() const { return static_cast<unsigned int>(m_meshes.size()); }
+    inline unsigned int GetInstanceCount() const { return static_cast<unsigned int>(m_instances.size()); }
+
+    // Vertices of all the meshes in object space, split in positions and attributes
+    // Positions are tightly packed, and read in the shaders as an array of floats, 3 per vertex
+    inline const std::vector<glm::vec3>& GetVertexPositions() const { return m_vertexPositions; }
+    inline const std::vector<VertexAttributes>& GetVertexAttributes() const { return m_vertexAttributes; }
+
+    // Triangles of all the meshes, indexing into the vertices of all the meshes. Each mesh range is sorted by its bottom-level leaves
+    inline const std::vector<Triangle>& GetTriangles() const { return m_triangles; }
+
+    // Nodes of the top-level hierarchy, followed by the nodes of all the bottom-level hierarchies
+    inline const std::vector<BVHNode>& GetNodes() const { return m_nodes; }
+
+    // Instances, sorted by the top-level leaves
+    inline const std::vector<AccelerationInstance>& GetInstances() const { return m_sortedInstances; }
+
+    // Range of GetTriangles() used by an instance in GetInstances(). Empty for analytic primitives
+    void GetInstanceTriangles(unsigned int sortedIndex, unsigned int& first, unsigned int& count) const;
+
+    // Bounds of all the instances, in world space
+    inline BoundingBox GetBounds() const { return m_topLevel.GetBounds(); }
+
+    // Find the closest triangle hit by a world space ray, closer than hit.distance. Returns false if there is none
+    // Same traversal as RayMeshIntersection in the shaders, so the CPU can trace the same scene
+    bool Intersect(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit) const;
+
+    // Test if any triangle is hit by a world space ray closer than maxDistance, for shadow rays. Same traversal as Occluded in the shaders
+    // Stops at the first leaf with a hit, and doesn't sort the children, since any hit will do
+    bool Occluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const;
+
+    // Find the closest hits of a packet of rays, each one closer than its hits[i].distance. Returns a mask of the rays that found one
+    // Rays with the same direction signs share the node visits, and whole subtrees are culled for all of them at once
+    // Packets that diverge, in world space or after the transform of an instance, are traced one ray at a time
+    std::uint64_t Intersect(const RayPacket& packet, RayHit hits[RayPacket::MaxSize]) const;
+
+    // Kernels used to test the triangles of the leaves in Intersect. Starts with the best one supported by the CPU
+    inline SimdLevel GetSimdLevel() const { return m_triangleBlocks.GetSimdLevel(); }
+    inline void SetSimdLevel(SimdLevel simdLevel) { m_triangleBlocks.SetSimdLevel(simdLevel); }
+
+    // Interpolate the vertex attributes at a hit of the ray. The normal is in world space
+    // Analytic primitives get the normal of the surface, facing the ray if it starts inside, and a parametric uv
+    // textureLodOffset is the one of the triangle, corrected by the change of area of the instance transform
+    void GetHitAttributes(const glm::vec3& origin, const glm::vec3& direction, const RayHit& hit,
+        glm::vec3& normal, glm::vec2& uv, unsigned int& materialId, float& textureLodOffset) const;
+
+    // Test intersection between a ray and a triangle, given by a vertex and its two edges from it
+    static bool IntersectTriangle(const glm::vec3& origin, const glm::vec3& direction,
+        const glm::vec3& v0, const glm::vec3& v1v0, const glm::vec3& v2v0, float& distance, float& u, float& v);
+
+    // Test intersection between a ray and the bounds of a node. Returns the entry distance, or infinity if there is no hit
+    static float IntersectNode(const BVHNode& node, const glm::vec3& origin, const glm::vec3& invDirection, float maxDistance);
+
+    // Decode a normal packed by PackNormal
+    static glm::vec3 UnpackNormal(glm::uint packedNormal);
+
+private:
+    // Mesh shared by one or more instances
+    struct MeshEntry
+    {
+        const Mesh* mesh;
+        BVH bottomLevel;
+        bool built;
+        unsigned int nodeOffset;
+        unsigned int triangleOffset;
+    };
+
+    // Rays of a packet prepared for the traversal, in the space of the hierarchy being traversed
+    struct PacketRays
+    {
+        glm::vec3 origins[RayPacket::MaxSize];
+        glm::vec3 directions[RayPacket::MaxSize];
+        glm::vec3 invDirections[RayPacket::MaxSize];
+
+        // Intervals containing the origins and the inverse directions of all the rays, to test the whole packet at once
+        glm::vec3 originMin, originMax;
+        glm::vec3 invDirectionMin, invDirectionMax;
+    };
+
+    // Called for each leaf reached by a packet, with the range of rays between the first and the last that hit the leaf bounds
+    // Returns the rays that found a hit
+    using PacketLeafFunction = std::function<std::uint64_t(const BVHNode& leaf, unsigned int firstRay, unsigned int endRay)>;
+
+    // Instance as added, before sorting
+    struct InstanceEntry
+    {
+        PrimitiveType type;
+        // Only for PrimitiveType::Mesh
+        unsigned int meshIndex;
+        glm::mat4 transform;
+        unsigned int materialId;
+        // Index of the instance in m_sortedInstances
+        unsigned int sortedIndex;
+    };
+
+    // Build the top-level hierarchy and write it at the beginning of m_nodes, followed by the sorted instances
+    void BuildTopLevel();
+
+    // Write the data of an instance in its sorted position
+    void UpdateSortedInstance(unsigned int instanceIndex);
+
+    // World bounds of an instance
+    BoundingBox GetInstanceBounds(const InstanceEntry& instance) const;
+
+    // Traverse the bottom-level hierarchy of an instance, or test its analytic primitive, updating the hit if a closer one is found
+    bool IntersectInstance(unsigned int instanceIndex, const glm::vec3& worldOrigin, const glm::vec3& worldDirection, RayHit& hit) const;
+
+    // Traverse the bottom-level hierarchy of an instance until a triangle closer than maxDistance is found, or test its analytic primitive
+    bool OccludedInstance(unsigned int instanceIndex, const glm::vec3& worldOrigin, const glm::vec3& worldDirection, float maxDistance) const;
+
+    // Traverse the bottom-level hierarchy of an instance with the rays [firstRay, endRay) of a packet, updating their hits
+    std::uint64_t IntersectInstance(unsigned int instanceIndex, const RayPacket& packet, unsigned int firstRay, unsigned int endRay, RayHit* hits) const;
+
+    // Traverse a hierarchy with the rays [firstRay, endRay) of a packet. Child indices of the nodes are relative to nodeOffset
+    // Nodes are culled for the whole packet with interval arithmetic, and the range of rays is narrowed to the ones that hit each node
+    std::uint64_t TraversePacket(const PacketRays& rays, unsigned int firstRay, unsigned int endRay, unsigned int nodeOffset, RayHit* hits,
+        const PacketLeafFunction& visitLeaf) const;
+
+    // Compute the intervals of the rays [firstRay, endRay). Returns false if the rays don't all have the same direction signs
+    static bool PreparePacket(PacketRays& rays, unsigned int firstRay, unsigned int endRay);
+
+    // Conservative test of a node with all the rays of a packet. Returns false only if none of them can hit it
+    static bool IntersectNode(const BVHNode& node, const PacketRays& rays, float maxDistance);
+
+    // Get the bounds of a box after transforming it
+    static BoundingBox TransformBounds(const BoundingBox& bounds, const glm::mat4& transform);
+
+    // Pack a normal in octahedral encoding, with 16 bits per component
+    static glm::uint PackNormal(const glm::vec3& normal);
+
+private:
+    std::vector<MeshEntry> m_meshes;
+
+    // Map from mesh address to its index in m_meshes
+    std::unordered_map<const Mesh*, unsigned int> m_meshIndices;
+
+    std::vector<InstanceEntry> m_instances;
+
+    // World bounds of each instance
+    std::vector<BoundingBox> m_instanceBounds;
+
+    // Instances moved since the last Update
+    std::vector<unsigned int> m_movedInstances;
+
+    // Hierarchy over the instances
+    BVH m_topLevel;
+
+    // Number of nodes reserved for the top-level hierarchy, so rebuilding it doesn't move the bottom-level nodes
+    unsigned int m_topLevelCapacity;
+
+    // Cost of the top-level hierarchy when it was last built
+    float m_topLevelBuildCost;
+
+    float m_rebuildThreshold;
+
+    // Set by Update
+    bool m_topLevelRebuilt;
+
+    BVH::BuildMode m_buildMode;
+
+    ThreadPool* m_threadPool;
+
+    // Runs changed by the last Update
+    std::vector<BVH::Range> m_updatedNodes;
+    std::vector<BVH::Range> m_updatedInstances;
+
+    // Flattened data, ready to be uploaded to the GPU
+    std::vector<glm::vec3> m_vertexPositions;
+    std::vector<VertexAttributes> m_vertexAttributes;
+    std::vector<Triangle> m_triangles;
+    std::vector<BVHNode> m_nodes;
+    std::vector<AccelerationInstance> m_sortedInstances;
+
+    // Copy of the triangles in SIMD friendly layout, for the CPU queries
+    TriangleBlocks m_triangleBlocks;
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <ituGL/raytracing/BoundingBox.h>
+#include <span>
+#include <vector>
+
+struct Triangle;
+struct TriangleVertex;
+class ThreadPool;
+
+// Node of a flattened bounding volume hierarchy, laid out to match the std430 struct used in the shaders
+// Nodes are stored depth-first: the first child of an interior node is always the next node in the array
+struct BVHNode
+{
+    glm::vec3 boundsMin;
+    // Interior nodes: index of the second child. Leaves: index of the first primitive
+    glm::uint childOrFirst;
+    glm::vec3 boundsMax;
+    // Number of primitives in the leaf, 0 for interior nodes
+    glm::uint primitiveCount;
+
+    inline bool IsLeaf() const { return primitiveCount > 0; }
+};
+
+// Bounding volume hierarchy built with the surface area heuristic (SAH), or along a Morton curve for faster builds
+// The primitives are referenced by index, so it can be built over triangles or any other bounded primitive
+class BVH
+{
+public:
+    // Deepest level the builder will create. Shaders use a traversal stack of this size
+    static constexpr unsigned int MaxDepth = 32;
+
+    // Algorithms to build the hierarchy
+    enum class BuildMode
+    {
+        // Binned surface area heuristic. Best hierarchy for tracing
+        SAH,
+        // Linear BVH: primitives sorted by the Morton codes of their centers, and split at the highest bit where the codes differ
+        // Much faster to build, for geometry rebuilt often, but slower to trace
+        Morton,
+    };
+
+    // Run of consecutive nodes or primitives
+    struct Range
+    {
+        unsigned int first;
+        unsigned int count;
+    };
+
+public:
+    BVH();
+
+    // Build the hierarchy over the bounds of a list of primitives
+    void Build(std::span<const BoundingBox> primitiveBounds);
+
+    // Build the hierarchy over a list of indexed triangles, in the space where their vertices are defined
+    void Build(std::span<const TriangleVertex> vertices, std::span<const Triangle> triangles);
+
+    // Recompute the bounds of the leaves containing the moved primitives, and of all their ancestors, keeping the tree topology
+    // primitiveBounds has the new bounds of all the primitives, indexed like in Build
+    // Returns false if nothing changed. Otherwise, changedNodes gets the changed nodes as runs of consecutive indices, in order
+    bool Refit(std::span<const BoundingBox> primitiveBounds, std::span<const unsigned int> movedPrimitives,
+        std::vector<Range>& changedNodes);
+
+    // Expected cost of tracing a ray with the surface area heuristic, relative to the cost of intersecting one primitive
+    // Refitting makes it grow as the primitives move away from where they were when the tree was built
+    float GetCost() const;
+
+    // Flattened nodes, the root is the first one
+    inline const std::vector<BVHNode>& GetNodes() const { return m_nodes; }
+
+    // Order of the primitives referenced by the leaves. Leaf ranges index into this list
+    inline const std::vector<unsigned int>& GetPrimitiveIndices() const { return m_primitiveIndices; }
+
+    // Bounds of the whole hierarchy
+    BoundingBox GetBounds() const;
+
+    // Preferred maximum number of primitives per leaf. Leaves can only be bigger if the primitives can't be split
+    inline unsigned int GetMaxLeafSize() const { return m_maxLeafSize; }
+    inline void SetMaxLeafSize(unsigned int maxLeafSize) { m_maxLeafSize = maxLeafSize; }
+
+    inline BuildMode GetBuildMode() const { return m_buildMode; }
+    inline void SetBuildMode(BuildMode buildMode) { m_buildMode = buildMode; }
+
+    // Pool used to build in parallel, or null to build on the calling thread. The result is the same either way
+    inline ThreadPool* GetThreadPool() const { return m_threadPool; }
+    inline void SetThreadPool(ThreadPool* threadPool) { m_threadPool = threadPool; }
+
+    // Get the bounds of an indexed triangle
+    static BoundingBox GetTriangleBounds(std::span<const TriangleVertex> vertices, const Triangle& triangle);
+
+private:
+    // Subtree built by a parallel task, in its own nodes. Its child indices are relative to its root
+    struct BuildTask
+    {
+        unsigned int begin, end;
+        unsigned int depth;
+        std::vector<BVHNode> nodes;
+    };
+
+    // Data shared by all the nodes of a build
+    struct BuildContext
+    {
+        std::span<const BoundingBox> primitiveBounds;
+        std::span<const glm::vec3> centroids;
+
+        // Morton codes of the primitives, sorted like m_primitiveIndices. Only used by BuildMode::Morton
+        std::span<const glm::uint> mortonCodes;
+
+        // Ranges with at most this number of primitives are left to a task, if tasks is not null
+        unsigned int taskSize;
+        std::vector<BuildTask>* tasks;
+
+        // Pool to split the work of the big nodes, or null
+        ThreadPool* threadPool;
+    };
+
+    // Build the node for the primitives in the range [begin, end), and its children, into nodes. Returns the node index
+    // The bounds of the nodes are only set by FinishNodes
+    unsigned int BuildNode(const BuildContext& context, std::vector<BVHNode>& nodes, unsigned int begin, unsigned int end, unsigned int depth);
+
+    // Find the best split plane with binned SAH. Returns false if keeping the leaf is cheaper
+    bool FindSplit(const BuildContext& context, unsigned int begin, unsigned int end, const BoundingBox& nodeBounds, const BoundingBox& centroidBounds,
+        int& splitAxis, float& splitPosition) const;
+
+    // Compute the Morton codes of the centroids and sort them, with m_primitiveIndices
+    void SortMortonCodes(const BuildContext& context, std::vector<glm::uint>& mortonCodes);
+
+    // Copy the nodes built above the tasks into m_nodes, replacing each placeholder with the nodes of its task
+    void AssembleNodes(const std::vector<BVHNode>& upperNodes, unsigned int upperIndex, const std::vector<BuildTask>& tasks);
+
+    // Compute the bounds of the nodes bottom-up, the parents and the leaves of the primitives
+    void FinishNodes(std::span<const BoundingBox> primitiveBounds);
+
+private:
+    // Flattened nodes
+    std::vector<BVHNode> m_nodes;
+
+    // Primitive indices, sorted so each leaf references a contiguous range
+    std::vector<unsigned int> m_primitiveIndices;
+
+    // Parent of each node, used to refit the tree bottom-up. The root is its own parent
+    std::vector<unsigned int> m_parentIndices;
+
+    // Leaf containing each primitive, indexed like the primitives passed to Build
+    std::vector<unsigned int> m_primitiveLeaves;
+
+    // Preferred maximum number of primitives per leaf
+    unsigned int m_maxLeafSize;
+
+    BuildMode m_buildMode;
+
+    ThreadPool* m_threadPool;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <limits>
+
+// Axis aligned bounding box stored as min and max corners, used to build the ray tracing hierarchies
+struct BoundingBox
+{
+    // Empty box: growing it with any point will make it contain only that point
+    BoundingBox()
+        : boundsMin(std::numeric_limits<float>::max())
+        , boundsMax(-std::numeric_limits<float>::max()) {}
+
+    BoundingBox(const glm::vec3& minPoint, const glm::vec3& maxPoint)
+        : boundsMin(minPoint), boundsMax(maxPoint) {}
+
+    inline bool IsEmpty() const { return boundsMin.x > boundsMax.x; }
+
+    inline glm::vec3 GetCenter() const { return 0.5f * (boundsMin + boundsMax); }
+    inline glm::vec3 GetSize() const { return boundsMax - boundsMin; }
+
+    // Half of the surface area, enough to compare costs in the surface area heuristic
+    inline float GetHalfArea() const
+    {
+        glm::vec3 size = glm::max(GetSize(), glm::vec3(0.0f));
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    inline void Grow(const glm::vec3& point)
+    {
+        boundsMin = glm::min(boundsMin, point);
+        boundsMax = glm::max(boundsMax, point);
+    }
+
+    inline void Grow(const BoundingBox& box)
+    {
+        boundsMin = glm::min(boundsMin, box.boundsMin);
+        boundsMax = glm::max(boundsMax, box.boundsMax);
+    }
+
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
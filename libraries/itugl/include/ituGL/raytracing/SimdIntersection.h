@@ -0,0 +1,72 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+
+struct Triangle;
+
+// Instruction sets of the SIMD intersection kernels
+enum class SimdLevel
+{
+    // One primitive at a time
+    Scalar,
+    // 4 primitives at a time
+    SSE42,
+    // 8 primitives at a time
+    AVX2,
+};
+
+// Best level supported by the CPU running the program, detected once
+SimdLevel GetSupportedSimdLevel();
+
+const char* GetSimdLevelName(SimdLevel simdLevel);
+
+// Triangles in structure-of-arrays layout, so a ray can be tested against 4 or 8 of them at once
+// Each triangle is stored as its first vertex, its two edges from it and its unnormalized normal, one array per component
+// The arrays are padded with a whole block, so the kernels can load a full block starting at any triangle
+class TriangleBlocks
+{
+public:
+    static constexpr unsigned int BlockSize = 8;
+
+public:
+    TriangleBlocks();
+
+    // Copy the triangles in the same order. Indices reference the positions
+    void Build(std::span<const glm::vec3> positions, std::span<const Triangle> triangles);
+
+    inline unsigned int GetTriangleCount() const { return m_triangleCount; }
+
+    // Kernels used by Intersect. Starts with the best supported level, and can't be set to a higher one
+    inline SimdLevel GetSimdLevel() const { return m_simdLevel; }
+    void SetSimdLevel(SimdLevel simdLevel);
+
+    // Test a ray against the triangles [first, first + count), looking for the closest hit closer than distance
+    // If one is found, the outputs are updated. Same test as RayTriangleIntersection in the shaders
+    bool Intersect(const glm::vec3& origin, const glm::vec3& direction, unsigned int first, unsigned int count,
+        float& distance, unsigned int& triangleIndex, float& u, float& v) const;
+
+private:
+    // Arrays stored one after the other in m_data
+    enum Stream
+    {
+        V0X, V0Y, V0Z,
+        Edge1X, Edge1Y, Edge1Z,
+        Edge2X, Edge2Y, Edge2Z,
+        NormalX, NormalY, NormalZ,
+        StreamCount
+    };
+
+    inline const float* GetStream(Stream stream) const { return m_data.data() + stream * m_stride; }
+
+private:
+    std::vector<float> m_data;
+
+    // Length of each array, including the padding
+    unsigned int m_stride;
+
+    unsigned int m_triangleCount;
+
+    SimdLevel m_simdLevel;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads to run loops in parallel
+// The calling thread also takes part in the work, so a pool of 1 thread runs everything on the caller
+class ThreadPool
+{
+public:
+    // Function called for each index of a loop, with the index of the thread running it
+    using LoopFunction = std::function<void(unsigned int index, unsigned int threadIndex)>;
+
+public:
+    // Create the pool with the number of threads, counting the caller. 0 uses one thread per available core
+    ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    inline unsigned int GetThreadCount() const { return static_cast<unsigned int>(m_workers.size()) + 1; }
+
+    // Call the function for every index in [0, count). Indices are handed out one by one as threads get free,
+    // so uneven work gets balanced. Thread indices are in [0, GetThreadCount()), 0 being the caller
+    // Blocks until all the calls finished. It must not be called from inside a loop function
+    void ParallelFor(unsigned int count, const LoopFunction& function);
+
+private:
+    // Wait for new loops until the pool is destroyed
+    void WorkerLoop(unsigned int threadIndex);
+
+    // Take indices of the current loop until there are none left
+    void RunLoop(unsigned int threadIndex);
+
+private:
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_startCondition;
+    std::condition_variable m_finishCondition;
+
+    // Current loop
+    const LoopFunction* m_function;
+    unsigned int m_count;
+    std::atomic<unsigned int> m_nextIndex;
+
+    // Workers still running the current loop
+    unsigned int m_busyWorkers;
+
+    // Incremented for each loop, so workers can tell there is a new one
+    unsigned int m_loopId;
+
+    bool m_stopping;
+};
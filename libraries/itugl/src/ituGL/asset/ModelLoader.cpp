@@ -6,12 +6,16 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <glm/gtc/packing.hpp>
 #include <iostream>
 #include <bit>
+#include <cassert>
+#include <limits>
 
 ModelLoader::ModelLoader(std::shared_ptr<Material> referenceMaterial)
     : m_referenceMaterial(referenceMaterial)
     , m_createMaterials(false)
+    , m_createSubmeshes(true)
 {
     m_textureLoader.SetGenerateMipmap(true);
 }
@@ -39,6 +43,16 @@ void ModelLoader::SetCreateMaterials(bool createMaterials)
     m_createMaterials = createMaterials;
 }
 
+bool ModelLoader::GetCreateSubmeshes() const
+{
+    return m_createSubmeshes;
+}
+
+void ModelLoader::SetCreateSubmeshes(bool createSubmeshes)
+{
+    m_createSubmeshes = createSubmeshes;
+}
+
 Texture2DLoader& ModelLoader::GetTexture2DLoader()
 {
     return m_textureLoader;
@@ -73,6 +87,18 @@ bool ModelLoader::SetMaterialProperty(MaterialProperty materialProperty, const c
     return found;
 }
 
+// Texture LOD offset of a ray cone hitting the triangle, from the ratio of its texture coordinate area to its area in object space
+// The texture size, the cone width and the instance scale are added by the shaders. 0 if either area is 0
+static glm::uint16 GetTextureLodOffset(const TriangleVertex& v0, const TriangleVertex& v1, const TriangleVertex& v2)
+{
+    glm::vec2 uv1 = v1.uv - v0.uv;
+    glm::vec2 uv2 = v2.uv - v0.uv;
+    float uvArea = std::abs(uv1.x * uv2.y - uv1.y * uv2.x);
+    float area = glm::length(glm::cross(v1.position - v0.position, v2.position - v0.position));
+    float offset = uvArea > 0.0f && area > 0.0f ? 0.5f * std::log2(uvArea / area) : 0.0f;
+    return static_cast<glm::uint16>(glm::packHalf1x16(offset));
+}
+
 Model ModelLoader::Load(const char* path)
 {
     Model model;
@@ -92,61 +118,44 @@ Model ModelLoader::Load(const char* path)
 
     model.SetMesh(std::make_shared<Mesh>());
     Mesh& mesh = model.GetMesh();
+
+    // Ray tracing geometry of all the submeshes. Vertices were already merged by aiProcess_JoinIdenticalVertices
+    std::vector<TriangleVertex> vertices;
+    std::vector<Triangle> triangles;
+
     for (unsigned int meshIndex = 0; meshIndex < scene->mNumMeshes; ++meshIndex)
     {
         aiMesh& meshData = *scene->mMeshes[meshIndex];
         if (!meshData.HasPositions()) continue;
 
-        std::vector<Triangle> triangles;
-
+        // Triangles store the index of their submesh material, relative to the materials of the model
+        unsigned int materialIndex = model.GetMaterialCount();
+        assert(materialIndex <= std::numeric_limits<glm::uint16>::max());
+
+        // Indices of the submesh are relative to its first vertex
+        unsigned int vertexOffset = static_cast<unsigned int>(vertices.size());
+        for (unsigned int i = 0; i < meshData.mNumVertices; i++) {
+            TriangleVertex& vertex = vertices.emplace_back();
+            vertex.position = glm::vec3(meshData.mVertices[i].x, meshData.mVertices[i].y, meshData.mVertices[i].z);
+            vertex.normal = meshData.HasNormals() ? glm::vec3(meshData.mNormals[i].x, meshData.mNormals[i].y, meshData.mNormals[i].z) : glm::vec3(0.0f);
+            vertex.uv = meshData.HasTextureCoords(0) ? glm::vec2(meshData.mTextureCoords[0][i].x, meshData.mTextureCoords[0][i].y) : glm::vec2(0.0f);
+        }
 
         for (unsigned int i = 0; i < meshData.mNumFaces; i++) {
-            aiFace face = meshData.mFaces[i];
-            // Ensure the face is a newTriangle
+            const aiFace& face = meshData.mFaces[i];
+            // Ensure the face is a triangle
             if (face.mNumIndices == 3) {
-                Triangle newTriangle;
-
-                newTriangle.v0 = glm::vec4(meshData.mVertices[face.mIndices[0]].x,
-                    meshData.mVertices[face.mIndices[0]].y,
-                    meshData.mVertices[face.mIndices[0]].z, 0.f);
-                newTriangle.v1 = glm::vec4(meshData.mVertices[face.mIndices[1]].x,
-                    meshData.mVertices[face.mIndices[1]].y,
-                    meshData.mVertices[face.mIndices[1]].z, 0.f);
-                newTriangle.v2 = glm::vec4(meshData.mVertices[face.mIndices[2]].x,
-                    meshData.mVertices[face.mIndices[2]].y,
-                    meshData.mVertices[face.mIndices[2]].z, 0.f);
-
-                // Set the UVs for each vertex
-                if (meshData.HasTextureCoords(0)) {
-                    newTriangle.uv0 = glm::vec2(meshData.mTextureCoords[0][face.mIndices[0]].x,
-                        meshData.mTextureCoords[0][face.mIndices[0]].y);
-                    newTriangle.uv1 = glm::vec2(meshData.mTextureCoords[0][face.mIndices[1]].x,
-                        meshData.mTextureCoords[0][face.mIndices[1]].y);
-                    newTriangle.uv2 = glm::vec2(meshData.mTextureCoords[0][face.mIndices[2]].x,
-                        meshData.mTextureCoords[0][face.mIndices[2]].y);
-                }
-
-                // Set the normals for each vertex
-                if (meshData.HasNormals()) {
-                    newTriangle.normal0 = glm::vec4(meshData.mNormals[face.mIndices[0]].x,
-                        meshData.mNormals[face.mIndices[0]].y,
-                        meshData.mNormals[face.mIndices[0]].z, 0.f);
-                    newTriangle.normal1 = glm::vec4(meshData.mNormals[face.mIndices[1]].x,
-                        meshData.mNormals[face.mIndices[1]].y,
-                        meshData.mNormals[face.mIndices[1]].z, 0.f);
-                    newTriangle.normal2 = glm::vec4(meshData.mNormals[face.mIndices[2]].x,
-                        meshData.mNormals[face.mIndices[2]].y,
-                        meshData.mNormals[face.mIndices[2]].z, 0.f);
-                }
-
-                // Add the populated newTriangle to the vector
-                triangles.push_back(newTriangle);
+                Triangle& newTriangle = triangles.emplace_back();
+                newTriangle.indices = glm::uvec3(face.mIndices[0], face.mIndices[1], face.mIndices[2]) + vertexOffset;
+                newTriangle.materialId = static_cast<glm::uint16>(materialIndex);
+                newTriangle.textureLodOffset = GetTextureLodOffset(vertices[newTriangle.indices.x], vertices[newTriangle.indices.y], vertices[newTriangle.indices.z]);
             }
         }
 
-        mesh.SetTriangleData(triangles);
-
-        GenerateSubmesh(mesh, meshData);
+        if (m_createSubmeshes)
+        {
+            GenerateSubmesh(mesh, meshData);
+        }
 
         std::shared_ptr<Material> material = m_referenceMaterial;
         if (m_createMaterials)
@@ -156,6 +165,10 @@ Model ModelLoader::Load(const char* path)
         }
         model.AddMaterial(material);
     }
+
+    mesh.SetTriangleVertices(vertices);
+    mesh.SetTriangleData(triangles);
+
     return model;
 }
 
@@ -1,5 +1,8 @@
 #include <ituGL/geometry/Mesh.h>
 
+#include <cassert>
+#include <limits>
+
 Mesh::Mesh()
 {
 }
@@ -37,20 +40,14 @@ unsigned int Mesh::AddSubmesh(unsigned int vaoIndex,
 
 void Mesh::SetTriangleMaterialID(unsigned int id)
 {
+    // Triangles store the id in 16 bits
+    assert(id <= std::numeric_limits<glm::uint16>::max());
 	for (auto & data : m_triangleData)
 	{
-        data.materialId = id;
+        data.materialId = static_cast<glm::uint16>(id);
 	}
 }
 
-void Mesh::SetTriangleTransformID(unsigned int id)
-{
-    for (auto& data : m_triangleData)
-    {
-        data.transformId = id;
-    }
-}
-
 // Bind the VAO and render the drawcall of the submesh
 void Mesh::DrawSubmesh(int submeshIndex) const
 {
@@ -0,0 +1,919 @@
+#include <ituGL/raytracing/AccelerationStructure.h>
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+// Test intersection between a ray and the sphere of radius 1 at the origin, updating the distance if the hit is closer
+// If the ray starts inside, the hit is where it exits
+static bool IntersectUnitSphere(const glm::vec3& origin, const glm::vec3& direction, float& distance)
+{
+    // The direction is not normalized, so the full quadratic is solved
+    float a = glm::dot(direction, direction);
+    float b = glm::dot(origin, direction);
+    float c = glm::dot(origin, origin) - 1.0f;
+    float discriminant = b * b - a * c;
+    if (discriminant < 0.0f)
+        return false;
+
+    float sqrtDiscriminant = std::sqrt(discriminant);
+    float t = (-b - sqrtDiscriminant) / a;
+    if (t < 0.0f)
+    {
+        t = (-b + sqrtDiscriminant) / a;
+    }
+    if (t < 0.0f || t >= distance)
+        return false;
+
+    distance = t;
+    return true;
+}
+
+// Test intersection between a ray and the box from -1 to 1, updating the distance if the hit is closer
+// If the ray starts inside, the hit is where it exits
+static bool IntersectUnitBox(const glm::vec3& origin, const glm::vec3& direction, float& distance)
+{
+    glm::vec3 invDirection = 1.0f / direction;
+    glm::vec3 distancesA = (glm::vec3(-1.0f) - origin) * invDirection;
+    glm::vec3 distancesB = (glm::vec3(1.0f) - origin) * invDirection;
+    glm::vec3 distancesMin = glm::min(distancesA, distancesB);
+    glm::vec3 distancesMax = glm::max(distancesA, distancesB);
+
+    float distanceMin = std::max(std::max(distancesMin.x, distancesMin.y), distancesMin.z);
+    float distanceMax = std::min(std::min(distancesMax.x, distancesMax.y), distancesMax.z);
+    if (distanceMin > distanceMax || distanceMax < 0.0f)
+        return false;
+
+    float t = distanceMin >= 0.0f ? distanceMin : distanceMax;
+    if (t >= distance)
+        return false;
+
+    distance = t;
+    return true;
+}
+
+// Test intersection between a ray in object space and an analytic primitive
+static bool IntersectPrimitive(PrimitiveType type, const glm::vec3& origin, const glm::vec3& direction, float& distance)
+{
+    return type == PrimitiveType::Sphere ? IntersectUnitSphere(origin, direction, distance) : IntersectUnitBox(origin, direction, distance);
+}
+
+AccelerationStructure::AccelerationStructure()
+    : m_topLevelCapacity(0)
+    , m_topLevelBuildCost(0.0f)
+    , m_rebuildThreshold(1.5f)
+    , m_topLevelRebuilt(false)
+    , m_buildMode(BVH::BuildMode::SAH)
+    , m_threadPool(nullptr)
+{
+}
+
+unsigned int AccelerationStructure::AddInstance(const Mesh& mesh, const glm::mat4& transform, unsigned int materialId)
+{
+    // Reuse the mesh entry if the mesh was already added by another instance
+    auto itMesh = m_meshIndices.find(&mesh);
+    unsigned int meshIndex;
+    if (itMesh != m_meshIndices.end())
+    {
+        meshIndex = itMesh->second;
+    }
+    else
+    {
+        meshIndex = static_cast<unsigned int>(m_meshes.size());
+        m_meshes.push_back(MeshEntry{ &mesh, BVH(), false, 0, 0 });
+        m_meshIndices.emplace(&mesh, meshIndex);
+    }
+
+    unsigned int instanceIndex = static_cast<unsigned int>(m_instances.size());
+    m_instances.push_back(InstanceEntry{ PrimitiveType::Mesh, meshIndex, transform, materialId, instanceIndex });
+    return instanceIndex;
+}
+
+unsigned int AccelerationStructure::AddPrimitive(PrimitiveType type, const glm::mat4& transform, unsigned int materialId)
+{
+    assert(type != PrimitiveType::Mesh);
+    unsigned int instanceIndex = static_cast<unsigned int>(m_instances.size());
+    m_instances.push_back(InstanceEntry{ type, 0, transform, materialId, instanceIndex });
+    return instanceIndex;
+}
+
+void AccelerationStructure::SetInstanceTransform(unsigned int instanceIndex, const glm::mat4& transform)
+{
+    assert(instanceIndex < m_instances.size());
+    m_instances[instanceIndex].transform = transform;
+    m_movedInstances.push_back(instanceIndex);
+}
+
+void AccelerationStructure::SetBuildMode(BVH::BuildMode buildMode)
+{
+    if (buildMode != m_buildMode)
+    {
+        m_buildMode = buildMode;
+        for (MeshEntry& meshEntry : m_meshes)
+        {
+            meshEntry.built = false;
+        }
+    }
+}
+
+void AccelerationStructure::Clear()
+{
+    m_meshes.clear();
+    m_meshIndices.clear();
+    m_instances.clear();
+    m_instanceBounds.clear();
+    m_movedInstances.clear();
+    m_vertexPositions.clear();
+    m_vertexAttributes.clear();
+    m_triangles.clear();
+    m_nodes.clear();
+    m_sortedInstances.clear();
+    m_topLevelCapacity = 0;
+}
+
+void AccelerationStructure::Build()
+{
+    // Bottom level: one hierarchy per mesh, independent of the instances
+    for (MeshEntry& meshEntry : m_meshes)
+    {
+        if (!meshEntry.built)
+        {
+            meshEntry.bottomLevel.SetBuildMode(m_buildMode);
+            meshEntry.bottomLevel.SetThreadPool(m_threadPool);
+            meshEntry.bottomLevel.Build(meshEntry.mesh->GetTriangleVertices(), meshEntry.mesh->GetTriangleData());
+            meshEntry.built = true;
+        }
+    }
+
+    // A binary tree over N instances never has more than 2N-1 nodes
+    m_topLevelCapacity = std::max(1u, 2 * GetInstanceCount()) - 1;
+
+    // Flatten the meshes after the space reserved for the top level
+    m_nodes.assign(m_topLevelCapacity, BVHNode{});
+    m_vertexPositions.clear();
+    m_vertexAttributes.clear();
+    m_triangles.clear();
+    for (MeshEntry& meshEntry : m_meshes)
+    {
+        const BVH& bottomLevel = meshEntry.bottomLevel;
+        const std::vector<TriangleVertex>& vertices = meshEntry.mesh->GetTriangleVertices();
+        const std::vector<Triangle>& triangles = meshEntry.mesh->GetTriangleData();
+
+        meshEntry.nodeOffset = static_cast<unsigned int>(m_nodes.size());
+        meshEntry.triangleOffset = static_cast<unsigned int>(m_triangles.size());
+        unsigned int vertexOffset = static_cast<unsigned int>(m_vertexPositions.size());
+
+        m_nodes.insert(m_nodes.end(), bottomLevel.GetNodes().begin(), bottomLevel.GetNodes().end());
+
+        for (const TriangleVertex& vertex : vertices)
+        {
+            m_vertexPositions.push_back(vertex.position);
+            m_vertexAttributes.push_back(VertexAttributes{ PackNormal(vertex.normal), glm::packHalf2x16(vertex.uv) });
+        }
+
+        // Indices are offset so they reference the vertices of all the meshes
+        for (unsigned int triangleIndex : bottomLevel.GetPrimitiveIndices())
+        {
+            Triangle& triangle = m_triangles.emplace_back(triangles[triangleIndex]);
+            triangle.indices += vertexOffset;
+        }
+    }
+
+    m_instanceBounds.resize(m_instances.size());
+    for (unsigned int instanceIndex = 0; instanceIndex < m_instances.size(); ++instanceIndex)
+    {
+        m_instanceBounds[instanceIndex] = GetInstanceBounds(m_instances[instanceIndex]);
+    }
+    m_movedInstances.clear();
+
+    m_triangleBlocks.Build(m_vertexPositions, m_triangles);
+
+    BuildTopLevel();
+}
+
+bool AccelerationStructure::Update()
+{
+    m_updatedNodes.clear();
+    m_updatedInstances.clear();
+    m_topLevelRebuilt = false;
+
+    if (m_movedInstances.empty())
+        return false;
+
+    // Remove duplicates, an instance may have been moved several times
+    std::sort(m_movedInstances.begin(), m_movedInstances.end());
+    m_movedInstances.erase(std::unique(m_movedInstances.begin(), m_movedInstances.end()), m_movedInstances.end());
+
+    for (unsigned int instanceIndex : m_movedInstances)
+    {
+        m_instanceBounds[instanceIndex] = GetInstanceBounds(m_instances[instanceIndex]);
+    }
+
+    m_topLevel.Refit(m_instanceBounds, m_movedInstances, m_updatedNodes);
+
+    if (m_topLevel.GetCost() > m_rebuildThreshold * m_topLevelBuildCost)
+    {
+        // The tree got too loose, rebuild the top level. This can change the order of all the instances
+        BuildTopLevel();
+        m_topLevelRebuilt = true;
+        m_updatedNodes.assign(1, BVH::Range{ 0, m_topLevelCapacity });
+        m_updatedInstances.assign(1, BVH::Range{ 0, GetInstanceCount() });
+    }
+    else
+    {
+        for (const BVH::Range& range : m_updatedNodes)
+        {
+            std::copy_n(m_topLevel.GetNodes().begin() + range.first, range.count, m_nodes.begin() + range.first);
+        }
+
+        // Runs of consecutive sorted indices of the moved instances
+        std::vector<unsigned int> sortedIndices;
+        sortedIndices.reserve(m_movedInstances.size());
+        for (unsigned int instanceIndex : m_movedInstances)
+        {
+            UpdateSortedInstance(instanceIndex);
+            sortedIndices.push_back(m_instances[instanceIndex].sortedIndex);
+        }
+        std::sort(sortedIndices.begin(), sortedIndices.end());
+        for (unsigned int sortedIndex : sortedIndices)
+        {
+            if (!m_updatedInstances.empty() && m_updatedInstances.back().first + m_updatedInstances.back().count == sortedIndex)
+            {
+                ++m_updatedInstances.back().count;
+            }
+            else
+            {
+                m_updatedInstances.push_back(BVH::Range{ sortedIndex, 1 });
+            }
+        }
+    }
+
+    m_movedInstances.clear();
+    return true;
+}
+
+bool AccelerationStructure::Intersect(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit) const
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    glm::vec3 invDirection = 1.0f / direction;
+    if (m_sortedInstances.empty() || IntersectNode(m_nodes[0], origin, invDirection, hit.distance) == infinity)
+        return false;
+
+    unsigned int stack[BVH::MaxDepth];
+    unsigned int stackSize = 0;
+    unsigned int nodeIndex = 0;
+    bool found = false;
+
+    while (true)
+    {
+        const BVHNode& node = m_nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            // Leaf: enter the hierarchy of each instance
+            for (unsigned int i = node.childOrFirst; i < node.childOrFirst + node.primitiveCount; ++i)
+            {
+                found |= IntersectInstance(i, origin, direction, hit);
+            }
+        }
+        else
+        {
+            // Interior: visit the closest child first and keep the other one for later
+            unsigned int nearIndex = nodeIndex + 1;
+            unsigned int farIndex = node.childOrFirst;
+            float nearDistance = IntersectNode(m_nodes[nearIndex], origin, invDirection, hit.distance);
+            float farDistance = IntersectNode(m_nodes[farIndex], origin, invDirection, hit.distance);
+            if (farDistance < nearDistance)
+            {
+                std::swap(nearIndex, farIndex);
+                std::swap(nearDistance, farDistance);
+            }
+
+            if (nearDistance != infinity)
+            {
+                if (farDistance != infinity)
+                {
+                    stack[stackSize++] = farIndex;
+                }
+                nodeIndex = nearIndex;
+                continue;
+            }
+        }
+
+        // Pop the next node that is still closer than the current hit
+        bool popped = false;
+        while (!popped && stackSize > 0)
+        {
+            nodeIndex = stack[--stackSize];
+            popped = IntersectNode(m_nodes[nodeIndex], origin, invDirection, hit.distance) != infinity;
+        }
+        if (!popped)
+            break;
+    }
+
+    return found;
+}
+
+bool AccelerationStructure::IntersectInstance(unsigned int instanceIndex, const glm::vec3& worldOrigin, const glm::vec3& worldDirection, RayHit& hit) const
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    const AccelerationInstance& instance = m_sortedInstances[instanceIndex];
+
+    // The direction is not normalized, so distances are the same as in world space
+    glm::vec3 origin = instance.worldToObject * glm::vec4(worldOrigin, 1.0f);
+    glm::vec3 direction = instance.worldToObject * glm::vec4(worldDirection, 0.0f);
+
+    // Analytic primitives have no hierarchy, the top-level leaf points directly at them
+    PrimitiveType type = static_cast<PrimitiveType>(instance.primitiveType);
+    if (type != PrimitiveType::Mesh)
+    {
+        if (!IntersectPrimitive(type, origin, direction, hit.distance))
+            return false;
+
+        hit.instanceIndex = instanceIndex;
+        hit.u = hit.v = 0.0f;
+        return true;
+    }
+
+    glm::vec3 invDirection = 1.0f / direction;
+
+    unsigned int stack[BVH::MaxDepth];
+    unsigned int stackSize = 0;
+    unsigned int nodeIndex = instance.nodeOffset;
+    bool found = false;
+
+    while (true)
+    {
+        const BVHNode& node = m_nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            // Leaf: test all its triangles at once
+            if (m_triangleBlocks.Intersect(origin, direction, instance.triangleOffset + node.childOrFirst, node.primitiveCount,
+                hit.distance, hit.triangleIndex, hit.u, hit.v))
+            {
+                hit.instanceIndex = instanceIndex;
+                found = true;
+            }
+        }
+        else
+        {
+            // Interior: visit the closest child first and keep the other one for later
+            unsigned int nearIndex = nodeIndex + 1;
+            unsigned int farIndex = instance.nodeOffset + node.childOrFirst;
+            float nearDistance = IntersectNode(m_nodes[nearIndex], origin, invDirection, hit.distance);
+            float farDistance = IntersectNode(m_nodes[farIndex], origin, invDirection, hit.distance);
+            if (farDistance < nearDistance)
+            {
+                std::swap(nearIndex, farIndex);
+                std::swap(nearDistance, farDistance);
+            }
+
+            if (nearDistance != infinity)
+            {
+                if (farDistance != infinity)
+                {
+                    stack[stackSize++] = farIndex;
+                }
+                nodeIndex = nearIndex;
+                continue;
+            }
+        }
+
+        // Pop the next node that is still closer than the current hit
+        bool popped = false;
+        while (!popped && stackSize > 0)
+        {
+            nodeIndex = stack[--stackSize];
+            popped = IntersectNode(m_nodes[nodeIndex], origin, invDirection, hit.distance) != infinity;
+        }
+        if (!popped)
+            break;
+    }
+
+    return found;
+}
+
+bool AccelerationStructure::Occluded(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    glm::vec3 invDirection = 1.0f / direction;
+    if (m_sortedInstances.empty() || IntersectNode(m_nodes[0], origin, invDirection, maxDistance) == infinity)
+        return false;
+
+    // The distance never shrinks, so the nodes on the stack were already tested
+    unsigned int stack[BVH::MaxDepth];
+    unsigned int stackSize = 0;
+    unsigned int nodeIndex = 0;
+
+    while (true)
+    {
+        const BVHNode& node = m_nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            for (unsigned int i = node.childOrFirst; i < node.childOrFirst + node.primitiveCount; ++i)
+            {
+                if (OccludedInstance(i, origin, direction, maxDistance))
+                    return true;
+            }
+        }
+        else
+        {
+            unsigned int firstIndex = nodeIndex + 1;
+            unsigned int secondIndex = node.childOrFirst;
+            bool firstHit = IntersectNode(m_nodes[firstIndex], origin, invDirection, maxDistance) != infinity;
+            bool secondHit = IntersectNode(m_nodes[secondIndex], origin, invDirection, maxDistance) != infinity;
+            if (firstHit || secondHit)
+            {
+                if (firstHit && secondHit)
+                {
+                    stack[stackSize++] = secondIndex;
+                }
+                nodeIndex = firstHit ? firstIndex : secondIndex;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        nodeIndex = stack[--stackSize];
+    }
+
+    return false;
+}
+
+bool AccelerationStructure::OccludedInstance(unsigned int instanceIndex, const glm::vec3& worldOrigin, const glm::vec3& worldDirection, float maxDistance) const
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    const AccelerationInstance& instance = m_sortedInstances[instanceIndex];
+
+    // The direction is not normalized, so distances are the same as in world space
+    glm::vec3 origin = instance.worldToObject * glm::vec4(worldOrigin, 1.0f);
+    glm::vec3 direction = instance.worldToObject * glm::vec4(worldDirection, 0.0f);
+
+    PrimitiveType type = static_cast<PrimitiveType>(instance.primitiveType);
+    if (type != PrimitiveType::Mesh)
+    {
+        float distance = maxDistance;
+        return IntersectPrimitive(type, origin, direction, distance);
+    }
+
+    glm::vec3 invDirection = 1.0f / direction;
+
+    unsigned int stack[BVH::MaxDepth];
+    unsigned int stackSize = 0;
+    unsigned int nodeIndex = instance.nodeOffset;
+
+    while (true)
+    {
+        const BVHNode& node = m_nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            // Leaf: the kernels test all its triangles at once, the closest one is not needed
+            float distance = maxDistance, u, v;
+            unsigned int triangleIndex;
+            if (m_triangleBlocks.Intersect(origin, direction, instance.triangleOffset + node.childOrFirst, node.primitiveCount,
+                distance, triangleIndex, u, v))
+                return true;
+        }
+        else
+        {
+            unsigned int firstIndex = nodeIndex + 1;
+            unsigned int secondIndex = instance.nodeOffset + node.childOrFirst;
+            bool firstHit = IntersectNode(m_nodes[firstIndex], origin, invDirection, maxDistance) != infinity;
+            bool secondHit = IntersectNode(m_nodes[secondIndex], origin, invDirection, maxDistance) != infinity;
+            if (firstHit || secondHit)
+            {
+                if (firstHit && secondHit)
+                {
+                    stack[stackSize++] = secondIndex;
+                }
+                nodeIndex = firstHit ? firstIndex : secondIndex;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        nodeIndex = stack[--stackSize];
+    }
+
+    return false;
+}
+
+std::uint64_t AccelerationStructure::Intersect(const RayPacket& packet, RayHit hits[RayPacket::MaxSize]) const
+{
+    assert(packet.size <= RayPacket::MaxSize);
+
+    if (m_sortedInstances.empty() || packet.size == 0)
+        return 0;
+
+    PacketRays rays;
+    std::copy(packet.origins, packet.origins + packet.size, rays.origins);
+    std::copy(packet.directions, packet.directions + packet.size, rays.directions);
+
+    if (!PreparePacket(rays, 0, packet.size))
+    {
+        // The rays go in different directions, trace them one at a time
+        std::uint64_t found = 0;
+        for (unsigned int i = 0; i < packet.size; ++i)
+        {
+            if (Intersect(packet.origins[i], packet.directions[i], hits[i]))
+            {
+                found |= std::uint64_t(1) << i;
+            }
+        }
+        return found;
+    }
+
+    // Top level: enter the hierarchy of each instance with the rays that reached its leaf
+    return TraversePacket(rays, 0, packet.size, 0, hits, [&](const BVHNode& leaf, unsigned int firstRay, unsigned int endRay)
+        {
+            std::uint64_t found = 0;
+            for (unsigned int i = leaf.childOrFirst; i < leaf.childOrFirst + leaf.primitiveCount; ++i)
+            {
+                found |= IntersectInstance(i, packet, firstRay, endRay, hits);
+            }
+            return found;
+        });
+}
+
+std::uint64_t AccelerationStructure::IntersectInstance(unsigned int instanceIndex, const RayPacket& packet, unsigned int firstRay, unsigned int endRay, RayHit* hits) const
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    const AccelerationInstance& instance = m_sortedInstances[instanceIndex];
+
+    // Analytic primitives are a single test per ray, there is no hierarchy to share
+    if (static_cast<PrimitiveType>(instance.primitiveType) != PrimitiveType::Mesh)
+    {
+        std::uint64_t found = 0;
+        for (unsigned int i = firstRay; i < endRay; ++i)
+        {
+            if (IntersectInstance(instanceIndex, packet.origins[i], packet.directions[i], hits[i]))
+            {
+                found |= std::uint64_t(1) << i;
+            }
+        }
+        return found;
+    }
+
+    // The directions are not normalized, so distances are the same as in world space
+    PacketRays rays;
+    for (unsigned int i = firstRay; i < endRay; ++i)
+    {
+        rays.origins[i] = instance.worldToObject * glm::vec4(packet.origins[i], 1.0f);
+        rays.directions[i] = instance.worldToObject * glm::vec4(packet.directions[i], 0.0f);
+    }
+
+    std::uint64_t found = 0;
+    if (!PreparePacket(rays, firstRay, endRay))
+    {
+        // The transform of the instance made the directions diverge
+        for (unsigned int i = firstRay; i < endRay; ++i)
+        {
+            if (IntersectInstance(instanceIndex, packet.origins[i], packet.directions[i], hits[i]))
+            {
+                found |= std::uint64_t(1) << i;
+            }
+        }
+        return found;
+    }
+
+    return TraversePacket(rays, firstRay, endRay, instance.nodeOffset, hits, [&](const BVHNode& leaf, unsigned int leafFirstRay, unsigned int leafEndRay)
+        {
+            // Each ray that hits the leaf tests all its triangles at once
+            std::uint64_t leafFound = 0;
+            for (unsigned int i = leafFirstRay; i < leafEndRay; ++i)
+            {
+                RayHit& hit = hits[i];
+                if (IntersectNode(leaf, rays.origins[i], rays.invDirections[i], hit.distance) != infinity
+                    && m_triangleBlocks.Intersect(rays.origins[i], rays.directions[i], instance.triangleOffset + leaf.childOrFirst, leaf.primitiveCount,
+                        hit.distance, hit.triangleIndex, hit.u, hit.v))
+                {
+                    hit.instanceIndex = instanceIndex;
+                    leafFound |= std::uint64_t(1) << i;
+                }
+            }
+            return leafFound;
+        });
+}
+
+std::uint64_t AccelerationStructure::TraversePacket(const PacketRays& rays, unsigned int firstRay, unsigned int endRay, unsigned int nodeOffset, RayHit* hits,
+    const PacketLeafFunction& visitLeaf) const
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    // Nodes farther than all the current hits can be culled. The hits only change in the leaves
+    auto getMaxDistance = [&]()
+        {
+            float maxDistance = 0.0f;
+            for (unsigned int i = firstRay; i < endRay; ++i)
+            {
+                maxDistance = std::max(maxDistance, hits[i].distance);
+            }
+            return maxDistance;
+        };
+    float maxDistance = getMaxDistance();
+
+    // Each node is pushed with the range of rays that hit its parent
+    struct StackEntry
+    {
+        unsigned int nodeIndex;
+        unsigned int firstRay;
+        unsigned int endRay;
+    };
+    StackEntry stack[BVH::MaxDepth + 1];
+    unsigned int stackSize = 0;
+    stack[stackSize++] = StackEntry{ nodeOffset, firstRay, endRay };
+
+    std::uint64_t found = 0;
+    while (stackSize > 0)
+    {
+        StackEntry entry = stack[--stackSize];
+        const BVHNode& node = m_nodes[entry.nodeIndex];
+
+        // Cull the node for the whole packet first, then find the first and the last rays that hit it
+        // The rays outside of that range miss the whole subtree
+        if (!IntersectNode(node, rays, maxDistance))
+            continue;
+
+        auto hitsNode = [&](unsigned int i) { return IntersectNode(node, rays.origins[i], rays.invDirections[i], hits[i].distance) != infinity; };
+        unsigned int nodeFirstRay = entry.firstRay;
+        while (nodeFirstRay < entry.endRay && !hitsNode(nodeFirstRay))
+        {
+            ++nodeFirstRay;
+        }
+        if (nodeFirstRay == entry.endRay)
+            continue;
+
+        unsigned int nodeEndRay = entry.endRay;
+        while (nodeEndRay - 1 > nodeFirstRay && !hitsNode(nodeEndRay - 1))
+        {
+            --nodeEndRay;
+        }
+
+        if (node.IsLeaf())
+        {
+            found |= visitLeaf(node, nodeFirstRay, nodeEndRay);
+            maxDistance = getMaxDistance();
+        }
+        else
+        {
+            // Visit first the child closest along the first active ray
+            unsigned int nearIndex = entry.nodeIndex + 1;
+            unsigned int farIndex = nodeOffset + node.childOrFirst;
+            const BVHNode& nearNode = m_nodes[nearIndex];
+            const BVHNode& farNode = m_nodes[farIndex];
+            glm::vec3 centerOffset = (nearNode.boundsMin + nearNode.boundsMax) - (farNode.boundsMin + farNode.boundsMax);
+            if (glm::dot(centerOffset, rays.directions[nodeFirstRay]) > 0.0f)
+            {
+                std::swap(nearIndex, farIndex);
+            }
+
+            stack[stackSize++] = StackEntry{ farIndex, nodeFirstRay, nodeEndRay };
+            stack[stackSize++] = StackEntry{ nearIndex, nodeFirstRay, nodeEndRay };
+        }
+    }
+
+    return found;
+}
+
+bool AccelerationStructure::PreparePacket(PacketRays& rays, unsigned int firstRay, unsigned int endRay)
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    rays.originMin = rays.invDirectionMin = glm::vec3(infinity);
+    rays.originMax = rays.invDirectionMax = glm::vec3(-infinity);
+
+    // The intervals of the inverse directions are only bounded if no direction crosses 0
+    glm::bvec3 negative = glm::lessThan(rays.directions[firstRay], glm::vec3(0.0f));
+    for (unsigned int i = firstRay; i < endRay; ++i)
+    {
+        glm::vec3 invDirection = 1.0f / rays.directions[i];
+        if (glm::lessThan(rays.directions[i], glm::vec3(0.0f)) != negative || glm::any(glm::isinf(invDirection)))
+            return false;
+
+        rays.invDirections[i] = invDirection;
+        rays.originMin = glm::min(rays.originMin, rays.origins[i]);
+        rays.originMax = glm::max(rays.originMax, rays.origins[i]);
+        rays.invDirectionMin = glm::min(rays.invDirectionMin, invDirection);
+        rays.invDirectionMax = glm::max(rays.invDirectionMax, invDirection);
+    }
+    return true;
+}
+
+bool AccelerationStructure::IntersectNode(const BVHNode& node, const PacketRays& rays, float maxDistance)
+{
+    // All the rays enter and exit the box through the same planes, as they have the same direction signs
+    glm::bvec3 negative = glm::lessThan(rays.invDirectionMin, glm::vec3(0.0f));
+    glm::vec3 entryPlanes = glm::mix(node.boundsMin, node.boundsMax, negative);
+    glm::vec3 exitPlanes = glm::mix(node.boundsMax, node.boundsMin, negative);
+
+    // Bounds of the distances to the planes, products of the intervals of (plane - origin) and of the inverse direction
+    glm::vec3 entryA = entryPlanes - rays.originMax, entryB = entryPlanes - rays.originMin;
+    glm::vec3 entryMin = glm::min(glm::min(entryA * rays.invDirectionMin, entryA * rays.invDirectionMax),
+        glm::min(entryB * rays.invDirectionMin, entryB * rays.invDirectionMax));
+    glm::vec3 exitA = exitPlanes - rays.originMax, exitB = exitPlanes - rays.originMin;
+    glm::vec3 exitMax = glm::max(glm::max(exitA * rays.invDirectionMin, exitA * rays.invDirectionMax),
+        glm::max(exitB * rays.invDirectionMin, exitB * rays.invDirectionMax));
+
+    float distanceMin = std::max(std::max(entryMin.x, entryMin.y), std::max(entryMin.z, 0.0f));
+    float distanceMax = std::min(std::min(exitMax.x, exitMax.y), std::min(exitMax.z, maxDistance));
+
+    return distanceMin <= distanceMax;
+}
+
+void AccelerationStructure::GetInstanceTriangles(unsigned int sortedIndex, unsigned int& first, unsigned int& count) const
+{
+    const InstanceEntry& instance = m_instances[m_sortedInstances[sortedIndex].instanceId];
+    if (instance.type != PrimitiveType::Mesh)
+    {
+        first = count = 0;
+        return;
+    }
+
+    const MeshEntry& meshEntry = m_meshes[instance.meshIndex];
+    first = meshEntry.triangleOffset;
+    count = static_cast<unsigned int>(meshEntry.mesh->GetTriangleData().size());
+}
+
+void AccelerationStructure::GetHitAttributes(const glm::vec3& origin, const glm::vec3& direction, const RayHit& hit,
+    glm::vec3& normal, glm::vec2& uv, unsigned int& materialId, float& textureLodOffset) const
+{
+    const AccelerationInstance& hitInstance = m_sortedInstances[hit.instanceIndex];
+    PrimitiveType type = static_cast<PrimitiveType>(hitInstance.primitiveType);
+    if (type != PrimitiveType::Mesh)
+    {
+        glm::vec3 objectOrigin = hitInstance.worldToObject * glm::vec4(origin, 1.0f);
+        glm::vec3 point = hitInstance.worldToObject * glm::vec4(origin + hit.distance * direction, 1.0f);
+
+        // Outward normal and parametric coordinates, and log2 of the uv area over the surface area, halved
+        glm::vec3 localNormal;
+        float localLodOffset;
+        bool inside;
+        if (type == PrimitiveType::Sphere)
+        {
+            localNormal = point;
+            uv = glm::vec2(0.5f + std::atan2(point.z, point.x) * glm::one_over_two_pi<float>(), std::acos(glm::clamp(point.y, -1.0f, 1.0f)) * glm::one_over_pi<float>());
+            localLodOffset = -0.5f * std::log2(4.0f * glm::pi<float>());
+            inside = glm::dot(objectOrigin, objectOrigin) < 1.0f;
+        }
+        else
+        {
+            glm::vec3 absPoint = glm::abs(point);
+            int axis = absPoint.x > absPoint.y ? (absPoint.x > absPoint.z ? 0 : 2) : (absPoint.y > absPoint.z ? 1 : 2);
+            localNormal = glm::vec3(0.0f);
+            localNormal[axis] = point[axis] >= 0.0f ? 1.0f : -1.0f;
+            uv = 0.5f + 0.5f * glm::vec2(point[(axis + 1) % 3], point[(axis + 2) % 3]);
+            localLodOffset = -1.0f;
+            inside = glm::all(glm::lessThan(glm::abs(objectOrigin), glm::vec3(1.0f)));
+        }
+
+        glm::vec3 worldNormal = glm::vec3(hitInstance.normalMatrix * glm::vec4(localNormal, 0.0f));
+        normal = glm::normalize(inside ? -worldNormal : worldNormal);
+        materialId = hitInstance.materialId;
+
+        float areaScale = std::abs(glm::determinant(glm::mat3(hitInstance.objectToWorld))) * glm::length(worldNormal);
+        textureLodOffset = localLodOffset - 0.5f * std::log2(areaScale);
+        return;
+    }
+
+    const Triangle& triangle = m_triangles[hit.triangleIndex];
+    const VertexAttributes& attributes0 = m_vertexAttributes[triangle.indices.x];
+    const VertexAttributes& attributes1 = m_vertexAttributes[triangle.indices.y];
+    const VertexAttributes& attributes2 = m_vertexAttributes[triangle.indices.z];
+    float w = 1.0f - hit.u - hit.v;
+
+    const AccelerationInstance& instance = m_sortedInstances[hit.instanceIndex];
+    glm::vec3 localNormal = glm::normalize(UnpackNormal(attributes0.normal) * w + UnpackNormal(attributes1.normal) * hit.u + UnpackNormal(attributes2.normal) * hit.v);
+    glm::vec3 worldNormal = glm::vec3(instance.normalMatrix * glm::vec4(localNormal, 0.0f));
+    normal = glm::normalize(worldNormal);
+
+    uv = glm::unpackHalf2x16(attributes0.uv) * w + glm::unpackHalf2x16(attributes1.uv) * hit.u + glm::unpackHalf2x16(attributes2.uv) * hit.v;
+
+    materialId = instance.materialId + triangle.materialId;
+
+    // An area with this normal is scaled by the determinant times the length of the transformed normal
+    float areaScale = std::abs(glm::determinant(glm::mat3(instance.objectToWorld))) * glm::length(worldNormal);
+    textureLodOffset = glm::unpackHalf1x16(triangle.textureLodOffset) - 0.5f * std::log2(areaScale);
+}
+
+bool AccelerationStructure::IntersectTriangle(const glm::vec3& origin, const glm::vec3& direction,
+    const glm::vec3& v0, const glm::vec3& v1v0, const glm::vec3& v2v0, float& distance, float& u, float& v)
+{
+    glm::vec3 rov0 = origin - v0;
+    glm::vec3 n = glm::cross(v1v0, v2v0);
+    glm::vec3 q = glm::cross(rov0, direction);
+    float d = 1.0f / glm::dot(n, direction);
+    u = d * glm::dot(-q, v2v0);
+    v = d * glm::dot(q, v1v0);
+    distance = d * glm::dot(-n, rov0);
+
+    // Written so that NaNs, from rays parallel to the triangle, fail the distance test of the caller
+    if (u < 0.0f || v < 0.0f || (u + v) > 1.0f) return false;
+    if (distance < 0.0f) return false;
+    return true;
+}
+
+float AccelerationStructure::IntersectNode(const BVHNode& node, const glm::vec3& origin, const glm::vec3& invDirection, float maxDistance)
+{
+    glm::vec3 distancesA = (node.boundsMin - origin) * invDirection;
+    glm::vec3 distancesB = (node.boundsMax - origin) * invDirection;
+    glm::vec3 distancesMin = glm::min(distancesA, distancesB);
+    glm::vec3 distancesMax = glm::max(distancesA, distancesB);
+
+    float distanceMin = std::max(std::max(distancesMin.x, distancesMin.y), std::max(distancesMin.z, 0.0f));
+    float distanceMax = std::min(std::min(distancesMax.x, distancesMax.y), std::min(distancesMax.z, maxDistance));
+
+    return distanceMin <= distanceMax ? distanceMin : std::numeric_limits<float>::infinity();
+}
+
+void AccelerationStructure::BuildTopLevel()
+{
+    m_topLevel.SetMaxLeafSize(1);
+    m_topLevel.Build(m_instanceBounds);
+    m_topLevelBuildCost = m_topLevel.GetCost();
+
+    // Unused nodes of the reserved range are left empty
+    const std::vector<BVHNode>& topLevelNodes = m_topLevel.GetNodes();
+    assert(topLevelNodes.size() <= m_topLevelCapacity);
+    std::copy(topLevelNodes.begin(), topLevelNodes.end(), m_nodes.begin());
+    std::fill(m_nodes.begin() + topLevelNodes.size(), m_nodes.begin() + m_topLevelCapacity, BVHNode{});
+
+    const std::vector<unsigned int>& sortedIndices = m_topLevel.GetPrimitiveIndices();
+    m_sortedInstances.resize(sortedIndices.size());
+    for (unsigned int sortedIndex = 0; sortedIndex < sortedIndices.size(); ++sortedIndex)
+    {
+        m_instances[sortedIndices[sortedIndex]].sortedIndex = sortedIndex;
+        UpdateSortedInstance(sortedIndices[sortedIndex]);
+    }
+}
+
+void AccelerationStructure::UpdateSortedInstance(unsigned int instanceIndex)
+{
+    const InstanceEntry& instance = m_instances[instanceIndex];
+    bool isMesh = instance.type == PrimitiveType::Mesh;
+
+    AccelerationInstance& sortedInstance = m_sortedInstances[instance.sortedIndex];
+    sortedInstance.objectToWorld = instance.transform;
+    sortedInstance.worldToObject = glm::inverse(instance.transform);
+    sortedInstance.normalMatrix = glm::transpose(sortedInstance.worldToObject);
+    sortedInstance.nodeOffset = isMesh ? m_meshes[instance.meshIndex].nodeOffset : 0;
+    sortedInstance.triangleOffset = isMesh ? m_meshes[instance.meshIndex].triangleOffset : 0;
+    sortedInstance.materialId = instance.materialId;
+    sortedInstance.instanceId = instanceIndex;
+    sortedInstance.primitiveType = static_cast<glm::uint>(instance.type);
+}
+
+BoundingBox AccelerationStructure::GetInstanceBounds(const InstanceEntry& instance) const
+{
+    // Both analytic primitives fit in the box from -1 to 1
+    const BoundingBox& bounds = instance.type == PrimitiveType::Mesh ? m_meshes[instance.meshIndex].bottomLevel.GetBounds()
+        : BoundingBox(glm::vec3(-1.0f), glm::vec3(1.0f));
+    return TransformBounds(bounds, instance.transform);
+}
+
+BoundingBox AccelerationStructure::TransformBounds(const BoundingBox& bounds, const glm::mat4& transform)
+{
+    BoundingBox transformedBounds;
+    if (!bounds.IsEmpty())
+    {
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            glm::vec3 point((corner & 1) ? bounds.boundsMax.x : bounds.boundsMin.x,
+                (corner & 2) ? bounds.boundsMax.y : bounds.boundsMin.y,
+                (corner & 4) ? bounds.boundsMax.z : bounds.boundsMin.z);
+            transformedBounds.Grow(glm::vec3(transform * glm::vec4(point, 1.0f)));
+        }
+    }
+    return transformedBounds;
+}
+
+glm::uint AccelerationStructure::PackNormal(const glm::vec3& normal)
+{
+    // Project on the octahedron, and unfold the lower half over the upper one
+    float length = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+    glm::vec2 encoded = length > 0.0f ? glm::vec2(normal) / length : glm::vec2(0.0f);
+    if (normal.z < 0.0f)
+    {
+        glm::vec2 signs(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+        encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * signs;
+    }
+    return glm::packSnorm2x16(encoded);
+}
+
+glm::vec3 AccelerationStructure::UnpackNormal(glm::uint packedNormal)
+{
+    glm::vec2 encoded = glm::unpackSnorm2x16(packedNormal);
+    glm::vec3 normal(encoded, 1.0f - glm::abs(encoded.x) - glm::abs(encoded.y));
+    float fold = glm::max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0.0f ? -fold : fold;
+    normal.y += normal.y >= 0.0f ? -fold : fold;
+    return glm::normalize(normal);
+}
@@ -0,0 +1,620 @@
+#include <ituGL/raytracing/BVH.h>
+
+#include <ituGL/geometry/Mesh.h>
+#include <ituGL/utils/ThreadPool.h>
+#include <algorithm>
+#include <numeric>
+#include <array>
+#include <bit>
+#include <cassert>
+
+// Number of bins used to evaluate the split candidates on each axis
+static constexpr int BinCount = 16;
+
+// Relative cost of visiting a node, compared to intersecting a primitive
+static constexpr float TraversalCost = 1.0f;
+
+// Loops over fewer primitives than this are not worth splitting between threads
+static constexpr unsigned int MinChunkSize = 4096;
+
+// Subtrees are handed to the threads when they get this small, relative to the whole tree
+static constexpr unsigned int TasksPerThread = 8;
+
+// Value of primitiveCount marking the placeholder of a subtree built by a task
+static constexpr glm::uint TaskPlaceholder = ~0u;
+
+struct Bin
+{
+    BoundingBox bounds;
+    unsigned int count = 0;
+};
+
+using AxisBins = std::array<std::array<Bin, BinCount>, 3>;
+
+// Number of chunks to split a loop over count elements. Without a pool it runs as a single chunk
+static unsigned int GetChunkCount(ThreadPool* threadPool, unsigned int count)
+{
+    return threadPool ? std::clamp(count / MinChunkSize, 1u, 4 * threadPool->GetThreadCount()) : 1;
+}
+
+// Split [begin, end) in chunkCount contiguous chunks and run them in parallel. The chunks are always the same for the same arguments
+static void RunChunks(ThreadPool* threadPool, unsigned int begin, unsigned int end, unsigned int chunkCount,
+    const std::function<void(unsigned int chunkBegin, unsigned int chunkEnd, unsigned int chunkIndex)>& function)
+{
+    auto getChunkBegin = [&](unsigned int chunkIndex)
+        {
+            return begin + static_cast<unsigned int>(static_cast<std::uint64_t>(end - begin) * chunkIndex / chunkCount);
+        };
+
+    if (chunkCount <= 1)
+    {
+        function(begin, end, 0);
+        return;
+    }
+
+    threadPool->ParallelFor(chunkCount, [&](unsigned int chunkIndex, unsigned int)
+        {
+            function(getChunkBegin(chunkIndex), getChunkBegin(chunkIndex + 1), chunkIndex);
+        });
+}
+
+// Bounds of the primitives in a range, and of their centroids
+static void ComputeRangeBounds(ThreadPool* threadPool, std::span<const unsigned int> primitiveIndices,
+    std::span<const BoundingBox> primitiveBounds, std::span<const glm::vec3> centroids, unsigned int begin, unsigned int end,
+    BoundingBox& bounds, BoundingBox& centroidBounds)
+{
+    auto growBounds = [&](unsigned int chunkBegin, unsigned int chunkEnd, BoundingBox& rangeBounds, BoundingBox& rangeCentroidBounds)
+        {
+            for (unsigned int i = chunkBegin; i < chunkEnd; ++i)
+            {
+                rangeBounds.Grow(primitiveBounds[primitiveIndices[i]]);
+                rangeCentroidBounds.Grow(centroids[primitiveIndices[i]]);
+            }
+        };
+
+    bounds = centroidBounds = BoundingBox();
+    unsigned int chunkCount = GetChunkCount(threadPool, end - begin);
+    if (chunkCount <= 1)
+    {
+        growBounds(begin, end, bounds, centroidBounds);
+        return;
+    }
+
+    std::vector<BoundingBox> chunkBounds(2 * chunkCount);
+    RunChunks(threadPool, begin, end, chunkCount, [&](unsigned int chunkBegin, unsigned int chunkEnd, unsigned int chunkIndex)
+        {
+            growBounds(chunkBegin, chunkEnd, chunkBounds[2 * chunkIndex], chunkBounds[2 * chunkIndex + 1]);
+        });
+
+    for (unsigned int chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+    {
+        bounds.Grow(chunkBounds[2 * chunkIndex]);
+        centroidBounds.Grow(chunkBounds[2 * chunkIndex + 1]);
+    }
+}
+
+// Spread the bits of a 10 bit value, leaving 2 zeros between them
+static glm::uint ExpandBits(glm::uint value)
+{
+    value = (value * 0x00010001u) & 0xFF0000FFu;
+    value = (value * 0x00000101u) & 0x0F00F00Fu;
+    value = (value * 0x00000011u) & 0xC30C30C3u;
+    value = (value * 0x00000005u) & 0x49249249u;
+    return value;
+}
+
+BVH::BVH() : m_maxLeafSize(4), m_buildMode(BuildMode::SAH), m_threadPool(nullptr)
+{
+}
+
+BoundingBox BVH::GetTriangleBounds(std::span<const TriangleVertex> vertices, const Triangle& triangle)
+{
+    BoundingBox bounds;
+    bounds.Grow(vertices[triangle.indices[0]].position);
+    bounds.Grow(vertices[triangle.indices[1]].position);
+    bounds.Grow(vertices[triangle.indices[2]].position);
+    return bounds;
+}
+
+void BVH::Build(std::span<const TriangleVertex> vertices, std::span<const Triangle> triangles)
+{
+    unsigned int triangleCount = static_cast<unsigned int>(triangles.size());
+    std::vector<BoundingBox> primitiveBounds(triangleCount);
+    RunChunks(m_threadPool, 0, triangleCount, GetChunkCount(m_threadPool, triangleCount), [&](unsigned int begin, unsigned int end, unsigned int)
+        {
+            for (unsigned int i = begin; i < end; ++i)
+            {
+                primitiveBounds[i] = GetTriangleBounds(vertices, triangles[i]);
+            }
+        });
+    Build(primitiveBounds);
+}
+
+void BVH::Build(std::span<const BoundingBox> primitiveBounds)
+{
+    unsigned int primitiveCount = static_cast<unsigned int>(primitiveBounds.size());
+
+    m_nodes.clear();
+    m_parentIndices.clear();
+    m_primitiveLeaves.resize(primitiveCount);
+    m_primitiveIndices.resize(primitiveCount);
+    std::iota(m_primitiveIndices.begin(), m_primitiveIndices.end(), 0u);
+
+    if (primitiveCount == 0)
+        return;
+
+    // Small trees are faster to build without waking up the threads
+    ThreadPool* threadPool = m_threadPool && m_threadPool->GetThreadCount() > 1 && primitiveCount >= 2 * MinChunkSize ? m_threadPool : nullptr;
+
+    // Primitives are classified by the center of their bounds
+    std::vector<glm::vec3> centroids(primitiveCount);
+    RunChunks(threadPool, 0, primitiveCount, GetChunkCount(threadPool, primitiveCount), [&](unsigned int begin, unsigned int end, unsigned int)
+        {
+            for (unsigned int i = begin; i < end; ++i)
+            {
+                centroids[i] = primitiveBounds[i].GetCenter();
+            }
+        });
+
+    BuildContext context{ primitiveBounds, centroids, {}, 0, nullptr, threadPool };
+
+    std::vector<glm::uint> mortonCodes;
+    if (m_buildMode == BuildMode::Morton)
+    {
+        SortMortonCodes(context, mortonCodes);
+        context.mortonCodes = mortonCodes;
+    }
+
+    // A binary tree never has more than 2N-1 nodes
+    m_nodes.reserve(2 * primitiveCount - 1);
+
+    if (!threadPool)
+    {
+        BuildNode(context, m_nodes, 0, primitiveCount, 0);
+    }
+    else
+    {
+        // The top of the tree is built first, splitting the work of its big nodes between the threads
+        // The subtrees below it are then built in parallel, one per task
+        std::vector<BuildTask> tasks;
+        context.taskSize = std::max(MinChunkSize, primitiveCount / (TasksPerThread * threadPool->GetThreadCount()));
+        context.tasks = &tasks;
+        std::vector<BVHNode> upperNodes;
+        BuildNode(context, upperNodes, 0, primitiveCount, 0);
+
+        // Biggest tasks first, so they don't finish last
+        std::vector<unsigned int> taskOrder(tasks.size());
+        std::iota(taskOrder.begin(), taskOrder.end(), 0u);
+        std::sort(taskOrder.begin(), taskOrder.end(),
+            [&](unsigned int a, unsigned int b) { return tasks[a].end - tasks[a].begin > tasks[b].end - tasks[b].begin; });
+
+        BuildContext taskContext = context;
+        taskContext.tasks = nullptr;
+        taskContext.threadPool = nullptr;
+        threadPool->ParallelFor(static_cast<unsigned int>(tasks.size()), [&](unsigned int index, unsigned int)
+            {
+                BuildTask& task = tasks[taskOrder[index]];
+                task.nodes.reserve(2 * (task.end - task.begin) - 1);
+                BuildNode(taskContext, task.nodes, task.begin, task.end, task.depth);
+            });
+
+        AssembleNodes(upperNodes, 0, tasks);
+    }
+
+    FinishNodes(primitiveBounds);
+}
+
+bool BVH::Refit(std::span<const BoundingBox> primitiveBounds, std::span<const unsigned int> movedPrimitives,
+    std::vector<Range>& changedNodes)
+{
+    changedNodes.clear();
+    if (movedPrimitives.empty() || m_nodes.empty())
+        return false;
+
+    // Mark the leaves of the moved primitives and their ancestors, stopping at nodes already marked
+    std::vector<bool> dirty(m_nodes.size(), false);
+    unsigned int lastNode = 0;
+    for (unsigned int primitiveIndex : movedPrimitives)
+    {
+        assert(primitiveIndex < m_primitiveLeaves.size());
+        unsigned int nodeIndex = m_primitiveLeaves[primitiveIndex];
+        lastNode = std::max(lastNode, nodeIndex);
+        while (!dirty[nodeIndex])
+        {
+            dirty[nodeIndex] = true;
+            nodeIndex = m_parentIndices[nodeIndex];
+        }
+    }
+
+    // Children are always stored after their parent, so walking backwards updates them first
+    for (unsigned int nodeIndex = lastNode + 1; nodeIndex-- > 0; )
+    {
+        if (!dirty[nodeIndex])
+            continue;
+
+        BVHNode& node = m_nodes[nodeIndex];
+        BoundingBox nodeBounds;
+        if (node.IsLeaf())
+        {
+            for (unsigned int i = node.childOrFirst; i < node.childOrFirst + node.primitiveCount; ++i)
+            {
+                nodeBounds.Grow(primitiveBounds[m_primitiveIndices[i]]);
+            }
+        }
+        else
+        {
+            const BVHNode& firstChild = m_nodes[nodeIndex + 1];
+            const BVHNode& secondChild = m_nodes[node.childOrFirst];
+            nodeBounds.Grow(BoundingBox(firstChild.boundsMin, firstChild.boundsMax));
+            nodeBounds.Grow(BoundingBox(secondChild.boundsMin, secondChild.boundsMax));
+        }
+        node.boundsMin = nodeBounds.boundsMin;
+        node.boundsMax = nodeBounds.boundsMax;
+    }
+
+    // Runs of marked nodes
+    for (unsigned int nodeIndex = 0; nodeIndex <= lastNode; ++nodeIndex)
+    {
+        if (!dirty[nodeIndex])
+            continue;
+
+        if (!changedNodes.empty() && changedNodes.back().first + changedNodes.back().count == nodeIndex)
+        {
+            ++changedNodes.back().count;
+        }
+        else
+        {
+            changedNodes.push_back(Range{ nodeIndex, 1 });
+        }
+    }
+
+    return true;
+}
+
+float BVH::GetCost() const
+{
+    if (m_nodes.empty())
+        return 0.0f;
+
+    float cost = 0.0f;
+    for (const BVHNode& node : m_nodes)
+    {
+        float area = BoundingBox(node.boundsMin, node.boundsMax).GetHalfArea();
+        cost += area * (node.IsLeaf() ? static_cast<float>(node.primitiveCount) : TraversalCost);
+    }
+
+    // Probability of hitting each node is relative to the area of the root
+    float rootArea = GetBounds().GetHalfArea();
+    return rootArea > 0.0f ? cost / rootArea : static_cast<float>(m_primitiveIndices.size());
+}
+
+BoundingBox BVH::GetBounds() const
+{
+    return m_nodes.empty() ? BoundingBox() : BoundingBox(m_nodes[0].boundsMin, m_nodes[0].boundsMax);
+}
+
+unsigned int BVH::BuildNode(const BuildContext& context, std::vector<BVHNode>& nodes, unsigned int begin, unsigned int end, unsigned int depth)
+{
+    // Add the node first, so the nodes end up in depth-first order
+    unsigned int nodeIndex = static_cast<unsigned int>(nodes.size());
+    nodes.emplace_back();
+
+    unsigned int count = end - begin;
+
+    // Leave small subtrees to the tasks
+    if (context.tasks && count <= context.taskSize)
+    {
+        nodes[nodeIndex].childOrFirst = static_cast<unsigned int>(context.tasks->size());
+        nodes[nodeIndex].primitiveCount = TaskPlaceholder;
+        context.tasks->push_back(BuildTask{ begin, end, depth, {} });
+        return nodeIndex;
+    }
+
+    unsigned int* first = m_primitiveIndices.data() + begin;
+    unsigned int* last = m_primitiveIndices.data() + end;
+    unsigned int* middle = first;
+    bool split = false;
+
+    if (m_buildMode == BuildMode::Morton)
+    {
+        // The primitives are already sorted along the curve, split where the highest bit that differs in the range changes
+        split = count > m_maxLeafSize && depth + 1 < MaxDepth;
+        if (split)
+        {
+            glm::uint firstCode = context.mortonCodes[begin];
+            glm::uint lastCode = context.mortonCodes[end - 1];
+            if (firstCode == lastCode)
+            {
+                // Same codes, split by the median
+                middle = first + count / 2;
+            }
+            else
+            {
+                int bit = 31 - std::countl_zero(firstCode ^ lastCode);
+                auto splitCode = std::partition_point(context.mortonCodes.begin() + begin, context.mortonCodes.begin() + end,
+                    [&](glm::uint code) { return ((code >> bit) & 1) == 0; });
+                middle = first + (splitCode - (context.mortonCodes.begin() + begin));
+            }
+        }
+    }
+    else
+    {
+        BoundingBox nodeBounds, centroidBounds;
+        ComputeRangeBounds(context.threadPool, m_primitiveIndices, context.primitiveBounds, context.centroids, begin, end, nodeBounds, centroidBounds);
+
+        int splitAxis = -1;
+        float splitPosition = 0.0f;
+        bool sahSplit = count > 1 && depth + 1 < MaxDepth
+            && FindSplit(context, begin, end, nodeBounds, centroidBounds, splitAxis, splitPosition);
+
+        // Oversized leaves are split even if the centroids can't be separated by SAH
+        split = sahSplit || (count > m_maxLeafSize && depth + 1 < MaxDepth);
+        if (split)
+        {
+            if (sahSplit)
+            {
+                middle = std::partition(first, last,
+                    [&](unsigned int index) { return context.centroids[index][splitAxis] < splitPosition; });
+            }
+            else
+            {
+                glm::vec3 size = centroidBounds.GetSize();
+                splitAxis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+            }
+
+            // If the partition didn't separate anything, fall back to splitting by the median
+            if (middle == first || middle == last)
+            {
+                middle = first + count / 2;
+                std::nth_element(first, middle, last,
+                    [&](unsigned int a, unsigned int b) { return context.centroids[a][splitAxis] < context.centroids[b][splitAxis]; });
+            }
+        }
+    }
+
+    if (!split)
+    {
+        nodes[nodeIndex].childOrFirst = begin;
+        nodes[nodeIndex].primitiveCount = count;
+        return nodeIndex;
+    }
+
+    unsigned int mid = static_cast<unsigned int>(middle - m_primitiveIndices.data());
+    BuildNode(context, nodes, begin, mid, depth + 1);
+    unsigned int secondChild = BuildNode(context, nodes, mid, end, depth + 1);
+
+    nodes[nodeIndex].childOrFirst = secondChild;
+    nodes[nodeIndex].primitiveCount = 0;
+    return nodeIndex;
+}
+
+bool BVH::FindSplit(const BuildContext& context, unsigned int begin, unsigned int end, const BoundingBox& nodeBounds, const BoundingBox& centroidBounds,
+    int& splitAxis, float& splitPosition) const
+{
+    glm::vec3 centroidSize = centroidBounds.GetSize();
+    glm::vec3 scale;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        scale[axis] = centroidSize[axis] > 0.0f ? BinCount / centroidSize[axis] : 0.0f;
+    }
+
+    // Distribute the primitives in bins along each axis. Big ranges are split in chunks with their own bins, merged after
+    auto fillBins = [&](unsigned int chunkBegin, unsigned int chunkEnd, AxisBins& bins)
+        {
+            for (unsigned int i = chunkBegin; i < chunkEnd; ++i)
+            {
+                unsigned int index = m_primitiveIndices[i];
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    int binIndex = std::min(BinCount - 1, static_cast<int>((context.centroids[index][axis] - centroidBounds.boundsMin[axis]) * scale[axis]));
+                    bins[axis][binIndex].bounds.Grow(context.primitiveBounds[index]);
+                    bins[axis][binIndex].count++;
+                }
+            }
+        };
+
+    AxisBins bins;
+    unsigned int chunkCount = GetChunkCount(context.threadPool, end - begin);
+    if (chunkCount <= 1)
+    {
+        fillBins(begin, end, bins);
+    }
+    else
+    {
+        std::vector<AxisBins> chunkBins(chunkCount);
+        RunChunks(context.threadPool, begin, end, chunkCount, [&](unsigned int chunkBegin, unsigned int chunkEnd, unsigned int chunkIndex)
+            {
+                fillBins(chunkBegin, chunkEnd, chunkBins[chunkIndex]);
+            });
+        for (const AxisBins& rangeBins : chunkBins)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int binIndex = 0; binIndex < BinCount; ++binIndex)
+                {
+                    bins[axis][binIndex].bounds.Grow(rangeBins[axis][binIndex].bounds);
+                    bins[axis][binIndex].count += rangeBins[axis][binIndex].count;
+                }
+            }
+        }
+    }
+
+    float bestCost = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (centroidSize[axis] <= 0.0f)
+            continue;
+
+        const std::array<Bin, BinCount>& axisBins = bins[axis];
+
+        // Sweep from the right to get the cost of every right side, then from the left to combine them
+        std::array<float, BinCount - 1> rightCosts;
+        BoundingBox rightBounds;
+        unsigned int rightCount = 0;
+        for (int binIndex = BinCount - 1; binIndex > 0; --binIndex)
+        {
+            rightBounds.Grow(axisBins[binIndex].bounds);
+            rightCount += axisBins[binIndex].count;
+            rightCosts[binIndex - 1] = rightCount > 0 ? rightBounds.GetHalfArea() * rightCount : 0.0f;
+        }
+
+        BoundingBox leftBounds;
+        unsigned int leftCount = 0;
+        for (int binIndex = 0; binIndex < BinCount - 1; ++binIndex)
+        {
+            leftBounds.Grow(axisBins[binIndex].bounds);
+            leftCount += axisBins[binIndex].count;
+            float cost = (leftCount > 0 ? leftBounds.GetHalfArea() * leftCount : 0.0f) + rightCosts[binIndex];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                splitAxis = axis;
+                splitPosition = centroidBounds.boundsMin[axis] + (binIndex + 1) / scale[axis];
+            }
+        }
+    }
+
+    if (splitAxis < 0)
+        return false;
+
+    // Compare against the cost of intersecting all the primitives in a leaf
+    float nodeArea = nodeBounds.GetHalfArea();
+    float splitCost = TraversalCost + (nodeArea > 0.0f ? bestCost / nodeArea : 0.0f);
+    float leafCost = static_cast<float>(end - begin);
+    return splitCost < leafCost || end - begin > m_maxLeafSize;
+}
+
+void BVH::SortMortonCodes(const BuildContext& context, std::vector<glm::uint>& mortonCodes)
+{
+    unsigned int primitiveCount = static_cast<unsigned int>(m_primitiveIndices.size());
+    unsigned int chunkCount = GetChunkCount(context.threadPool, primitiveCount);
+
+    // Quantize the centroids to 10 bits per axis, in their bounds
+    BoundingBox bounds, centroidBounds;
+    ComputeRangeBounds(context.threadPool, m_primitiveIndices, context.primitiveBounds, context.centroids, 0, primitiveCount, bounds, centroidBounds);
+    glm::vec3 centroidSize = centroidBounds.GetSize();
+    glm::vec3 scale;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        scale[axis] = centroidSize[axis] > 0.0f ? 1023.0f / centroidSize[axis] : 0.0f;
+    }
+
+    mortonCodes.resize(primitiveCount);
+    RunChunks(context.threadPool, 0, primitiveCount, chunkCount, [&](unsigned int begin, unsigned int end, unsigned int)
+        {
+            for (unsigned int i = begin; i < end; ++i)
+            {
+                glm::uvec3 cell = glm::clamp((context.centroids[i] - centroidBounds.boundsMin) * scale, glm::vec3(0.0f), glm::vec3(1023.0f));
+                mortonCodes[i] = (ExpandBits(cell.x) << 2) | (ExpandBits(cell.y) << 1) | ExpandBits(cell.z);
+            }
+        });
+
+    // Radix sort of the 30 bit codes with the indices, 8 bits at a time starting from the lowest ones
+    // Each chunk counts its digits, then writes its elements after the ones of the previous chunks, so the sort is stable
+    std::vector<glm::uint> sortedCodes(primitiveCount);
+    std::vector<unsigned int> sortedIndices(primitiveCount);
+    std::vector<std::array<unsigned int, 256>> chunkOffsets(chunkCount);
+    for (unsigned int shift = 0; shift < 30; shift += 8)
+    {
+        RunChunks(context.threadPool, 0, primitiveCount, chunkCount, [&](unsigned int begin, unsigned int end, unsigned int chunkIndex)
+            {
+                std::array<unsigned int, 256>& counts = chunkOffsets[chunkIndex];
+                counts.fill(0);
+                for (unsigned int i = begin; i < end; ++i)
+                {
+                    counts[(mortonCodes[i] >> shift) & 0xFF]++;
+                }
+            });
+
+        // Skip the digits that are the same for all the codes
+        unsigned int offset = 0;
+        bool sameDigit = false;
+        for (unsigned int digit = 0; digit < 256; ++digit)
+        {
+            unsigned int digitBegin = offset;
+            for (std::array<unsigned int, 256>& offsets : chunkOffsets)
+            {
+                unsigned int count = offsets[digit];
+                offsets[digit] = offset;
+                offset += count;
+            }
+            sameDigit |= offset - digitBegin == primitiveCount;
+        }
+        if (sameDigit)
+            continue;
+
+        RunChunks(context.threadPool, 0, primitiveCount, chunkCount, [&](unsigned int begin, unsigned int end, unsigned int chunkIndex)
+            {
+                std::array<unsigned int, 256>& offsets = chunkOffsets[chunkIndex];
+                for (unsigned int i = begin; i < end; ++i)
+                {
+                    unsigned int position = offsets[(mortonCodes[i] >> shift) & 0xFF]++;
+                    sortedCodes[position] = mortonCodes[i];
+                    sortedIndices[position] = m_primitiveIndices[i];
+                }
+            });
+        mortonCodes.swap(sortedCodes);
+        m_primitiveIndices.swap(sortedIndices);
+    }
+}
+
+void BVH::AssembleNodes(const std::vector<BVHNode>& upperNodes, unsigned int upperIndex, const std::vector<BuildTask>& tasks)
+{
+    const BVHNode& upperNode = upperNodes[upperIndex];
+    unsigned int nodeIndex = static_cast<unsigned int>(m_nodes.size());
+
+    if (upperNode.primitiveCount == TaskPlaceholder)
+    {
+        // Copy the subtree, moving its child indices after the nodes already assembled
+        for (BVHNode node : tasks[upperNode.childOrFirst].nodes)
+        {
+            if (!node.IsLeaf())
+            {
+                node.childOrFirst += nodeIndex;
+            }
+            m_nodes.push_back(node);
+        }
+    }
+    else if (upperNode.IsLeaf())
+    {
+        m_nodes.push_back(upperNode);
+    }
+    else
+    {
+        m_nodes.push_back(upperNode);
+        AssembleNodes(upperNodes, upperIndex + 1, tasks);
+        m_nodes[nodeIndex].childOrFirst = static_cast<unsigned int>(m_nodes.size());
+        AssembleNodes(upperNodes, upperNode.childOrFirst, tasks);
+    }
+}
+
+void BVH::FinishNodes(std::span<const BoundingBox> primitiveBounds)
+{
+    m_parentIndices.assign(m_nodes.size(), 0);
+
+    // Children are always stored after their parent, so walking backwards gets them done first
+    for (unsigned int nodeIndex = static_cast<unsigned int>(m_nodes.size()); nodeIndex-- > 0; )
+    {
+        BVHNode& node = m_nodes[nodeIndex];
+        BoundingBox nodeBounds;
+        if (node.IsLeaf())
+        {
+            for (unsigned int i = node.childOrFirst; i < node.childOrFirst + node.primitiveCount; ++i)
+            {
+                nodeBounds.Grow(primitiveBounds[m_primitiveIndices[i]]);
+                m_primitiveLeaves[m_primitiveIndices[i]] = nodeIndex;
+            }
+        }
+        else
+        {
+            const BVHNode& firstChild = m_nodes[nodeIndex + 1];
+            const BVHNode& secondChild = m_nodes[node.childOrFirst];
+            nodeBounds.Grow(BoundingBox(firstChild.boundsMin, firstChild.boundsMax));
+            nodeBounds.Grow(BoundingBox(secondChild.boundsMin, secondChild.boundsMax));
+            m_parentIndices[nodeIndex + 1] = nodeIndex;
+            m_parentIndices[node.childOrFirst] = nodeIndex;
+        }
+        node.boundsMin = nodeBounds.boundsMin;
+        node.boundsMax = nodeBounds.boundsMax;
+    }
+}
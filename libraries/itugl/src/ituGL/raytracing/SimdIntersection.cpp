@@ -0,0 +1,321 @@
+#include <ituGL/raytracing/SimdIntersection.h>
+
+#include <ituGL/geometry/Mesh.h>
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+// The SIMD kernels are compiled for their instruction set only, so the rest of the library doesn't require it
+// They are only called after checking that the CPU supports them
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ITUGL_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define ITUGL_TARGET(instructions)
+#else
+#define ITUGL_TARGET(instructions) __attribute__((target(instructions)))
+#endif
+#endif
+
+namespace
+{
+    // Arrays of a TriangleBlocks, one per component
+    struct TriangleStreams
+    {
+        const float* v0[3];
+        const float* edge1[3];
+        const float* edge2[3];
+        const float* normal[3];
+    };
+}
+
+SimdLevel GetSupportedSimdLevel()
+{
+    static const SimdLevel supportedLevel = []
+        {
+            SimdLevel level = SimdLevel::Scalar;
+#if defined(ITUGL_SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 1);
+            bool sse42 = (info[2] & (1 << 20)) != 0;
+            // AVX registers must also be enabled by the OS
+            bool avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+            __cpuidex(info, 7, 0);
+            bool avx2 = avx && (info[1] & (1 << 5)) != 0;
+            level = avx2 ? SimdLevel::AVX2 : sse42 ? SimdLevel::SSE42 : SimdLevel::Scalar;
+#elif defined(ITUGL_SIMD_X86)
+            __builtin_cpu_init();
+            level = __builtin_cpu_supports("avx2") ? SimdLevel::AVX2 : __builtin_cpu_supports("sse4.2") ? SimdLevel::SSE42 : SimdLevel::Scalar;
+#endif
+            return level;
+        }();
+    return supportedLevel;
+}
+
+const char* GetSimdLevelName(SimdLevel simdLevel)
+{
+    switch (simdLevel)
+    {
+    case SimdLevel::SSE42:
+        return "SSE4.2";
+    case SimdLevel::AVX2:
+        return "AVX2";
+    default:
+        return "Scalar";
+    }
+}
+
+static bool IntersectTrianglesScalar(const TriangleStreams& streams, const glm::vec3& origin, const glm::vec3& direction,
+    unsigned int first, unsigned int count, float& distance, unsigned int& triangleIndex, float& hitU, float& hitV)
+{
+    bool found = false;
+    for (unsigned int i = first; i < first + count; ++i)
+    {
+        glm::vec3 rov0 = origin - glm::vec3(streams.v0[0][i], streams.v0[1][i], streams.v0[2][i]);
+        glm::vec3 edge1(streams.edge1[0][i], streams.edge1[1][i], streams.edge1[2][i]);
+        glm::vec3 edge2(streams.edge2[0][i], streams.edge2[1][i], streams.edge2[2][i]);
+        glm::vec3 normal(streams.normal[0][i], streams.normal[1][i], streams.normal[2][i]);
+
+        glm::vec3 q = glm::cross(rov0, direction);
+        float invDet = 1.0f / glm::dot(normal, direction);
+        float u = -glm::dot(q, edge2) * invDet;
+        float v = glm::dot(q, edge1) * invDet;
+        float t = -glm::dot(normal, rov0) * invDet;
+
+        // Written so that NaNs, from rays parallel to the triangle, are not hits
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < distance)
+        {
+            distance = t;
+            triangleIndex = i;
+            hitU = u;
+            hitV = v;
+            found = true;
+        }
+    }
+    return found;
+}
+
+#ifdef ITUGL_SIMD_X86
+
+ITUGL_TARGET("sse4.2")
+static bool IntersectTrianglesSSE42(const TriangleStreams& streams, const glm::vec3& origin, const glm::vec3& direction,
+    unsigned int first, unsigned int count, float& distance, unsigned int& triangleIndex, float& hitU, float& hitV)
+{
+    const __m128 originX = _mm_set1_ps(origin.x);
+    const __m128 originY = _mm_set1_ps(origin.y);
+    const __m128 originZ = _mm_set1_ps(origin.z);
+    const __m128 directionX = _mm_set1_ps(direction.x);
+    const __m128 directionY = _mm_set1_ps(direction.y);
+    const __m128 directionZ = _mm_set1_ps(direction.z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 infinity = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    const __m128i laneIndices = _mm_setr_epi32(0, 1, 2, 3);
+
+    __m128 closest = _mm_set1_ps(distance);
+    bool found = false;
+
+    for (unsigned int offset = 0; offset < count; offset += 4)
+    {
+        unsigned int i = first + offset;
+
+        __m128 rx = _mm_sub_ps(originX, _mm_loadu_ps(streams.v0[0] + i));
+        __m128 ry = _mm_sub_ps(originY, _mm_loadu_ps(streams.v0[1] + i));
+        __m128 rz = _mm_sub_ps(originZ, _mm_loadu_ps(streams.v0[2] + i));
+
+        // q = cross(rov0, direction)
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ry, directionZ), _mm_mul_ps(rz, directionY));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(rz, directionX), _mm_mul_ps(rx, directionZ));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(rx, directionY), _mm_mul_ps(ry, directionX));
+
+        __m128 nx = _mm_loadu_ps(streams.normal[0] + i);
+        __m128 ny = _mm_loadu_ps(streams.normal[1] + i);
+        __m128 nz = _mm_loadu_ps(streams.normal[2] + i);
+
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, directionX), _mm_mul_ps(ny, directionY)), _mm_mul_ps(nz, directionZ));
+        __m128 invDet = _mm_div_ps(one, det);
+        __m128 negInvDet = _mm_sub_ps(zero, invDet);
+
+        __m128 qDotEdge2 = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(qx, _mm_loadu_ps(streams.edge2[0] + i)),
+            _mm_mul_ps(qy, _mm_loadu_ps(streams.edge2[1] + i))),
+            _mm_mul_ps(qz, _mm_loadu_ps(streams.edge2[2] + i)));
+        __m128 qDotEdge1 = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(qx, _mm_loadu_ps(streams.edge1[0] + i)),
+            _mm_mul_ps(qy, _mm_loadu_ps(streams.edge1[1] + i))),
+            _mm_mul_ps(qz, _mm_loadu_ps(streams.edge1[2] + i)));
+        __m128 nDotR = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, rx), _mm_mul_ps(ny, ry)), _mm_mul_ps(nz, rz));
+
+        __m128 u = _mm_mul_ps(qDotEdge2, negInvDet);
+        __m128 v = _mm_mul_ps(qDotEdge1, invDet);
+        __m128 t = _mm_mul_ps(nDotR, negInvDet);
+
+        // Ordered comparisons are false for NaNs
+        __m128 mask = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(t, zero));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(t, closest));
+        mask = _mm_and_ps(mask, _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(static_cast<int>(count - offset)), laneIndices)));
+
+        if (_mm_movemask_ps(mask) != 0)
+        {
+            // Find the closest hit of the block
+            __m128 distances = _mm_blendv_ps(infinity, t, mask);
+            __m128 minimum = _mm_min_ps(distances, _mm_shuffle_ps(distances, distances, _MM_SHUFFLE(1, 0, 3, 2)));
+            minimum = _mm_min_ps(minimum, _mm_shuffle_ps(minimum, minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+            int lane = std::countr_zero(static_cast<unsigned int>(_mm_movemask_ps(_mm_cmpeq_ps(distances, minimum))));
+
+            alignas(16) float us[4], vs[4];
+            _mm_store_ps(us, u);
+            _mm_store_ps(vs, v);
+            distance = _mm_cvtss_f32(minimum);
+            triangleIndex = i + lane;
+            hitU = us[lane];
+            hitV = vs[lane];
+            closest = minimum;
+            found = true;
+        }
+    }
+    return found;
+}
+
+ITUGL_TARGET("avx2")
+static bool IntersectTrianglesAVX2(const TriangleStreams& streams, const glm::vec3& origin, const glm::vec3& direction,
+    unsigned int first, unsigned int count, float& distance, unsigned int& triangleIndex, float& hitU, float& hitV)
+{
+    const __m256 originX = _mm256_set1_ps(origin.x);
+    const __m256 originY = _mm256_set1_ps(origin.y);
+    const __m256 originZ = _mm256_set1_ps(origin.z);
+    const __m256 directionX = _mm256_set1_ps(direction.x);
+    const __m256 directionY = _mm256_set1_ps(direction.y);
+    const __m256 directionZ = _mm256_set1_ps(direction.z);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    const __m256i laneIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256 closest = _mm256_set1_ps(distance);
+    bool found = false;
+
+    for (unsigned int offset = 0; offset < count; offset += 8)
+    {
+        unsigned int i = first + offset;
+
+        __m256 rx = _mm256_sub_ps(originX, _mm256_loadu_ps(streams.v0[0] + i));
+        __m256 ry = _mm256_sub_ps(originY, _mm256_loadu_ps(streams.v0[1] + i));
+        __m256 rz = _mm256_sub_ps(originZ, _mm256_loadu_ps(streams.v0[2] + i));
+
+        // q = cross(rov0, direction)
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ry, directionZ), _mm256_mul_ps(rz, directionY));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(rz, directionX), _mm256_mul_ps(rx, directionZ));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(rx, directionY), _mm256_mul_ps(ry, directionX));
+
+        __m256 nx = _mm256_loadu_ps(streams.normal[0] + i);
+        __m256 ny = _mm256_loadu_ps(streams.normal[1] + i);
+        __m256 nz = _mm256_loadu_ps(streams.normal[2] + i);
+
+        __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, directionX), _mm256_mul_ps(ny, directionY)), _mm256_mul_ps(nz, directionZ));
+        __m256 invDet = _mm256_div_ps(one, det);
+        __m256 negInvDet = _mm256_sub_ps(zero, invDet);
+
+        __m256 qDotEdge2 = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(qx, _mm256_loadu_ps(streams.edge2[0] + i)),
+            _mm256_mul_ps(qy, _mm256_loadu_ps(streams.edge2[1] + i))),
+            _mm256_mul_ps(qz, _mm256_loadu_ps(streams.edge2[2] + i)));
+        __m256 qDotEdge1 = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(qx, _mm256_loadu_ps(streams.edge1[0] + i)),
+            _mm256_mul_ps(qy, _mm256_loadu_ps(streams.edge1[1] + i))),
+            _mm256_mul_ps(qz, _mm256_loadu_ps(streams.edge1[2] + i)));
+        __m256 nDotR = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, rx), _mm256_mul_ps(ny, ry)), _mm256_mul_ps(nz, rz));
+
+        __m256 u = _mm256_mul_ps(qDotEdge2, negInvDet);
+        __m256 v = _mm256_mul_ps(qDotEdge1, invDet);
+        __m256 t = _mm256_mul_ps(nDotR, negInvDet);
+
+        // Ordered comparisons are false for NaNs
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, closest, _CMP_LT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count - offset)), laneIndices)));
+
+        if (_mm256_movemask_ps(mask) != 0)
+        {
+            // Find the closest hit of the block
+            __m256 distances = _mm256_blendv_ps(infinity, t, mask);
+            __m256 minimum = _mm256_min_ps(distances, _mm256_permute2f128_ps(distances, distances, 1));
+            minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+            minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+            int lane = std::countr_zero(static_cast<unsigned int>(_mm256_movemask_ps(_mm256_cmp_ps(distances, minimum, _CMP_EQ_OQ))));
+
+            alignas(32) float us[8], vs[8];
+            _mm256_store_ps(us, u);
+            _mm256_store_ps(vs, v);
+            distance = _mm256_cvtss_f32(minimum);
+            triangleIndex = i + lane;
+            hitU = us[lane];
+            hitV = vs[lane];
+            closest = minimum;
+            found = true;
+        }
+    }
+    return found;
+}
+
+#endif // ITUGL_SIMD_X86
+
+TriangleBlocks::TriangleBlocks() : m_stride(0), m_triangleCount(0), m_simdLevel(GetSupportedSimdLevel())
+{
+}
+
+void TriangleBlocks::Build(std::span<const glm::vec3> positions, std::span<const Triangle> triangles)
+{
+    m_triangleCount = static_cast<unsigned int>(triangles.size());
+
+    // Round up to whole blocks, and add one more so a block can start at the last triangle
+    m_stride = (m_triangleCount + BlockSize - 1) / BlockSize * BlockSize + BlockSize;
+    m_data.assign(StreamCount * m_stride, 0.0f);
+
+    for (unsigned int i = 0; i < m_triangleCount; ++i)
+    {
+        const glm::uvec3& indices = triangles[i].indices;
+        glm::vec3 v0 = positions[indices.x];
+        glm::vec3 edge1 = positions[indices.y] - v0;
+        glm::vec3 edge2 = positions[indices.z] - v0;
+        glm::vec3 normal = glm::cross(edge1, edge2);
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            m_data[(V0X + axis) * m_stride + i] = v0[axis];
+            m_data[(Edge1X + axis) * m_stride + i] = edge1[axis];
+            m_data[(Edge2X + axis) * m_stride + i] = edge2[axis];
+            m_data[(NormalX + axis) * m_stride + i] = normal[axis];
+        }
+    }
+}
+
+void TriangleBlocks::SetSimdLevel(SimdLevel simdLevel)
+{
+    m_simdLevel = std::min(simdLevel, GetSupportedSimdLevel());
+}
+
+bool TriangleBlocks::Intersect(const glm::vec3& origin, const glm::vec3& direction, unsigned int first, unsigned int count,
+    float& distance, unsigned int& triangleIndex, float& u, float& v) const
+{
+    TriangleStreams streams = {
+        { GetStream(V0X), GetStream(V0Y), GetStream(V0Z) },
+        { GetStream(Edge1X), GetStream(Edge1Y), GetStream(Edge1Z) },
+        { GetStream(Edge2X), GetStream(Edge2Y), GetStream(Edge2Z) },
+        { GetStream(NormalX), GetStream(NormalY), GetStream(NormalZ) },
+    };
+
+#ifdef ITUGL_SIMD_X86
+    // Small ranges, like most leaves, don't fill 8 lanes
+    if (m_simdLevel == SimdLevel::AVX2 && count > 4)
+        return IntersectTrianglesAVX2(streams, origin, direction, first, count, distance, triangleIndex, u, v);
+    if (m_simdLevel >= SimdLevel::SSE42)
+        return IntersectTrianglesSSE42(streams, origin, direction, first, count, distance, triangleIndex, u, v);
+#endif
+    return IntersectTrianglesScalar(streams, origin, direction, first, count, distance, triangleIndex, u, v);
+}
@@ -0,0 +1,102 @@
+#include <ituGL/utils/ThreadPool.h>
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+    : m_function(nullptr)
+    , m_count(0)
+    , m_nextIndex(0)
+    , m_busyWorkers(0)
+    , m_loopId(0)
+    , m_stopping(false)
+{
+    if (threadCount == 0)
+    {
+        // hardware_concurrency can return 0 if it can't be detected
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // The caller is thread 0
+    for (unsigned int threadIndex = 1; threadIndex < threadCount; ++threadIndex)
+    {
+        m_workers.emplace_back(&ThreadPool::WorkerLoop, this, threadIndex);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_startCondition.notify_all();
+
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::ParallelFor(unsigned int count, const LoopFunction& function)
+{
+    // Not worth waking up the workers
+    if (m_workers.empty() || count <= 1)
+    {
+        for (unsigned int index = 0; index < count; ++index)
+        {
+            function(index, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_function = &function;
+        m_count = count;
+        m_nextIndex = 0;
+        m_busyWorkers = static_cast<unsigned int>(m_workers.size());
+        ++m_loopId;
+    }
+    m_startCondition.notify_all();
+
+    RunLoop(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finishCondition.wait(lock, [this] { return m_busyWorkers == 0; });
+    m_function = nullptr;
+}
+
+void ThreadPool::WorkerLoop(unsigned int threadIndex)
+{
+    unsigned int lastLoopId = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_startCondition.wait(lock, [&] { return m_stopping || m_loopId != lastLoopId; });
+            if (m_stopping)
+                return;
+            lastLoopId = m_loopId;
+        }
+
+        RunLoop(threadIndex);
+
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            finished = --m_busyWorkers == 0;
+        }
+        if (finished)
+        {
+            m_finishCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::RunLoop(unsigned int threadIndex)
+{
+    for (unsigned int index = m_nextIndex++; index < m_count; index = m_nextIndex++)
+    {
+        (*m_function)(index, threadIndex);
+    }
+}